@@ -28,6 +28,8 @@ using namespace MoSyncError;
 
 #ifdef WIN32
 typedef int socklen_t;
+#else
+#include <fcntl.h>
 #endif
 
 #ifdef _WIN32_WCE
@@ -286,6 +288,68 @@ int TcpConnection::write(const void* src, int len) {
 }
 
 
+//******************************************************************************
+// TcpConnection, non-blocking
+//******************************************************************************
+
+bool MASocketSetNonBlocking(MoSyncSocket sock) {
+#if defined(WIN32) || defined(_WIN32_WCE)
+	u_long nonBlocking = 1;
+	return ioctlsocket(sock, FIONBIO, &nonBlocking) != SOCKET_ERROR;
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	if(flags < 0)
+		return false;
+	return fcntl(sock, F_SETFL, flags | O_NONBLOCK) >= 0;
+#endif
+}
+
+bool TcpConnection::hasNumericHost() const {
+	return inet_addr(mHostname.c_str()) != INADDR_NONE;
+}
+
+int TcpConnection::connectStart() {
+	int result;
+	mSock = MASocketCreate(mHostname.c_str(), result, mInetAddr);
+	if(mSock == INVALID_SOCKET)
+		return result;
+	if(!MASocketSetNonBlocking(mSock)) {
+		LOG("TcpConnection::connectStart: could not set non-blocking mode. %d\n", SOCKET_ERRNO);
+		return CONNERR_INTERNAL;
+	}
+
+	sockaddr_in clientService;
+	clientService.sin_family = AF_INET;
+	clientService.sin_addr.s_addr = mInetAddr;
+	clientService.sin_port = htons( mPort );
+
+	int iRet = ::connect(mSock, (sockaddr*) &clientService, sizeof(clientService));
+	if(iRet != SOCKET_ERROR)
+		return 1;
+#if defined(WIN32) || defined(_WIN32_WCE)
+	if(SOCKET_ERRNO == WSAEWOULDBLOCK)
+#else
+	if(SOCKET_ERRNO == EINPROGRESS)
+#endif
+		return 0;
+	LOG("TcpConnection::connectStart: connect returned error code %d\n", SOCKET_ERRNO);
+	return CONNERR_GENERIC;
+}
+
+int TcpConnection::connectFinish() {
+	int error;
+	socklen_t len = sizeof(error);
+	if(getsockopt(mSock, SOL_SOCKET, SO_ERROR, (char*)&error, &len) == SOCKET_ERROR) {
+		LOG("TcpConnection::connectFinish: getsockopt failed. %d\n", SOCKET_ERRNO);
+		return CONNERR_INTERNAL;
+	}
+	if(error != 0) {
+		LOG("TcpConnection::connectFinish: connect failed with error code %d\n", error);
+		return CONNERR_GENERIC;
+	}
+	return 1;
+}
+
 //******************************************************************************
 // ProtocolConnection helpers
 //******************************************************************************
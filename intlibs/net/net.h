@@ -52,6 +52,7 @@ typedef int MoSyncSocket;
 MoSyncSocket MASocketOpen(const char* address, u16 port, int& result, uint& inetAddr);
 MoSyncSocket MASocketCreate(const char* address, int& result, uint& inetAddr);
 int MASocketConnect(MoSyncSocket sock, uint inetAddr, u16 port);
+bool MASocketSetNonBlocking(MoSyncSocket sock);
 
 static const char http_string[] = "http://";
 static const char https_string[] = "https://";
@@ -75,6 +76,16 @@ public:
 	virtual int write(const void* src, int len);
 	virtual void close();
 	int getAddr(MAConnAddr& addr);
+
+	//Non-blocking connect, for event-driven callers.
+	//Returns >0 if connected, 0 if the connection is in progress, or a CONNERR code.
+	//Will block on DNS lookup unless hasNumericHost().
+	int connectStart();
+	//Call when the socket has become writable after connectStart() returned 0.
+	//Returns >0 or CONNERR code.
+	int connectFinish();
+	bool hasNumericHost() const;
+	MoSyncSocket socket() const { return mSock; }
 protected:
 	MoSyncSocket mSock;
 	const std::string mHostname;
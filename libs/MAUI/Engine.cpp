@@ -36,6 +36,7 @@ namespace MAUI {
 		defaultFont = NULL;
 		defaultSkin = NULL;
 		overlay = NULL;
+		numDamageRects = 0;
 		singletonPtr = this;
 		//clipStackPtr = -1;
 		Environment::getEnvironment().addFocusListener(this);
@@ -179,6 +180,39 @@ namespace MAUI {
 		Environment::getEnvironment().addIdleListener(this);
 	}
 	
+	static void unionRect(MARect& d, const MARect& r) {
+		int right = d.left + d.width;
+		int bottom = d.top + d.height;
+		if(r.left + r.width > right) right = r.left + r.width;
+		if(r.top + r.height > bottom) bottom = r.top + r.height;
+		if(r.left < d.left) d.left = r.left;
+		if(r.top < d.top) d.top = r.top;
+		d.width = right - d.left;
+		d.height = bottom - d.top;
+	}
+
+	void Engine::addDamage(const MARect& r) {
+		if(r.width <= 0 || r.height <= 0) return;
+		for(int i = 0; i < numDamageRects; i++) {
+			MARect& d = damageRects[i];
+			if(r.left < d.left + d.width && d.left < r.left + r.width &&
+				r.top < d.top + d.height && d.top < r.top + r.height)
+			{
+				unionRect(d, r);
+				return;
+			}
+		}
+		if(numDamageRects == MAX_DAMAGE_RECTS) {
+			// too fragmented, fall back to the bounding box.
+			for(int i = 1; i < numDamageRects; i++)
+				unionRect(damageRects[0], damageRects[i]);
+			unionRect(damageRects[0], r);
+			numDamageRects = 1;
+			return;
+		}
+		damageRects[numDamageRects++] = r;
+	}
+	
 	void Engine::repaint() {
 		//lprintfln("repaint @ (%i ms)", maGetMilliSecondCount());
 		if(!main) return;
@@ -189,7 +223,7 @@ namespace MAUI {
 		//clearClipRect();
 		Gfx_clearClipRect();
 		Gfx_clearMatrix();
-
+		numDamageRects = 0;
 		
 		int scrW = EXTENT_X(maGetScrSize());
 		int scrH = EXTENT_Y(maGetScrSize());
@@ -200,18 +234,46 @@ namespace MAUI {
 		Gfx_popClipRect();
 
 		if(overlay) {
-			Gfx_clearClipRect();
-			Gfx_clearMatrix();
-			Gfx_pushClipRect(0, 0, scrW, scrH);
-
-			overlay->requestRepaint();
-			Gfx_translate(overlayPosition.x, overlayPosition.y);
 			overlay->update();
-			overlay->draw();
+			if(overlay->isDirty()) {
+				Gfx_clearClipRect();
+				Gfx_clearMatrix();
+				Gfx_pushClipRect(0, 0, scrW, scrH);
+				Gfx_translate(overlayPosition.x, overlayPosition.y);
+				overlay->draw();
+			} else {
+				MARect damaged[MAX_DAMAGE_RECTS];
+				int numDamaged = numDamageRects;
+				memcpy(damaged, damageRects, numDamaged*sizeof(MARect));
+
+				// dirty widgets in the overlay draw themselves and add their own damage.
+				Gfx_clearClipRect();
+				Gfx_clearMatrix();
+				Gfx_pushClipRect(0, 0, scrW, scrH);
+				Gfx_translate(overlayPosition.x, overlayPosition.y);
+				overlay->draw();
+
+				// the rest of it is only redrawn where the main tree drew over it.
+				for(int i = 0; i < numDamaged; i++) {
+					Gfx_clearClipRect();
+					Gfx_clearMatrix();
+					Gfx_pushClipRect(damaged[i].left, damaged[i].top, damaged[i].width, damaged[i].height);
+					Gfx_translate(overlayPosition.x, overlayPosition.y);
+					overlay->setDirty(true);
+					overlay->draw();
+				}
+				overlay->setDirty(false);
+			}
 		}
 
-		//maUpdateScreen();
-		Gfx_updateScreen();
+		// Nothing damaged means the whole screen must be restored, after losing focus for instance.
+		int area = 0;
+		for(int i = 0; i < numDamageRects; i++)
+			area += damageRects[i].width*damageRects[i].height;
+		if(numDamageRects == 0 || area > (scrW*scrH)/2)
+			Gfx_updateScreen();
+		else
+			Gfx_updateScreenRects(damageRects, numDamageRects);
 	}
 	
 	void Engine::idle() {
@@ -41,7 +41,8 @@ namespace MAUI {
 	class Engine : public IdleListener, public FocusListener {
 	public:
 		enum {
-			MAX_WIDGET_DEPTH = 16
+			MAX_WIDGET_DEPTH = 16,
+			MAX_DAMAGE_RECTS = 8
 		};
 
 		/** Sets the widget that is main to the application, constituting the root of the UI tree **/
@@ -76,8 +77,15 @@ namespace MAUI {
 		void focusLost();
 		void focusGained();
 
-		/** Actually performs repainting **/ 
+		/** Actually performs repainting. Only the areas damaged by dirty
+		  * widgets are redrawn and copied to the screen.
+		  **/ 
 		void repaint();
+
+		/** Widgets call this with their clip rect, in screen coordinates,
+		  * when they redraw during repaint(). Overlapping areas are merged.
+		  **/
+		void addDamage(const MARect& rect);
 		
 		/** Returns a reference to the single instance of this class, using lazy
 		  * initialization.
@@ -106,6 +114,9 @@ namespace MAUI {
 
 		bool characterInputActive;
 
+		MARect damageRects[MAX_DAMAGE_RECTS];
+		int numDamageRects;
+
 	private:
 		Engine();
 	};
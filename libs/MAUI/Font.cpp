@@ -20,6 +20,9 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include "Font.h"
 #include <MAUtil/Graphics.h>
 #include <MAUtil/PlaceholderPool.h>
+#include <MAUtil/HashMap.h>
+#include <MAUtil/LruList.h>
+#include <MAUtil/String.h>
 
 #include <conprint.h>
 
@@ -265,6 +268,7 @@ namespace MAUI {
 	}
 
 	Font::~Font() {
+		flushStringCache(this);
 		if(mFontImage) {
 			maDestroyObject(mFontImage);
 			PlaceholderPool::put(mFontImage);
@@ -281,6 +285,9 @@ namespace MAUI {
 	}
 	
 	void Font::setLineSpacing(int size) {
+		// cached multi-line strings were laid out with the old spacing.
+		if(size != mLineSpacing)
+			flushStringCache(this);
 		mLineSpacing = size;
 	}
 	
@@ -290,6 +297,7 @@ namespace MAUI {
 
 	void Font::setResource(MAHandle font) {
 		//printf("Font is using resource: %d\n", font);
+		flushStringCache(this);
 		if(font == 0) {
 			mFontImage = 0;
 			return;
@@ -348,38 +356,6 @@ namespace MAUI {
 		delete []rebuiltFont;
 	} */
 
-	void Font::drawString(const char* strS, int x, int y) {
-		if(!mFontImage) return;
-		const unsigned char* str = (const unsigned char*)strS;
-		MARect srcRect = {0, 0, 0, 0};
-		MAPoint2d cursor = {x,y};
-
-		CharDescriptor *chars = mCharset->chars;
-		while(*str) {
-			if((*str)=='\n')
-			{
-				cursor.x = x;
-				cursor.y += mCharset->lineHeight + mLineSpacing;
-				str++;
-				continue;
-			}
-
-			srcRect.left = chars[*str].x;
-			srcRect.top = chars[*str].y;
-			srcRect.width = chars[*str].width;
-			srcRect.height = chars[*str].height;
-
-			MAPoint2d destPoint = {cursor.x + chars[*str].xOffset,
-				cursor.y + chars[*str].yOffset};
-
-			//maDrawImageRegion(this->mFontImage, &srcRect, &destPoint, 0);
-			Gfx_drawImageRegion(this->mFontImage, &srcRect, &destPoint, 0);
-
-			cursor.x += chars[*str].xAdvance;
-			str++;
-		}
-	}
-
 	short lineBreaks[2048]; // TODO: should probably change this to a vector (no good with limitations)
 	int numLineBreaks;
 
@@ -422,40 +398,280 @@ namespace MAUI {
 		lineBreaks[j] = -1;
 	}
 
-	void Font::drawBoundedString(const char* strS, int x, int y, const Rect& bound) {
+	// Glyphs are collected into runs of this size before being passed on.
+	#define GLYPH_RUN_SIZE 64
+
+	static bool sStringCacheEnabled = false;
+
+	void Font::layoutString(const char* strS, int x, int y, const Rect* bound, GlyphSink sink, void* user) const {
+		MARect srcRects[GLYPH_RUN_SIZE];
+		MAPoint2d dstPoints[GLYPH_RUN_SIZE];
+		int n = 0;
 		int i = 0;
 		int j = 0;
-		if(!mFontImage) return;
 		const unsigned char* str = (const unsigned char*)strS;
-		calcLineBreaks(strS, x, y, bound);
-		MARect srcRect = {0, 0, 0, 0};
+		if(bound)
+			calcLineBreaks(strS, x, y, *bound);
 		MAPoint2d cursor = {x, y};
 		CharDescriptor *chars = mCharset->chars;
 		while(str[i]) {
-			if(lineBreaks[j] == i) {
-				j++;
+			if(bound) {
+				if(lineBreaks[j] == i) {
+					j++;
+					cursor.x = x;
+					cursor.y += mCharset->lineHeight + mLineSpacing;
+					if(str[i]=='\n') {
+						i++;
+						continue;
+					}
+				}
+			} else if(str[i]=='\n') {
 				cursor.x = x;
 				cursor.y += mCharset->lineHeight + mLineSpacing;
-				if(str[i]=='\n') {
-					i++;
-					continue;
+				i++;
+				continue;
+			}
+
+			const CharDescriptor& c = chars[str[i]];
+			if(c.width && c.height) {
+				srcRects[n].left = c.x;
+				srcRects[n].top = c.y;
+				srcRects[n].width = c.width;
+				srcRects[n].height = c.height;
+				dstPoints[n].x = cursor.x + c.xOffset;
+				dstPoints[n].y = cursor.y + c.yOffset;
+				if(++n == GLYPH_RUN_SIZE) {
+					sink(srcRects, dstPoints, n, user);
+					n = 0;
 				}
 			}
 
-			srcRect.left = chars[str[i]].x;
-			srcRect.top = chars[str[i]].y;
-			srcRect.width = chars[str[i]].width;
-			srcRect.height = chars[str[i]].height;
+			cursor.x += c.xAdvance;
+			i++;
+		}
+		if(n)
+			sink(srcRects, dstPoints, n, user);
+	}
+
+	static void drawGlyphRun(const MARect* srcRects, const MAPoint2d* dstPoints, int count, void* user) {
+		Gfx_drawImageRegions(*(MAHandle*)user, srcRects, dstPoints, count);
+	}
+
+	void Font::drawString(const char* str, int x, int y) {
+		if(!mFontImage) return;
+		if(sStringCacheEnabled && drawCachedString(str, x, y, NULL)) return;
+		layoutString(str, x, y, NULL, drawGlyphRun, &mFontImage);
+	}
 
-			MAPoint2d destPoint = {cursor.x + chars[str[i]].xOffset,
-				cursor.y + chars[str[i]].yOffset};
+	void Font::drawBoundedString(const char* str, int x, int y, const Rect& bound) {
+		if(!mFontImage) return;
+		if(sStringCacheEnabled && drawCachedString(str, x, y, &bound)) return;
+		layoutString(str, x, y, &bound, drawGlyphRun, &mFontImage);
+	}
 
-			//maDrawImageRegion(this->mFontImage, &srcRect, &destPoint, 0);
-			Gfx_drawImageRegion(this->mFontImage, &srcRect, &destPoint, 0);
+	//******************************************************************************
+	// String cache
+	//******************************************************************************
 
-			cursor.x += chars[str[i]].xAdvance;
-			i++;
+	#define DEFAULT_STRING_CACHE_SIZE (256*1024)
+
+	// The glyph colors are part of the font image, so the font identifies the color.
+	// Bounded strings also depend on the width available for line breaking.
+	struct StringCacheKey {
+		StringCacheKey() {
+		}
+		StringCacheKey(const Font* f, const char* str, int w) : font(f), text(str), wrapWidth(w) {
+		}
+
+		bool operator==(const StringCacheKey& c) const {
+			return (font==c.font && wrapWidth==c.wrapWidth && text==c.text);
+		}
+
+		bool operator<(const StringCacheKey& c) const {
+			if(font != c.font) return font < c.font;
+			if(wrapWidth != c.wrapWidth) return wrapWidth < c.wrapWidth;
+			return text < c.text;
 		}
+
+		const Font* font;
+		String text;
+		int wrapWidth;
+	};
+
+	struct StringCacheElement {
+		StringCacheKey key;
+		MAHandle image;
+		// position of the image relative to the string origin.
+		int x, y;
+		int pixels;
+		StringCacheElement *prev, *next;
+	};
+}
+
+namespace MAUtil {
+	template<> hash_val_t THashFunction<MAUI::StringCacheKey>(const MAUI::StringCacheKey& data) {
+		return THashFunction<String>(data.text) ^ THashFunction<int>((int)data.font + data.wrapWidth);
+	}
+}
+
+namespace MAUI {
+	static HashMap<StringCacheKey, StringCacheElement> sStringCache;
+	static LruList<StringCacheElement> sStringLru;
+	static int sStringCachePixels = 0;
+	static int sMaxStringCacheSize = DEFAULT_STRING_CACHE_SIZE;
+
+	static void destroyStringCacheElement(StringCacheElement* e) {
+		sStringLru.unlink(e);
+		sStringCachePixels -= e->pixels;
+		maDestroyObject(e->image);
+		PlaceholderPool::put(e->image);
+		StringCacheKey key = e->key;
+		sStringCache.erase(key);
+	}
+
+	void Font::setStringCacheEnabled(bool e) {
+		sStringCacheEnabled = e;
+		if(!e) flushStringCache();
+	}
+
+	void Font::setMaxStringCacheSize(int pixels) {
+		sMaxStringCacheSize = pixels;
+		while(sStringLru.tail() && sStringCachePixels > sMaxStringCacheSize)
+			destroyStringCacheElement(sStringLru.tail());
+	}
+
+	void Font::flushStringCache() {
+		while(sStringLru.tail())
+			destroyStringCacheElement(sStringLru.tail());
+	}
+
+	void Font::flushStringCache(const Font* font) {
+		StringCacheElement* e = sStringLru.head();
+		while(e) {
+			StringCacheElement* next = e->next;
+			if(e->key.font == font)
+				destroyStringCacheElement(e);
+			e = next;
+		}
+	}
+
+	struct GlyphBounds {
+		int left, top, right, bottom;
+		int maxGlyphPixels;
+	};
+
+	static void boundGlyphRun(const MARect* srcRects, const MAPoint2d* dstPoints, int count, void* user) {
+		GlyphBounds* b = (GlyphBounds*)user;
+		for(int i = 0; i < count; i++) {
+			if(dstPoints[i].x < b->left) b->left = dstPoints[i].x;
+			if(dstPoints[i].y < b->top) b->top = dstPoints[i].y;
+			if(dstPoints[i].x + srcRects[i].width > b->right) b->right = dstPoints[i].x + srcRects[i].width;
+			if(dstPoints[i].y + srcRects[i].height > b->bottom) b->bottom = dstPoints[i].y + srcRects[i].height;
+			if(srcRects[i].width*srcRects[i].height > b->maxGlyphPixels)
+				b->maxGlyphPixels = srcRects[i].width*srcRects[i].height;
+		}
+	}
+
+	struct GlyphCompositor {
+		MAHandle fontImage;
+		int* data;
+		int scanLength;
+		int* glyph;
+	};
+
+	// Source-over blend of two non-premultiplied ARGB pixels.
+	static int blendPixel(int dst, int src) {
+		unsigned int sa = ((unsigned int)src)>>24;
+		unsigned int da = ((unsigned int)dst)>>24;
+		if(sa == 0) return dst;
+		if(sa == 255 || da == 0) return src;
+		unsigned int ia = (da*(255-sa))/255;
+		unsigned int oa = sa + ia;
+		unsigned int r = ((((src>>16)&0xff)*sa) + (((dst>>16)&0xff)*ia))/oa;
+		unsigned int g = ((((src>>8)&0xff)*sa) + (((dst>>8)&0xff)*ia))/oa;
+		unsigned int b = (((src&0xff)*sa) + ((dst&0xff)*ia))/oa;
+		return (int)((oa<<24) | (r<<16) | (g<<8) | b);
+	}
+
+	// Glyphs may overlap, so they are blended into the image rather than copied.
+	static void compositeGlyphRun(const MARect* srcRects, const MAPoint2d* dstPoints, int count, void* user) {
+		GlyphCompositor* c = (GlyphCompositor*)user;
+		for(int i = 0; i < count; i++) {
+			const MARect& r = srcRects[i];
+			maGetImageData(c->fontImage, c->glyph, &r, r.width);
+			const int* src = c->glyph;
+			for(int y = 0; y < r.height; y++) {
+				int* dst = &c->data[dstPoints[i].x + (dstPoints[i].y+y)*c->scanLength];
+				for(int x = 0; x < r.width; x++) {
+					dst[x] = blendPixel(dst[x], *src++);
+				}
+			}
+		}
+	}
+
+	bool Font::drawCachedString(const char* str, int x, int y, const Rect* bound) {
+		int wrapWidth = -1;
+		if(bound) {
+			wrapWidth = bound->x + bound->width - x;
+			if(wrapWidth < 0) wrapWidth = 0;
+		}
+
+		StringCacheKey key(this, str, wrapWidth);
+		HashMap<StringCacheKey, StringCacheElement>::Iterator itr = sStringCache.find(key);
+		if(itr != sStringCache.end()) {
+			StringCacheElement* e = &itr->second;
+			sStringLru.touch(e);
+			Gfx_drawImage(e->image, x + e->x, y + e->y);
+			return true;
+		}
+
+		// Lay the string out at the origin so that the image can be drawn anywhere.
+		Rect localBound;
+		if(bound) localBound = Rect(bound->x - x, bound->y - y, bound->width, bound->height);
+		GlyphBounds b = {0x7fffffff, 0x7fffffff, -0x7fffffff, -0x7fffffff, 0};
+		layoutString(str, 0, 0, bound ? &localBound : NULL, boundGlyphRun, &b);
+		if(!b.maxGlyphPixels) return true;
+
+		int width = b.right - b.left;
+		int height = b.bottom - b.top;
+		if(width*height > sMaxStringCacheSize) return false;
+		while(sStringLru.tail() && sStringCachePixels + width*height > sMaxStringCacheSize)
+			destroyStringCacheElement(sStringLru.tail());
+
+		// catch running out of heap, and draw the glyphs directly in that case.
+		malloc_handler mh = set_malloc_handler(NULL);
+		int* data = new int[width*height];
+		int* glyph = new int[b.maxGlyphPixels];
+		set_malloc_handler(mh);
+		if(!data || !glyph) {
+			delete []data;
+			delete []glyph;
+			return false;
+		}
+		memset(data, 0, width*height*sizeof(int));
+
+		GlyphCompositor c = {mFontImage, data - b.left - b.top*width, width, glyph};
+		layoutString(str, 0, 0, bound ? &localBound : NULL, compositeGlyphRun, &c);
+
+		StringCacheElement elem;
+		elem.key = key;
+		elem.x = b.left;
+		elem.y = b.top;
+		elem.pixels = width*height;
+		elem.image = PlaceholderPool::alloc();
+		int res = maCreateImageRaw(elem.image, data, EXTENT(width, height), 1);
+		delete []data;
+		delete []glyph;
+		if(res != RES_OK) {
+			PlaceholderPool::put(elem.image);
+			return false;
+		}
+
+		StringCacheElement* e = &sStringCache.insert(key, elem).first->second;
+		sStringLru.link(e);
+		sStringCachePixels += e->pixels;
+		Gfx_drawImage(e->image, x + e->x, y + e->y);
+		return true;
 	}
 
 	MAExtent Font::getStringDimensions(const char *strS, int length) const {
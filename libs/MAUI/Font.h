@@ -117,7 +117,8 @@ namespace MAUI {
 		  **/
 		Rect calculateRectOfIndex(int index, const char *str, const Rect& bound) const;
 
-		/** Renders str at x, y
+		/** Renders str at x, y.
+		  * The glyphs are submitted in runs through Gfx_drawImageRegions().
 		  **/
 		void drawString(const char* str, int x, int y);
 
@@ -129,11 +130,39 @@ namespace MAUI {
 
 		const Charset& getCharset() const;
 
+		/**
+		* Enables or disables the string cache. When enabled, drawString()
+		* and drawBoundedString() render each string once into an image
+		* and then draw that image with a single blit. This suits text that
+		* stays the same between frames, like labels and list items.
+		* The cache is disabled by default.
+		*/
+		static void setStringCacheEnabled(bool e=true);
+
+		/** Sets the maximum number of pixels held by the string cache. **/
+		static void setMaxStringCacheSize(int pixels);
+
+		/** Destroys all cached string images. **/
+		static void flushStringCache();
+
+		/**
+		* Receives a run of glyphs laid out by layoutString().
+		*/
+		typedef void (*GlyphSink)(const MARect* srcRects, const MAPoint2d* dstPoints, int count, void* user);
+
 	protected:
 		
 		void calcCharPos(char c, int *x, int *y);
 		void calcLineBreaks(const char* str, int x, int y, const Rect& bound) const;
 
+		/**
+		* Lays out str at x,y and passes the glyphs to \a sink in runs.
+		* If \a bound is not NULL, the string is linebroken according to it.
+		*/
+		void layoutString(const char* str, int x, int y, const Rect* bound, GlyphSink sink, void* user) const;
+		bool drawCachedString(const char* str, int x, int y, const Rect* bound);
+		static void flushStringCache(const Font* font);
+
 		MAHandle mFontImage;
 		Charset *mCharset;
 		int mLineSpacing;
@@ -262,8 +262,10 @@ namespace MAUI {
 			BOOL res = Gfx_intersectClipRect(0, 0, bounds.width, bounds.height);
 
 			if(res) {
-				if((isDirty() || forceDraw) && shouldDrawBackground) {
-					drawBackground();
+				if(isDirty() || forceDraw) {
+					Engine::getSingleton().addDamage(Gfx_getClipRect());
+					if(shouldDrawBackground)
+						drawBackground();
 				}
 
 				//bool res = engine.pushClipRectIntersect(paddedBounds.x, paddedBounds.y,
@@ -318,8 +320,10 @@ namespace MAUI {
 
 			if(res) 
 			{
-				if((isDirty() || forceDraw) && shouldDrawBackground) {
-					drawBackground();
+				if(isDirty() || forceDraw) {
+					Engine::getSingleton().addDamage(Gfx_getClipRect());
+					if(shouldDrawBackground)
+						drawBackground();
 				}
 	
 				//bool res = engine.pushClipRectIntersect(paddedBounds.x, paddedBounds.y,	
@@ -108,6 +108,7 @@ namespace MAUI {
 	class Widget {
 		friend class Screen;
 		friend class Layout;
+		friend class Engine;
 	
 	public:
 
@@ -162,43 +162,68 @@ namespace MAUI {
 	HashMap<WidgetSkin::CacheKey, WidgetSkin::CacheElement> WidgetSkin::sCache;
 	int WidgetSkin::maxCacheSize = 	DEFAULT_CACHE_THRESHOLD;
 	bool WidgetSkin::useCache = false;
+
+	int WidgetSkin::sCachePixels = 0;
+	int WidgetSkin::sCacheHits = 0;
+	int WidgetSkin::sCacheMisses = 0;
+	int WidgetSkin::sCacheEvictions = 0;
+	LruList<WidgetSkin::CacheElement> WidgetSkin::sLru;
 	
 	void WidgetSkin::setMaxCacheSize(int c) {
 		maxCacheSize = c;
 	}
+
+	int WidgetSkin::getMaxCacheSize() {
+		return maxCacheSize;
+	}
+
+	void WidgetSkin::setMaxCacheBytes(int bytes) {
+		maxCacheSize = bytes/sizeof(int);
+	}
+
+	int WidgetSkin::getMaxCacheBytes() {
+		return maxCacheSize*sizeof(int);
+	}
+
+	int WidgetSkin::getCacheSize() {
+		return sCachePixels;
+	}
 	
 	void WidgetSkin::setCacheEnabled(bool e) {
 		useCache = e;
 	}
-	
-		
-	void WidgetSkin::flushCacheUntilNewImageFits(int numPixels) {
-		int totalPixelsInCache = numPixels;
-		
-		HashMap<CacheKey, CacheElement>::Iterator iter = sCache.begin();
-		while(iter != sCache.end()) {
-			totalPixelsInCache += iter->first.w*iter->first.h;
-			iter++;
-		}
 
-		int currentTime = maGetMilliSecondCount();
-		
-		while(totalPixelsInCache>maxCacheSize) {
-			int oldest = currentTime;
-			iter = sCache.begin();	
-			HashMap<CacheKey, CacheElement>::Iterator best = sCache.end();
-			while(iter != sCache.end()) {
-				if(iter->second.lastUsed<oldest) {
-					oldest = iter->second.lastUsed;
-					best = iter;
-				}
-				iter++;
-			}
-			if(best == sCache.end()) break;
-			maDestroyObject(best->second.image);
-			PlaceholderPool::put(best->second.image);
-			sCache.erase(best);
-			totalPixelsInCache-=iter->first.w*iter->first.h;
+	int WidgetSkin::getCacheHits() {
+		return sCacheHits;
+	}
+
+	int WidgetSkin::getCacheMisses() {
+		return sCacheMisses;
+	}
+
+	int WidgetSkin::getCacheEvictions() {
+		return sCacheEvictions;
+	}
+
+	void WidgetSkin::resetCacheStats() {
+		sCacheHits = 0;
+		sCacheMisses = 0;
+		sCacheEvictions = 0;
+	}
+
+	// The elements are linked in most recently used order and the pixel
+	// count is kept up to date on insert, so eviction is constant time.
+	void WidgetSkin::flushCacheUntilNewImageFits(int numPixels) {
+		while(sLru.tail() && sCachePixels+numPixels>maxCacheSize) {
+			CacheElement* victim = sLru.tail();
+			sLru.unlink(victim);
+			sCachePixels -= victim->key.w*victim->key.h;
+			maDestroyObject(victim->image);
+			PlaceholderPool::put(victim->image);
+			sCacheEvictions++;
+			// erasing frees the element, so take a copy of the key first.
+			CacheKey key = victim->key;
+			sCache.erase(key);
 		}
 	}
 	
@@ -210,17 +235,29 @@ namespace MAUI {
 			iter++;
 		}
 		sCache.clear();
+		sLru.clear();
+		sCachePixels = 0;
 	}
 			
 	void WidgetSkin::addToCache(const CacheKey& key, const CacheElement& elem) {
-		sCache.insert(key, elem);
+		Pair<HashMap<CacheKey, CacheElement>::Iterator, bool> res = sCache.insert(key, elem);
+		if(!res.second) return;
+		CacheElement* e = &res.first->second;
+		e->key = key;
+		sLru.link(e);
+		sCachePixels += key.w*key.h;
 	}
 	
 	MAHandle WidgetSkin::getFromCache(const CacheKey& key) {
 		HashMap<CacheKey, CacheElement>::Iterator s = sCache.find(key);
-		if(s == sCache.end()) return 0;
-		else return s->second.image;
-		
+		if(s == sCache.end()) {
+			sCacheMisses++;
+			return 0;
+		}
+		sCacheHits++;
+		CacheElement* e = &s->second;
+		sLru.touch(e);
+		return e->image;
 	}
 		
 	void WidgetSkin::draw(int x, int y, int width, int height, eType type) {
@@ -257,7 +294,6 @@ namespace MAUI {
 			}
 
 			delete data;
-			cacheElem.lastUsed = maGetMilliSecondCount();
 			cached = cacheElem.image;
 			addToCache(newKey, cacheElem);
 		}
@@ -28,6 +28,7 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 
 //#include <MAUtil/Vector.h>
 #include <MAUtil/HashMap.h>
+#include <MAUtil/LruList.h>
 
 namespace MAUI {
 
@@ -193,23 +194,45 @@ namespace MAUI {
 */
 
 		struct CacheElement {
-			/*
-			// key
-			int w, h;
-			eType type;
-			*/
+			CacheElement() : image(0), prev(NULL), next(NULL) {
+			}
+
+			// key, kept so that the least recently used element can be erased.
+			CacheKey key;
 			
 			// value
 			MAHandle image;
-			
-			// timestamp
-			int lastUsed;
+
+			// intrusive LRU list, most recently used first.
+			CacheElement *prev, *next;
 		};		
 		
 		// in pixels.
 		static void setMaxCacheSize(int c);
+		static int getMaxCacheSize();
+
+		/**
+		 * Sets the cache budget in bytes. Cached images are stored
+		 * as 32-bit pixels, so this is four times the pixel budget.
+		 **/
+		static void setMaxCacheBytes(int bytes);
+		static int getMaxCacheBytes();
+
+		/**
+		 * Returns the number of pixels currently held by the cache.
+		 **/
+		static int getCacheSize();
 		static void setCacheEnabled(bool e=true);
 
+		/**
+		 * Cache statistics. Hits and misses are counted in
+		 * getFromCache(), evictions in flushCacheUntilNewImageFits().
+		 **/
+		static int getCacheHits();
+		static int getCacheMisses();
+		static int getCacheEvictions();
+		static void resetCacheStats();
+
 		static void flushCache();		
 		static void flushCacheUntilNewImageFits(int numPixels); 
 		static void addToCache(const CacheKey& key, const CacheElement& elem);
@@ -218,6 +241,13 @@ namespace MAUI {
 	private:
 		static int maxCacheSize;
 		static bool useCache;
+
+		static int sCachePixels;
+		static int sCacheHits;
+		static int sCacheMisses;
+		static int sCacheEvictions;
+		static LruList<CacheElement> sLru;
+
 		
 		//Vector<CacheElement> cache;
 		static HashMap<CacheKey, CacheElement> sCache;
@@ -47,9 +47,11 @@ void dummy_drawTextW(int left, int top, const wchar_t* text);
 void dummy_drawImage(MAHandle image, int left, int top);
 void dummy_drawRGB(const MAPoint2d *dstPoint, const void *src, const MARect *srcRect, int scanlength);
 void dummy_drawImageRegion(MAHandle image, const MARect *srcRect, const MAPoint2d *dstPoint, int transformMode);
+void dummy_drawImageRegions(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count);
 void dummy_notifyImageUpdated(MAHandle image);
 void dummy_beginRendering(void);
 void dummy_updateScreen(void);
+void dummy_updateScreenRects(const MARect *rects, int count);
 void dummy_setClearColor(int r, int g, int b);
 void dummy_setColor(int r, int g, int b);
 void dummy_setAlpha(int a);
@@ -73,9 +75,11 @@ static MAGraphicsDriver sDummy = {
 	&dummy_drawImage,
 	&dummy_drawRGB,
 	&dummy_drawImageRegion,
+	&dummy_drawImageRegions,
 	&dummy_notifyImageUpdated,
 	&dummy_beginRendering,
 	&dummy_updateScreen,
+	&dummy_updateScreenRects,
 	&dummy_setClearColor,
 	&dummy_setColor,
 	&dummy_setAlpha
@@ -162,6 +166,11 @@ void dummy_drawImageRegion(MAHandle image, const MARect *srcRect, const MAPoint2
 	graphicsDriver->drawImageRegion(image, srcRect, dstPoint, transformMode);
 }
 
+void dummy_drawImageRegions(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count)  {
+	Gfx_useDriverSoftware();
+	graphicsDriver->drawImageRegions(image, srcRects, dstPoints, count);
+}
+
 void dummy_notifyImageUpdated(MAHandle image)  {
 	Gfx_useDriverSoftware();
 	graphicsDriver->notifyImageUpdated(image);
@@ -177,6 +186,11 @@ void dummy_updateScreen(void)  {
 	graphicsDriver->updateScreen();
 }
 
+void dummy_updateScreenRects(const MARect *rects, int count)  {
+	Gfx_useDriverSoftware();
+	graphicsDriver->updateScreenRects(rects, count);
+}
+
 void dummy_setClearColor(int r, int g, int b) {
 	Gfx_useDriverSoftware();
 	graphicsDriver->setClearColor(r, g, b);
@@ -287,6 +301,11 @@ BOOL Gfx_pushClipRect(int left, int top, int width, int height) {
 	else return FALSE;
 }
 
+MARect Gfx_getClipRect(void) {
+	_Gfx_init();
+	return sClipStack[sClipStackPtr];
+}
+
 /** Computes the intersection rectangle of the specified clip rect and the current, pushing the result on the stack.
 *  Returns true if the area of the resulting clip rect is > 0, otherwise false. 
 **/
@@ -540,6 +559,11 @@ void Gfx_drawImageRegion(MAHandle image, const MARect *srcRect, const MAPoint2d
 	graphicsDriver->drawImageRegion(image, srcRect, dstPoint, transformMode);
 }
 
+void Gfx_drawImageRegions(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count) {
+	if(count <= 0) return;
+	graphicsDriver->drawImageRegions(image, srcRects, dstPoints, count);
+}
+
 void Gfx_notifyImageUpdated(MAHandle image) {
 	graphicsDriver->notifyImageUpdated(image);
 }
@@ -552,6 +576,10 @@ void Gfx_updateScreen(void) {
 	graphicsDriver->updateScreen();
 }
 
+void Gfx_updateScreenRects(const MARect *rects, int count) {
+	graphicsDriver->updateScreenRects(rects, count);
+}
+
 void Gfx_setClearColor(int r, int g, int b) {
 	graphicsDriver->setClearColor(r, g, b);
 }
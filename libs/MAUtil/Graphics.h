@@ -67,9 +67,11 @@ typedef void (*DrawTextWFunc)(int left, int top, const wchar_t* text);
 typedef void (*DrawImageFunc)(MAHandle image, int left, int top);
 typedef void (*DrawRGBFunc)(const MAPoint2d *dstPoint, const void *src, const MARect *srcRect, int scanlength);
 typedef void (*DrawImageRegionFunc)(MAHandle image, const MARect *srcRect, const MAPoint2d *dstPoint, int transformMode);
+typedef void (*DrawImageRegionsFunc)(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count);
 typedef void (*NotifyImageUpdated)(MAHandle image);
 typedef void (*BeginRendering)(void);
 typedef void (*UpdateScreen)(void);
+typedef void (*UpdateScreenRects)(const MARect *rects, int count);
 typedef void (*SetClearColor)(int r, int g, int b);
 typedef void (*SetColor)(int r, int g, int b);
 typedef void (*SetAlpha)(int a);
@@ -94,9 +96,11 @@ typedef struct MAGraphicsDriver_t {
 	DrawImageFunc drawImage;
 	DrawRGBFunc drawRGB;
 	DrawImageRegionFunc drawImageRegion;
+	DrawImageRegionsFunc drawImageRegions;
 	NotifyImageUpdated notifyImageUpdated; // not very pretty (for opengl so that it knows that it has to update the texture again)
 	BeginRendering beginRendering;
 	UpdateScreen updateScreen;
+	UpdateScreenRects updateScreenRects;
 	SetClearColor setClearColor;	
 	SetColor setColor;
 	SetAlpha setAlpha;
@@ -133,6 +137,11 @@ BOOL Gfx_intersectClipRect(int left, int top, int width, int height);
    **/
 BOOL Gfx_popClipRect(void);
 
+/**
+   * Returns the current clip rect, in screen coordinates.
+   **/
+MARect Gfx_getClipRect(void);
+
 /** 
   * Clears the transform stack.
   **/
@@ -170,12 +179,26 @@ void Gfx_drawImage(MAHandle image, int left, int top);
 void Gfx_drawRGB(const MAPoint2d *dstPoint, const void *src, const MARect *srcRect, int scanlength);
 void Gfx_drawImageRegion(MAHandle image, const MARect *srcRect, const MAPoint2d *dstPoint, int transformMode);
 
+/**
+* Draws \a count regions of the same image, untransformed, with respect to the current transform.
+* Used for glyph runs and other batches of small blits. The OpenGL driver draws the whole batch
+* at once; the software driver still makes one maDrawImageRegion() call per region.
+**/
+void Gfx_drawImageRegions(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count);
+
 void Gfx_notifyImageUpdated(MAHandle image);
 
 // when in opengl mode, clears the depth and color buffer.
 // software do nothing.
 void Gfx_beginRendering(void);
 void Gfx_updateScreen(void);
+
+/**
+* Updates only the given areas of the screen, in screen coordinates.
+* Falls back to updating the whole screen where the platform
+* or the driver can't do partial updates.
+**/
+void Gfx_updateScreenRects(const MARect *rects, int count);
 void Gfx_setClearColor(int r, int g, int b);
 void Gfx_setColor(int r, int g, int b);
 void Gfx_setAlpha(int a);
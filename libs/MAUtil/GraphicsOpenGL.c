@@ -37,9 +37,11 @@ static void ogl_drawTextW(int left, int top, const wchar_t* text);
 static void ogl_drawImage(MAHandle image, int left, int top);
 static void ogl_drawRGB(const MAPoint2d *dstPoint, const void *src, const MARect *srcRect, int scanlength);
 static void ogl_drawImageRegion(MAHandle image, const MARect *srcRect, const MAPoint2d *dstPoint, int transformMode);
+static void ogl_drawImageRegions(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count);
 static void ogl_notifyImageUpdated(MAHandle image);
 static void ogl_beginRendering(void);
 static void ogl_updateScreen(void);
+static void ogl_updateScreenRects(const MARect *rects, int count);
 static void ogl_setClearColor(int r, int g, int b);
 static void ogl_setColor(int r, int g, int b);
 static void ogl_setAlpha(int a);
@@ -64,9 +66,11 @@ static MAGraphicsDriver sGLGraphicsDriver = {
 	&ogl_drawImage,
 	&ogl_drawRGB,
 	&ogl_drawImageRegion,
+	&ogl_drawImageRegions,
 	&ogl_notifyImageUpdated,
 	&ogl_beginRendering,
 	&ogl_updateScreen,
+	&ogl_updateScreenRects,
 	&ogl_setClearColor,
 	&ogl_setColor,
 	&ogl_setAlpha
@@ -339,6 +343,70 @@ static void ogl_drawImageRegion(MAHandle image, const MARect *srcRect, const MAP
 	drawImage(textureCoords, vertexCoords, texture);
 }
 
+#define OGL_BATCH_SIZE 64
+
+static void drawTriangles(GLshort* textureCoords, GLshort* vertexCoords, int numVertices) {
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_VERTEX_ARRAY);
+
+	glTexCoordPointer(2, GL_SHORT, 0, textureCoords);
+	glVertexPointer(2, GL_SHORT, 0, vertexCoords);
+	glDrawArrays(GL_TRIANGLES, 0, numVertices);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+}
+
+// Each region becomes two triangles, so a whole batch is drawn with
+// one texture bind and one glDrawArrays instead of one per region.
+static void ogl_drawImageRegions(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count) {
+	static GLshort textureCoords[OGL_BATCH_SIZE*12];
+	static GLshort vertexCoords[OGL_BATCH_SIZE*12];
+	Texture* texture = getTexture(image);
+	int i, n = 0;
+
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, texture->glTexture);
+	glMatrixMode(GL_TEXTURE);
+	glPushMatrix();
+	glScalex(texture->textureWidthInv, texture->textureHeightInv, 0x10000);
+	glMatrixMode(GL_MODELVIEW);
+
+	for(i = 0; i < count; i++) {
+		const MARect* s = &srcRects[i];
+		const MAPoint2d* d = &dstPoints[i];
+		GLshort* t = &textureCoords[n*12];
+		GLshort* v = &vertexCoords[n*12];
+		if(s->width <= 0 || s->height <= 0)
+			continue;
+
+		t[0] = s->left;				t[1] = s->top;
+		t[2] = s->left+s->width;	t[3] = s->top;
+		t[4] = s->left+s->width;	t[5] = s->top+s->height;
+		t[6] = s->left;				t[7] = s->top;
+		t[8] = s->left+s->width;	t[9] = s->top+s->height;
+		t[10] = s->left;			t[11] = s->top+s->height;
+
+		v[0] = d->x;				v[1] = d->y;
+		v[2] = d->x+s->width;		v[3] = d->y;
+		v[4] = d->x+s->width;		v[5] = d->y+s->height;
+		v[6] = d->x;				v[7] = d->y;
+		v[8] = d->x+s->width;		v[9] = d->y+s->height;
+		v[10] = d->x;				v[11] = d->y+s->height;
+
+		if(++n == OGL_BATCH_SIZE) {
+			drawTriangles(textureCoords, vertexCoords, n*6);
+			n = 0;
+		}
+	}
+	if(n)
+		drawTriangles(textureCoords, vertexCoords, n*6);
+
+	glMatrixMode(GL_TEXTURE);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+}
+
 static void ogl_notifyImageUpdated(MAHandle image) {
 	int i;
 	GLuint handle;
@@ -375,6 +443,11 @@ static void ogl_updateScreen(void) {
 		maWidgetSetProperty(sNativeUIOpenGLView, "invalidate", "");
 }
 
+// the whole frame is rendered every time, so swap all of it.
+static void ogl_updateScreenRects(const MARect *rects, int count) {
+	ogl_updateScreen();
+}
+
 static int sColorR = 255, sColorG = 255, sColorB = 255, sAlpha = 255;
 
 static void ogl_setClearColor(int r, int g, int b) {
@@ -48,9 +48,11 @@ static void soft_drawTextW(int left, int top, const wchar_t* text);
 static void soft_drawImage(MAHandle image, int left, int top);
 static void soft_drawRGB(const MAPoint2d *dstPoint, const void *src, const MARect *srcRect, int scanlength);
 static void soft_drawImageRegion(MAHandle image, const MARect *srcRect, const MAPoint2d *dstPoint, int transformMode);
+static void soft_drawImageRegions(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count);
 static void soft_notifyImageUpdated(MAHandle image);
 static void soft_beginRendering(void);
 static void soft_updateScreen(void);
+static void soft_updateScreenRects(const MARect *rects, int count);
 static void soft_setClearColor(int r, int g, int b);
 static void soft_setColor(int r, int g, int b);
 static void soft_setAlpha(int a);
@@ -72,9 +74,11 @@ static MAGraphicsDriver sSoftwareGraphicsDriver = {
 	&soft_drawImage,
 	&soft_drawRGB,
 	&soft_drawImageRegion,
+	&soft_drawImageRegions,
 	&soft_notifyImageUpdated,
 	&soft_beginRendering,
 	&soft_updateScreen,
+	&soft_updateScreenRects,
 	&soft_setClearColor,
 	&soft_setColor,
 	&soft_setAlpha
@@ -186,6 +190,19 @@ static void soft_drawImageRegion(MAHandle image, const MARect *srcRect, const MA
 	maDrawImageRegion(image, srcRect, &p, transformMode);
 }
 
+// There is no batched blit syscall, so this is still one syscall per
+// region; only the driver dispatch is saved. Glyph runs are only
+// batched for real by the OpenGL driver.
+static void soft_drawImageRegions(MAHandle image, const MARect *srcRects, const MAPoint2d *dstPoints, int count) {
+	int i;
+	MAPoint2d p;
+	for(i = 0; i < count; i++) {
+		p.x = dstPoints[i].x + sCurrentOffset.x;
+		p.y = dstPoints[i].y + sCurrentOffset.y;
+		maDrawImageRegion(image, &srcRects[i], &p, TRANS_NONE);
+	}
+}
+
 static void soft_notifyImageUpdated(MAHandle image) {
 }
 
@@ -196,6 +213,11 @@ static void soft_updateScreen(void) {
 	maUpdateScreen();
 }
 
+static void soft_updateScreenRects(const MARect *rects, int count) {
+	if(maUpdateScreenRects(rects, count) < 0)
+		maUpdateScreen();
+}
+
 static void soft_setClearColor(int r, int g, int b) {
 }
 
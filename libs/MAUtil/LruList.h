@@ -0,0 +1,88 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+/** \file LruList.h
+ *
+ * \brief Intrusive list for keeping cache elements in least recently used order.
+ *
+ */
+
+#ifndef _SE_MSAB_MAUTIL_LRULIST_H_
+#define _SE_MSAB_MAUTIL_LRULIST_H_
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+namespace MAUtil {
+
+/** \brief Doubly linked list of elements, most recently used first.
+ *
+ * T must have the members <tt>T* prev</tt> and <tt>T* next</tt>, which the
+ * list owns while the element is linked. The list doesn't own the elements
+ * themselves; they usually live in a HashMap, which doesn't move them.
+ * All operations are constant time.
+ */
+template<class T> class LruList {
+public:
+	LruList() : mHead(NULL), mTail(NULL) {}
+
+	/** Links \a e in as the most recently used element. */
+	void link(T* e) {
+		e->prev = NULL;
+		e->next = mHead;
+		if(mHead) mHead->prev = e;
+		else mTail = e;
+		mHead = e;
+	}
+
+	/** Unlinks \a e, which must be in the list. */
+	void unlink(T* e) {
+		if(e->prev) e->prev->next = e->next;
+		else mHead = e->next;
+		if(e->next) e->next->prev = e->prev;
+		else mTail = e->prev;
+		e->prev = e->next = NULL;
+	}
+
+	/** Makes \a e, which must be in the list, the most recently used element. */
+	void touch(T* e) {
+		if(e != mHead) {
+			unlink(e);
+			link(e);
+		}
+	}
+
+	/** Forgets all elements, without touching them. */
+	void clear() {
+		mHead = mTail = NULL;
+	}
+
+	/** The most recently used element, or NULL if the list is empty. */
+	T* head() const { return mHead; }
+
+	/** The least recently used element, or NULL if the list is empty. */
+	T* tail() const { return mTail; }
+
+private:
+	T* mHead;
+	T* mTail;
+};
+
+}
+
+#endif	//_SE_MSAB_MAUTIL_LRULIST_H_
@@ -18,6 +18,23 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include <cstdlib>
 #include "AudioChannel.h"
 #include "AudioSource.h"
+#include "ThreadPoolImpl.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+/**
+ * Orders the ring accesses of the decoder thread and the mixing thread.
+ */
+static inline void memoryBarrier ( void )
+{
+#ifdef _MSC_VER
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
 
 
 
@@ -33,8 +50,41 @@ AudioChannel::AudioChannel ( int s, AudioSource* audioSource )
   mOutputSampleRate( s ),
   mAudioSource( audioSource ),
   mBufferedSamples( 0 ),
-  mBufferedSamplePos( 0 )
+  mBufferedSamplePos( 0 ),
+  mBufferedSampleFrac( 0 ),
+  mQuality( AudioMixer::LINEAR ),
+  mBuffer( NULL ),
+  mRing( NULL ),
+  mRingWrite( 0 ),
+  mRingRead( 0 ),
+  mRingEnded( false ),
+  mRingGen( 0 ),
+  mRingStart( 0 ),
+  mRingRate( s ),
+  mSeenGen( 0 ),
+  mRate( s ),
+  mPrimed( false ),
+  mUnderruns( 0 ),
+  mMinBuffered( 0 ),
+  mDecodeMutex( NULL ),
+  mAheadMs( 0 ),
+  mRingLimit( RING_FRAMES ),
+  mSourceChanging( false ),
+  mFilling( false ),
+  mPendingFrames( 0 ),
+  mPendingPos( 0 )
 {
+    mHistory[0] = mHistory[1] = 0;
+}
+
+AudioChannel::~AudioChannel ( )
+{
+    delete[] mRing;
+    if ( mDecodeMutex != NULL )
+    {
+        mDecodeMutex->close();
+        delete mDecodeMutex;
+    }
 }
 
 /**
@@ -44,7 +94,44 @@ AudioChannel::AudioChannel ( int s, AudioSource* audioSource )
  */
 void AudioChannel::setAudioSource ( AudioSource* as )
 {
+    if ( mRing == NULL )
+    {
+        mAudioSource = as;
+        resetPosition();
+        return;
+    }
+
+    // Keeps decode() from starting on the old source again, and then
+    // waits for a fillBuffer() still running on it. The caller has
+    // closed the source, so that returns soon even if it is waiting for
+    // the application. mix() drops the frames left from the old source
+    // when it sees the new generation.
+    mDecodeMutex->lock();
+    mSourceChanging = true;
+    while ( mFilling )
+    {
+        mDecodeMutex->unlock();
+        MoSyncThread::sleep( 1 );
+        mDecodeMutex->lock();
+    }
+    mSourceChanging = false;
     mAudioSource = as;
+    mPendingFrames = 0;
+    mPendingPos = 0;
+
+    mRingGen++;
+    memoryBarrier();
+    mRingStart = mRingWrite;
+    mRingRate = as != NULL ? as->getInfo().sampleRate : mOutputSampleRate;
+    mRingLimit = (unsigned)((long long)mRingRate*mAheadMs/1000);
+    if ( mRingLimit < MIX_BLOCK_FRAMES )
+        mRingLimit = MIX_BLOCK_FRAMES;
+    if ( mRingLimit > RING_FRAMES )
+        mRingLimit = RING_FRAMES;
+    mRingEnded = false;
+    memoryBarrier();
+    mRingGen++;
+    mDecodeMutex->unlock();
 }
 
 /**
@@ -103,52 +190,128 @@ int AudioChannel::getVolume ( void )
 
 
 /**
- * This is a template for on the fly converting and mixing from
- * any source (8/16/mono/stereo) format to 32 bit signed stereo
+ * Sets how the source is resampled to the output rate.
+ *
+ * @param q     The resampling quality
+ */
+void AudioChannel::setQuality ( AudioMixer::Quality q )
+{
+    mQuality = q;
+}
+
+/**
+ * Returns the resampling quality
  *
- * @param dst           Pointer to the destination buffer
- * @param numSamples    Number of samples to mix
- * @param src           Pointer to the source buffer
- * @param pos           The position in the source buffer to start (24.8 FIXP)
- * @param delta         The increment delta (24.8 FIXP)
- * @param vol           The source volume [0-1) (16.16 FIXP)
+ * @return The resampling quality
+ */
+AudioMixer::Quality AudioChannel::getQuality ( void ) const
+{
+    return mQuality;
+}
+
+
+
+/**
+ * Restarts playback at the beginning of the next buffer.
  */
-template< typename SrcT, int srcBitDepth, int srcNumChannels, bool sign >
-void convert_audio ( int *dst, int numSamples, const SrcT *src,
-                     int pos, int delta, int vol )
+void AudioChannel::resetPosition ( void )
 {
-    int sample;
+    mBufferedSamples = 0;
+    mBufferedSamplePos = 0;
+    mBufferedSampleFrac = 0;
+    mHistory[0] = mHistory[1] = 0;
+}
 
-    for( int i = 0; i < numSamples; i++ )
+/**
+ * Picks up a source change made by setAudioSource(), skipping the
+ * frames still buffered from the old source.
+ *
+ * @return false if the change is still in progress.
+ */
+bool AudioChannel::syncRing ( void )
+{
+    unsigned gen, start;
+    int rate;
+    do
     {
-        sample = (int)src[((pos>>8)<<(srcNumChannels>>1))];
-        if ( sign == false )
-            sample -= ((1<<srcBitDepth)>>1);
-        sample <<= 16-srcBitDepth;
-        sample = (sample*vol)>>16;
-        dst[i*2+0] += sample;
-
-        if ( srcNumChannels == 2 )
-        {
-            sample = (int)src[((pos>>8)<<1)+1];
-            if ( sign == false)
-                sample -= ((1<<srcBitDepth)>>1);
-            sample <<= 16-srcBitDepth;
-            sample = (sample*vol)>>16;
-            dst[i*2+1] += sample;
-        }
-        else
-            dst[i*2+1] += sample;
+        gen = mRingGen;
+        if ( gen == mSeenGen )
+            return true;
+        if ( gen & 1 )
+            return false;
+        memoryBarrier();
+        start = mRingStart;
+        rate = mRingRate;
+        memoryBarrier();
+    } while ( gen != mRingGen );
 
-        pos+=delta;
-    }
+    mSeenGen = gen;
+    mRate = rate;
+    mRingRead = start;
+    mPrimed = false;
+    mMinBuffered = RING_FRAMES;
+    resetPosition();
+    return true;
 }
 
+/**
+ * Moves on to the next buffer of frames, and sets mBuffer and its
+ * format.
+ *
+ * @return The number of frames in the buffer, 0 at the end of the
+ *         source or -1 if the decoder hasn't caught up.
+ */
+int AudioChannel::refill ( void )
+{
+    if ( mRing == NULL )
+    {
+        int frames = mAudioSource->fillBuffer( );
+        const AudioSource::Info& info = mAudioSource->getInfo();
+        mBuffer = (const char*)mAudioSource->getBuffer();
+        mFormat = (AudioMixer::SampleFormat)info.fmt;
+        mNumChannels = info.numChannels;
+        mFrameSize = mNumChannels*((mFormat == AudioMixer::FMT_S16 || mFormat == AudioMixer::FMT_U16) ? 2 : 1);
+        // amount of src samples per dst sample (in 16:16 fixed point)
+        mDelta = (int)(((long long)info.sampleRate<<16)/mOutputSampleRate);
+        return frames;
+    }
+
+    // hand the frames just played back to the decoder
+    memoryBarrier();
+    mRingRead += mBufferedSamples;
 
+    bool ended = mRingEnded;
+    memoryBarrier();
+    unsigned buffered = mRingWrite - mRingRead;
+    if ( buffered == 0 )
+        return ended ? 0 : -1;
+    memoryBarrier();
+
+    unsigned offset = mRingRead & (RING_FRAMES-1);
+    if ( buffered > RING_FRAMES - offset )
+        buffered = RING_FRAMES - offset;
+    mBuffer = (const char*)&mRing[offset*2];
+    mFormat = AudioMixer::FMT_S16;
+    mNumChannels = 2;
+    mFrameSize = 2*sizeof(short);
+    mDelta = (int)(((long long)mRate<<16)/mOutputSampleRate);
+    mPrimed = true;
+    return (int)buffered;
+}
 
 /**
  * Converts and mixes the audio source to the internal buffer
  *
+ * The source is converted to 16-bit stereo, or 16-bit mono for mono
+ * sources, and volume scaled one block at a time, and then resampled
+ * and mixed in one pass. The
+ * source position is kept as a frame index plus a 16-bit fraction,
+ * so no rounding error builds up across calls.
+ *
+ * With decode-ahead enabled this never blocks: if the decoder falls
+ * behind, the rest of the buffer is left silent and counted as an
+ * underrun.
+ *
  * @param dst           Pointer to the internal buffer to mix in to.
  * @param numSamples    The number of samples to mix.
  *
@@ -158,72 +321,196 @@ void AudioChannel::mix ( int *dst, int numSamples )
     if ( mAudioSource == NULL || mActive == false )
         return;
 
-    int samplesWritten = 0;
-    int srate   = mAudioSource->getInfo().sampleRate;
-    int delta   = (srate<<8)/mOutputSampleRate; // amount of src samples per dst sample (in 24:8 fixed point)
-    int snc     = mAudioSource->getInfo().numChannels;
-    //int numSourceSamples = srate*numSamples/mOutputSampleRate; //
-
-    AudioSource::Format sfmt = mAudioSource->getInfo().fmt;
-    
-
-    const void *src = mAudioSource->getBuffer();
+    if ( mRing != NULL && syncRing() == false )
+        return;
 
+    int samplesWritten = 0;
     while ( samplesWritten < numSamples )
     {
-        if ( mBufferedSamples == false )
+        if ( mBufferedSamplePos >= mBufferedSamples )
         {
-            if ( (mBufferedSamples=mAudioSource->fillBuffer( )) == false )
+            if ( mBufferedSamples > 0 )
+            {
+                const char *last = mBuffer + (mBufferedSamples-1)*mFrameSize;
+                AudioMixer::convert( mHistory, last, mFormat, mNumChannels, 1 );
+            }
+            mBufferedSamplePos -= mBufferedSamples;
+
+            int frames = refill();
+            if ( frames < 0 )
+            {
+                mBufferedSamples = 0;
+                if ( mPrimed )
+                    mUnderruns++;
+                break;
+            }
+            if ( (mBufferedSamples=frames) == 0 )
             {
                 mActive = false;
+                resetPosition();
                 break;
             }
-            mBufferedSamplePos = 0;
+            continue;
         }
 
-        int copySize = numSamples - samplesWritten;
-        int scaledBufferedSamples = (mBufferedSamples*mOutputSampleRate)/srate;
+        int delta = mDelta;
+        int first = mBufferedSamplePos;
+        int available = mBufferedSamples - first;
+        if ( available > MIX_BLOCK_FRAMES )
+            available = MIX_BLOCK_FRAMES;
+
+        // output frames until the position leaves the block
+        int copySize = ((available<<16) - mBufferedSampleFrac + delta - 1)/delta;
+        if ( copySize > numSamples - samplesWritten )
+            copySize = numSamples - samplesWritten;
+        int numFrames = ((mBufferedSampleFrac + (copySize-1)*delta)>>16) + 1;
 
-        if ( copySize > scaledBufferedSamples )
-            copySize = scaledBufferedSamples;
+        int *out = &dst[samplesWritten<<1];
+        bool sameRate = delta == 0x10000 && mBufferedSampleFrac == 0;
+        // 0xffff is the default, full volume
+        bool scaled = mVolume < 0xffff;
 
-        if ( copySize > 0 )
+        // mBlock starts with the frame before the block. Mono sources
+        // stay mono in it, which halves the conversion and scaling.
+        if ( mNumChannels == 1 )
         {
-            switch ( sfmt )
+            if ( first == 0 )
+                mBlock[0] = mHistory[0];
+            else
+                AudioMixer::convertMono( mBlock, mBuffer + (first-1)*mFrameSize, mFormat, 1 );
+            AudioMixer::convertMono( &mBlock[1], mBuffer + first*mFrameSize, mFormat, numFrames );
+            if ( scaled )
+                AudioMixer::scaleMono( mBlock, numFrames+1, mVolume );
+
+            if ( sameRate )
+                AudioMixer::mixMono( out, &mBlock[mQuality == AudioMixer::LINEAR ? 0 : 1], copySize );
+            else
+                AudioMixer::resampleMono( out, copySize, mBlock, mBufferedSampleFrac, delta, mQuality );
+        }
+        else
+        {
+            if ( first == 0 )
+            {
+                mBlock[0] = mHistory[0];
+                mBlock[1] = mHistory[1];
+            }
+            else
             {
-                case AudioSource::FMT_S8:
-                    if ( snc == 1 )
-                        convert_audio<char, sizeof(char)<<3, 1, true>( &dst[samplesWritten<<1], copySize, (char*)src, mBufferedSamplePos<<8, delta, mVolume );
-                    else
-                        convert_audio<char, sizeof(char)<<3, 2, true>( &dst[samplesWritten<<1], copySize, (char*)src, mBufferedSamplePos<<8, delta, mVolume );
-                    break;
-                case AudioSource::FMT_S16:
-                    if( snc == 1 )
-                        convert_audio<short, sizeof(short)<<3, 1, true>( &dst[samplesWritten<<1], copySize, (short*)src, mBufferedSamplePos<<8, delta, mVolume );
-                    else
-                        convert_audio<short, sizeof(short)<<3, 2, true>( &dst[samplesWritten<<1], copySize, (short*)src, mBufferedSamplePos<<8, delta, mVolume );
-                    break;
-                case AudioSource::FMT_U8:
-                    if ( snc == 1 )
-                        convert_audio<unsigned char, sizeof(char)<<3, 1, false>( &dst[samplesWritten<<1], copySize, (unsigned char*)src, mBufferedSamplePos<<8, delta, mVolume);
-                    else
-                        convert_audio<unsigned char, sizeof(char)<<3, 2, false>( &dst[samplesWritten<<1], copySize, (unsigned char*)src, mBufferedSamplePos<<8, delta, mVolume);
-                    break;
-                case AudioSource::FMT_U16:
-                    if ( snc == 1 )
-                        convert_audio<unsigned short, sizeof(short)<<3, 1, false>( &dst[samplesWritten<<1], copySize, (unsigned short*)src, mBufferedSamplePos<<8, delta, mVolume );
-                    else
-                        convert_audio<unsigned short, sizeof(short)<<3, 2, false>( &dst[samplesWritten<<1], copySize, (unsigned short*)src, mBufferedSamplePos<<8, delta, mVolume );
-                    break;
+                AudioMixer::convert( mBlock, mBuffer + (first-1)*mFrameSize, mFormat, mNumChannels, 1 );
             }
+            AudioMixer::convert( &mBlock[2], mBuffer + first*mFrameSize, mFormat, mNumChannels, numFrames );
+            if ( scaled )
+                AudioMixer::scale( mBlock, numFrames+1, mVolume );
+
+            if ( sameRate )
+                AudioMixer::mix( out, &mBlock[mQuality == AudioMixer::LINEAR ? 0 : 2], copySize );
+            else
+                AudioMixer::resample( out, copySize, mBlock, mBufferedSampleFrac, delta, mQuality );
+        }
+
+        int advance = mBufferedSampleFrac + copySize*delta;
+        samplesWritten      += copySize;
+        mBufferedSamplePos  += advance>>16;
+        mBufferedSampleFrac  = advance&0xffff;
+    }
+
+    if ( mRing != NULL && mActive )
+    {
+        int buffered = (int)(mRingWrite - mRingRead) - mBufferedSamplePos;
+        if ( buffered < 0 )
+            buffered = 0;
+        if ( mPrimed && buffered < mMinBuffered )
+            mMinBuffered = buffered;
+    }
+}
 
-            int scaledCopySize = (copySize*delta)>>8;
-            if ( scaledCopySize == 0 )
-                scaledCopySize = 1;
+/**
+ * Makes mix() play from a ring of decoded frames, filled by decode().
+ *
+ * @param aheadMs   How far ahead of playback to decode.
+ */
+void AudioChannel::enableDecodeAhead ( int aheadMs )
+{
+    if ( mRing != NULL )
+        return;
+    mAheadMs = aheadMs;
+    mDecodeMutex = new MoSyncMutex();
+    mDecodeMutex->init();
+    mRing = new short[RING_FRAMES*2];
+    mMinBuffered = RING_FRAMES;
+}
+
+/**
+ * Decodes from the audio source into the ring.
+ *
+ * @return true if frames were added, false if the ring is full
+ *         or there is nothing to decode.
+ */
+bool AudioChannel::decode ( void )
+{
+    MutexHandler lock( mDecodeMutex );
+    if ( mAudioSource == NULL || mRingEnded || mSourceChanging )
+        return false;
 
-            samplesWritten      += copySize;
-            mBufferedSamplePos  += scaledCopySize;
-            mBufferedSamples    -= scaledCopySize;
+    unsigned buffered = mRingWrite - mRingRead;
+    if ( buffered >= mRingLimit )
+        return false;
+    unsigned space = mRingLimit - buffered;
+
+    if ( mPendingFrames == 0 )
+    {
+        // fillBuffer() may block until the application answers, so it
+        // runs without the lock. setAudioSource() waits for it to return.
+        AudioSource* source = mAudioSource;
+        mFilling = true;
+        mDecodeMutex->unlock();
+        int frames = source->fillBuffer( );
+        mDecodeMutex->lock();
+        mFilling = false;
+        // the source was closed to be replaced; its frames are not wanted
+        if ( mSourceChanging )
+            return false;
+
+        mPendingPos = 0;
+        if ( (mPendingFrames=frames) == 0 )
+        {
+            memoryBarrier();
+            mRingEnded = true;
+            return false;
         }
     }
+
+    const AudioSource::Info& info = mAudioSource->getInfo();
+    AudioMixer::SampleFormat fmt = (AudioMixer::SampleFormat)info.fmt;
+    int frameSize = info.numChannels*((fmt == AudioMixer::FMT_S16 || fmt == AudioMixer::FMT_U16) ? 2 : 1);
+    const char *src = (const char*)mAudioSource->getBuffer() + mPendingPos*frameSize;
+
+    unsigned frames = (unsigned)mPendingFrames < space ? (unsigned)mPendingFrames : space;
+    unsigned offset = mRingWrite & (RING_FRAMES-1);
+    unsigned firstPart = RING_FRAMES - offset < frames ? RING_FRAMES - offset : frames;
+    AudioMixer::convert( &mRing[offset*2], src, fmt, info.numChannels, firstPart );
+    if ( frames > firstPart )
+        AudioMixer::convert( mRing, src + firstPart*frameSize, fmt, info.numChannels, frames - firstPart );
+
+    // publish the frames only once they are written
+    memoryBarrier();
+    mRingWrite += frames;
+    mPendingPos += frames;
+    mPendingFrames -= frames;
+    return true;
+}
+
+/**
+ * Returns the decode-ahead telemetry.
+ */
+AudioChannel::Stats AudioChannel::getStats ( void ) const
+{
+    Stats stats = { 0, 0, 0, 0 };
+    if ( mRing == NULL )
+        return stats;
+    stats.underruns = mUnderruns;
+    stats.bufferedFrames = (int)(mRingWrite - mRingRead);
+    stats.minBufferedFrames = mMinBuffered == RING_FRAMES ? stats.bufferedFrames : mMinBuffered;
+    stats.capacity = (int)mRingLimit;
+    return stats;
 }
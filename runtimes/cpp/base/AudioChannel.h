@@ -19,8 +19,10 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #define _AUDIO_CHANNEL_H_
 
 #include <cstdlib>
+#include "AudioMixer.h"
 
 class AudioSource;
+class MoSyncMutex;
 
 /**
  * This class is an audio channel, it takes an audio source
@@ -31,6 +33,17 @@ class AudioSource;
 class AudioChannel
 {
 protected:
+    /**
+     * Source frames converted to 16-bit stereo, or mono, per block.
+     */
+    enum { MIX_BLOCK_FRAMES = 512 };
+
+    /**
+     * Size of the decode-ahead ring, in frames. Must be a power of two.
+     * Only the part set by enableDecodeAhead() is filled.
+     */
+    enum { RING_FRAMES = 1<<14 };
+
     bool            mActive;
     int             mVolume;
 
@@ -39,6 +52,57 @@ protected:
     AudioSource*    mAudioSource;
     int             mBufferedSamples;
     int             mBufferedSamplePos;
+    int             mBufferedSampleFrac;
+
+    AudioMixer::Quality mQuality;
+
+    // last frame of the previous source buffer, for interpolation
+    short           mHistory[2];
+    // the current block, with the frame before it first
+    short           mBlock[(MIX_BLOCK_FRAMES+1)*2];
+
+    // the buffer being played and its format, set by refill()
+    const char*     mBuffer;
+    AudioMixer::SampleFormat mFormat;
+    int             mNumChannels;
+    int             mFrameSize;
+    int             mDelta;
+
+    // Decode-ahead ring of 16-bit stereo frames at the source rate.
+    // decode() is the only producer and mix() the only consumer; each
+    // index only grows and is written by one side. mRing is NULL when
+    // the source is decoded synchronously in mix().
+    short*          mRing;
+    volatile unsigned mRingWrite;
+    volatile unsigned mRingRead;
+    volatile bool   mRingEnded;
+    // written by setAudioSource() as a seqlock; odd while changing
+    volatile unsigned mRingGen;
+    volatile unsigned mRingStart;
+    volatile int    mRingRate;
+
+    // consumer side
+    unsigned        mSeenGen;
+    int             mRate;
+    bool            mPrimed;
+    int             mUnderruns;
+    int             mMinBuffered;
+
+    // producer side, guarded by mDecodeMutex
+    MoSyncMutex*    mDecodeMutex;
+    int             mAheadMs;
+    // frames decode() buffers ahead for the current source
+    unsigned        mRingLimit;
+    // set while setAudioSource() waits for a fillBuffer() to return
+    bool            mSourceChanging;
+    // set while decode() is in fillBuffer(), which it calls unlocked
+    bool            mFilling;
+    int             mPendingFrames;
+    int             mPendingPos;
+
+    void resetPosition ( void );
+    bool syncRing ( void );
+    int refill ( void );
 
 public:
     /**
@@ -49,8 +113,23 @@ public:
      */
     AudioChannel ( int s, AudioSource* audioSource = NULL );
 
+    virtual ~AudioChannel ( );
+
     /**
-     * Set the channel audio source
+     * Decode-ahead telemetry.
+     */
+    struct Stats
+    {
+        int underruns;          // mix() calls that ran out of decoded frames
+        int bufferedFrames;     // decoded frames waiting to be played
+        int minBufferedFrames;  // low watermark since the source was set
+        int capacity;           // frames buffered at most for the source
+    };
+
+    /**
+     * Set the channel audio source. With decode-ahead enabled, this
+     * waits for the decoder to let go of the old source, so a source
+     * that blocks in fillBuffer() must have been closed first.
      *
      * @param as    Pointer to an audio source
      */
@@ -94,6 +173,21 @@ public:
      */
     int getVolume ( void );
 
+    /**
+     * Sets how the source is resampled to the output rate.
+     * Default is linear interpolation.
+     *
+     * @param q     The resampling quality
+     */
+    void setQuality ( AudioMixer::Quality q );
+
+    /**
+     * Returns the resampling quality
+     *
+     * @return The resampling quality
+     */
+    AudioMixer::Quality getQuality ( void ) const;
+
     /**
      * Converts and mixes the audio source to the internal buffer
      *
@@ -102,6 +196,34 @@ public:
      *
      */
     virtual void mix ( int *buffer, int numSamples );
+
+    /**
+     * Makes mix() play from a ring of decoded frames instead of
+     * calling AudioSource::fillBuffer() itself. decode() must then be
+     * called repeatedly from a thread other than the one calling mix().
+     * Must be called before the first audio source is set.
+     *
+     * @param aheadMs   How far ahead of playback to decode. This is
+     *                  the latency of a BufferAudioSource, so it should
+     *                  only be a few mix() calls long.
+     */
+    void enableDecodeAhead ( int aheadMs );
+
+    /**
+     * Decodes from the audio source into the ring. May block in
+     * AudioSource::fillBuffer(), which is called without holding the
+     * lock that setAudioSource() takes.
+     *
+     * @return true if frames were added, false if the ring is full
+     *         or there is nothing to decode.
+     */
+    bool decode ( void );
+
+    /**
+     * Returns the decode-ahead telemetry. All zero unless
+     * enableDecodeAhead() has been called.
+     */
+    Stats getStats ( void ) const;
 };
 
 #endif /* _AUDIO_CHANNEL_H_ */
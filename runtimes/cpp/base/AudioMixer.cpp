@@ -0,0 +1,471 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#include <string.h>
+#include "AudioMixer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIXER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define MIXER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace AudioMixer
+{
+
+/**
+ * Volume as used by the mixing loops: [0-1) in 1.15 fixed point,
+ * so that it fits a 16-bit multiply.
+ */
+static inline int vol15 ( int vol )
+{
+    vol >>= 1;
+    if ( vol < 0 )
+        return 0;
+    if ( vol > 0x7fff )
+        return 0x7fff;
+    return vol;
+}
+
+/**
+ * Converts one sample to signed 16 bits.
+ */
+template< typename SrcT, int srcBitDepth, bool sign >
+static inline short to_s16 ( SrcT s )
+{
+    int sample = (int)s;
+    if ( sign == false )
+        sample -= ((1<<srcBitDepth)>>1);
+    return (short)(sample * (1<<(16-srcBitDepth)));
+}
+
+/**
+ * Converts any source (8/16/mono/stereo) format to 16 bit signed
+ * stereo.
+ *
+ * @param dst           Pointer to the destination buffer
+ * @param src           Pointer to the source buffer
+ * @param numFrames     Number of frames to convert
+ */
+template< typename SrcT, int srcBitDepth, int srcNumChannels, bool sign >
+static void convert_frames ( short *dst, const SrcT *src, int numFrames )
+{
+    if ( srcBitDepth == 16 && srcNumChannels == 2 && sign )
+    {
+        memcpy ( dst, src, numFrames*2*sizeof(short) );
+        return;
+    }
+
+    int i = 0;
+#if defined(MIXER_SSE2)
+    if ( srcBitDepth == 16 && srcNumChannels == 1 && sign )
+    {
+        for ( ; i + 8 <= numFrames; i += 8 )
+        {
+            __m128i s = _mm_loadu_si128( (const __m128i*)&src[i] );
+            _mm_storeu_si128( (__m128i*)&dst[i*2],   _mm_unpacklo_epi16( s, s ) );
+            _mm_storeu_si128( (__m128i*)&dst[i*2+8], _mm_unpackhi_epi16( s, s ) );
+        }
+    }
+#endif
+
+    for ( ; i < numFrames; i++ )
+    {
+        short l = to_s16<SrcT, srcBitDepth, sign>( src[i*srcNumChannels] );
+        short r = l;
+        if ( srcNumChannels == 2 )
+            r = to_s16<SrcT, srcBitDepth, sign>( src[i*2+1] );
+        dst[i*2+0] = l;
+        dst[i*2+1] = r;
+    }
+}
+
+void convert ( short *dst, const void *src, SampleFormat fmt,
+               int numChannels, int numFrames )
+{
+    switch ( fmt )
+    {
+        case FMT_S8:
+            if ( numChannels == 1 )
+                convert_frames<signed char, 8, 1, true>( dst, (const signed char*)src, numFrames );
+            else
+                convert_frames<signed char, 8, 2, true>( dst, (const signed char*)src, numFrames );
+            break;
+        case FMT_U8:
+            if ( numChannels == 1 )
+                convert_frames<unsigned char, 8, 1, false>( dst, (const unsigned char*)src, numFrames );
+            else
+                convert_frames<unsigned char, 8, 2, false>( dst, (const unsigned char*)src, numFrames );
+            break;
+        case FMT_S16:
+            if ( numChannels == 1 )
+                convert_frames<short, 16, 1, true>( dst, (const short*)src, numFrames );
+            else
+                convert_frames<short, 16, 2, true>( dst, (const short*)src, numFrames );
+            break;
+        case FMT_U16:
+            if ( numChannels == 1 )
+                convert_frames<unsigned short, 16, 1, false>( dst, (const unsigned short*)src, numFrames );
+            else
+                convert_frames<unsigned short, 16, 2, false>( dst, (const unsigned short*)src, numFrames );
+            break;
+    }
+}
+
+/**
+ * Converts a mono source format to 16 bit signed mono.
+ *
+ * @param dst           Pointer to the destination buffer
+ * @param src           Pointer to the source buffer
+ * @param numFrames     Number of frames to convert
+ */
+template< typename SrcT, int srcBitDepth, bool sign >
+static void convert_mono ( short *dst, const SrcT *src, int numFrames )
+{
+    if ( srcBitDepth == 16 && sign )
+    {
+        memcpy ( dst, src, numFrames*sizeof(short) );
+        return;
+    }
+
+    int i = 0;
+#if defined(MIXER_SSE2)
+    if ( srcBitDepth == 8 && sign == false )
+    {
+        // (s-128)<<8 is s with its top bit flipped, in the high byte
+        __m128i flip = _mm_set1_epi8( (char)0x80 );
+        __m128i zero = _mm_setzero_si128();
+        for ( ; i + 16 <= numFrames; i += 16 )
+        {
+            __m128i s = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)&src[i] ), flip );
+            _mm_storeu_si128( (__m128i*)&dst[i],   _mm_unpacklo_epi8( zero, s ) );
+            _mm_storeu_si128( (__m128i*)&dst[i+8], _mm_unpackhi_epi8( zero, s ) );
+        }
+    }
+#endif
+
+    for ( ; i < numFrames; i++ )
+        dst[i] = to_s16<SrcT, srcBitDepth, sign>( src[i] );
+}
+
+void convertMono ( short *dst, const void *src, SampleFormat fmt,
+                   int numFrames )
+{
+    switch ( fmt )
+    {
+        case FMT_S8:
+            convert_mono<signed char, 8, true>( dst, (const signed char*)src, numFrames );
+            break;
+        case FMT_U8:
+            convert_mono<unsigned char, 8, false>( dst, (const unsigned char*)src, numFrames );
+            break;
+        case FMT_S16:
+            convert_mono<short, 16, true>( dst, (const short*)src, numFrames );
+            break;
+        case FMT_U16:
+            convert_mono<unsigned short, 16, false>( dst, (const unsigned short*)src, numFrames );
+            break;
+    }
+}
+
+/**
+ * Multiplies n samples by v, a 1.15 fixed point volume.
+ */
+static void scale_samples ( short *buf, int n, int v )
+{
+    int i = 0;
+
+#if defined(MIXER_SSE2)
+    // The 32-bit products are put together from the low and high
+    // halves of the 16-bit multiplies.
+    __m128i vv = _mm_set1_epi16( (short)v );
+    for ( ; i + 8 <= n; i += 8 )
+    {
+        __m128i s  = _mm_loadu_si128( (const __m128i*)&buf[i] );
+        __m128i lo = _mm_mullo_epi16( s, vv );
+        __m128i hi = _mm_mulhi_epi16( s, vv );
+        __m128i p0 = _mm_srai_epi32( _mm_unpacklo_epi16( lo, hi ), 15 );
+        __m128i p1 = _mm_srai_epi32( _mm_unpackhi_epi16( lo, hi ), 15 );
+        _mm_storeu_si128( (__m128i*)&buf[i], _mm_packs_epi32( p0, p1 ) );
+    }
+#elif defined(MIXER_NEON)
+    int16x4_t vv = vdup_n_s16( (short)v );
+    for ( ; i + 8 <= n; i += 8 )
+    {
+        int16x8_t s = vld1q_s16( &buf[i] );
+        int16x4_t p0 = vshrn_n_s32( vmull_s16( vget_low_s16( s ), vv ), 15 );
+        int16x4_t p1 = vshrn_n_s32( vmull_s16( vget_high_s16( s ), vv ), 15 );
+        vst1q_s16( &buf[i], vcombine_s16( p0, p1 ) );
+    }
+#endif
+
+    for ( ; i < n; i++ )
+        buf[i] = (short)((buf[i]*v)>>15);
+}
+
+void scale ( short *buf, int numFrames, int vol )
+{
+    scale_samples( buf, numFrames*2, vol15( vol ) );
+}
+
+void scaleMono ( short *buf, int numFrames, int vol )
+{
+    scale_samples( buf, numFrames, vol15( vol ) );
+}
+
+void mix ( int *dst, const short *src, int numFrames )
+{
+    int n = numFrames*2;
+    int i = 0;
+
+#if defined(MIXER_SSE2)
+    for ( ; i + 8 <= n; i += 8 )
+    {
+        // sign extend by unpacking into the high halves and shifting down
+        __m128i s  = _mm_loadu_si128( (const __m128i*)&src[i] );
+        __m128i s0 = _mm_srai_epi32( _mm_unpacklo_epi16( s, s ), 16 );
+        __m128i s1 = _mm_srai_epi32( _mm_unpackhi_epi16( s, s ), 16 );
+        __m128i d0 = _mm_loadu_si128( (const __m128i*)&dst[i] );
+        __m128i d1 = _mm_loadu_si128( (const __m128i*)&dst[i+4] );
+        _mm_storeu_si128( (__m128i*)&dst[i],   _mm_add_epi32( d0, s0 ) );
+        _mm_storeu_si128( (__m128i*)&dst[i+4], _mm_add_epi32( d1, s1 ) );
+    }
+#elif defined(MIXER_NEON)
+    for ( ; i + 8 <= n; i += 8 )
+    {
+        int16x8_t s = vld1q_s16( &src[i] );
+        vst1q_s32( &dst[i],   vaddw_s16( vld1q_s32( &dst[i] ), vget_low_s16( s ) ) );
+        vst1q_s32( &dst[i+4], vaddw_s16( vld1q_s32( &dst[i+4] ), vget_high_s16( s ) ) );
+    }
+#endif
+
+    for ( ; i < n; i++ )
+        dst[i] += src[i];
+}
+
+void mixMono ( int *dst, const short *src, int numFrames )
+{
+    int i = 0;
+
+#if defined(MIXER_SSE2)
+    for ( ; i + 8 <= numFrames; i += 8 )
+    {
+        __m128i s  = _mm_loadu_si128( (const __m128i*)&src[i] );
+        __m128i s0 = _mm_srai_epi32( _mm_unpacklo_epi16( s, s ), 16 );
+        __m128i s1 = _mm_srai_epi32( _mm_unpackhi_epi16( s, s ), 16 );
+        // each sample goes to both channels
+        __m128i d0 = _mm_loadu_si128( (const __m128i*)&dst[i*2] );
+        __m128i d1 = _mm_loadu_si128( (const __m128i*)&dst[i*2+4] );
+        __m128i d2 = _mm_loadu_si128( (const __m128i*)&dst[i*2+8] );
+        __m128i d3 = _mm_loadu_si128( (const __m128i*)&dst[i*2+12] );
+        _mm_storeu_si128( (__m128i*)&dst[i*2],    _mm_add_epi32( d0, _mm_unpacklo_epi32( s0, s0 ) ) );
+        _mm_storeu_si128( (__m128i*)&dst[i*2+4],  _mm_add_epi32( d1, _mm_unpackhi_epi32( s0, s0 ) ) );
+        _mm_storeu_si128( (__m128i*)&dst[i*2+8],  _mm_add_epi32( d2, _mm_unpacklo_epi32( s1, s1 ) ) );
+        _mm_storeu_si128( (__m128i*)&dst[i*2+12], _mm_add_epi32( d3, _mm_unpackhi_epi32( s1, s1 ) ) );
+    }
+#elif defined(MIXER_NEON)
+    for ( ; i + 4 <= numFrames; i += 4 )
+    {
+        int32x4_t s = vmovl_s16( vld1_s16( &src[i] ) );
+        int32x4x2_t d = vzipq_s32( s, s );
+        vst1q_s32( &dst[i*2],   vaddq_s32( vld1q_s32( &dst[i*2] ), d.val[0] ) );
+        vst1q_s32( &dst[i*2+4], vaddq_s32( vld1q_s32( &dst[i*2+4] ), d.val[1] ) );
+    }
+#endif
+
+    for ( ; i < numFrames; i++ )
+    {
+        dst[i*2+0] += src[i];
+        dst[i*2+1] += src[i];
+    }
+}
+
+void resample ( int *dst, int numFrames, const short *src,
+                int pos, int delta, Quality quality )
+{
+    if ( quality == NEAREST )
+    {
+        int k = 0;
+#if defined(MIXER_SSE2)
+        for ( ; k + 4 <= numFrames; k += 4 )
+        {
+            int f[4];
+            for ( int j = 0; j < 4; j++, pos += delta )
+                memcpy( &f[j], &src[((pos>>16)+1)<<1], sizeof(int) );
+            __m128i s  = _mm_set_epi32( f[3], f[2], f[1], f[0] );
+            __m128i s0 = _mm_srai_epi32( _mm_unpacklo_epi16( s, s ), 16 );
+            __m128i s1 = _mm_srai_epi32( _mm_unpackhi_epi16( s, s ), 16 );
+            __m128i d0 = _mm_loadu_si128( (const __m128i*)&dst[k*2] );
+            __m128i d1 = _mm_loadu_si128( (const __m128i*)&dst[k*2+4] );
+            _mm_storeu_si128( (__m128i*)&dst[k*2],   _mm_add_epi32( d0, s0 ) );
+            _mm_storeu_si128( (__m128i*)&dst[k*2+4], _mm_add_epi32( d1, s1 ) );
+        }
+#endif
+        for ( ; k < numFrames; k++ )
+        {
+            const short *s = &src[((pos>>16)+1)<<1];
+            dst[k*2+0] += s[0];
+            dst[k*2+1] += s[1];
+            pos += delta;
+        }
+        return;
+    }
+
+    // Weights are 2.14 fixed point, so that both fit a 16-bit multiply
+    // and each output sample is a single multiply-add of two frames.
+    int k = 0;
+
+#if defined(MIXER_SSE2)
+    for ( ; k + 2 <= numFrames; k += 2 )
+    {
+        int f0 = (pos&0xffff)>>2;
+        __m128i a = _mm_loadl_epi64( (const __m128i*)&src[(pos>>16)<<1] );
+        pos += delta;
+        int f1 = (pos&0xffff)>>2;
+        __m128i b = _mm_loadl_epi64( (const __m128i*)&src[(pos>>16)<<1] );
+        pos += delta;
+
+        // l0 r0 l1 r1 -> l0 l1 r0 r1, for both frames
+        __m128i s = _mm_unpacklo_epi64( a, b );
+        s = _mm_shufflelo_epi16( s, _MM_SHUFFLE(3,1,2,0) );
+        s = _mm_shufflehi_epi16( s, _MM_SHUFFLE(3,1,2,0) );
+        __m128i w = _mm_set_epi16( (short)f1, (short)(0x4000-f1), (short)f1, (short)(0x4000-f1),
+                                   (short)f0, (short)(0x4000-f0), (short)f0, (short)(0x4000-f0) );
+        __m128i p = _mm_srai_epi32( _mm_madd_epi16( s, w ), 14 );
+        __m128i d = _mm_loadu_si128( (const __m128i*)&dst[k*2] );
+        _mm_storeu_si128( (__m128i*)&dst[k*2], _mm_add_epi32( d, p ) );
+    }
+#endif
+
+    for ( ; k < numFrames; k++ )
+    {
+        const short *s = &src[(pos>>16)<<1];
+        int f = (pos&0xffff)>>2;
+        dst[k*2+0] += (s[0]*(0x4000-f) + s[2]*f)>>14;
+        dst[k*2+1] += (s[1]*(0x4000-f) + s[3]*f)>>14;
+        pos += delta;
+    }
+}
+
+void resampleMono ( int *dst, int numFrames, const short *src,
+                    int pos, int delta, Quality quality )
+{
+    int k = 0;
+
+    // The gathered samples are put together in registers; storing
+    // them to an array and loading that as a vector stalls.
+    if ( quality == NEAREST )
+    {
+#if defined(MIXER_SSE2)
+        for ( ; k + 4 <= numFrames; k += 4 )
+        {
+            int s0 = src[(pos>>16)+1];  pos += delta;
+            int s1 = src[(pos>>16)+1];  pos += delta;
+            int s2 = src[(pos>>16)+1];  pos += delta;
+            int s3 = src[(pos>>16)+1];  pos += delta;
+            __m128i lo = _mm_unpacklo_epi32( _mm_cvtsi32_si128( s0 ), _mm_cvtsi32_si128( s1 ) );
+            __m128i hi = _mm_unpacklo_epi32( _mm_cvtsi32_si128( s2 ), _mm_cvtsi32_si128( s3 ) );
+            __m128i d0 = _mm_loadu_si128( (const __m128i*)&dst[k*2] );
+            __m128i d1 = _mm_loadu_si128( (const __m128i*)&dst[k*2+4] );
+            _mm_storeu_si128( (__m128i*)&dst[k*2],   _mm_add_epi32( d0, _mm_unpacklo_epi32( lo, lo ) ) );
+            _mm_storeu_si128( (__m128i*)&dst[k*2+4], _mm_add_epi32( d1, _mm_unpacklo_epi32( hi, hi ) ) );
+        }
+#endif
+        for ( ; k < numFrames; k++ )
+        {
+            int s = src[(pos>>16)+1];
+            dst[k*2+0] += s;
+            dst[k*2+1] += s;
+            pos += delta;
+        }
+        return;
+    }
+
+    // The same 2.14 weights as resample(), so the result matches
+    // resampling the source converted to stereo.
+#if defined(MIXER_SSE2)
+    // the weights of four frames are worked out from their positions
+    __m128i vpos = _mm_set_epi32( pos+3*delta, pos+2*delta, pos+delta, pos );
+    __m128i vstep = _mm_set1_epi32( 4*delta );
+    __m128i fmask = _mm_set1_epi32( 0xffff );
+    __m128i one = _mm_set1_epi32( 0x4000 );
+    for ( ; k + 4 <= numFrames; k += 4 )
+    {
+        int p0, p1, p2, p3;
+        memcpy( &p0, &src[pos>>16], sizeof(int) );  pos += delta;
+        memcpy( &p1, &src[pos>>16], sizeof(int) );  pos += delta;
+        memcpy( &p2, &src[pos>>16], sizeof(int) );  pos += delta;
+        memcpy( &p3, &src[pos>>16], sizeof(int) );  pos += delta;
+        __m128i s = _mm_unpacklo_epi64(
+            _mm_unpacklo_epi32( _mm_cvtsi32_si128( p0 ), _mm_cvtsi32_si128( p1 ) ),
+            _mm_unpacklo_epi32( _mm_cvtsi32_si128( p2 ), _mm_cvtsi32_si128( p3 ) ) );
+        __m128i f = _mm_srli_epi32( _mm_and_si128( vpos, fmask ), 2 );
+        __m128i w = _mm_or_si128( _mm_slli_epi32( f, 16 ), _mm_sub_epi32( one, f ) );
+        vpos = _mm_add_epi32( vpos, vstep );
+        __m128i v = _mm_srai_epi32( _mm_madd_epi16( s, w ), 14 );
+        __m128i d0 = _mm_loadu_si128( (const __m128i*)&dst[k*2] );
+        __m128i d1 = _mm_loadu_si128( (const __m128i*)&dst[k*2+4] );
+        _mm_storeu_si128( (__m128i*)&dst[k*2],   _mm_add_epi32( d0, _mm_unpacklo_epi32( v, v ) ) );
+        _mm_storeu_si128( (__m128i*)&dst[k*2+4], _mm_add_epi32( d1, _mm_unpackhi_epi32( v, v ) ) );
+    }
+#endif
+
+    for ( ; k < numFrames; k++ )
+    {
+        const short *s = &src[pos>>16];
+        int f = (pos&0xffff)>>2;
+        int v = (s[0]*(0x4000-f) + s[1]*f)>>14;
+        dst[k*2+0] += v;
+        dst[k*2+1] += v;
+        pos += delta;
+    }
+}
+
+void saturate ( short *dst, const int *src, int numSamples )
+{
+    int i = 0;
+
+#if defined(MIXER_SSE2)
+    for ( ; i + 8 <= numSamples; i += 8 )
+    {
+        __m128i a = _mm_loadu_si128( (const __m128i*)&src[i] );
+        __m128i b = _mm_loadu_si128( (const __m128i*)&src[i+4] );
+        _mm_storeu_si128( (__m128i*)&dst[i], _mm_packs_epi32( a, b ) );
+    }
+#elif defined(MIXER_NEON)
+    for ( ; i + 8 <= numSamples; i += 8 )
+    {
+        int16x4_t a = vqmovn_s32( vld1q_s32( &src[i] ) );
+        int16x4_t b = vqmovn_s32( vld1q_s32( &src[i+4] ) );
+        vst1q_s16( &dst[i], vcombine_s16( a, b ) );
+    }
+#endif
+
+    for ( ; i < numSamples; i++ )
+    {
+        int sample = src[i];
+        if ( sample < -32768 )
+            sample = -32768;
+        else if ( sample > 32767 )
+            sample = 32767;
+        dst[i] = (short)sample;
+    }
+}
+
+}
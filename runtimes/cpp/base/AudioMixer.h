@@ -0,0 +1,162 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#ifndef _AUDIO_MIXER_H_
+#define _AUDIO_MIXER_H_
+
+/**
+ * Block based sample conversion, resampling and mixing routines
+ * used by AudioChannel and the audio engines.
+ *
+ * Everything works on interleaved 16-bit stereo frames, mixed into
+ * 32-bit stereo accumulators, so the inner loops are plain array
+ * loops. Mono sources have their own functions, which keep one 16-bit
+ * sample per frame until it is mixed into both channels; they give the
+ * same output as converting to stereo first. They use SSE2 or NEON when the compiler targets it and
+ * fall back to portable C otherwise; all paths give identical output.
+ *
+ * This file has no dependencies on the rest of the runtime, so that
+ * it can be built into tools such as the mixer benchmark.
+ */
+namespace AudioMixer
+{
+    /**
+     * Source sample formats. Must match the order of
+     * AudioSource::Format.
+     */
+    enum SampleFormat
+    {
+        FMT_S8,
+        FMT_U8,
+        FMT_S16,
+        FMT_U16
+    };
+
+    /**
+     * Resampling quality.
+     */
+    enum Quality
+    {
+        NEAREST,
+        LINEAR
+    };
+
+    /**
+     * Converts source frames of any format to signed 16-bit stereo.
+     * Mono sources are duplicated to both channels.
+     *
+     * @param dst           Destination, 2*numFrames shorts
+     * @param src           Source frames
+     * @param fmt           Source sample format
+     * @param numChannels   Source channels, 1 or 2
+     * @param numFrames     Number of frames to convert
+     */
+    void convert ( short *dst, const void *src, SampleFormat fmt,
+                   int numChannels, int numFrames );
+
+    /**
+     * Converts mono source frames of any format to signed 16-bit mono.
+     *
+     * @param dst           Destination, numFrames shorts
+     * @param src           Source frames
+     * @param fmt           Source sample format
+     * @param numFrames     Number of frames to convert
+     */
+    void convertMono ( short *dst, const void *src, SampleFormat fmt,
+                       int numFrames );
+
+    /**
+     * Applies a volume to 16-bit stereo frames in place.
+     *
+     * @param buf           16-bit stereo frames
+     * @param numFrames     Number of frames
+     * @param vol           Volume [0-1] (16.16 FIXP)
+     */
+    void scale ( short *buf, int numFrames, int vol );
+
+    /**
+     * Applies a volume to 16-bit mono frames in place.
+     *
+     * @param buf           16-bit mono frames
+     * @param numFrames     Number of frames
+     * @param vol           Volume [0-1] (16.16 FIXP)
+     */
+    void scaleMono ( short *buf, int numFrames, int vol );
+
+    /**
+     * Mixes 16-bit stereo frames into the accumulator without
+     * changing the rate.
+     *
+     * @param dst           32-bit stereo accumulator
+     * @param src           16-bit stereo frames
+     * @param numFrames     Number of frames to mix
+     */
+    void mix ( int *dst, const short *src, int numFrames );
+
+    /**
+     * Mixes 16-bit mono frames into both channels of the accumulator
+     * without changing the rate.
+     *
+     * @param dst           32-bit stereo accumulator
+     * @param src           16-bit mono frames
+     * @param numFrames     Number of frames to mix
+     */
+    void mixMono ( int *dst, const short *src, int numFrames );
+
+    /**
+     * Resamples 16-bit stereo frames and mixes them into the
+     * accumulator. Output frame k is taken at source position
+     * p = pos + k*delta. LINEAR interpolates between src frame
+     * (p>>16) and the one after it, NEAREST picks the one after it,
+     * so both modes read the same frames.
+     * The caller must make sure all frames read are in src.
+     *
+     * @param dst           32-bit stereo accumulator
+     * @param numFrames     Number of frames to write
+     * @param src           16-bit stereo frames
+     * @param pos           Start position in src (16.16 FIXP)
+     * @param delta         Source frames per output frame (16.16 FIXP)
+     * @param quality       Interpolation mode
+     */
+    void resample ( int *dst, int numFrames, const short *src,
+                    int pos, int delta, Quality quality );
+
+    /**
+     * Like resample(), but for 16-bit mono frames, which are mixed
+     * into both channels of the accumulator.
+     *
+     * @param dst           32-bit stereo accumulator
+     * @param numFrames     Number of frames to write
+     * @param src           16-bit mono frames
+     * @param pos           Start position in src (16.16 FIXP)
+     * @param delta         Source frames per output frame (16.16 FIXP)
+     * @param quality       Interpolation mode
+     */
+    void resampleMono ( int *dst, int numFrames, const short *src,
+                        int pos, int delta, Quality quality );
+
+    /**
+     * Clamps mixed 32-bit samples to the 16-bit output range.
+     *
+     * @param dst           16-bit output samples
+     * @param src           32-bit mixed samples
+     * @param numSamples    Number of samples (not frames)
+     */
+    void saturate ( short *dst, const int *src, int numSamples );
+}
+
+#endif /* _AUDIO_MIXER_H_ */
@@ -0,0 +1,427 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#include <string.h>
+#include "Blitter.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLITTER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define BLITTER_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(BLITTER_SSE2) || defined(BLITTER_NEON)
+#define BLITTER_SIMD
+#endif
+
+namespace Blitter {
+
+// Rotations are copied in blocks of this many pixels squared.
+// 16 pixels of 32 bits are a 64-byte cache line.
+#define TILE_SIZE 16
+
+//******************************************************************************
+// Copying
+//******************************************************************************
+
+template<typename T>
+static void copyPixels(unsigned char* dst, int dstPitch, const unsigned char* src,
+	int srcPitchX, int srcPitchY, int width, int height)
+{
+	if(srcPitchX == -(int)sizeof(T)) {	//mirrored rows
+		while(height--) {
+			const T* s = (const T*)src;
+			T* d = (T*)dst;
+			for(int x = 0; x < width; x++)
+				d[x] = s[-x];
+			src += srcPitchY;
+			dst += dstPitch;
+		}
+		return;
+	}
+
+	// The source is read along its columns. Within a tile, each of its rows
+	// is touched once per destination row, so it's only loaded once.
+	for(int ty = 0; ty < height; ty += TILE_SIZE) {
+		int th = height - ty < TILE_SIZE ? height - ty : TILE_SIZE;
+		for(int tx = 0; tx < width; tx += TILE_SIZE) {
+			int tw = width - tx < TILE_SIZE ? width - tx : TILE_SIZE;
+			const unsigned char* srow = src + tx*srcPitchX + ty*srcPitchY;
+			unsigned char* drow = dst + tx*(int)sizeof(T) + ty*dstPitch;
+			for(int y = 0; y < th; y++) {
+				const unsigned char* s = srow;
+				T* d = (T*)drow;
+				for(int x = 0; x < tw; x++) {
+					d[x] = *(const T*)s;
+					s += srcPitchX;
+				}
+				srow += srcPitchY;
+				drow += dstPitch;
+			}
+		}
+	}
+}
+
+void copy(unsigned char* dst, int dstPitch, const unsigned char* src,
+	int srcPitchX, int srcPitchY, int bytesPerPixel, int width, int height)
+{
+	if(srcPitchX == bytesPerPixel) {
+		// memmove, because an image may be drawn onto itself.
+		int rowBytes = width*bytesPerPixel;
+		while(height--) {
+			memmove(dst, src, rowBytes);
+			src += srcPitchY;
+			dst += dstPitch;
+		}
+		return;
+	}
+
+	switch(bytesPerPixel) {
+	case 2:
+		copyPixels<unsigned short>(dst, dstPitch, src, srcPitchX, srcPitchY, width, height);
+		break;
+	case 4:
+		copyPixels<unsigned int>(dst, dstPitch, src, srcPitchX, srcPitchY, width, height);
+		break;
+	default:
+		while(height--) {
+			const unsigned char* s = src;
+			unsigned char* d = dst;
+			for(int x = 0; x < width; x++) {
+				memcpy(d, s, bytesPerPixel);
+				s += srcPitchX;
+				d += bytesPerPixel;
+			}
+			src += srcPitchY;
+			dst += dstPitch;
+		}
+	}
+}
+
+//******************************************************************************
+// Blending
+//******************************************************************************
+
+// Returns the number of bits in a channel, or -1 if mask isn't a contiguous
+// run of bits starting at shift.
+static int channelBits(unsigned int mask, unsigned int shift) {
+	if(mask == 0 || shift >= 32)
+		return -1;
+	unsigned int m = mask >> shift;
+	if((m << shift) != mask || (m & (m + 1)) != 0)
+		return -1;
+	int bits = 0;
+	while(m) {
+		bits++;
+		m >>= 1;
+	}
+	return bits;
+}
+
+bool canBlend(const Format& fmt) {
+	int r = channelBits(fmt.redMask, fmt.redShift);
+	int g = channelBits(fmt.greenMask, fmt.greenShift);
+	int b = channelBits(fmt.blueMask, fmt.blueShift);
+	switch(fmt.bytesPerPixel) {
+	case 4:
+		return r == 8 && g == 8 && b == 8 && (fmt.redShift & 7) == 0 &&
+			(fmt.greenShift & 7) == 0 && (fmt.blueShift & 7) == 0 &&
+			(fmt.redMask | fmt.greenMask | fmt.blueMask) == 0xffffff;
+	case 2:
+		// (s - d) * 256 must fit in a signed 16-bit lane.
+		return r > 0 && r <= 7 && g > 0 && g <= 7 && b > 0 && b <= 7 &&
+			(fmt.redMask | fmt.greenMask | fmt.blueMask) <= 0xffff;
+	default:
+		return false;
+	}
+}
+
+// The channels are in bytes 0-2, in any order. Bytes 0 and 2 are blended in
+// parallel, as SDL does; the per-channel results are the same.
+static inline unsigned int blendPixel32(unsigned int s, unsigned int d, unsigned int a) {
+	if(a == 255)
+		return s & 0xffffff;
+	unsigned int rb = d & 0xff00ff;
+	unsigned int g = d & 0xff00;
+	rb = (rb + (((s & 0xff00ff) - rb) * a >> 8)) & 0xff00ff;
+	g = (g + (((s & 0xff00) - g) * a >> 8)) & 0xff00;
+	return rb | g;
+}
+
+static inline unsigned int blendChannel(unsigned int s, unsigned int d,
+	unsigned int mask, unsigned int shift, int a)
+{
+	int sc = (s & mask) >> shift;
+	int dc = (d & mask) >> shift;
+	return (unsigned int)(dc + (((sc - dc) * a) >> 8)) << shift;
+}
+
+static inline unsigned int blendPixel16(unsigned int s, unsigned int d,
+	const Format& fmt, int a)
+{
+	if(a == 255)
+		return s & (fmt.redMask | fmt.greenMask | fmt.blueMask);
+	return blendChannel(s, d, fmt.redMask, fmt.redShift, a) |
+		blendChannel(s, d, fmt.greenMask, fmt.greenShift, a) |
+		blendChannel(s, d, fmt.blueMask, fmt.blueShift, a);
+}
+
+#ifdef BLITTER_SSE2
+// Four 32-bit pixels, with their alphas in the low bytes of a. The channels
+// are widened to 16 bits; only the low 16 bits of (s - d) * alpha are
+// needed, because the result is d plus bits 8-15 of the product, modulo
+// 256. Alpha 255 is done as 256, which gives s exactly.
+static inline __m128i blend4(__m128i s, __m128i d, __m128i a) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lowByte = _mm_set1_epi16(0xff);
+
+	a = _mm_add_epi32(a, _mm_srli_epi32(_mm_cmpeq_epi32(a, _mm_set1_epi32(255)), 31));
+	a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+	__m128i aLo = _mm_unpacklo_epi32(a, a);
+	__m128i aHi = _mm_unpackhi_epi32(a, a);
+
+	__m128i sLo = _mm_unpacklo_epi8(s, zero), sHi = _mm_unpackhi_epi8(s, zero);
+	__m128i dLo = _mm_unpacklo_epi8(d, zero), dHi = _mm_unpackhi_epi8(d, zero);
+	__m128i rLo = _mm_add_epi16(dLo, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(sLo, dLo), aLo), 8));
+	__m128i rHi = _mm_add_epi16(dHi, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(sHi, dHi), aHi), 8));
+	return _mm_packus_epi16(_mm_and_si128(rLo, lowByte), _mm_and_si128(rHi, lowByte));
+}
+
+// One channel of eight 16-bit pixels. Channels have at most 7 bits, so the
+// product fits and can be shifted arithmetically, like the C version.
+static inline __m128i blendChannel8(__m128i s, __m128i d, __m128i a,
+	__m128i mask, __m128i shift)
+{
+	__m128i sc = _mm_srl_epi16(_mm_and_si128(s, mask), shift);
+	__m128i dc = _mm_srl_epi16(_mm_and_si128(d, mask), shift);
+	__m128i r = _mm_add_epi16(dc, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(sc, dc), a), 8));
+	return _mm_sll_epi16(r, shift);
+}
+#elif defined(BLITTER_NEON)
+// See the SSE2 version. vmovn_u16 keeps the low byte of each lane.
+static inline uint32x4_t blend4(uint32x4_t s, uint32x4_t d, uint32x4_t a) {
+	uint8x16_t a8 = vreinterpretq_u8_u32(vmulq_n_u32(a, 0x01010101));
+	uint8x16_t s8 = vreinterpretq_u8_u32(s);
+	uint8x16_t d8 = vreinterpretq_u8_u32(d);
+	const uint16x8_t opaque = vdupq_n_u16(255);
+
+	uint16x8_t aLo = vmovl_u8(vget_low_u8(a8));
+	uint16x8_t aHi = vmovl_u8(vget_high_u8(a8));
+	aLo = vaddq_u16(aLo, vshrq_n_u16(vceqq_u16(aLo, opaque), 15));
+	aHi = vaddq_u16(aHi, vshrq_n_u16(vceqq_u16(aHi, opaque), 15));
+
+	uint16x8_t dLo = vmovl_u8(vget_low_u8(d8));
+	uint16x8_t dHi = vmovl_u8(vget_high_u8(d8));
+	uint16x8_t rLo = vaddq_u16(dLo, vshrq_n_u16(vmulq_u16(vsubq_u16(vmovl_u8(vget_low_u8(s8)), dLo), aLo), 8));
+	uint16x8_t rHi = vaddq_u16(dHi, vshrq_n_u16(vmulq_u16(vsubq_u16(vmovl_u8(vget_high_u8(s8)), dHi), aHi), 8));
+	return vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(rLo), vmovn_u16(rHi)));
+}
+
+// shiftRight is the negated shift, as vshlq takes it.
+static inline uint16x8_t blendChannel8(uint16x8_t s, uint16x8_t d, int16x8_t a,
+	uint16x8_t mask, int16x8_t shiftRight, int16x8_t shiftLeft)
+{
+	int16x8_t sc = vreinterpretq_s16_u16(vshlq_u16(vandq_u16(s, mask), shiftRight));
+	int16x8_t dc = vreinterpretq_s16_u16(vshlq_u16(vandq_u16(d, mask), shiftRight));
+	int16x8_t r = vaddq_s16(dc, vshrq_n_s16(vmulq_s16(vsubq_s16(sc, dc), a), 8));
+	return vshlq_u16(vreinterpretq_u16_s16(r), shiftLeft);
+}
+#endif
+
+static void blend32(unsigned char* dst, int dstPitch, const unsigned char* src,
+	const unsigned char* alpha, int srcPitchX, int srcPitchY, int width, int height)
+{
+	int alphaPitchX = srcPitchX / 4;
+	int alphaPitchY = srcPitchY / 4;
+#ifdef BLITTER_SSE2
+	const __m128i rgb = _mm_set1_epi32(0xffffff);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i opaque = _mm_set1_epi32(255);
+#elif defined(BLITTER_NEON)
+	const uint32x4_t rgb = vdupq_n_u32(0xffffff);
+#endif
+	while(height--) {
+		unsigned int* d = (unsigned int*)dst;
+		int x = 0;
+#ifdef BLITTER_SIMD
+		if(srcPitchX == 4) {
+			const unsigned int* s = (const unsigned int*)src;
+#ifdef BLITTER_SSE2
+			for(; x + 4 <= width; x += 4) {
+				__m128i sv = _mm_loadu_si128((const __m128i*)&s[x]);
+				__m128i dv = _mm_loadu_si128((const __m128i*)&d[x]);
+				__m128i av;
+				if(alpha) {
+					int a4;
+					memcpy(&a4, &alpha[x], 4);
+					av = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(a4), zero), zero);
+				} else {
+					av = _mm_srli_epi32(sv, 24);
+				}
+				int isOpaque = _mm_movemask_epi8(_mm_cmpeq_epi32(av, opaque));
+				int isClear = _mm_movemask_epi8(_mm_cmpeq_epi32(av, zero));
+				__m128i rv;
+				if(isOpaque == 0xffff) {
+					rv = sv;
+				} else if(isClear == 0xffff) {
+					rv = dv;
+				} else if((isOpaque | isClear) == 0xffff) {	//sprite edges, no blending needed
+					__m128i m = _mm_cmpeq_epi32(av, opaque);
+					rv = _mm_or_si128(_mm_and_si128(m, sv), _mm_andnot_si128(m, dv));
+				} else {
+					rv = blend4(sv, dv, av);
+				}
+				_mm_storeu_si128((__m128i*)&d[x], _mm_and_si128(rv, rgb));
+			}
+#elif defined(BLITTER_NEON)
+			for(; x + 4 <= width; x += 4) {
+				uint32x4_t sv = vld1q_u32(&s[x]);
+				uint32x4_t av;
+				if(alpha) {
+					// Only four alphas are left at the end of the plane.
+					uint32_t a4;
+					memcpy(&a4, &alpha[x], 4);
+					av = vmovl_u16(vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(a4)))));
+				} else {
+					av = vshrq_n_u32(sv, 24);
+				}
+				uint32x4_t rv = blend4(sv, vld1q_u32(&d[x]), av);
+				vst1q_u32(&d[x], vandq_u32(rv, rgb));
+			}
+#endif
+		}
+#endif
+
+		const unsigned char* s = src + x*srcPitchX;
+		if(alpha) {
+			const unsigned char* a = alpha + x*alphaPitchX;
+			for(; x < width; x++) {
+				d[x] = blendPixel32(*(const unsigned int*)s, d[x], *a);
+				s += srcPitchX;
+				a += alphaPitchX;
+			}
+			alpha += alphaPitchY;
+		} else {
+			for(; x < width; x++) {
+				unsigned int p = *(const unsigned int*)s;
+				d[x] = blendPixel32(p, d[x], p >> 24);
+				s += srcPitchX;
+			}
+		}
+		src += srcPitchY;
+		dst += dstPitch;
+	}
+}
+
+static void blend16(unsigned char* dst, int dstPitch, const unsigned char* src,
+	const unsigned char* alpha, int srcPitchX, int srcPitchY, const Format& fmt,
+	int width, int height)
+{
+	int alphaPitchX = srcPitchX / 2;
+	int alphaPitchY = srcPitchY / 2;
+#ifdef BLITTER_SSE2
+	const __m128i rgb = _mm_set1_epi16((short)(fmt.redMask | fmt.greenMask | fmt.blueMask));
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i opaque = _mm_set1_epi16(255);
+	const __m128i rMask = _mm_set1_epi16((short)fmt.redMask);
+	const __m128i gMask = _mm_set1_epi16((short)fmt.greenMask);
+	const __m128i bMask = _mm_set1_epi16((short)fmt.blueMask);
+	const __m128i rShift = _mm_cvtsi32_si128(fmt.redShift);
+	const __m128i gShift = _mm_cvtsi32_si128(fmt.greenShift);
+	const __m128i bShift = _mm_cvtsi32_si128(fmt.blueShift);
+#elif defined(BLITTER_NEON)
+	const uint16x8_t opaque = vdupq_n_u16(255);
+	const uint16x8_t rMask = vdupq_n_u16((unsigned short)fmt.redMask);
+	const uint16x8_t gMask = vdupq_n_u16((unsigned short)fmt.greenMask);
+	const uint16x8_t bMask = vdupq_n_u16((unsigned short)fmt.blueMask);
+	const int16x8_t rLeft = vdupq_n_s16((short)fmt.redShift);
+	const int16x8_t gLeft = vdupq_n_s16((short)fmt.greenShift);
+	const int16x8_t bLeft = vdupq_n_s16((short)fmt.blueShift);
+	const int16x8_t rRight = vnegq_s16(rLeft);
+	const int16x8_t gRight = vnegq_s16(gLeft);
+	const int16x8_t bRight = vnegq_s16(bLeft);
+#endif
+	while(height--) {
+		unsigned short* d = (unsigned short*)dst;
+		int x = 0;
+#ifdef BLITTER_SIMD
+		if(srcPitchX == 2) {
+			const unsigned short* s = (const unsigned short*)src;
+#ifdef BLITTER_SSE2
+			for(; x + 8 <= width; x += 8) {
+				__m128i a8 = _mm_loadl_epi64((const __m128i*)&alpha[x]);
+				int isOpaque = _mm_movemask_epi8(_mm_cmpeq_epi8(a8, _mm_set1_epi8((char)255))) & 0xff;
+				int isClear = _mm_movemask_epi8(_mm_cmpeq_epi8(a8, zero)) & 0xff;
+				__m128i sv = _mm_loadu_si128((const __m128i*)&s[x]);
+				__m128i dv = _mm_loadu_si128((const __m128i*)&d[x]);
+				__m128i rv;
+				if(isOpaque == 0xff) {
+					rv = sv;
+				} else if(isClear == 0xff) {
+					rv = dv;
+				} else {
+					__m128i av = _mm_unpacklo_epi8(a8, zero);
+					av = _mm_sub_epi16(av, _mm_cmpeq_epi16(av, opaque));
+					rv = _mm_or_si128(_mm_or_si128(
+						blendChannel8(sv, dv, av, rMask, rShift),
+						blendChannel8(sv, dv, av, gMask, gShift)),
+						blendChannel8(sv, dv, av, bMask, bShift));
+				}
+				_mm_storeu_si128((__m128i*)&d[x], _mm_and_si128(rv, rgb));
+			}
+#elif defined(BLITTER_NEON)
+			for(; x + 8 <= width; x += 8) {
+				uint16x8_t sv = vld1q_u16(&s[x]);
+				uint16x8_t dv = vld1q_u16(&d[x]);
+				uint16x8_t au = vmovl_u8(vld1_u8(&alpha[x]));
+				int16x8_t av = vreinterpretq_s16_u16(vaddq_u16(au, vshrq_n_u16(vceqq_u16(au, opaque), 15)));
+				uint16x8_t rv = vorrq_u16(vorrq_u16(
+					blendChannel8(sv, dv, av, rMask, rRight, rLeft),
+					blendChannel8(sv, dv, av, gMask, gRight, gLeft)),
+					blendChannel8(sv, dv, av, bMask, bRight, bLeft));
+				vst1q_u16(&d[x], rv);
+			}
+#endif
+		}
+#endif
+
+		const unsigned char* s = src + x*srcPitchX;
+		const unsigned char* a = alpha + x*alphaPitchX;
+		for(; x < width; x++) {
+			d[x] = (unsigned short)blendPixel16(*(const unsigned short*)s, d[x], fmt, *a);
+			s += srcPitchX;
+			a += alphaPitchX;
+		}
+		src += srcPitchY;
+		alpha += alphaPitchY;
+		dst += dstPitch;
+	}
+}
+
+void blend(unsigned char* dst, int dstPitch, const unsigned char* src,
+	const unsigned char* alpha, int srcPitchX, int srcPitchY, const Format& fmt,
+	int width, int height)
+{
+	if(fmt.bytesPerPixel == 4)
+		blend32(dst, dstPitch, src, alpha, srcPitchX, srcPitchY, width, height);
+	else
+		blend16(dst, dstPitch, src, alpha, srcPitchX, srcPitchY, fmt, width, height);
+}
+
+}
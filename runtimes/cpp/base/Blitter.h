@@ -0,0 +1,62 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#ifndef BLITTER_H
+#define BLITTER_H
+
+// The inner loops of Image::drawImageRegion(), for when the source and the
+// destination have the same pixel format.
+//
+// Source pixel (x, y) is at src + x*srcPitchX + y*srcPitchY, which covers
+// all eight transforms. Destination rows are contiguous. Pitches are in
+// bytes, and the caller does the clipping.
+//
+// This file doesn't depend on the rest of the runtime, so that it can be
+// built into the blitter benchmark.
+
+namespace Blitter {
+
+struct Format {
+	int bytesPerPixel;
+	unsigned int redMask, greenMask, blueMask;
+	unsigned int redShift, greenShift, blueShift;
+};
+
+// Copies the pixels. Rows are copied whole when srcPitchX is bytesPerPixel.
+// Rotations are copied in tiles, so that the source rows being read stay
+// in the cache.
+void copy(unsigned char* dst, int dstPitch, const unsigned char* src,
+	int srcPitchX, int srcPitchY, int bytesPerPixel, int width, int height);
+
+// Returns true if blend() handles the format: 32 bits with 8-bit channels
+// in the low three bytes, or 16 bits with at most 7 bits per channel.
+bool canBlend(const Format& fmt);
+
+// Blends each channel as d + (((s - d) * alpha) >> 8); alpha 255 copies the
+// source. Destination bits outside the color channels are cleared.
+//
+// alpha points to the alpha of the first source pixel, in a plane with one
+// byte per pixel and the source's layout, so its pitches are the source's
+// divided by bytesPerPixel. If alpha is NULL, it is the top byte of each
+// 32-bit source pixel.
+void blend(unsigned char* dst, int dstPitch, const unsigned char* src,
+	const unsigned char* alpha, int srcPitchX, int srcPitchY, const Format& fmt,
+	int width, int height);
+
+}
+
+#endif	//BLITTER_H
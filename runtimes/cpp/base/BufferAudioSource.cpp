@@ -26,6 +26,7 @@ using namespace Base;
 
 BufferAudioSource::BufferAudioSource(const MAAudioBufferInfo *i, BufferRequestCallback callback) {
 	mSem = new MoSyncSemaphore();
+	mClosed = false;
 	info.sampleRate = i->sampleRate;
 	switch(i->fmt) {
 				case AUDIO_FMT_S16: 
@@ -64,6 +65,7 @@ int BufferAudioSource::init() {
 }
 
 void BufferAudioSource::close() {
+	mClosed = true;
 	ready();
 }
 
@@ -72,6 +74,9 @@ void BufferAudioSource::ready() {
 }
 
 int BufferAudioSource::fillBuffer() {
+	// a decoder calling again after close() would otherwise wait forever.
+	if(mClosed)
+		return 0;
 	mCallback();
 	/*
 	MAEvent audioEvent;
@@ -79,6 +84,8 @@ int BufferAudioSource::fillBuffer() {
 	gEventFifo.put(audioEvent);
 	*/
 	mSem->wait();
+	if(mClosed)
+		return 0;
 	return info.bufferSize/(info.bytesPerSample*info.numChannels);
 }
 
@@ -44,6 +44,8 @@ private:
 	void* mBuffer;
 
 	MoSyncSemaphore *mSem;
+	// once set, fillBuffer() returns at once.
+	volatile bool mClosed;
 
 	BufferRequestCallback mCallback;
 };
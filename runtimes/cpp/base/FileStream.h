@@ -21,6 +21,7 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include "Platform.h"
 
 #include "Stream.h"
+#include "MemStream.h"
 
 #include <time.h>
 
@@ -98,6 +99,26 @@ namespace Base {
 #endif
 	};
 
+#ifdef HAVE_MAPPED_FILES
+	class FileMapping;
+
+	//A whole file, mapped into memory. ptrc() returns the mapping.
+	//Writes go to private copy-on-write pages and never reach the file.
+	class MappedFileStream : public MemStreamC {
+	public:
+		MappedFileStream(const char* filename);
+		virtual ~MappedFileStream();
+		bool write(const void* src, int size);
+		void* ptr() { return (void*)mSrc; }
+		Stream* createLimitedCopy(int size) const;
+		Stream* createCopy() const;
+		Stream* createView(int size);
+	protected:
+		MappedFileStream(FileMapping* mapping, const void* src, int size);
+		FileMapping* mMapping;	//shared by all views; deleted with the last one
+	};
+#endif	//HAVE_MAPPED_FILES
+
 } // namespace Base
 
 #endif // _BASE_FILE_STREAM_H_
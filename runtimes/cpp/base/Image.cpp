@@ -16,6 +16,7 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 */
 
 #include "Image.h"
+#include "Blitter.h"
 #include <stdlib.h>
 #include <config_platform.h>
 #include <helpers/helpers.h>
@@ -370,6 +371,23 @@ void Image::drawImage(int left, int top, Image *img) {
 
 #define BIG_PHAT_SOURCE_RECT_ERROR { BIG_PHAT_ERROR(ERR_SOURCE_RECT_OOB);}
 
+// Returns true, and fills in fmt, if the Blitter can draw img onto dst.
+static bool blitterFormat(const Image* dst, const Image* img, Blitter::Format& fmt) {
+	if(dst->bytesPerPixel != img->bytesPerPixel ||
+		dst->redMask != img->redMask || dst->redShift != img->redShift ||
+		dst->greenMask != img->greenMask || dst->greenShift != img->greenShift ||
+		dst->blueMask != img->blueMask || dst->blueShift != img->blueShift)
+		return false;
+	fmt.bytesPerPixel = img->bytesPerPixel;
+	fmt.redMask = img->redMask;
+	fmt.greenMask = img->greenMask;
+	fmt.blueMask = img->blueMask;
+	fmt.redShift = img->redShift;
+	fmt.greenShift = img->greenShift;
+	fmt.blueShift = img->blueShift;
+	return true;
+}
+
 void Image::drawImageRegion(int left, int top, ClipRect *srcRect, Image *img, int transformMode) {
 	int width = srcRect->width,
 		height = srcRect->height,
@@ -542,6 +560,27 @@ void Image::drawImageRegion(int left, int top, ClipRect *srcRect, Image *img, in
 	//DUMPX(img->alpha);
 	//DUMP(bpp);
 
+	// Same formats on both sides go through the Blitter.
+	// The loops below are left for the rest.
+	Blitter::Format fmt;
+	if(blitterFormat(this, img, fmt)) {
+		if(img->alpha) {
+			if(Blitter::canBlend(fmt)) {
+				unsigned char *salpha = &img->alpha[transTopLeftX + transTopLeftY*(img->pitch/bpp)];
+				Blitter::blend(dst, pitch, src, salpha, srcPitchX, srcPitchY, fmt, transWidth, transHeight);
+				return;
+			}
+		} else if(img->alphaMask) {
+			if(bpp == 4 && img->alphaMask == 0xff000000 && Blitter::canBlend(fmt)) {
+				Blitter::blend(dst, pitch, src, NULL, srcPitchX, srcPitchY, fmt, transWidth, transHeight);
+				return;
+			}
+		} else {
+			Blitter::copy(dst, pitch, src, srcPitchX, srcPitchY, bpp, transWidth, transHeight);
+			return;
+		}
+	}
+
 	if(img->alpha) {
 		switch(bpp) {
 		case 2:
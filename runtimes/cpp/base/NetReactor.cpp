@@ -0,0 +1,435 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#include "config_platform.h"
+#include "Platform.h"
+
+#ifdef HAVE_EPOLL
+
+#include <helpers/helpers.h>
+
+#define NETWORKING_H
+#include "networking.h"
+
+#include <map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+//***************************************************************************
+//NetReactor
+//***************************************************************************
+
+// Runs connect, read and write operations on plain TCP connections with
+// non-blocking sockets and epoll, all in one thread. The ThreadPool would
+// otherwise block one thread per pending operation.
+//
+// Sockets are registered once, edge-triggered. Reads and writes are tried
+// as soon as they are requested, so epoll is only waited on when they
+// would block.
+//
+// Results are reported with ConnOp::handleResult(), which takes gConnMutex.
+// To keep the lock order, this is never done while holding mMutex.
+class NetReactor {
+public:
+	NetReactor();
+	~NetReactor();
+
+	bool connect(MAStreamConn& mac);
+	void read(MAStreamConn& mac, void* dst, int size, MemStream* data, MAHandle handle);
+	void write(MAStreamConn& mac, const void* src, int size, Stream* data,
+		MAHandle handle, byte* temp);
+	void cancel(MAConn& mac);
+
+private:
+	struct Op {
+		bool active;
+		byte* buf;	//read destination or write source
+		int size, pos;
+		Stream* data;	//binary resource to deflux when done, or NULL
+		MAHandle handle;
+		byte* temp;	//owned copy of the write source, or NULL
+	};
+
+	struct Entry {
+		MAStreamConn* mac;
+		int fd;	//as registered with epoll
+		bool registered;
+		bool connecting;
+		Op read, write;
+	};
+
+	struct Result {
+		MAStreamConn* mac;
+		int opcode, result;
+		Stream* data;
+		MAHandle handle;
+	};
+
+	typedef std::map<MAHandle, Entry> EntryMap;
+	typedef EntryMap::iterator EntryItr;
+	typedef std::vector<Result> ResultVector;
+
+	//epoll_event.data for the wakeup eventfd. Never a valid handle.
+	static const uint64_t WAKE_KEY = ~(uint64_t)0;
+
+	Entry& entry(MAStreamConn& mac);
+	bool registerSocket(Entry& e, ResultVector& results);
+	void doRead(Entry& e, ResultVector& results);
+	void doWrite(Entry& e, ResultVector& results);
+	void finish(Op& op, MAStreamConn* mac, int opcode, int result, ResultVector& results);
+	void finishAll(Entry& e, int result, ResultVector& results);
+	void wake();
+	static void report(const ResultVector& results);
+
+	void run();
+	static int homeRun(void*);
+
+	int mEpoll, mWake;
+	MoSyncThread mThread;
+	MoSyncMutex mMutex;
+	EntryMap mEntries;
+	ResultVector mDone;	//results for the reactor thread to report
+	bool mQuit;
+};
+
+#ifdef _MSC_VER
+#pragma warning(disable:4355)
+#endif
+
+NetReactor::NetReactor() : mQuit(false) {
+	mMutex.init();
+	mEpoll = epoll_create(CONN_MAX + 1);
+	if(mEpoll < 0) {
+		LOG("epoll_create failed: %i\n", errno);
+		DEBIG_PHAT_ERROR;
+	}
+	mWake = eventfd(0, 0);
+	if(mWake < 0) {
+		LOG("eventfd failed: %i\n", errno);
+		DEBIG_PHAT_ERROR;
+	}
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = WAKE_KEY;
+	if(epoll_ctl(mEpoll, EPOLL_CTL_ADD, mWake, &ev) < 0) {
+		LOG("epoll_ctl failed: %i\n", errno);
+		DEBIG_PHAT_ERROR;
+	}
+	mThread.start(homeRun, this);
+}
+
+NetReactor::~NetReactor() {
+	mMutex.lock();
+	mQuit = true;
+	wake();
+	mMutex.unlock();
+	mThread.join();
+
+	DEBUG_ASSERT(mEntries.empty());
+	::close(mWake);
+	::close(mEpoll);
+	mMutex.close();
+}
+
+//*****************************************************************************
+//Operations, called from the VM thread.
+//*****************************************************************************
+
+// Called with gConnMutex held, so any result is left to the reactor thread.
+bool NetReactor::connect(MAStreamConn& mac) {
+	if(!mac.tcp->hasNumericHost())
+		return false;
+	mMutex.lock();
+	{
+		Entry& e(entry(mac));
+		int res = mac.tcp->connectStart();
+		if(res < 0) {
+			Result r = { &mac, CONNOP_CONNECT, res, NULL, 0 };
+			mDone.push_back(r);
+		} else {
+			//even if we're already connected, let epoll report it.
+			e.connecting = true;
+			registerSocket(e, mDone);
+		}
+		if(!mDone.empty())
+			wake();
+	}
+	mMutex.unlock();
+	return true;
+}
+
+void NetReactor::read(MAStreamConn& mac, void* dst, int size, MemStream* data,
+	MAHandle handle)
+{
+	ResultVector results;
+	mMutex.lock();
+	{
+		Entry& e(entry(mac));
+		DEBUG_ASSERT(!e.read.active);
+		Op op = { true, (byte*)dst, size, 0, data, handle, NULL };
+		e.read = op;
+		if(registerSocket(e, results) && !e.connecting)
+			doRead(e, results);
+	}
+	mMutex.unlock();
+	report(results);
+}
+
+void NetReactor::write(MAStreamConn& mac, const void* src, int size, Stream* data,
+	MAHandle handle, byte* temp)
+{
+	ResultVector results;
+	mMutex.lock();
+	{
+		Entry& e(entry(mac));
+		DEBUG_ASSERT(!e.write.active);
+		Op op = { true, (byte*)src, size, 0, data, handle, temp };
+		e.write = op;
+		if(registerSocket(e, results) && !e.connecting)
+			doWrite(e, results);
+	}
+	mMutex.unlock();
+	report(results);
+}
+
+void NetReactor::cancel(MAConn& mac) {
+	if(mac.type != eStreamConn || ((MAStreamConn&)mac).tcp == NULL)
+		return;
+	ResultVector results;
+	mMutex.lock();
+	{
+		EntryItr itr = mEntries.find(mac.handle);
+		if(itr != mEntries.end()) {
+			Entry& e(itr->second);
+			if(e.registered)
+				epoll_ctl(mEpoll, EPOLL_CTL_DEL, e.fd, NULL);
+			finishAll(e, CONNERR_CANCELED, results);
+			mEntries.erase(itr);
+
+			//report any that are queued too, so that MAConn::close()
+			//needn't wait for the reactor thread.
+			results.insert(results.end(), mDone.begin(), mDone.end());
+			mDone.clear();
+		}
+	}
+	mMutex.unlock();
+	report(results);
+}
+
+//*****************************************************************************
+//Helpers. mMutex must be held.
+//*****************************************************************************
+
+NetReactor::Entry& NetReactor::entry(MAStreamConn& mac) {
+	EntryItr itr = mEntries.find(mac.handle);
+	if(itr != mEntries.end())
+		return itr->second;
+	Entry& e(mEntries[mac.handle]);
+	memset(&e, 0, sizeof(e));
+	e.mac = &mac;
+	e.fd = INVALID_SOCKET;
+	return e;
+}
+
+// Returns false, and fails all pending operations, if the socket can't be
+// registered.
+bool NetReactor::registerSocket(Entry& e, ResultVector& results) {
+	if(e.registered)
+		return true;
+	//the socket may have been connected by the ThreadPool, in blocking mode.
+	e.fd = e.mac->tcp->socket();
+	if(e.fd != INVALID_SOCKET && MASocketSetNonBlocking(e.fd)) {
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		ev.data.u64 = e.mac->handle;
+		if(epoll_ctl(mEpoll, EPOLL_CTL_ADD, e.fd, &ev) == 0) {
+			e.registered = true;
+			return true;
+		}
+	}
+	LOG("NetReactor: could not register socket %i: %i\n", e.fd, errno);
+	finishAll(e, CONNERR_GENERIC, results);
+	return false;
+}
+
+void NetReactor::doRead(Entry& e, ResultVector& results) {
+	int res = recv(e.fd, e.read.buf, e.read.size, 0);
+	if(res > 0) {
+		finish(e.read, e.mac, CONNOP_READ, res, results);
+	} else if(res == 0) {
+		finish(e.read, e.mac, CONNOP_READ, CONNERR_CLOSED, results);
+	} else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		LOG("NetReactor: recv failed. error code: %i\n", errno);
+		finish(e.read, e.mac, CONNOP_READ, CONNERR_GENERIC, results);
+	}
+}
+
+void NetReactor::doWrite(Entry& e, ResultVector& results) {
+	Op& op(e.write);
+	while(op.pos < op.size) {
+		int res = send(e.fd, op.buf + op.pos, op.size - op.pos, MSG_NOSIGNAL);
+		if(res < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if(errno == EINTR)
+				continue;
+			LOG("NetReactor: send failed. error code: %i\n", errno);
+			finish(op, e.mac, CONNOP_WRITE, CONNERR_GENERIC, results);
+			return;
+		}
+		op.pos += res;
+	}
+	finish(op, e.mac, CONNOP_WRITE, 1, results);
+}
+
+void NetReactor::finish(Op& op, MAStreamConn* mac, int opcode, int result,
+	ResultVector& results)
+{
+	Result r = { mac, opcode, result, op.data, op.handle };
+	results.push_back(r);
+	delete[] op.temp;
+	op.temp = NULL;
+	op.active = false;
+}
+
+void NetReactor::finishAll(Entry& e, int result, ResultVector& results) {
+	if(e.connecting) {
+		e.connecting = false;
+		Result r = { e.mac, CONNOP_CONNECT, result, NULL, 0 };
+		results.push_back(r);
+	}
+	if(e.read.active)
+		finish(e.read, e.mac, CONNOP_READ, result, results);
+	if(e.write.active)
+		finish(e.write, e.mac, CONNOP_WRITE, result, results);
+}
+
+void NetReactor::wake() {
+	uint64_t one = 1;
+	if(::write(mWake, &one, sizeof(one)) != sizeof(one)) {
+		LOG("NetReactor: wake failed: %i\n", errno);
+	}
+}
+
+// mMutex must NOT be held.
+void NetReactor::report(const ResultVector& results) {
+	for(size_t i=0; i<results.size(); i++) {
+		const Result& r(results[i]);
+		if(r.data)
+			DefluxBinPushEvent(r.handle, *r.data);
+		ConnOp::handleResult(*r.mac, r.opcode, r.result);
+	}
+}
+
+//*****************************************************************************
+//Reactor thread
+//*****************************************************************************
+
+int NetReactor::homeRun(void* data) {
+	((NetReactor*)data)->run();
+	return 0;
+}
+
+void NetReactor::run() {
+	epoll_event events[CONN_MAX + 1];
+	ResultVector results;
+	bool quit = false;
+	while(!quit) {
+		int n = epoll_wait(mEpoll, events, CONN_MAX + 1, -1);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			LOG("epoll_wait failed: %i\n", errno);
+			DEBIG_PHAT_ERROR;
+		}
+
+		mMutex.lock();
+		for(int i=0; i<n; i++) {
+			if(events[i].data.u64 == WAKE_KEY) {
+				uint64_t count;
+				if(::read(mWake, &count, sizeof(count)) != sizeof(count)) {
+					LOG("NetReactor: eventfd read failed: %i\n", errno);
+				}
+				continue;
+			}
+			//the connection may have been closed since epoll_wait returned.
+			//if its handle has been reused, the I/O will just find nothing to do.
+			EntryItr itr = mEntries.find((MAHandle)events[i].data.u64);
+			if(itr == mEntries.end())
+				continue;
+			Entry& e(itr->second);
+			if(e.connecting) {
+				if(!(events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+					continue;
+				e.connecting = false;
+				Result r = { e.mac, CONNOP_CONNECT, e.mac->tcp->connectFinish(), NULL, 0 };
+				results.push_back(r);
+			}
+			if(e.read.active)
+				doRead(e, results);
+			if(e.write.active)
+				doWrite(e, results);
+		}
+		results.insert(results.end(), mDone.begin(), mDone.end());
+		mDone.clear();
+		quit = mQuit;
+		mMutex.unlock();
+
+		report(results);
+		results.clear();
+	}
+}
+
+//*****************************************************************************
+//Interface
+//*****************************************************************************
+
+static NetReactor* sReactor = NULL;
+
+void NetReactorInit() {
+	DEBUG_ASSERT(sReactor == NULL);
+	sReactor = new NetReactor;
+}
+
+void NetReactorClose() {
+	SAFE_DELETE(sReactor);
+}
+
+bool NetReactorConnect(MAStreamConn& mac) {
+	return sReactor->connect(mac);
+}
+
+void NetReactorRead(MAStreamConn& mac, void* dst, int size, MemStream* data,
+	MAHandle handle)
+{
+	sReactor->read(mac, dst, size, data, handle);
+}
+
+void NetReactorWrite(MAStreamConn& mac, const void* src, int size, Stream* data,
+	MAHandle handle, byte* temp)
+{
+	sReactor->write(mac, src, size, data, handle, temp);
+}
+
+void NetReactorCancel(MAConn& mac) {
+	sReactor->cancel(mac);
+}
+
+#endif	//HAVE_EPOLL
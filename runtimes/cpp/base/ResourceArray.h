@@ -23,6 +23,7 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include <helpers/CPP_IX_RESOURCE_TYPES.h>
 
 #include "base_errors.h"
+#include "Stream.h"
 using namespace MoSyncError;
 
 // platform specific
@@ -68,6 +69,9 @@ namespace Base {
 
 #define ROOM(func) if((func) == RES_OUT_OF_MEMORY) { BIG_PHAT_ERROR(ERR_RES_OOM); }
 
+	//Decodes the data of a lazy resource. Returns NULL on failure.
+	typedef void* (*LazyDecoder)(byte type, Stream& src);
+
 	//Internally, "resource" and "object" are used interchangably.
 	class ResourceArray {	//type and bound-safe
 	public:
@@ -75,7 +79,7 @@ namespace Base {
 #ifdef RESOURCE_MEMORY_LIMIT
 			uint resMax
 #endif
-			) : mN(0), mRes(NULL), mTypes(NULL), 
+			) : mN(0), mRes(NULL), mTypes(NULL), mLazy(NULL), mLazyClock(0), mLazySafeClock(0), mLazyDecoder(NULL),
 #ifdef RESOURCE_MEMORY_LIMIT
 			mResmemMax(resMax),
 			mResmem(0),
@@ -99,6 +103,14 @@ namespace Base {
 				delete[] oldRes;
 				delete[] oldTypes;
 			}
+			if(mLazy) {
+				LazyResource* oldLazy = mLazy;
+				mLazy = new LazyResource[mN];
+				MYASSERT(mLazy != NULL, ERR_OOM);
+				memcpy(mLazy, oldLazy, oldN*sizeof(LazyResource));
+				memset(&mLazy[oldN], 0, (mN - oldN) * sizeof(LazyResource));
+				delete[] oldLazy;
+			}
 			if(mN > oldN) { //clear the new objects
 				//pointer arithmetic bug
 				//memset(mRes + oldN*sizeof(void*), 0, (mN - oldN)*sizeof(void*));
@@ -117,6 +129,7 @@ namespace Base {
 			}
 			delete[] mRes;
 			delete[] mTypes;
+			delete[] mLazy;
 			
 			for(unsigned i=1; i<dynResSize; i++) {
 				LOGD("DA %i\n", i);
@@ -190,6 +203,94 @@ namespace Base {
 		uint getResmemMax() const { return mResmemMax; }
 		uint getResmem() const { return mResmem; }
 #endif
+
+		//**************************************************************************
+		// lazy resources
+		//**************************************************************************
+		// A lazy resource is added as its undecoded data, and decoded by the
+		// LazyDecoder on the first get(). Decoded lazy resources that haven't
+		// been used recently are evicted when resource memory runs out,
+		// and decoded again when they are needed.
+		// The caller of get() may hold on to the pointer until it reaches a
+		// safe point and calls releaseLazy(), which the core does after each
+		// syscall. Lazy resources fetched since then are never evicted.
+		// Only static resources can be lazy. A lazy resource that is extracted
+		// becomes an ordinary resource, since its owner may modify it.
+
+		enum LazyState {
+			LAZY_NONE,	//not a lazy resource
+			LAZY_ENCODED,	//not decoded, or evicted
+			LAZY_DECODED
+		};
+
+		void setLazyDecoder(LazyDecoder decoder) {
+			mLazyDecoder = decoder;
+		}
+
+		//deletes any existing resource at index. takes ownership of src.
+		int dadd_lazy(unsigned index, byte type, Stream* src) {
+			TESTINDEX(index, mN);
+			DEBUG_ASSERT(mLazyDecoder != NULL);
+			if(mRes[index] != NULL || isLazy(index)) {
+				_destroy(index);
+			}
+			if(mTypes[index] != RT_PLACEHOLDER) {
+				BIG_PHAT_ERROR(ERR_RES_OVERWRITE);
+			}
+			if(!mLazy) {
+				mLazy = new LazyResource[mN];
+				MYASSERT(mLazy != NULL, ERR_OOM);
+				memset(mLazy, 0, mN * sizeof(LazyResource));
+			}
+			mLazy[index].src = src;
+			mLazy[index].lastUse = 0;
+			mTypes[index] = type;
+			return RES_OK;
+		}
+
+		//Lets the lazy resources fetched so far be evicted again.
+		void releaseLazy() {
+			mLazySafeClock = mLazyClock;
+		}
+
+		LazyState get_lazy_state(unsigned index) {
+			if((index & DYNAMIC_PLACEHOLDER_BIT) || !isLazy(index))
+				return LAZY_NONE;
+			return mRes[index] ? LAZY_DECODED : LAZY_ENCODED;
+		}
+
+		//Evicts decoded lazy resources, least recently used first, until
+		//at least 'needed' bytes of resource memory are free or none are left
+		//that were released by releaseLazy().
+		//Returns the number of resources evicted.
+		int evictLazy(uint needed, unsigned keep = 0) {
+			int count = 0;
+			while(true) {
+#ifdef RESOURCE_MEMORY_LIMIT
+				if(mResmem + needed < mResmemMax)
+					break;
+#endif
+				unsigned oldest = 0;
+				for(unsigned i=1; mLazy && i<mN; i++) {
+					if(i != keep && mLazy[i].src && mRes[i] &&
+						mLazy[i].lastUse <= mLazySafeClock &&
+						(oldest == 0 || mLazy[i].lastUse < mLazy[oldest].lastUse))
+					{
+						oldest = i;
+					}
+				}
+				if(oldest == 0)
+					break;
+				LOGD("Evicting lazy resource %i\n", oldest);
+#ifdef RESOURCE_MEMORY_LIMIT
+				subResmem(mRes[oldest], mTypes[oldest]);
+#endif
+				__destroy(mRes[oldest], mTypes[oldest], oldest);
+				mRes[oldest] = NULL;
+				count++;
+			}
+			return count;
+		}
 		
 		void logEverything() {
 #define RESOURCE_STRINGS(R, T, D) resourceStrings[R] = #R;
@@ -233,7 +334,7 @@ namespace Base {
 				return _add(index, o, type);
 			} else {
 				TESTINDEX(index, mN);
-				if(mRes[index] != NULL) {
+				if(mRes[index] != NULL || isLazy(index)) {
 					_destroy(index);
 				}
 				return _add(index, o, type);
@@ -277,6 +378,9 @@ namespace Base {
 #define CASE_ADDMEM(R, T, D) case R: mResmem += size_##R((T*)o); break;
 				TYPES(CASE_ADDMEM);
 			}
+			if(mResmem >= mResmemMax) {
+				evictLazy(0, index);
+			}
 			if(mResmem >= mResmemMax) {
 				//BIG_PHAT_ERROR(ERR_RES_OOM);
 				mResmem = oldResmem;
@@ -304,9 +408,54 @@ namespace Base {
 			if(types[index] != R) {
 				BIG_PHAT_ERROR(ERR_RES_INVALID_TYPE);
 			}
+			if(res == mRes && isLazy(index)) {
+				mLazy[index].lastUse = ++mLazyClock;
+				if(res[index] == NULL)
+					_decodeLazy(index);
+			}
 			return res[index];
 		}
 
+		bool isLazy(unsigned index) const {
+			return mLazy != NULL && mLazy[index].src != NULL;
+		}
+
+		void _decodeLazy(unsigned index) {
+			LOGD("Decoding lazy resource %i\n", index);
+			Stream& src(*mLazy[index].src);
+			MYASSERT(src.seek(Seek::Start, 0), ERR_RES_FILE_INCONSISTENT);
+			void* o = mLazyDecoder(mTypes[index], src);
+			MYASSERT(o != NULL, ERR_RES_FILE_INCONSISTENT);
+#ifdef RESOURCE_MEMORY_LIMIT
+			switch(mTypes[index]) {
+#define CASE_ADDMEM_LAZY(R, T, D) case R: mResmem += size_##R((T*)o); break;
+				TYPES(CASE_ADDMEM_LAZY);
+			}
+			if(mResmem >= mResmemMax) {
+				evictLazy(0, index);
+			}
+			if(mResmem >= mResmemMax) {
+				BIG_PHAT_ERROR(ERR_RES_OOM);
+			}
+#endif
+			mRes[index] = o;
+		}
+
+#ifdef RESOURCE_MEMORY_LIMIT
+		void subResmem(void* o, byte type) {
+			switch(type) {
+#define CASE_SUBMEM_LAZY(R, T, D) case R: mResmem -= size_##R((T*)o); break;
+				TYPES(CASE_SUBMEM_LAZY);
+			}
+		}
+#endif
+
+		//deletes the undecoded data of a lazy resource, making it an ordinary one.
+		void _dropLazy(unsigned index) {
+			delete mLazy[index].src;
+			mLazy[index].src = NULL;
+		}
+
 		void* _extract(unsigned index, byte R) {
 			void **res = mRes;
 			byte *types = mTypes;
@@ -322,6 +471,11 @@ namespace Base {
 			if(types[index] != R) {
 				BIG_PHAT_ERROR(ERR_RES_INVALID_TYPE);
 			}
+			if(res == mRes && isLazy(index)) {
+				if(res[index] == NULL)
+					_decodeLazy(index);
+				_dropLazy(index);
+			}
 
 #ifdef RESOURCE_MEMORY_LIMIT
 			switch(types[index]) {
@@ -361,6 +515,14 @@ namespace Base {
 
 			MYASSERT(types[index] != RT_FLUX, ERR_RES_DESTROY_FLUX);
 
+			if(res == mRes && isLazy(index)) {
+				_dropLazy(index);
+				if(res[index] == NULL) {	//never decoded, or evicted
+					types[index] = RT_PLACEHOLDER;
+					return;
+				}
+			}
+
 #ifdef RESOURCE_MEMORY_LIMIT
 			switch(types[index]) {
 #define CASE_SUBMEM(R, T, D) case R: mResmem -= size_##R((T*)res[index]); break;
@@ -381,6 +543,15 @@ namespace Base {
 		void** mRes;
 		byte* mTypes;
 
+		struct LazyResource {
+			Stream* src;	//NULL if the resource isn't lazy
+			uint lastUse;
+		};
+		LazyResource* mLazy;	//NULL until the first lazy resource is added
+		uint mLazyClock;
+		uint mLazySafeClock;	//mLazyClock at the last releaseLazy()
+		LazyDecoder mLazyDecoder;
+
 #ifdef RESOURCE_MEMORY_LIMIT
 		const uint mResmemMax;
 		uint mResmem;
@@ -93,6 +93,12 @@ namespace Base {
 		//Must be [deleted].
 		virtual Stream* createCopy() const = 0;
 
+		//supported only by memory-mapped files.
+		//Creates a writable view of this stream's memory, with the current position as
+		//the view's starting point and the specified size. The view stays valid after
+		//this stream is deleted. Returns NULL if unsupported.
+		virtual Stream* createView(int /*size*/) { return NULL; }
+
 		virtual ~Stream() {}
 	};
 
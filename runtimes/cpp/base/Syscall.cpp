@@ -147,6 +147,21 @@ namespace Base {
 		platformDestruct();
 	}
 
+#ifndef _android
+	//decodes the lazy resources added by loadResources().
+	void* Syscall::decodeLazyResource(byte type, Stream& src) {
+		DEBUG_ASSERT(type == RT_IMAGE);
+		int size;
+		TEST(src.length(size));
+		MemStream b(size);
+		TEST(src.readFully(b));
+		RT_IMAGE_Type* image = gSyscall->loadImage(b);
+		if(!image)
+			BIG_PHAT_ERROR(ERR_IMAGE_LOAD_FAILED);
+		return image;
+	}
+#endif
+
 	bool Syscall::loadResources(Stream& file, const char* aFilename)  {
 		bool hasResources = true;
 		if(!file.isOpen())
@@ -172,6 +187,9 @@ namespace Base {
 		DAR_UVINT(nResources);
 		DAR_UVINT(rSize);
 		resources.init(nResources);
+#ifndef _android
+		resources.setLazyDecoder(decodeLazyResource);
+#endif
 
 		// rI is the resource index.
 		int rI = 1;
@@ -190,6 +208,13 @@ namespace Base {
 			case RT_BINARY:
 				{
 #ifndef _android
+					//memory-mapped resource files are referenced in place.
+					Stream* view = file.createView(size);
+					if(view) {
+						ROOM(resources.dadd_RT_BINARY(rI, view));
+						TEST(file.seek(Seek::Current, size));
+						break;
+					}
 					MemStream* ms = new MemStream(size);
 #else
 					char* b = loadBinary(rI, size);
@@ -229,17 +254,23 @@ namespace Base {
 				break;
 			case RT_IMAGE:
 				{
-					MemStream b(size);
-					TEST(file.readFully(b));
 #ifndef _android
-					// On all platforms except Android, we load and add
-					// the image data. "dadd" means "delete and add",
+					// On all platforms except Android, we add the image data,
+					// to be decoded on first use by decodeLazyResource().
+					// "dadd" means "delete and add",
 					// and is defined in runtimes\cpp\base\ResourceArray.h
-                    RT_IMAGE_Type* image = loadImage(b);
-                    if(!image)
-                        BIG_PHAT_ERROR(ERR_IMAGE_LOAD_FAILED);
-					ROOM(resources.dadd_RT_IMAGE(rI, image));
+					Stream* src = file.createView(size);
+					if(src) {
+						TEST(file.seek(Seek::Current, size));
+					} else {
+						MemStream* ms = new MemStream(size);
+						TEST(file.readFully(*ms));
+						src = ms;
+					}
+					ROOM(resources.dadd_lazy(rI, RT_IMAGE, src));
 #else
+					MemStream b(size);
+					TEST(file.readFully(b));
 					// On Android images are stored on the Java side.
 					// Here we allocate a dummy array (real image is
 					// in a table in Java) so that the resource handling,
@@ -267,8 +298,11 @@ namespace Base {
 					DAR_SHORT(cx);
 					DAR_SHORT(cy);
 #ifndef _android
-					ROOM(resources.dadd_RT_IMAGE(rI, loadSprite(resources.get_RT_IMAGE(indexSource),
-						left, top, width, height, cx, cy)));
+					RT_IMAGE_Type* sprite = loadSprite(resources.get_RT_IMAGE(indexSource),
+						left, top, width, height, cx, cy);
+					// loadSprite() copies the pixels, so the source may be evicted.
+					resources.releaseLazy();
+					ROOM(resources.dadd_RT_IMAGE(rI, sprite));
 #endif
 				}
 				break;
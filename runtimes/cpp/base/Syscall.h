@@ -48,6 +48,9 @@ namespace Base {
 
 	public:
 		bool loadResources(Stream& file, const char* aFilename);
+#ifndef _android
+		static void* decodeLazyResource(byte type, Stream& src);
+#endif
 
 		void init();
 		virtual ~Syscall();
@@ -26,18 +26,13 @@ using namespace MoSyncError;
 
 class WorkerThread {
 public:
-	WorkerThread();
-	~WorkerThread();
+	WorkerThread(ThreadPool& pool);
 
-	bool isAvailable();
-	void start(Runnable* r);
+	void join() { mThread.join(); }
 private:
+	ThreadPool& mPool;
 	MoSyncThread mThread;
-	MoSyncSemaphore mSem;
-	Runnable* mR;
-	bool mQuit;
 
-	void run();
 	static int homeRun(void*);
 };
 
@@ -47,34 +42,145 @@ Runnable::~Runnable() {}
 //ThreadPool
 //*****************************************************************************
 
+ThreadPool::ThreadPool(int maxThreads, int idleTimeout)
+: mMaxThreads(maxThreads), mIdleTimeout(idleTimeout), mIdle(0), mQuit(false)
+{
+	DEBUG_ASSERT(maxThreads > 0);
+	memset(&mStats, 0, sizeof(mStats));
+	mMutex.init();
+}
+
 void ThreadPool::execute(Runnable* r) {
-	WorkerThread* wt = NULL;
-	for(uint i=0; i<mThreads.size(); i++) {
-		WorkerThread* temp = mThreads[i];
-		if(temp->isAvailable()) {
-			wt = temp;
-			break;
+	Task t = { r, MoSyncThread::getTicks() };
+	mMutex.lock();
+	DEBUG_ASSERT(!mQuit);
+	mQueue.push_back(t);
+	if((int)mQueue.size() > mStats.peakQueued)
+		mStats.peakQueued = mQueue.size();
+	//start another thread only if the idle ones can't take all the queued work.
+	//a new thread counts as idle until it has taken a Task.
+	if((int)mQueue.size() > mIdle && (int)mThreads.size() < mMaxThreads) {
+		mThreads.push_back(new WorkerThread(*this));
+		mIdle++;
+		mStats.threadsStarted++;
+		if((int)mThreads.size() > mStats.peakThreads)
+			mStats.peakThreads = mThreads.size();
+	}
+	mMutex.unlock();
+	mWork.post();
+
+	joinExited();
+}
+
+void ThreadPool::workerRun(WorkerThread* wt) {
+	while(true) {
+		bool woken = mWork.tryWait(mIdleTimeout);
+		mMutex.lock();
+		mIdle--;
+		if(!woken) {
+			//exit, unless the other idle threads can't take all the queued work.
+			//close() relies on the thread count not changing once mQuit is set.
+			if(!mQuit && (int)mQueue.size() <= mIdle) {
+				for(size_t i=0; i<mThreads.size(); i++) {
+					if(mThreads[i] == wt) {
+						mThreads.erase(mThreads.begin() + i);
+						break;
+					}
+				}
+				mExited.push_back(wt);
+				mStats.threadsReaped++;
+				mMutex.unlock();
+				return;
+			}
+			mIdle++;
+			mMutex.unlock();
+			continue;
 		}
+		if(mQueue.empty()) {	//posted by close()
+			DEBUG_ASSERT(mQuit);
+			mMutex.unlock();
+			return;
+		}
+		Task t = mQueue.front();
+		mQueue.pop_front();
+		mMutex.unlock();
+
+		int start = MoSyncThread::getTicks();
+		LOGD("WTrun\n");
+		t.r->run();
+		LOGD("WTend\n");
+		delete t.r;
+		int end = MoSyncThread::getTicks();
+
+		mMutex.lock();
+		int wait = start - t.queueTime;
+		int run = end - start;
+		mStats.completed++;
+		mStats.totalWait += wait;
+		if(wait > mStats.maxWait)
+			mStats.maxWait = wait;
+		mStats.totalRun += run;
+		if(run > mStats.maxRun)
+			mStats.maxRun = run;
+		mIdle++;
+		mMutex.unlock();
 	}
-	if(wt == NULL) {	//no available threads; we must make another.
-		wt = new WorkerThread();
-		mThreads.push_back(wt);
+}
+
+//joins threads that have exited on their own.
+//must not be called by a WorkerThread.
+void ThreadPool::joinExited() {
+	std::vector<WorkerThread*> exited;
+	mMutex.lock();
+	exited.swap(mExited);
+	mMutex.unlock();
+	for(size_t i=0; i<exited.size(); i++) {
+		exited[i]->join();
+		delete exited[i];
 	}
-	wt->start(r);
+}
+
+ThreadPool::Stats ThreadPool::getStats() {
+	mMutex.lock();
+	Stats s = mStats;
+	s.threads = mThreads.size();
+	s.idleThreads = mIdle;
+	s.queued = mQueue.size();
+	mMutex.unlock();
+	return s;
 }
 
 //this will wait for all outstanding operations to complete. not so useful.
 void ThreadPool::close() {
-	LOGD("Closing %i threads.\n", mThreads.size());
-	for(uint i=0; i<mThreads.size(); i++) {
-		WorkerThread* wt = mThreads[i];
-		delete wt;
+	mMutex.lock();
+	mQuit = true;
+	std::vector<WorkerThread*> threads;
+	threads.swap(mThreads);
+	mMutex.unlock();
+
+	LOGD("Closing %i threads.\n", threads.size());
+	for(size_t i=0; i<threads.size(); i++) {
+		mWork.post();
 	}
-	mThreads.clear();
+	for(size_t i=0; i<threads.size(); i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+	joinExited();
+	DEBUG_ASSERT(mQueue.empty());
+	DEBUG_ASSERT(mIdle == 0);
+
+	LOGD("ThreadPool: %i started, %i reaped, peak %i threads, peak %i queued.\n",
+		mStats.threadsStarted, mStats.threadsReaped, mStats.peakThreads, mStats.peakQueued);
+	LOGD("ThreadPool: %i completed. wait: %i ms total, %i max. run: %i ms total, %i max.\n",
+		mStats.completed, mStats.totalWait, mStats.maxWait, mStats.totalRun, mStats.maxRun);
+
+	mQuit = false;
 }
 
 ThreadPool::~ThreadPool() {
 	DEBUG_ASSERT(mThreads.size() == 0);	//make sure it's closed
+	mMutex.close();
 }
 
 //*****************************************************************************
@@ -85,46 +191,12 @@ ThreadPool::~ThreadPool() {
 #pragma warning(disable:4355)
 #endif
 
-WorkerThread::WorkerThread() : mR(NULL), mQuit(false) {
+WorkerThread::WorkerThread(ThreadPool& pool) : mPool(pool) {
 	mThread.start(homeRun, this);
 }
 
-bool WorkerThread::isAvailable() {
-	return mR == NULL;
-}
-
-void WorkerThread::start(Runnable* r) {
-	//LOG("wtStart\n");
-	DEBUG_ASSERT(isAvailable());
-	mR = r;
-	mSem.post();
-}
-
-WorkerThread::~WorkerThread() {
-	mQuit = true;
-	mSem.post();
-	mThread.join();
-}
-
 int WorkerThread::homeRun(void* data) {
 	WorkerThread* wt = (WorkerThread*)data;
-	//LOGT("homeRun. Quit: 0x%x  mr:0x%x", wt->mQuit, wt->mR);
-	wt->run();
+	wt->mPool.workerRun(wt);
 	return 0;
 }
-
-void WorkerThread::run() {
-	while(!mQuit) {
-		do {
-			mSem.wait();
-			if(mQuit)
-				return;
-		} while(mR == NULL);
-
-		LOGD("WTrun\n");
-		mR->run();
-		LOGD("WTend\n");
-		delete mR;
-		mR = NULL;
-	}
-}
@@ -19,7 +19,9 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #define THREADPOOL_H
 
 #include <vector>
+#include <deque>
 #include "ThreadPoolImpl.h"
+#include "netImpl.h"	//MoSyncMutex
 
 class Runnable {
 public:
@@ -31,15 +33,59 @@ class WorkerThread;
 
 class ThreadPool {
 public:
+	enum {
+		DEFAULT_MAX_THREADS = 16,
+		DEFAULT_IDLE_TIMEOUT = 10000
+	};
+
+	/// At most \a maxThreads Runnables run at once. The rest wait in a queue.
+	/// Worker threads exit after \a idleTimeout milliseconds without work.
+	///
+	/// Runnables that block until another Runnable in the same pool has run
+	/// will deadlock if \a maxThreads is too low.
+	ThreadPool(int maxThreads = DEFAULT_MAX_THREADS, int idleTimeout = DEFAULT_IDLE_TIMEOUT);
 	~ThreadPool();
 
 	/// In a separate thread: calls Runnable::run(), then deletes \a r.
+	/// Runnables are started in the order they are passed.
+	/// Thread-safe.
 	void execute(Runnable* r);
 
 	/// Waits until all Runnables passed to execute() has completed.
 	void close();
+
+	struct Stats {
+		int threads, idleThreads, peakThreads;
+		int threadsStarted, threadsReaped;
+		int queued, peakQueued;	//Runnables waiting for a thread
+		int completed;	//Runnables that have finished
+		int totalWait, maxWait;	//milliseconds between execute() and run()
+		int totalRun, maxRun;	//milliseconds spent in run()
+	};
+
+	/// Thread-safe.
+	Stats getStats();
+
 private:
+	friend class WorkerThread;
+
+	struct Task {
+		Runnable* r;
+		int queueTime;
+	};
+
+	const int mMaxThreads, mIdleTimeout;
+	MoSyncMutex mMutex;
+	MoSyncSemaphore mWork;	//posted once per queued Task, and once per thread on close().
+	std::deque<Task> mQueue;
 	std::vector<WorkerThread*> mThreads;
+	std::vector<WorkerThread*> mExited;	//reaped, but not yet joined.
+	int mIdle;	//threads waiting on mWork.
+	bool mQuit;
+	Stats mStats;
+
+	void workerRun(WorkerThread* wt);
+	void joinExited();
 };
 
 #endif	//THREADPOOL_H
@@ -41,10 +41,14 @@ MoSyncMutex* gpConnMutex = NULL;
 void MANetworkInit() {
 	gConnNextHandle = 1;
 	gpConnMutex = new MoSyncMutex;
-	gpThreadPool = new ThreadPool;
+	//each connection blocks at most one read and one write at a time.
+	gpThreadPool = new ThreadPool(CONN_MAX * 2);
 	gpConnections = new ConnMap;
 	gConnMutex.init();
 	MANetworkSslInit();
+#ifdef HAVE_EPOLL
+	NetReactorInit();
+#endif
 }
 
 void MANetworkReset() {
@@ -63,6 +67,9 @@ void MANetworkClose() {
 	MANetworkReset();
 	MANetworkSslClose();
 
+#ifdef HAVE_EPOLL
+	NetReactorClose();
+#endif
 	gThreadPool.close();
 	gConnMutex.close();
 	SAFE_DELETE(gpConnections);
@@ -410,6 +417,7 @@ SYSCALL(MAHandle, maConnect(const char* url)) {
 	if(gConnections.size() >= CONN_MAX)
 		return CONNERR_MAX;
 	Connection* conn;
+	TcpConnection* tcp = NULL;
 	if(sstrcmp(url, http_string) == 0) {
 		const char* parturl = url + sizeof(http_string) - 1;
 		TLTZ_PASS(httpCreateFinishingGetConnection(parturl, conn, false));
@@ -426,6 +434,7 @@ SYSCALL(MAHandle, maConnect(const char* url)) {
 		//extract address and port
 		const char* parturl = url + sizeof(socket_string) - 1;
 		TLTZ_PASS(createSocketConnection(parturl, conn, false));
+		tcp = (TcpConnection*)conn;
 	} else if(sstrcmp(url, ssl_string) == 0) {
 		const char* parturl = url + sizeof(ssl_string) - 1;
 		TLTZ_PASS(createSocketConnection(parturl, conn, true));
@@ -526,9 +535,12 @@ SYSCALL(MAHandle, maConnect(const char* url)) {
 	int result;
 	gConnMutex.lock();
 	{
-		MAStreamConn* mac = new MAStreamConn(gConnNextHandle, conn);
+		MAStreamConn* mac = new MAStreamConn(gConnNextHandle, conn, tcp);
 		gConnections.insert(ConnPair(gConnNextHandle, mac));
 		mac->state = CONNOP_CONNECT;
+#ifdef HAVE_EPOLL
+		if(!tcp || !NetReactorConnect(*mac))
+#endif
 		gThreadPool.execute(new Connect(*mac));
 		result = gConnNextHandle++;
 	}
@@ -539,6 +551,9 @@ SYSCALL(MAHandle, maConnect(const char* url)) {
 SYSCALL(void, maConnClose(MAHandle conn)) {
 	LOGST("ConnClose %i", conn);
 	MAConn& mac = getConn(conn);
+#ifdef HAVE_EPOLL
+	NetReactorCancel(mac);
+#endif
 	mac.close();	//may take too long
 	delete &mac;
 	gConnMutex.lock();
@@ -582,6 +597,12 @@ SYSCALL(void, maConnRead(MAHandle conn, void* dst, int size)) {
 	MAStreamConn& mac = getStreamConn(conn);
 	MYASSERT((mac.state & CONNOP_READ) == 0, ERR_CONN_ALREADY_READING);
 	mac.state |= CONNOP_READ;
+#ifdef HAVE_EPOLL
+	if(mac.tcp) {
+		NetReactorRead(mac, dst, size);
+		return;
+	}
+#endif
 	gThreadPool.execute(new ConnRead(mac, dst, size));
 }
 
@@ -591,6 +612,12 @@ SYSCALL(void, maConnWrite(MAHandle conn, const void* src, int size)) {
 	MAStreamConn& mac = getStreamConn(conn);
 	MYASSERT((mac.state & CONNOP_WRITE) == 0, ERR_CONN_ALREADY_WRITING);
 	mac.state |= CONNOP_WRITE;
+#ifdef HAVE_EPOLL
+	if(mac.tcp) {
+		NetReactorWrite(mac, src, size);
+		return;
+	}
+#endif
 	gThreadPool.execute(new ConnWrite(mac, src, size));
 }
 
@@ -613,6 +640,12 @@ SYSCALL(void, maConnReadToData(MAHandle conn, MAHandle data, int offset, int siz
 	}
 
 	mac.state |= CONNOP_READ;
+#ifdef HAVE_EPOLL
+	if(mac.tcp) {
+		NetReactorRead(mac, (byte*)stream.ptr() + offset, size, (MemStream*)&stream, data);
+		return;
+	}
+#endif
 	gThreadPool.execute(new ConnReadToData(mac, (MemStream&)stream, data, offset, size));
 }
 
@@ -634,6 +667,24 @@ SYSCALL(void, maConnWriteFromData(MAHandle conn, MAHandle data, int offset, int
 	}
 
 	mac.state |= CONNOP_WRITE;
+#ifdef HAVE_EPOLL
+	if(mac.tcp) {
+		if(stream.ptrc() != NULL) {
+			NetReactorWrite(mac, (byte*)stream.ptrc() + offset, size, &stream, data);
+		} else {
+			byte* temp = new byte[size];
+			if(!stream.read(temp, size)) {
+				LOG("Stream error in ConnWriteFromData!\n");
+				delete[] temp;
+				DefluxBinPushEvent(data, stream);
+				ConnOp::handleResult(mac, CONNOP_WRITE, CONNERR_GENERIC);
+			} else {
+				NetReactorWrite(mac, temp, size, &stream, data, temp);
+			}
+		}
+		return;
+	}
+#endif
 	gThreadPool.execute(new ConnWriteFromData(mac, stream, data, offset, size));
 }
 
@@ -70,6 +70,24 @@ extern ConnMap* gpConnections;
 
 extern int gConnNextHandle;
 
+#ifdef HAVE_EPOLL
+//Event-driven operations on plain TCP connections, run by a single thread.
+//See NetReactor.cpp.
+struct MAStreamConn;
+void NetReactorInit();
+void NetReactorClose();
+//Returns false if the connection can't be made without blocking.
+//The caller should then run it in the ThreadPool.
+bool NetReactorConnect(MAStreamConn& mac);
+void NetReactorRead(MAStreamConn& mac, void* dst, int size,
+	MemStream* data = NULL, MAHandle handle = 0);
+void NetReactorWrite(MAStreamConn& mac, const void* src, int size,
+	Stream* data = NULL, MAHandle handle = 0, byte* temp = NULL);
+//Cancels all operations the reactor has pending on the connection.
+//Call before MAConn::close().
+void NetReactorCancel(MAConn& mac);
+#endif
+
 //***************************************************************************
 //Glue classes, MAConn
 //***************************************************************************
@@ -111,8 +129,10 @@ struct MAConn {
 };
 
 struct MAStreamConn : public MAConn {
-	MAStreamConn(MAHandle h, Connection* c) : MAConn(h, eStreamConn, c), conn(c) {}
+	MAStreamConn(MAHandle h, Connection* c, TcpConnection* t = NULL)
+		: MAConn(h, eStreamConn, c), conn(c), tcp(t) {}
 	Connection* conn;
+	TcpConnection* tcp;	//same as conn, if it is a plain TCP connection.
 };
 
 struct MAServerConn : public MAConn {
@@ -125,11 +145,8 @@ struct MAServerConn : public MAConn {
 //***************************************************************************
 
 class ConnOp : public Runnable {
-protected:
-	ConnOp(MAConn& m) : mac(m) {}
-	MAConn& mac;
-
-	void handleResult(int opcode, int result) {
+public:
+	static void handleResult(MAConn& mac, int opcode, int result) {
 		gConnMutex.lock();
 		{
 			LOGST("ConnOp::handleResult %i %i %i", mac.handle, opcode, result);
@@ -150,6 +167,13 @@ protected:
 		}
 		gConnMutex.unlock();
 	}
+protected:
+	ConnOp(MAConn& m) : mac(m) {}
+	MAConn& mac;
+
+	void handleResult(int opcode, int result) {
+		handleResult(mac, opcode, result);
+	}
 };
 
 class ConnStreamOp : public ConnOp {
@@ -34,11 +34,36 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include <helpers/maapi_defs.h>
 
 #include <base/FileStream.h>
+#include <helpers/smartie.h>
 
 #include "helpers/TranslateSyscall.h"
 //#undef LOGC
 //#define LOGC(...) do { if(InstCount > 8200000) LOG(__VA_ARGS__); } while(0)
 
+#ifdef USE_THREADED_CODE
+#ifndef __GNUC__
+#error USE_THREADED_CODE requires the GCC labels-as-values extension.
+#endif
+#if defined(CORE_DEBUGGING_MODE) || defined(GDB_DEBUG)
+#error USE_THREADED_CODE cannot be combined with CORE_DEBUGGING_MODE or GDB_DEBUG.
+#endif
+#if defined(USE_ARM_RECOMPILER) || defined(USE_X64_RECOMPILER)
+#error USE_THREADED_CODE cannot be combined with a recompiler.
+#endif
+#endif	//USE_THREADED_CODE
+
+#ifdef SAMPLING_PROFILING
+#ifndef FAKE_CALL_STACK
+#error SAMPLING_PROFILING requires FAKE_CALL_STACK.
+#endif
+#if defined(USE_ARM_RECOMPILER) || defined(USE_X64_RECOMPILER)
+#error SAMPLING_PROFILING cannot be combined with a recompiler.
+#endif
+#ifndef SAMPLING_INTERVAL
+#define SAMPLING_INTERVAL 1	//milliseconds
+#endif
+#endif	//SAMPLING_PROFILING
+
 #ifdef GDB_DEBUG
 #define UPDATE_IP
 /*
@@ -90,6 +115,8 @@ __inline void chrashTestDummy(const char* fmt, ...) {
 	chrashTestDummyV(fmt, argptr);
 }
 #endif	// 1
+#elif defined(USE_X64_RECOMPILER)
+#include "Recompiler/X64Recompiler.h"
 #endif	// USE_ARM_RECOMPILER
 
 #include "Core.h"
@@ -111,6 +138,12 @@ __inline void chrashTestDummy(const char* fmt, ...) {
 #include <vector>
 #endif
 
+#ifdef SAMPLING_PROFILING
+#include <map>
+#include <string>
+#include <base/ThreadPool.h>
+#endif
+
 namespace Core {
 
 using namespace Base;
@@ -323,16 +356,64 @@ public:
 
 #ifdef USE_ARM_RECOMPILER
 	MoSync::ArmRecompiler recompiler;
+#elif defined(USE_X64_RECOMPILER)
+	MoSync::X64Recompiler recompiler;
 #endif
 
 #ifdef MEMORY_DEBUG
 	int InstCount;
 #endif
 
+#ifdef COUNT_INSTRUCTIONS
+	uint mInstructionCount;
+#endif
+
 #ifdef INSTRUCTION_PROFILING
 	int* instruction_count;
 #endif
 
+#ifdef BLOCK_PROFILING
+	// Indexed by the code address that starts a block. A block runs from a
+	// jump target, or the instruction after a conditional branch, up to and
+	// including the next jump or conditional branch.
+	int* mBlockCount;
+	int* mBlockTaken;	//number of times the block ended with a jump
+	int* mBlockEnd;	//address after the last instruction
+	int mBlockStart;
+#endif
+
+#ifdef SAMPLING_PROFILING
+	// The sampler thread requests a sample every SAMPLING_INTERVAL ms.
+	// The VM thread takes it at the next jump, where the fake call stack
+	// is consistent, so the sampler never touches VM state.
+	MoSyncThread mSampler;
+	volatile bool mSampleRequested;
+	volatile bool mSamplerQuit;
+	bool mSamplerRunning;
+	typedef std::map<std::vector<int>, int> SampleMap;
+	SampleMap mSamples;	//call stack -> number of samples
+	std::vector<int> mSampleStack;
+#endif
+
+#ifdef USE_THREADED_CODE
+	// A predecoded instruction. Operands are fully resolved: imm holds the
+	// constant pool value, or the index of the target instruction for
+	// direct branches and calls. FAR prefixes are folded away.
+	struct ThreadedInstruction {
+		const void* handler;
+		int imm;
+		byte rd, rs;
+		byte padding[16 - sizeof(void*) - sizeof(int) - 2];
+	};
+
+	ThreadedInstruction* mThreadedCode;	//aligned to THREADED_CODE_ALIGNMENT
+	byte* mThreadedBuffer;
+	int* mThreadedIndex;	//code address -> instruction index
+	int* mThreadedAddress;	//instruction index -> code address
+	int mThreadedCount;	//mThreadedCode[mThreadedCount] traps illegal jumps
+	const void* const* mThreadedHandlers;
+#endif
+
 #ifdef FAKE_CALL_STACK
 	int* fakeCallStack;
 	int fakeCallStackDepth;	//measured in ints
@@ -602,6 +683,8 @@ public:
 #ifdef USE_ARM_RECOMPILER
 		//aIP = RunArm(aIP);
 		rIP = (byte*)recompiler.run((int)rIP);
+#elif defined(USE_X64_RECOMPILER)
+		rIP = mem_cs + recompiler.run(int(rIP - mem_cs));
 #else
 		rIP = Run(rIP);
 #endif
@@ -652,6 +735,28 @@ public:
 #ifndef MOBILEAUTHOR
 
 #ifndef _android
+#ifdef HAVE_MAPPED_FILES
+	//maps the file if possible, so resources can be referenced in place.
+	static Stream* openReadStream(const char* filename) {
+		Stream* s = new MappedFileStream(filename);
+		if(!s->isOpen()) {
+			delete s;
+			s = new FileStream(filename);
+		}
+		return s;
+	}
+
+	bool LoadVMApp(const char* modfile, const char* resfile) {
+		InitVM();
+
+		Smartie<Stream> mod(openReadStream(modfile));
+		if(!LoadVM(*mod))
+			return false;
+
+		Smartie<Stream> res(openReadStream(resfile));
+		if(!mSyscall.loadResources(*res, resfile))
+			return false;
+#else
 	bool LoadVMApp(const char* modfile, const char* resfile) {
 		InitVM();
 
@@ -662,6 +767,7 @@ public:
 		FileStream res(resfile);
 		if(!mSyscall.loadResources(res, resfile))
 			return false;
+#endif	//HAVE_MAPPED_FILES
 #else
 	bool LoadVMApp(int modFd, int resFd) {
 		InitVM();
@@ -744,7 +850,7 @@ public:
 		LOGC("\n");
 #endif
 
-#ifdef USE_ARM_RECOMPILER
+#if defined(USE_ARM_RECOMPILER) || defined(USE_X64_RECOMPILER)
 		//closeRecompiler();
 		LOG("Close recompiler\n");
 		recompiler.close();
@@ -789,6 +895,13 @@ public:
 		DUMPHEX(Head.HeapSize);
 		DUMPHEX(Head.EntryPoint);
 		IP = Head.EntryPoint;
+#ifdef BLOCK_PROFILING
+		mBlockStart = Head.EntryPoint & CODE_SEGMENT_MASK;
+#endif
+#ifdef SAMPLING_PROFILING
+		mSamples.clear();
+		startSampler();
+#endif
 
 #ifdef TRACK_SYSCALL_ID
 		currentSyscallId = -1;
@@ -804,6 +917,16 @@ public:
 			instruction_count = new int[CODE_SEGMENT_SIZE];
 			if(!instruction_count) BIG_PHAT_ERROR(ERR_OOM);
 			ZEROMEM(instruction_count, sizeof(int)*CODE_SEGMENT_SIZE);
+#endif
+#ifdef BLOCK_PROFILING
+			freeBlockProfile();
+			mBlockCount = new int[CODE_SEGMENT_SIZE];
+			mBlockTaken = new int[CODE_SEGMENT_SIZE];
+			mBlockEnd = new int[CODE_SEGMENT_SIZE];
+			if(!mBlockCount || !mBlockTaken || !mBlockEnd) BIG_PHAT_ERROR(ERR_OOM);
+			ZEROMEM(mBlockCount, sizeof(int)*CODE_SEGMENT_SIZE);
+			ZEROMEM(mBlockTaken, sizeof(int)*CODE_SEGMENT_SIZE);
+			ZEROMEM(mBlockEnd, sizeof(int)*CODE_SEGMENT_SIZE);
 #endif
 			TEST(file.read(mem_cs, Head.CodeLen));
 			ZEROMEM(mem_cs + Head.CodeLen, CODE_SEGMENT_SIZE - Head.CodeLen);
@@ -901,25 +1024,426 @@ public:
 #else
 		recompiler.init(this, &VM_Yield, mJniEnv, mJThis);
 #endif
+#elif defined(USE_X64_RECOMPILER)
+		recompiler.init(this, &VM_Yield);
+#endif
+
+#ifdef USE_THREADED_CODE
+		predecodeThreadedCode();
 #endif
 
 		return 1; //good load
 	}
 
+#ifdef USE_THREADED_CODE
+	//****************************************
+	//Threaded code
+	//****************************************
+#define THREADED_CODE_ALIGNMENT 64	//cache line size
+#define MAX_INSTRUCTION_SIZE 8
+
+	void freeThreadedCode() {
+		SAFE_DELETE(mThreadedBuffer);
+		SAFE_DELETE(mThreadedIndex);
+		SAFE_DELETE(mThreadedAddress);
+		mThreadedCode = NULL;
+		mThreadedCount = 0;
+	}
+
+	// Reads a constant pool index, encoded as by FETCH_CONST.
+	static int readConstIndex(const byte*& ip) {
+		int i = *ip++;
+#ifdef USE_VAR_INT
+		if(i > 127) {
+			i = ((i & 127) << 8) + *ip++;
+		}
+#else
+		i = (i << 8) + *ip++;
+#endif
+		return i;
+	}
+
+	static int readImm16(const byte*& ip) {
+		int i = *ip++ << 8;
+		return i + *ip++;
+	}
+
+	static int readImm24(const byte*& ip) {
+		int i = *ip++ << 16;
+		i += *ip++ << 8;
+		return i + *ip++;
+	}
+
+	// Decodes the instruction at ip into ti and returns its size in bytes.
+	// Direct branch targets are left as code addresses, and isBranch is set.
+	// Undecodable instructions get the _NUL handler, which raises
+	// ERR_ILLEGAL_INSTRUCTION if they are ever executed.
+	int decodeThreadedInstruction(const byte* ip, ThreadedInstruction& ti, bool& isBranch) {
+		const byte* start = ip;
+		byte op = *ip++;
+		bool isFar = false;
+		int c;
+
+		if(op == _FAR) {
+			op = *ip++;
+			isFar = true;
+		}
+
+		// a superinstruction has the operands of its first part.
+		// the following parts are decoded as separate instructions.
+#define SUPER_FIRST_ELEM(name, first, second) _##first,
+#define SUPER3_FIRST_ELEM(name, first, second, third) _##first,
+		static const byte sSuperFirst[] = {
+			SUPERINSTRUCTIONS(SUPER_FIRST_ELEM)
+			SUPERINSTRUCTIONS3(SUPER3_FIRST_ELEM)
+		};
+#undef SUPER_FIRST_ELEM
+#undef SUPER3_FIRST_ELEM
+		byte handlerOp = op;
+		if(op >= _SUPER && op < _ENDSUPER) {
+			if(isFar) goto illegal;
+			op = sSuperFirst[op - _SUPER];
+		}
+
+		ti.rd = ti.rs = 0;
+		ti.imm = 0;
+		isBranch = false;
+
+		switch(op) {
+		case _ADD: case _SUB: case _MUL: case _AND: case _OR: case _XOR:
+		case _DIVU: case _DIV: case _SLL: case _SRA: case _SRL:
+		case _NOT: case _NEG: case _LDR: case _XB: case _XH:
+			if(isFar) goto illegal;
+			ti.rd = *ip++;
+			ti.rs = *ip++;
+			break;
+		case _ADDI: case _SUBI: case _MULI: case _ANDI: case _ORI: case _XORI:
+		case _DIVUI: case _DIVI: case _LDI:
+			if(isFar) goto illegal;
+			ti.rd = *ip++;
+			c = readConstIndex(ip);
+			if(c >= Head.IntLen) goto illegal;
+			ti.imm = mem_cp[c];
+			break;
+		case _LDB: case _LDH: case _LDW: case _STB: case _STH: case _STW:
+			if(isFar) goto illegal;
+			ti.rd = *ip++;
+			ti.rs = *ip++;
+			c = readConstIndex(ip);
+			if(c >= Head.IntLen) goto illegal;
+			ti.imm = mem_cp[c];
+			break;
+		case _SLLI: case _SRAI: case _SRLI: case _PUSH: case _POP:
+			if(isFar) goto illegal;
+			ti.rd = *ip++;
+			ti.imm = *ip++;
+			break;
+		case _CALL: case _JPR:
+			if(isFar) goto illegal;
+			ti.rd = *ip++;
+			break;
+		case _RET:
+			if(isFar) goto illegal;
+			break;
+		case _SYSCALL:
+			if(isFar) goto illegal;
+			ti.imm = *ip++;
+			break;
+		case _CASE:
+			if(isFar) goto illegal;
+			ti.rd = *ip++;
+			ti.imm = readImm24(ip);
+			break;
+		case _CALLI: case _JPI:
+			ti.imm = isFar ? readImm24(ip) : readImm16(ip);
+			isBranch = true;
+			break;
+		case _JC_EQ: case _JC_NE: case _JC_GE: case _JC_GEU: case _JC_GT:
+		case _JC_GTU: case _JC_LE: case _JC_LEU: case _JC_LT: case _JC_LTU:
+			ti.rd = *ip++;
+			ti.rs = *ip++;
+			ti.imm = isFar ? readImm24(ip) : readImm16(ip);
+			isBranch = true;
+			break;
+		default:
+			goto illegal;
+		}
+		ti.handler = mThreadedHandlers[handlerOp];
+		return int(ip - start);
+
+illegal:
+		ti.handler = mThreadedHandlers[_NUL];
+		ti.rd = ti.rs = 0;
+		ti.imm = 0;
+		isBranch = false;
+		return 1;
+	}
+
+	// Translates the code segment into mThreadedCode.
+	// Instructions are never decoded across the end of the code,
+	// so there is no need to validate the code layout beforehand.
+	void predecodeThreadedCode() {
+		freeThreadedCode();
+		Run(NULL);	//fetch mThreadedHandlers
+		DEBUG_ASSERT(mThreadedHandlers != NULL);
+
+		mThreadedIndex = new int[CODE_SEGMENT_SIZE];
+		if(!mThreadedIndex) BIG_PHAT_ERROR(ERR_OOM);
+		for(uint i=0; i<CODE_SEGMENT_SIZE; i++) {
+			mThreadedIndex[i] = -1;
+		}
+
+		// first pass: find the instruction boundaries.
+		ThreadedInstruction ti;
+		bool isBranch;
+		int count = 0;
+		for(uint address = 0; address < uint(Head.CodeLen); count++) {
+			mThreadedIndex[address] = count;
+			address += decodeThreadedInstruction(threadedDecodePointer(address), ti, isBranch);
+		}
+		for(uint i=0; i<CODE_SEGMENT_SIZE; i++) {
+			if(mThreadedIndex[i] < 0)
+				mThreadedIndex[i] = count;
+		}
+
+		mThreadedCount = count;
+		mThreadedBuffer = new byte[(count + 1) * sizeof(ThreadedInstruction) + THREADED_CODE_ALIGNMENT - 1];
+		mThreadedAddress = new int[count + 1];
+		if(!mThreadedBuffer || !mThreadedAddress) BIG_PHAT_ERROR(ERR_OOM);
+		mThreadedCode = (ThreadedInstruction*)(((size_t)mThreadedBuffer + THREADED_CODE_ALIGNMENT - 1) &
+			~(size_t)(THREADED_CODE_ALIGNMENT - 1));
+
+		// second pass: decode and resolve branch targets.
+		uint address = 0;
+		for(int i=0; i<count; i++) {
+			ThreadedInstruction& t(mThreadedCode[i]);
+			mThreadedAddress[i] = address;
+			address += decodeThreadedInstruction(threadedDecodePointer(address), t, isBranch);
+			if(isBranch) {
+				t.imm = (uint(t.imm) < CODE_SEGMENT_SIZE) ? mThreadedIndex[t.imm] : count;
+			}
+		}
+
+		ThreadedInstruction& trap(mThreadedCode[count]);
+		trap.handler = mThreadedHandlers[_ENDOP];
+		trap.rd = trap.rs = 0;
+		trap.imm = 0;
+		mThreadedAddress[count] = Head.CodeLen;
+
+		LOG("Predecoded %i instructions\n", count);
+	}
+
+	// Returns a pointer from which a whole instruction can safely be read.
+	const byte* threadedDecodePointer(uint address) {
+		static byte tail[MAX_INSTRUCTION_SIZE];
+		if(CODE_SEGMENT_SIZE - address >= MAX_INSTRUCTION_SIZE)
+			return mem_cs + address;
+		ZEROMEM(tail, sizeof(tail));
+		memcpy(tail, mem_cs + address, CODE_SEGMENT_SIZE - address);
+		return tail;
+	}
+#endif	//USE_THREADED_CODE
+
+#ifdef BLOCK_PROFILING
+	void profileBlock(int end, bool taken, int next) {
+		mBlockCount[mBlockStart]++;
+		if(taken)
+			mBlockTaken[mBlockStart]++;
+		mBlockEnd[mBlockStart] = end;
+		mBlockStart = next;
+	}
+
+	void freeBlockProfile() {
+		SAFE_DELETE(mBlockCount);
+		SAFE_DELETE(mBlockTaken);
+		SAFE_DELETE(mBlockEnd);
+	}
+
+	// One line per block: "start-end: count taken", with addresses in hex.
+	// The block's last instruction is a jump or a conditional branch,
+	// taken is the number of times it jumped.
+	// pipe-tool -super= reads this file.
+	void writeBlockProfile() {
+		if(mBlockCount == NULL)
+			return;
+		FILE* file = fopen("block_profile.txt", "w");
+		if(!file) {
+			LOG("Block profile dump failed; couldn't open file for writing.\n");
+			return;
+		}
+		fprintf(file, "BLOCK COUNTS: %i\n", Head.CodeLen);
+		for(uint i=0; i<CODE_SEGMENT_SIZE; i++) {
+			if(mBlockCount[i] != 0)
+				fprintf(file, "%x-%x: %i %i\n", i, mBlockEnd[i], mBlockCount[i], mBlockTaken[i]);
+		}
+		fclose(file);
+		LOG("Block profile dumped.\n");
+	}
+#endif	//BLOCK_PROFILING
+
+#ifdef SAMPLING_PROFILING
+	static int samplerThread(void* arg) {
+		VMCoreInt* core = (VMCoreInt*)arg;
+		while(!core->mSamplerQuit) {
+			MoSyncThread::sleep(SAMPLING_INTERVAL);
+			core->mSampleRequested = true;
+		}
+		return 0;
+	}
+
+	void startSampler() {
+		if(mSamplerRunning)
+			return;
+		mSampleRequested = false;
+		mSamplerQuit = false;
+		mSampler.start(samplerThread, this);
+		mSamplerRunning = true;
+	}
+
+	void stopSampler() {
+		if(!mSamplerRunning)
+			return;
+		mSamplerQuit = true;
+		mSampler.join();
+		mSamplerRunning = false;
+	}
+
+	// ip is the address of an instruction in the running function.
+	void takeSample(int ip) {
+		mSampleRequested = false;
+		mSampleStack.assign(fakeCallStack, fakeCallStack + fakeCallStackDepth);
+		mSampleStack.push_back(ip);
+		mSamples[mSampleStack]++;
+	}
+
+	// Function name if the SLD has one, source line if not, else the address.
+	static std::string symbolizeSample(int ip) {
+		const char* name = mapFunction(ip);
+		if(name)
+			return name;
+		char buf[32];
+		int line;
+		std::string file;
+		if(mapIp(ip, line, file)) {
+			sprintf(buf, ":%i", line);
+			return file + buf;
+		}
+		sprintf(buf, "0x%x", ip);
+		return buf;
+	}
+
+	// Folded stacks, one per line: "outermost;...;innermost count".
+	// This is the input format of flamegraph.pl.
+	void writeSampleProfile() {
+		if(mSamples.empty())
+			return;
+		std::map<std::string, int> folded;
+		for(SampleMap::const_iterator itr = mSamples.begin(); itr != mSamples.end(); itr++) {
+			const std::vector<int>& stack(itr->first);
+			std::string line;
+			for(size_t i=0; i<stack.size(); i++) {
+				if(i != 0)
+					line += ';';
+				// return addresses point past the call instruction.
+				line += symbolizeSample(i == stack.size()-1 ? stack[i] : stack[i] - 1);
+			}
+			folded[line] += itr->second;
+		}
+		FILE* file = fopen("samples.folded", "w");
+		if(!file) {
+			LOG("Sample profile dump failed; couldn't open file for writing.\n");
+			return;
+		}
+		for(std::map<std::string, int>::const_iterator itr = folded.begin(); itr != folded.end(); itr++) {
+			fprintf(file, "%s %i\n", itr->first.c_str(), itr->second);
+		}
+		fclose(file);
+		LOG("Sample profile dumped.\n");
+	}
+#endif	//SAMPLING_PROFILING
+
 	//****************************************
 	//Definitions
 	//****************************************
+// Counts every instruction, including each part of a superinstruction.
+#ifdef COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION mInstructionCount++;
+#else
+#define COUNT_INSTRUCTION
+#endif
+
+#ifdef USE_THREADED_CODE
+// ti is the instruction being executed, tp the next one.
+#define THREADED_ADDRESS(t) mThreadedAddress[(t) - mThreadedCode]
+#define NEXT_ADDRESS THREADED_ADDRESS(tp)
+
+#ifdef UPDATE_IP
+#define THREADED_UPDATE_IP IP = THREADED_ADDRESS(ti);
+#else
+#define THREADED_UPDATE_IP
+#endif
+#if defined(INSTRUCTION_PROFILING) && defined(UPDATE_IP) && defined(MEMORY_DEBUG)
+#define THREADED_PROFILE InstCount++; instruction_count[IP]++;
+#elif defined(MEMORY_DEBUG)
+#define THREADED_PROFILE InstCount++;
+#else
+#define THREADED_PROFILE
+#endif
+#ifdef LOG_STATE_CHANGE
+#define THREADED_LOG_STATE_CHANGE logStateChange(THREADED_ADDRESS(ti));
+#else
+#define THREADED_LOG_STATE_CHANGE
+#endif
+
+#define THREADED_DISPATCH ti = tp++; THREADED_UPDATE_IP THREADED_PROFILE COUNT_INSTRUCTION\
+	THREADED_LOG_STATE_CHANGE goto *ti->handler;
+
+#ifdef COUNT_INSTRUCTION_USE
+#define OPC(opcode)	L_##opcode: countInstructionUse(#opcode, _##opcode);
+#define SOPC(name, first)	L_##name: countInstructionUse(#first, _##first);
+#define SUPER_COUNT(opcode)	countInstructionUse(#opcode, _##opcode);
+#else
+#define OPC(opcode)	L_##opcode:
+#define SOPC(name, first)	L_##name:
+#define SUPER_COUNT(opcode)
+#endif
+#define EOP	THREADED_DISPATCH
+
+// Continues a superinstruction with its next part. Should that part not be
+// the expected instruction, it is dispatched normally instead.
+#define SUPER_NEXT(opcode) if(tp->handler != handlers[_##opcode]) { THREADED_DISPATCH }\
+	ti = tp++; THREADED_UPDATE_IP THREADED_PROFILE COUNT_INSTRUCTION THREADED_LOG_STATE_CHANGE\
+	SUPER_COUNT(opcode)
+#else
+#define NEXT_ADDRESS ((int32_t) (ip - mem_cs))
+
 #ifdef COUNT_INSTRUCTION_USE
 #define OPC(opcode)	case _##opcode: LOGC("%x: %i %s", (int)(ip - mem_cs - 1), _##opcode, #opcode); countInstructionUse(#opcode, op);
+#define SUPER_COUNT(opcode)	countInstructionUse(#opcode, _##opcode);
 #else
 #define OPC(opcode)	case _##opcode: LOGC("%x: %i %s", (int)(ip - mem_cs - 1), _##opcode, #opcode);
+#define SUPER_COUNT(opcode)
 #endif
+#define SOPC(name, first)	case _##name: LOGC("%x: %i %s", (int)(ip - mem_cs - 1), _##name, #name); SUPER_COUNT(first)
 #ifdef CORE_DEBUGGING_MODE
 #define EOP	LOGC("\n"); break;
 #else
 #define EOP	LOGC("\n"); RUN_LOOP;
 #endif	//CORE_DEBUGGING_MODE
 
+// Continues a superinstruction with its next part. Should that part not be
+// the expected instruction, for example because it has been replaced by a
+// breakpoint, it is dispatched normally instead. When single-stepping, every
+// superinstruction stops after its first part.
+#if defined(CORE_DEBUGGING_MODE) || defined(GDB_DEBUG)
+#define SUPER_NEXT(opcode) EOP
+#else
+#define SUPER_NEXT(opcode) if(*ip != _##opcode) { EOP } ip++; COUNT_INSTRUCTION\
+	LOGC("\n%x: %i %s", (int)(ip - mem_cs - 1), _##opcode, #opcode); SUPER_COUNT(opcode)
+#endif
+#endif	//USE_THREADED_CODE
+#define NEXT_IP (mem_cs + NEXT_ADDRESS)
+
 #define REG(nn)	regs[nn]
 #define	RD	(regs[rd])
 #define	RS	(regs[rs])
@@ -958,20 +1482,62 @@ void WRITE_REG(int reg, int value) {
 #else
 #define dumpJump(a)
 #endif
-#define JMP_GENERIC(address) dumpJump(address); if(uint(address) >= CODE_SEGMENT_SIZE) {\
+#ifdef USE_THREADED_CODE
+#define JMP_TO(address) tp = mThreadedCode + mThreadedIndex[address];
+#else
+#define JMP_TO(address) ip = (byte*)(mem_cs + (address));
+#endif
+#define JMP_ADDRESS(address) dumpJump(address); if(uint(address) >= CODE_SEGMENT_SIZE) {\
 	LOG("\nIllegal jump to 0x%04X\n", (uint)address); BIG_PHAT_ERROR(ERR_IMEM_OOB); }\
-		ip = (byte*)(mem_cs + (address));
+		JMP_TO(address)
+#elif defined(USE_THREADED_CODE)
+#define JMP_ADDRESS(address) \
+	tp = mThreadedCode + mThreadedIndex[(address) & CODE_SEGMENT_MASK];
 #else
-#define JMP_GENERIC(address) \
+#define JMP_ADDRESS(address) \
 	ip = (byte*)(mem_cs + ((address) & CODE_SEGMENT_MASK));
 #endif  //MEMORY_DEBUG
 
+// Every jump ends a profiled block, and so does a conditional branch that
+// isn't taken. JMP_ADDRESS is only used directly to resume execution.
+#ifdef BLOCK_PROFILING
+#define PROFILE_BLOCK(address) profileBlock(NEXT_ADDRESS, true, (address) & CODE_SEGMENT_MASK);
+#define PROFILE_NOT_TAKEN profileBlock(NEXT_ADDRESS, false, NEXT_ADDRESS);
+#else
+#define PROFILE_BLOCK(address)
+#define PROFILE_NOT_TAKEN
+#endif
+#ifdef SAMPLING_PROFILING
+#define PROFILE_SAMPLE if(mSampleRequested) takeSample(NEXT_ADDRESS - 1);
+#else
+#define PROFILE_SAMPLE
+#endif
+#define PROFILE_JUMP(address) PROFILE_BLOCK(address) PROFILE_SAMPLE
+#define JMP_GENERIC(address) PROFILE_JUMP(address) JMP_ADDRESS(address)
+
+#ifdef USE_THREADED_CODE
+// direct branch targets are predecoded into instruction indices.
+#define	JMP_IMM	PROFILE_JUMP(IMM_ADDRESS) tp = mThreadedCode + IMM;
+#define IMM_ADDRESS THREADED_ADDRESS(mThreadedCode + IMM)
+#else
 #define	JMP_IMM	JMP_GENERIC(IMM)
+#define IMM_ADDRESS IMM
+#endif
 #define	JMP_RD	JMP_GENERIC(RD)
-
-#define	CALL_IMM	REG(REG_rt) = (int32_t) (ip - mem_cs); JMP_IMM;
-#define	CALL_RD		REG(REG_rt) = (int32_t) (ip - mem_cs); JMP_RD;
-
+#define JMP_IMM_IF(condition) if (condition) { JMP_IMM; } else { PROFILE_NOT_TAKEN }
+
+#define	CALL_IMM	REG(REG_rt) = NEXT_ADDRESS; JMP_IMM;
+#define	CALL_RD		REG(REG_rt) = NEXT_ADDRESS; JMP_RD;
+
+#ifdef USE_THREADED_CODE
+#define FETCH_RD	rd = ti->rd;
+#define FETCH_RS	rs = ti->rs;
+#define FETCH_CONST	imm32 = ti->imm;
+#define FETCH_INT	imm32 = ti->imm;
+#define FETCH_IMM8	imm32 = ti->imm;
+#define FETCH_IMM16	imm32 = ti->imm;
+#define FETCH_IMM24	imm32 = ti->imm;
+#else
 #define IB ((int)(*ip++))
 
 #define FETCH_RD	rd = IB; LOGC(" rd%i(0x%08x)", rd, RD);
@@ -993,6 +1559,7 @@ void WRITE_REG(int reg, int value) {
 	LOGC(" i%i(0x%x)", imm32, imm32);
 /*#define FETCH_IMM32	imm32 = IB << 24; imm32 += IB << 16; imm32 += IB << 8;\
 	imm32 += IB; LOGC(" n%i(0x%x)", imm32, imm32);*/
+#endif	//USE_THREADED_CODE
 
 #define FETCH_RD_RS		FETCH_RD FETCH_RS
 #define FETCH_RD_CONST		FETCH_RD FETCH_CONST
@@ -1034,28 +1601,36 @@ void WRITE_REG(int reg, int value) {
 		return getValidatedMemRefBase<T, 1>(address);
 	}
 
+	// The common case costs one branch: with a power-of-two segment and an
+	// aligned access, address < DATA_SEGMENT_SIZE implies the whole access
+	// is in bounds. The errors are sorted out of line.
 	template<class T, bool write> T& getValidatedMemRefBase(uint address) {
 		DEBUG_ASSERT(isPowerOf2(sizeof(T)));
-		if(address >= DATA_SEGMENT_SIZE || (address+sizeof(T)) > DATA_SEGMENT_SIZE ||
-			((address & (sizeof(T) - 1)) != 0) || //alignment check
-			(address < 4))	//NULL pointer check
+		if((address & (sizeof(T) - 1)) | (uint(address - 4) >= uint(DATA_SEGMENT_SIZE - 4)))
+			memRefValidationFailed(address, sizeof(T));
+
+#ifdef MEMORY_PROTECTION
+		// an aligned access never spans more than one byte of the protection set.
+		if(protectionEnabled &&
+			(protectionSet[address >> 3] & (((1 << sizeof(T)) - 1) << (address & 7))))
 		{
-			LOG("Memory reference validation failed. Size %"PFZT", address 0x%x\n",
-				sizeof(T), address);
-			if((address & (sizeof(T) - 1)) != 0) {
-				BIG_PHAT_ERROR(ERR_MEMORY_ALIGNMENT);
-			} else if(address >= DATA_SEGMENT_SIZE || (address+sizeof(T)) > DATA_SEGMENT_SIZE) {
-				BIG_PHAT_ERROR(ERR_MEMORY_OOB);
-			} else {
-				BIG_PHAT_ERROR(ERR_MEMORY_NULL);
-			}
+			BIG_PHAT_ERROR(ERR_MEMORY_PROTECTED);
 		}
-
-#ifdef MEMORY_PROTECTION	
-		checkProtection(address, sizeof(T));
 #endif
 
-		return MEMREF(T, address);
+		return RAW_MEMREF(T, address);
+	}
+
+	void ATTRIBUTE(noinline, memRefValidationFailed(uint address, uint size)) {
+		LOG("Memory reference validation failed. Size %i, address 0x%x\n",
+			size, address);
+		if((address & (size - 1)) != 0) {
+			BIG_PHAT_ERROR(ERR_MEMORY_ALIGNMENT);
+		} else if(address >= DATA_SEGMENT_SIZE || (address+size) > DATA_SEGMENT_SIZE) {
+			BIG_PHAT_ERROR(ERR_MEMORY_OOB);
+		} else {
+			BIG_PHAT_ERROR(ERR_MEMORY_NULL);
+		}
 	}
 #else
 #define MEM(type, addr, write) MEMREF(type, addr)
@@ -1233,6 +1808,10 @@ void WRITE_REG(int reg, int value) {
 #else
 		ISC2(syscall_id);
 #endif
+#ifdef RESOURCE_MEMORY_LIMIT
+		// nothing holds a pointer from resources.get() across syscalls.
+		Base::gSyscall->resources.releaseLazy();
+#endif
 #ifdef TRACK_SYSCALL_ID
 		currentSyscallId = -1;
 #endif
@@ -1294,6 +1873,20 @@ void WRITE_REG(int reg, int value) {
 		IP = ip;
 	}
 
+	bool GetInstructionCount(uint& count) const {
+#if defined(USE_ARM_RECOMPILER) || defined(USE_X64_RECOMPILER)
+		return false;
+#elif defined(COUNT_INSTRUCTIONS)
+		count = mInstructionCount;
+		return true;
+#elif defined(MEMORY_DEBUG) && !defined(USE_DELAY)
+		count = (uint)InstCount;
+		return true;
+#else
+		return false;
+#endif
+	}
+
 #ifdef _MSC_VER
 #pragma warning(disable:4355)
 #endif
@@ -1303,8 +1896,21 @@ void WRITE_REG(int reg, int value) {
 #ifdef MEMORY_DEBUG
 	, InstCount(0)
 #endif
+#ifdef COUNT_INSTRUCTIONS
+	, mInstructionCount(0)
+#endif
 #ifdef INSTRUCTION_PROFILING
 	,instruction_count(NULL)
+#endif
+#ifdef BLOCK_PROFILING
+	, mBlockCount(NULL), mBlockTaken(NULL), mBlockEnd(NULL), mBlockStart(0)
+#endif
+#ifdef SAMPLING_PROFILING
+	, mSampleRequested(false), mSamplerQuit(false), mSamplerRunning(false)
+#endif
+#ifdef USE_THREADED_CODE
+	, mThreadedCode(NULL), mThreadedBuffer(NULL), mThreadedIndex(NULL)
+	, mThreadedAddress(NULL), mThreadedCount(0), mThreadedHandlers(NULL)
 #endif
 	, mSyscall(aSyscall) {
 
@@ -1335,6 +1941,10 @@ void WRITE_REG(int reg, int value) {
 
 #ifdef COUNT_INSTRUCTION_USE
 	logInstructionUse();
+#endif
+#ifdef SAMPLING_PROFILING
+		stopSampler();
+		writeSampleProfile();
 #endif
 		delete mem_cs;
 		delete mem_ds;
@@ -1348,11 +1958,15 @@ void WRITE_REG(int reg, int value) {
 		freeStateChange();
 #endif
 
-#ifdef USE_ARM_RECOMPILER
+#if defined(USE_ARM_RECOMPILER) || defined(USE_X64_RECOMPILER)
 		//closeRecompiler();
 		recompiler.close();
 #endif
 
+#ifdef USE_THREADED_CODE
+		freeThreadedCode();
+#endif
+
 #ifdef FAKE_CALL_STACK
 		freeFakeCallStack();
 #endif
@@ -1373,6 +1987,10 @@ void WRITE_REG(int reg, int value) {
 		}
 		delete instruction_count;
 #endif
+#ifdef BLOCK_PROFILING
+		writeBlockProfile();
+		freeBlockProfile();
+#endif
 
 	}
 	
@@ -1443,6 +2061,10 @@ void SetIp(VMCore* core, int ip) {
 	CORE->SetIp(ip);
 }
 
+bool GetInstructionCount(const VMCore* core, uint& count) {
+	return CORE->GetInstructionCount(count);
+}
+
 #ifdef FAKE_CALL_STACK
 int GetFakeCallStackDepth(const VMCore* core) {
 	return CORE->fakeCallStackDepth;
@@ -152,6 +152,10 @@ namespace Core {
 	void DeleteCore(VMCore* core);
 	int GetIp(const VMCore* core);	//only valid if VM is not Running, or UPDATE_IP is defined
 	void SetIp(VMCore* core, int ip);
+	//number of instructions executed, modulo 2^32.
+	//only counted by the interpreters, in COUNT_INSTRUCTIONS builds or MEMORY_DEBUG builds
+	//without USE_DELAY; returns false otherwise.
+	bool GetInstructionCount(const VMCore* core, uint& count);
 	int GetFakeCallStackDepth(const VMCore* core);
 	const int* GetFakeCallStack(const VMCore* core);
 
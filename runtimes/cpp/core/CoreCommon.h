@@ -83,14 +83,56 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 	m(CASE)\
 	m(FAR)
 
+//****************************************
+//		 Superinstructions
+//****************************************
+// A superinstruction executes a straight-line sequence of ordinary
+// instructions with a single dispatch. It is encoded by replacing the opcode
+// byte of the first instruction of the sequence; all other bytes, including
+// the opcodes of the following instructions, are left as they were.
+// A decoder that doesn't care about superinstructions can therefore decode
+// one as its first part and continue normally.
+//
+// The first parts must not transfer control and none of the parts may be FAR.
+// pipe-tool chooses which of these to emit from COUNT_INSTRUCTION_USE data.
+// Keep this in sync with tools/pipe-tool/compile.h.
+
+#define SUPERINSTRUCTIONS(m)\
+	m(LDW_ADD, LDW, ADD)\
+	m(LDW_LDW, LDW, LDW)\
+	m(LDW_STW, LDW, STW)\
+	m(LDR_LDR, LDR, LDR)\
+	m(LDI_LDI, LDI, LDI)\
+	m(ADD_LDW, ADD, LDW)\
+	m(ADDI_LDW, ADDI, LDW)\
+	m(ADD_JC_LT, ADD, JC_LT)\
+	m(ADD_JC_NE, ADD, JC_NE)\
+	m(PUSH_SUB, PUSH, SUB)\
+	m(PUSH_SUBI, PUSH, SUBI)\
+	m(ADD_POP, ADD, POP)\
+	m(ADDI_POP, ADDI, POP)\
+	m(POP_RET, POP, RET)
+
+#define SUPERINSTRUCTIONS3(m)\
+	m(ADD_POP_RET, ADD, POP, RET)\
+	m(ADDI_POP_RET, ADDI, POP, RET)
+
 #define ENUM_INSTRUCTION_ELEM(inst) _ ## inst,
+#define ENUM_SUPERINSTRUCTION_ELEM(name, first, second) _ ## name,
+#define ENUM_SUPERINSTRUCTION3_ELEM(name, first, second, third) _ ## name,
 enum
 {
 	_NUL = 0,
 	INSTRUCTIONS(ENUM_INSTRUCTION_ELEM)
-	_ENDOP
+	_ENDOP,	// also the breakpoint opcode
+	SUPERINSTRUCTIONS(ENUM_SUPERINSTRUCTION_ELEM)
+	SUPERINSTRUCTIONS3(ENUM_SUPERINSTRUCTION3_ELEM)
+	_ENDSUPER
 };
 
+// first superinstruction opcode
+#define _SUPER (_ENDOP + 1)
+
 //****************************************
 // 			Register enums
 //****************************************
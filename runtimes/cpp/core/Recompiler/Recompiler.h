@@ -20,7 +20,7 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 
 #include <config_platform.h>
 
-#ifdef USE_ARM_RECOMPILER
+#if defined(USE_ARM_RECOMPILER) || defined(USE_X64_RECOMPILER)
 
 #include <Core.h>
 #include "Recompiler.h"
@@ -164,7 +164,8 @@ namespace MoSync {
 		}
 
 		virtual void close() {
-			delete mInstructions;
+			delete[] mInstructions;
+			mInstructions = NULL;
 		}
 
 		struct Label {
@@ -413,6 +414,6 @@ endOfFunction:
 
 } // namespace MoSync
 
-#endif	//USE_ARM_RECOMPILER
+#endif	//USE_ARM_RECOMPILER || USE_X64_RECOMPILER
 
 #endif
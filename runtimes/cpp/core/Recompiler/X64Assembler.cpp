@@ -0,0 +1,338 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#include <config_platform.h>
+
+#ifdef USE_X64_RECOMPILER
+
+#include "X64Assembler.h"
+
+namespace MoSync {
+
+	//****************************************
+	// Encoding helpers
+	//****************************************
+
+	void X64Assembler::emit8(int b) {
+		if(mBuffer)
+			mBuffer[mSize] = (unsigned char)b;
+		mSize++;
+	}
+
+	void X64Assembler::emit32(int i) {
+		emit8(i);
+		emit8(i >> 8);
+		emit8(i >> 16);
+		emit8(i >> 24);
+	}
+
+	void X64Assembler::emit64(long long l) {
+		emit32((int)l);
+		emit32((int)(l >> 32));
+	}
+
+	// force is needed to address spl, bpl, sil and dil rather than ah..bh.
+	void X64Assembler::emitRex(bool w, int reg, int index, int base, bool force) {
+		if(index == NoIndex) index = 0;
+		int rex = 0x40 | (w ? 8 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+		if(rex != 0x40 || force)
+			emit8(rex);
+	}
+
+	void X64Assembler::emitRex(bool w, int reg, const Mem& m, bool force) {
+		emitRex(w, reg, m.index, m.base, force);
+	}
+
+	void X64Assembler::emitModRM(int reg, const Mem& m) {
+		int base = m.base & 7;
+		int mod;
+		// rbp and r13 as base can't be encoded without a displacement.
+		if(m.disp == 0 && base != RBP)
+			mod = 0;
+		else if(m.disp >= -128 && m.disp <= 127)
+			mod = 1;
+		else
+			mod = 2;
+
+		// rsp and r12 as base always need a SIB byte.
+		if(m.index == NoIndex && base != RSP) {
+			emit8((mod << 6) | ((reg & 7) << 3) | base);
+		} else {
+			int index = (m.index == NoIndex) ? RSP : (m.index & 7);
+			emit8((mod << 6) | ((reg & 7) << 3) | RSP);
+			emit8((m.scale << 6) | (index << 3) | base);
+		}
+
+		if(mod == 1)
+			emit8(m.disp);
+		else if(mod == 2)
+			emit32(m.disp);
+	}
+
+	void X64Assembler::emitModRM(int reg, Register rm) {
+		emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+
+	//****************************************
+	// 32-bit register/memory forms
+	//****************************************
+
+	void X64Assembler::MOV(Register rd, const Mem& m) {
+		emitRex(false, rd, m);
+		emit8(0x8B);
+		emitModRM(rd, m);
+	}
+
+	void X64Assembler::MOV(const Mem& m, Register rs) {
+		emitRex(false, rs, m);
+		emit8(0x89);
+		emitModRM(rs, m);
+	}
+
+	void X64Assembler::MOV(Register rd, Register rs) {
+		emitRex(false, rs, NoIndex, rd);
+		emit8(0x89);
+		emitModRM(rs, rd);
+	}
+
+	void X64Assembler::MOV_imm32(Register rd, int imm32) {
+		emitRex(false, 0, NoIndex, rd);
+		emit8(0xB8 + (rd & 7));
+		emit32(imm32);
+	}
+
+	void X64Assembler::MOV_imm32(const Mem& m, int imm32) {
+		emitRex(false, 0, m);
+		emit8(0xC7);
+		emitModRM(0, m);
+		emit32(imm32);
+	}
+
+	void X64Assembler::MOVB(const Mem& m, Register rs) {
+		emitRex(false, rs, m, rs >= RSP && rs <= RDI);
+		emit8(0x88);
+		emitModRM(rs, m);
+	}
+
+	void X64Assembler::MOVW(const Mem& m, Register rs) {
+		emit8(0x66);
+		emitRex(false, rs, m);
+		emit8(0x89);
+		emitModRM(rs, m);
+	}
+
+	void X64Assembler::MOVSXB(Register rd, const Mem& m) {
+		emitRex(false, rd, m);
+		emit8(0x0F);
+		emit8(0xBE);
+		emitModRM(rd, m);
+	}
+
+	void X64Assembler::MOVSXW(Register rd, const Mem& m) {
+		emitRex(false, rd, m);
+		emit8(0x0F);
+		emit8(0xBF);
+		emitModRM(rd, m);
+	}
+
+	void X64Assembler::MOVSXB(Register rd, Register rs) {
+		emitRex(false, rd, NoIndex, rs, rs >= RSP && rs <= RDI);
+		emit8(0x0F);
+		emit8(0xBE);
+		emitModRM(rd, rs);
+	}
+
+	void X64Assembler::MOVSXW(Register rd, Register rs) {
+		emitRex(false, rd, NoIndex, rs);
+		emit8(0x0F);
+		emit8(0xBF);
+		emitModRM(rd, rs);
+	}
+
+	void X64Assembler::ALU(AluOp op, Register rd, const Mem& m) {
+		emitRex(false, rd, m);
+		emit8((op << 3) | 0x03);
+		emitModRM(rd, m);
+	}
+
+	void X64Assembler::ALU(AluOp op, Register rd, Register rs) {
+		emitRex(false, rs, NoIndex, rd);
+		emit8((op << 3) | 0x01);
+		emitModRM(rs, rd);
+	}
+
+	void X64Assembler::ALU_imm32(AluOp op, Register rd, int imm32) {
+		emitRex(false, 0, NoIndex, rd);
+		if(imm32 >= -128 && imm32 <= 127) {
+			emit8(0x83);
+			emitModRM(op, rd);
+			emit8(imm32);
+		} else {
+			emit8(0x81);
+			emitModRM(op, rd);
+			emit32(imm32);
+		}
+	}
+
+	void X64Assembler::IMUL(Register rd, const Mem& m) {
+		emitRex(false, rd, m);
+		emit8(0x0F);
+		emit8(0xAF);
+		emitModRM(rd, m);
+	}
+
+	void X64Assembler::IMUL_imm32(Register rd, Register rs, int imm32) {
+		emitRex(false, rd, NoIndex, rs);
+		emit8(0x69);
+		emitModRM(rd, rs);
+		emit32(imm32);
+	}
+
+	void X64Assembler::SHIFT_CL(ShiftOp op, Register rd) {
+		emitRex(false, 0, NoIndex, rd);
+		emit8(0xD3);
+		emitModRM(op, rd);
+	}
+
+	void X64Assembler::SHIFT_imm8(ShiftOp op, Register rd, int imm8) {
+		emitRex(false, 0, NoIndex, rd);
+		emit8(0xC1);
+		emitModRM(op, rd);
+		emit8(imm8);
+	}
+
+	void X64Assembler::NOT(Register rd) {
+		emitRex(false, 0, NoIndex, rd);
+		emit8(0xF7);
+		emitModRM(2, rd);
+	}
+
+	void X64Assembler::NEG(Register rd) {
+		emitRex(false, 0, NoIndex, rd);
+		emit8(0xF7);
+		emitModRM(3, rd);
+	}
+
+	void X64Assembler::TEST_rr(Register rd, Register rs) {
+		emitRex(false, rs, NoIndex, rd);
+		emit8(0x85);
+		emitModRM(rs, rd);
+	}
+
+	void X64Assembler::CDQ() {
+		emit8(0x99);
+	}
+
+	void X64Assembler::IDIV(Register rs) {
+		emitRex(false, 0, NoIndex, rs);
+		emit8(0xF7);
+		emitModRM(7, rs);
+	}
+
+	void X64Assembler::DIV(Register rs) {
+		emitRex(false, 0, NoIndex, rs);
+		emit8(0xF7);
+		emitModRM(6, rs);
+	}
+
+	//****************************************
+	// 64-bit forms
+	//****************************************
+
+	void X64Assembler::MOV64_imm64(Register rd, long long imm64) {
+		emitRex(true, 0, NoIndex, rd);
+		emit8(0xB8 + (rd & 7));
+		emit64(imm64);
+	}
+
+	void X64Assembler::ADD64_imm8(Register rd, int imm8) {
+		emitRex(true, 0, NoIndex, rd);
+		emit8(0x83);
+		emitModRM(OP_ADD, rd);
+		emit8(imm8);
+	}
+
+	void X64Assembler::SUB64_imm8(Register rd, int imm8) {
+		emitRex(true, 0, NoIndex, rd);
+		emit8(0x83);
+		emitModRM(OP_SUB, rd);
+		emit8(imm8);
+	}
+
+	void X64Assembler::PUSH(Register r) {
+		emitRex(false, 0, NoIndex, r);
+		emit8(0x50 + (r & 7));
+	}
+
+	void X64Assembler::POP(Register r) {
+		emitRex(false, 0, NoIndex, r);
+		emit8(0x58 + (r & 7));
+	}
+
+	//****************************************
+	// Control flow
+	//****************************************
+
+	void X64Assembler::JMP_rel32(int rel32) {
+		emit8(0xE9);
+		emit32(rel32);
+	}
+
+	void X64Assembler::JCC_rel32(ConditionCode cc, int rel32) {
+		emit8(0x0F);
+		emit8(0x80 + cc);
+		emit32(rel32);
+	}
+
+	void X64Assembler::JCC_rel8(ConditionCode cc, int rel8) {
+		emit8(0x70 + cc);
+		emit8(rel8);
+	}
+
+	void X64Assembler::JMP(Register r) {
+		emitRex(false, 0, NoIndex, r);
+		emit8(0xFF);
+		emitModRM(4, r);
+	}
+
+	void X64Assembler::JMP(const Mem& m) {
+		emitRex(false, 0, m);
+		emit8(0xFF);
+		emitModRM(4, m);
+	}
+
+	void X64Assembler::CALL(Register r) {
+		emitRex(false, 0, NoIndex, r);
+		emit8(0xFF);
+		emitModRM(2, r);
+	}
+
+	void X64Assembler::RET() {
+		emit8(0xC3);
+	}
+
+	void X64Assembler::NOP() {
+		emit8(0x90);
+	}
+
+	void X64Assembler::INT3() {
+		emit8(0xCC);
+	}
+
+} // namespace MoSync
+
+#endif	// USE_X64_RECOMPILER
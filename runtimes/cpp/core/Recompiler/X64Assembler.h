@@ -0,0 +1,189 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#ifndef _X64_ASSEMBLER_H_
+#define _X64_ASSEMBLER_H_
+
+#include <stddef.h>
+
+namespace MoSync {
+
+	/**
+	 * A minimal x86-64 instruction emitter, covering the instruction forms
+	 * used by the X64Recompiler.
+	 *
+	 * If no buffer is set, the assembler only counts bytes. This is used by
+	 * the first recompiler pass to lay out the code before any executable
+	 * memory has been allocated. All encodings depend only on their operands,
+	 * never on the buffer address, so both passes produce code of equal size.
+	 */
+	class X64Assembler {
+	public:
+		/* x86-64 registers */
+		typedef enum
+		{
+			RAX = 0,
+			RCX = 1,
+			RDX = 2,
+			RBX = 3,
+			RSP = 4,
+			RBP = 5,
+			RSI = 6,
+			RDI = 7,
+			R8  = 8,
+			R9  = 9,
+			R10 = 10,
+			R11 = 11,
+			R12 = 12,
+			R13 = 13,
+			R14 = 14,
+			R15 = 15,
+
+			NoIndex = -1
+		}
+		Register;
+
+		/* x86 condition codes, as used by Jcc */
+		typedef enum
+		{
+			O  = 0x0, // Overflow
+			NO = 0x1, // No overflow
+			B  = 0x2, // Below (unsigned <)
+			AE = 0x3, // Above or equal (unsigned >=)
+			E  = 0x4, // Equal
+			NE = 0x5, // Not equal
+			BE = 0x6, // Below or equal (unsigned <=)
+			A  = 0x7, // Above (unsigned >)
+			S  = 0x8, // Sign
+			NS = 0x9, // No sign
+			P  = 0xA, // Parity
+			NP = 0xB, // No parity
+			L  = 0xC, // Less (signed <)
+			GE = 0xD, // Greater or equal (signed >=)
+			LE = 0xE, // Less or equal (signed <=)
+			G  = 0xF  // Greater (signed >)
+		}
+		ConditionCode;
+
+		/* group 1 arithmetic operations, as encoded in the /digit field of 0x81 */
+		typedef enum
+		{
+			OP_ADD = 0,
+			OP_OR  = 1,
+			OP_AND = 4,
+			OP_SUB = 5,
+			OP_XOR = 6,
+			OP_CMP = 7
+		}
+		AluOp;
+
+		/* group 2 shift operations, as encoded in the /digit field of 0xC1/0xD3 */
+		typedef enum
+		{
+			SH_SHL = 4,
+			SH_SHR = 5,
+			SH_SAR = 7
+		}
+		ShiftOp;
+
+		/* memory operand: [base + index*scale + disp] */
+		struct Mem {
+			Mem(Register base, int disp=0) :
+				base(base), index(NoIndex), scale(0), disp(disp) {}
+			Mem(Register base, Register index, int scale, int disp=0) :
+				base(base), index(index), scale(scale), disp(disp) {}
+
+			Register base;
+			Register index;
+			int scale; // log2 of the scale factor
+			int disp;
+		};
+
+		X64Assembler() : mBuffer(NULL), mSize(0) {}
+
+		void setBuffer(unsigned char *buffer) { mBuffer = buffer; mSize = 0; }
+		unsigned char *getBuffer() const { return mBuffer; }
+		int getSize() const { return mSize; }
+
+		// 32-bit register/memory forms
+		void MOV(Register rd, const Mem& m);			// mov r32, [m]
+		void MOV(const Mem& m, Register rs);			// mov [m], r32
+		void MOV(Register rd, Register rs);			// mov r32, r32
+		void MOV_imm32(Register rd, int imm32);			// mov r32, imm32
+		void MOV_imm32(const Mem& m, int imm32);		// mov dword [m], imm32
+		void MOVB(const Mem& m, Register rs);			// mov byte [m], r8
+		void MOVW(const Mem& m, Register rs);			// mov word [m], r16
+		void MOVSXB(Register rd, const Mem& m);			// movsx r32, byte [m]
+		void MOVSXW(Register rd, const Mem& m);			// movsx r32, word [m]
+		void MOVSXB(Register rd, Register rs);			// movsx r32, r8
+		void MOVSXW(Register rd, Register rs);			// movsx r32, r16
+
+		void ALU(AluOp op, Register rd, const Mem& m);		// op r32, [m]
+		void ALU(AluOp op, Register rd, Register rs);		// op r32, r32
+		void ALU_imm32(AluOp op, Register rd, int imm32);	// op r32, imm32
+		void IMUL(Register rd, const Mem& m);			// imul r32, [m]
+		void IMUL_imm32(Register rd, Register rs, int imm32);	// imul r32, r32, imm32
+		void SHIFT_CL(ShiftOp op, Register rd);			// op r32, cl
+		void SHIFT_imm8(ShiftOp op, Register rd, int imm8);	// op r32, imm8
+		void NOT(Register rd);
+		void NEG(Register rd);
+		void TEST_rr(Register rd, Register rs);			// test r32, r32
+		void CDQ();
+		void IDIV(Register rs);
+		void DIV(Register rs);
+
+		// 64-bit forms
+		void MOV64_imm64(Register rd, long long imm64);	// mov r64, imm64
+		void ADD64_imm8(Register rd, int imm8);			// add r64, imm8
+		void SUB64_imm8(Register rd, int imm8);			// sub r64, imm8
+		void PUSH(Register r);
+		void POP(Register r);
+
+		// control flow. rel32 is relative to the end of the instruction.
+		void JMP_rel32(int rel32);
+		void JCC_rel32(ConditionCode cc, int rel32);
+		void JCC_rel8(ConditionCode cc, int rel8);
+		void JMP(Register r);					// jmp r64
+		void JMP(const Mem& m);					// jmp qword [m]
+		void CALL(Register r);					// call r64
+		void RET();
+
+		void NOP();
+		void INT3();
+
+		// sizes of the fixed-length jumps, used for computing rel32 values
+		enum {
+			JMP_REL32_SIZE = 5,
+			JCC_REL32_SIZE = 6
+		};
+
+	private:
+		void emit8(int b);
+		void emit32(int i);
+		void emit64(long long l);
+		void emitRex(bool w, int reg, int index, int base, bool force=false);
+		void emitRex(bool w, int reg, const Mem& m, bool force=false);
+		void emitModRM(int reg, const Mem& m);
+		void emitModRM(int reg, Register rm);
+
+		unsigned char *mBuffer;
+		int mSize;
+	};
+
+} // namespace MoSync
+
+#endif	// _X64_ASSEMBLER_H_
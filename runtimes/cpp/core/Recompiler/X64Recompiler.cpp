@@ -0,0 +1,705 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#include "X64Recompiler.h"
+
+#ifdef USE_X64_RECOMPILER
+
+#include <helpers/helpers.h>
+#include <base/base_errors.h>
+using namespace MoSyncError;
+
+using namespace Core;
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+
+// libgcc and libunwind. On Apple, these take a single FDE instead of
+// a whole .eh_frame section.
+extern "C" void __register_frame(void *begin);
+extern "C" void __deregister_frame(void *begin);
+#endif
+
+#define FUNCTION_ALIGNMENT 16 // bytes
+
+// Size of the register save area pushed by the entry stub, plus padding
+// that keeps the native stack 16-byte aligned at every call we generate.
+// 32 bytes of it double as the Win64 shadow space.
+#define FRAME_PADDING 40
+
+#ifdef _WIN64
+#define ARG0 XA::RCX
+#define ARG1 XA::RDX
+#else
+#define ARG0 XA::RDI
+#define ARG1 XA::RSI
+#endif
+
+// Space reserved after the code for the unwind tables.
+#define UNWIND_INFO_SIZE 256
+#define UNWIND_INFO_OFFSET(codeSize) (((codeSize) + 7) & ~7)
+#define CODE_MEMORY_SIZE(codeSize) (UNWIND_INFO_OFFSET(codeSize) + UNWIND_INFO_SIZE)
+
+#define NATIVE_OFFSET(address) ((int)mNativeMap[(address) & mEnvironment.codeMask])
+
+namespace MoSync {
+
+	const XA::Register X64Recompiler::sSavedRegisters[NUM_SAVED_REGISTERS] = {
+		XA::RBX, XA::RBP, XA::R12, XA::R13, XA::R14, XA::R15, XA::RDI, XA::RSI
+	};
+
+	// The memory is not executable until protectCodeMemory() is called.
+	void* X64Recompiler::allocateCodeMemory(int size) {
+#ifdef _WIN32
+		return VirtualAlloc(NULL, size, MEM_COMMIT, PAGE_READWRITE);
+#else
+		void *mem = mmap(NULL, size, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if(mem == MAP_FAILED)
+			return NULL;
+		return mem;
+#endif
+	}
+
+	void X64Recompiler::freeCodeMemory(void *addr, int size) {
+#ifdef _WIN32
+		VirtualFree(addr, 0, MEM_RELEASE);
+#else
+		munmap(addr, size);
+#endif
+	}
+
+	// Makes the memory executable and read-only.
+	void X64Recompiler::protectCodeMemory(void *addr, int size) {
+#ifdef _WIN32
+		DWORD oldProtect;
+		if(!VirtualProtect(addr, size, PAGE_EXECUTE_READ, &oldProtect))
+			BIG_PHAT_ERROR(ERR_OOM);
+		FlushInstructionCache(GetCurrentProcess(), addr, size);
+#else
+		if(mprotect(addr, size, PROT_READ|PROT_EXEC) != 0)
+			BIG_PHAT_ERROR(ERR_OOM);
+#endif
+	}
+
+	//****************************************
+	// Unwind info
+	//****************************************
+
+#ifdef _WIN64
+#define UWOP_PUSH_NONVOL 0
+#define UWOP_ALLOC_SMALL 2
+
+	// One RUNTIME_FUNCTION covering all the code, followed by its
+	// UNWIND_INFO. Unwind codes are listed in reverse prologue order.
+	void X64Recompiler::registerUnwindInfo() {
+		mUnwindInfo = mCode + UNWIND_INFO_OFFSET(mCodeSize);
+		RUNTIME_FUNCTION *func = (RUNTIME_FUNCTION*)mUnwindInfo;
+		unsigned char *p = (unsigned char*)(func + 1);
+		func->BeginAddress = 0;
+		func->EndAddress = mCodeSize;
+		func->UnwindData = (DWORD)(p - mCode);
+		*p++ = 1;	// version 1, no flags
+		*p++ = (unsigned char)mPrologueEnd;
+		*p++ = NUM_SAVED_REGISTERS + 1;
+		*p++ = 0;	// no frame register
+		*p++ = (unsigned char)mPrologueEnd;
+		*p++ = UWOP_ALLOC_SMALL | (((FRAME_PADDING - 8) / 8) << 4);
+		for(int i = NUM_SAVED_REGISTERS - 1; i >= 0; i--) {
+			*p++ = (unsigned char)mPushEnd[i];
+			*p++ = UWOP_PUSH_NONVOL | (sSavedRegisters[i] << 4);
+		}
+		DEBUG_ASSERT(p - mUnwindInfo <= UNWIND_INFO_SIZE);
+		if(!RtlAddFunctionTable(func, 1, (DWORD64)mCode))
+			BIG_PHAT_ERROR(ERR_OOM);
+	}
+
+	void X64Recompiler::unregisterUnwindInfo() {
+		RtlDeleteFunctionTable((RUNTIME_FUNCTION*)mUnwindInfo);
+	}
+#else
+#define DW_CFA_advance_loc 0x40
+#define DW_CFA_offset 0x80
+#define DW_CFA_def_cfa 0x0c
+#define DW_CFA_def_cfa_offset 0x0e
+#define DW_CFA_nop 0x00
+
+#define DW_REG_RSP 7
+#define DW_REG_RA 16
+
+	// DWARF numbers the first eight registers differently from the
+	// instruction encoding.
+	static const unsigned char sDwarfRegisters[16] = {
+		0, 2, 1, 3, 7, 6, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15
+	};
+
+	static unsigned char* put32(unsigned char *p, unsigned int i) {
+		memcpy(p, &i, sizeof(i));
+		return p + sizeof(i);
+	}
+
+	static unsigned char* put64(unsigned char *p, unsigned long long l) {
+		memcpy(p, &l, sizeof(l));
+		return p + sizeof(l);
+	}
+
+	// Pads the CIE or FDE starting at entry to a multiple of 8 bytes
+	// and fills in its length.
+	static unsigned char* finishEntry(unsigned char *entry, unsigned char *p) {
+		while(((p - entry) & 7) != 0)
+			*p++ = DW_CFA_nop;
+		put32(entry, (unsigned int)(p - entry - 4));
+		return p;
+	}
+
+	// An .eh_frame section with one CIE and one FDE covering all the code.
+	// The FDE describes the entry stub's prologue; after it, the CFA stays
+	// at a fixed offset from rsp, as the generated code never pushes.
+	void X64Recompiler::registerUnwindInfo() {
+		mUnwindInfo = mCode + UNWIND_INFO_OFFSET(mCodeSize);
+		unsigned char *cie = mUnwindInfo;
+		unsigned char *p = cie + 4;
+		p = put32(p, 0);	// CIE id
+		*p++ = 1;	// version
+		*p++ = 0;	// no augmentation
+		*p++ = 1;	// code alignment factor
+		*p++ = 0x78;	// data alignment factor, -8 in SLEB128
+		*p++ = DW_REG_RA;
+		*p++ = DW_CFA_def_cfa; *p++ = DW_REG_RSP; *p++ = 8;
+		*p++ = DW_CFA_offset | DW_REG_RA; *p++ = 1;
+		p = finishEntry(cie, p);
+
+		unsigned char *fde = p;
+		p += 4;
+		p = put32(p, (unsigned int)(p - cie));	// CIE pointer
+		p = put64(p, (size_t)mCode);
+		p = put64(p, mCodeSize);
+		int loc = 0;
+		int cfaOffset = 8;
+		for(int i = 0; i < NUM_SAVED_REGISTERS; i++) {
+			DEBUG_ASSERT(mPushEnd[i] - loc < 64);
+			*p++ = DW_CFA_advance_loc | (mPushEnd[i] - loc);
+			loc = mPushEnd[i];
+			cfaOffset += 8;
+			*p++ = DW_CFA_def_cfa_offset; *p++ = cfaOffset;
+			*p++ = DW_CFA_offset | sDwarfRegisters[sSavedRegisters[i]]; *p++ = cfaOffset / 8;
+		}
+		*p++ = DW_CFA_advance_loc | (mPrologueEnd - loc);
+		*p++ = DW_CFA_def_cfa_offset; *p++ = cfaOffset + FRAME_PADDING;
+		p = finishEntry(fde, p);
+		p = put32(p, 0);	// terminator
+		DEBUG_ASSERT(p - mUnwindInfo <= UNWIND_INFO_SIZE);
+
+#ifdef __APPLE__
+		__register_frame(fde);
+#else
+		__register_frame(cie);
+#endif
+	}
+
+	void X64Recompiler::unregisterUnwindInfo() {
+#ifdef __APPLE__
+		// the FDE follows the CIE
+		unsigned int cieLength;
+		memcpy(&cieLength, mUnwindInfo, sizeof(cieLength));
+		__deregister_frame(mUnwindInfo + 4 + cieLength);
+#else
+		__deregister_frame(mUnwindInfo);
+#endif
+	}
+#endif	//_WIN64
+
+	//****************************************
+	// Runtime helpers, called from generated code
+	//****************************************
+
+	void X64Recompiler::invokeSyscall(Core::VMCore *core, int id) {
+		core->invokeSysCall(id);
+	}
+
+	void X64Recompiler::illegalJump() {
+		BIG_PHAT_ERROR(ERR_IMEM_OOB);
+	}
+
+	void X64Recompiler::divisionByZero() {
+		BIG_PHAT_ERROR(ERR_DIVISION_BY_ZERO);
+	}
+
+	void X64Recompiler::generateCall(void *func) {
+		assm.MOV64_imm64(XA::RAX, (long long)(size_t)func);
+		assm.CALL(XA::RAX);
+	}
+
+	// The entry stub sits at offset 0, followed by the shared exit and
+	// error stubs. Entry is called as int entry(void* nativeTarget).
+	void X64Recompiler::generateStubs() {
+		for(int i = 0; i < NUM_SAVED_REGISTERS; i++) {
+			assm.PUSH(sSavedRegisters[i]);
+			mPushEnd[i] = assm.getSize();
+		}
+		assm.SUB64_imm8(XA::RSP, FRAME_PADDING);
+		mPrologueEnd = assm.getSize();
+		assm.MOV64_imm64(XA::RBX, (long long)(size_t)mEnvironment.regs);
+		assm.MOV64_imm64(XA::R12, (long long)(size_t)mEnvironment.mem_ds);
+		assm.MOV64_imm64(XA::R14, (long long)(size_t)mNativeMap);
+		assm.JMP(ARG0);
+
+		// eax holds the MoSync address to resume from.
+		mExitOffset = assm.getSize();
+		assm.ADD64_imm8(XA::RSP, FRAME_PADDING);
+		for(int i = NUM_SAVED_REGISTERS - 1; i >= 0; i--)
+			assm.POP(sSavedRegisters[i]);
+		assm.RET();
+
+		mIllegalJumpOffset = assm.getSize();
+		generateCall((void*)&X64Recompiler::illegalJump);
+		assm.INT3();
+
+		mDivisionByZeroOffset = assm.getSize();
+		generateCall((void*)&X64Recompiler::divisionByZero);
+		assm.INT3();
+	}
+
+	//****************************************
+	// Code generation helpers
+	//****************************************
+
+	void X64Recompiler::arithmetic(XA::AluOp op, int rd, int rs) {
+		loadRegister(XA::RAX, rd);
+		assm.ALU(op, XA::RAX, reg(rs));
+		saveRegister(rd, XA::RAX);
+	}
+
+	void X64Recompiler::arithmeticImm(XA::AluOp op, int rd, int imm32) {
+		loadRegister(XA::RAX, rd);
+		assm.ALU_imm32(op, XA::RAX, imm32);
+		saveRegister(rd, XA::RAX);
+	}
+
+	void X64Recompiler::shift(XA::ShiftOp op, int rd, int rs) {
+		loadRegister(XA::RCX, rs);
+		loadRegister(XA::RAX, rd);
+		assm.SHIFT_CL(op, XA::RAX);
+		saveRegister(rd, XA::RAX);
+	}
+
+	void X64Recompiler::shiftImm(XA::ShiftOp op, int rd, int imm8) {
+		loadRegister(XA::RAX, rd);
+		assm.SHIFT_imm8(op, XA::RAX, imm8 & 31);
+		saveRegister(rd, XA::RAX);
+	}
+
+	void X64Recompiler::divide(int rd, int rs, bool isSigned) {
+		loadRegister(XA::RCX, rs);
+		assm.TEST_rr(XA::RCX, XA::RCX);
+		assm.JCC_rel32(XA::E, mDivisionByZeroOffset - (assm.getSize() + XA::JCC_REL32_SIZE));
+		loadRegister(XA::RAX, rd);
+		if(isSigned) {
+			assm.CDQ();
+			assm.IDIV(XA::RCX);
+		} else {
+			assm.ALU(XA::OP_XOR, XA::RDX, XA::RDX);
+			assm.DIV(XA::RCX);
+		}
+		saveRegister(rd, XA::RAX);
+	}
+
+	void X64Recompiler::divideImm(int rd, int imm32, bool isSigned) {
+		if(imm32 == 0) {
+			assm.JMP_rel32(mDivisionByZeroOffset - (assm.getSize() + XA::JMP_REL32_SIZE));
+			return;
+		}
+		assm.MOV_imm32(XA::RCX, imm32);
+		loadRegister(XA::RAX, rd);
+		if(isSigned) {
+			assm.CDQ();
+			assm.IDIV(XA::RCX);
+		} else {
+			assm.ALU(XA::OP_XOR, XA::RDX, XA::RDX);
+			assm.DIV(XA::RCX);
+		}
+		saveRegister(rd, XA::RAX);
+	}
+
+	// rax = (msReg + imm32) & dataMask & ~(size - 1), the same as RECOMP_MEMREF.
+	void X64Recompiler::memoryAddress(int msReg, int imm32, int size) {
+		loadRegister(XA::RAX, msReg);
+		if(imm32 != 0)
+			assm.ALU_imm32(XA::OP_ADD, XA::RAX, imm32);
+		assm.ALU_imm32(XA::OP_AND, XA::RAX, mEnvironment.dataMask & ~(size - 1));
+	}
+
+	void X64Recompiler::jumpTo(int address) {
+		assm.JMP_rel32(NATIVE_OFFSET(address) - (assm.getSize() + XA::JMP_REL32_SIZE));
+	}
+
+	void X64Recompiler::jumpIf(XA::ConditionCode cc, int rd, int rs, int address) {
+		loadRegister(XA::RAX, rd);
+		assm.ALU(XA::OP_CMP, XA::RAX, reg(rs));
+		assm.JCC_rel32(cc, NATIVE_OFFSET(address) - (assm.getSize() + XA::JCC_REL32_SIZE));
+	}
+
+	// jumps to the MoSync address in eax.
+	void X64Recompiler::jumpIndirect() {
+		assm.ALU_imm32(XA::OP_AND, XA::RAX, mEnvironment.codeMask);
+		assm.JMP(XA::Mem(XA::R14, XA::RAX, 3));
+	}
+
+	void X64Recompiler::callTo(int address) {
+		int returnAddr = mInstructions[0].ip + mInstructions[0].length;
+		assm.MOV_imm32(reg(REG_rt), returnAddr);
+		jumpTo(address);
+	}
+
+	//****************************************
+	// Instruction visitors
+	//****************************************
+
+	void X64Recompiler::visit_PUSH() {
+		byte rd = mInstructions[0].rd;
+		int n = mInstructions[0].imm;
+
+		loadRegister(XA::RAX, REG_sp);
+		for(int i = rd; i < rd + n; i++) {
+			assm.ALU_imm32(XA::OP_SUB, XA::RAX, 4);
+			assm.MOV(XA::RDX, XA::RAX);
+			assm.ALU_imm32(XA::OP_AND, XA::RDX, mEnvironment.dataMask & ~3);
+			loadRegister(XA::RCX, i);
+			assm.MOV(XA::Mem(XA::R12, XA::RDX, 0), XA::RCX);
+		}
+		saveRegister(REG_sp, XA::RAX);
+	}
+
+	void X64Recompiler::visit_POP() {
+		byte rd = mInstructions[0].rd;
+		int n = mInstructions[0].imm;
+
+		loadRegister(XA::RAX, REG_sp);
+		for(int i = rd; i > rd - n; i--) {
+			assm.MOV(XA::RDX, XA::RAX);
+			assm.ALU_imm32(XA::OP_AND, XA::RDX, mEnvironment.dataMask & ~3);
+			assm.MOV(XA::RCX, XA::Mem(XA::R12, XA::RDX, 0));
+			saveRegister(i, XA::RCX);
+			assm.ALU_imm32(XA::OP_ADD, XA::RAX, 4);
+		}
+		saveRegister(REG_sp, XA::RAX);
+	}
+
+	void X64Recompiler::visit_CALL() {
+		int returnAddr = mInstructions[0].ip + mInstructions[0].length;
+		loadRegister(XA::RAX, mInstructions[0].rd);
+		assm.MOV_imm32(reg(REG_rt), returnAddr);
+		jumpIndirect();
+	}
+
+	void X64Recompiler::visit_CALLI() {
+		callTo(mInstructions[0].imm);
+	}
+
+	void X64Recompiler::visit_LDB() {
+		memoryAddress(mInstructions[0].rs, mInstructions[0].imm, sizeof(char));
+		assm.MOVSXB(XA::RAX, XA::Mem(XA::R12, XA::RAX, 0));
+		saveRegister(mInstructions[0].rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_STB() {
+		memoryAddress(mInstructions[0].rd, mInstructions[0].imm, sizeof(char));
+		loadRegister(XA::RCX, mInstructions[0].rs);
+		assm.MOVB(XA::Mem(XA::R12, XA::RAX, 0), XA::RCX);
+	}
+
+	void X64Recompiler::visit_LDH() {
+		memoryAddress(mInstructions[0].rs, mInstructions[0].imm, sizeof(short));
+		assm.MOVSXW(XA::RAX, XA::Mem(XA::R12, XA::RAX, 0));
+		saveRegister(mInstructions[0].rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_STH() {
+		memoryAddress(mInstructions[0].rd, mInstructions[0].imm, sizeof(short));
+		loadRegister(XA::RCX, mInstructions[0].rs);
+		assm.MOVW(XA::Mem(XA::R12, XA::RAX, 0), XA::RCX);
+	}
+
+	void X64Recompiler::visit_LDW() {
+		memoryAddress(mInstructions[0].rs, mInstructions[0].imm, sizeof(int));
+		assm.MOV(XA::RAX, XA::Mem(XA::R12, XA::RAX, 0));
+		saveRegister(mInstructions[0].rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_STW() {
+		memoryAddress(mInstructions[0].rd, mInstructions[0].imm, sizeof(int));
+		loadRegister(XA::RCX, mInstructions[0].rs);
+		assm.MOV(XA::Mem(XA::R12, XA::RAX, 0), XA::RCX);
+	}
+
+	void X64Recompiler::visit_LDI() {
+		assm.MOV_imm32(reg(mInstructions[0].rd), mInstructions[0].imm);
+	}
+
+	void X64Recompiler::visit_LDR() {
+		loadRegister(XA::RAX, mInstructions[0].rs);
+		saveRegister(mInstructions[0].rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_ADD() { arithmetic(XA::OP_ADD, mInstructions[0].rd, mInstructions[0].rs); }
+	void X64Recompiler::visit_ADDI() { arithmeticImm(XA::OP_ADD, mInstructions[0].rd, mInstructions[0].imm); }
+	void X64Recompiler::visit_SUB() { arithmetic(XA::OP_SUB, mInstructions[0].rd, mInstructions[0].rs); }
+	void X64Recompiler::visit_SUBI() { arithmeticImm(XA::OP_SUB, mInstructions[0].rd, mInstructions[0].imm); }
+	void X64Recompiler::visit_AND() { arithmetic(XA::OP_AND, mInstructions[0].rd, mInstructions[0].rs); }
+	void X64Recompiler::visit_ANDI() { arithmeticImm(XA::OP_AND, mInstructions[0].rd, mInstructions[0].imm); }
+	void X64Recompiler::visit_OR() { arithmetic(XA::OP_OR, mInstructions[0].rd, mInstructions[0].rs); }
+	void X64Recompiler::visit_ORI() { arithmeticImm(XA::OP_OR, mInstructions[0].rd, mInstructions[0].imm); }
+	void X64Recompiler::visit_XOR() { arithmetic(XA::OP_XOR, mInstructions[0].rd, mInstructions[0].rs); }
+	void X64Recompiler::visit_XORI() { arithmeticImm(XA::OP_XOR, mInstructions[0].rd, mInstructions[0].imm); }
+
+	void X64Recompiler::visit_MUL() {
+		byte rd = mInstructions[0].rd;
+		loadRegister(XA::RAX, rd);
+		assm.IMUL(XA::RAX, reg(mInstructions[0].rs));
+		saveRegister(rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_MULI() {
+		byte rd = mInstructions[0].rd;
+		loadRegister(XA::RAX, rd);
+		assm.IMUL_imm32(XA::RAX, XA::RAX, mInstructions[0].imm);
+		saveRegister(rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_DIVU() { divide(mInstructions[0].rd, mInstructions[0].rs, false); }
+	void X64Recompiler::visit_DIVUI() { divideImm(mInstructions[0].rd, mInstructions[0].imm, false); }
+	void X64Recompiler::visit_DIV() { divide(mInstructions[0].rd, mInstructions[0].rs, true); }
+	void X64Recompiler::visit_DIVI() { divideImm(mInstructions[0].rd, mInstructions[0].imm, true); }
+
+	void X64Recompiler::visit_SLL() { shift(XA::SH_SHL, mInstructions[0].rd, mInstructions[0].rs); }
+	void X64Recompiler::visit_SLLI() { shiftImm(XA::SH_SHL, mInstructions[0].rd, mInstructions[0].imm); }
+	void X64Recompiler::visit_SRA() { shift(XA::SH_SAR, mInstructions[0].rd, mInstructions[0].rs); }
+	void X64Recompiler::visit_SRAI() { shiftImm(XA::SH_SAR, mInstructions[0].rd, mInstructions[0].imm); }
+	void X64Recompiler::visit_SRL() { shift(XA::SH_SHR, mInstructions[0].rd, mInstructions[0].rs); }
+	void X64Recompiler::visit_SRLI() { shiftImm(XA::SH_SHR, mInstructions[0].rd, mInstructions[0].imm); }
+
+	void X64Recompiler::visit_NOT() {
+		loadRegister(XA::RAX, mInstructions[0].rs);
+		assm.NOT(XA::RAX);
+		saveRegister(mInstructions[0].rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_NEG() {
+		loadRegister(XA::RAX, mInstructions[0].rs);
+		assm.NEG(XA::RAX);
+		saveRegister(mInstructions[0].rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_RET() {
+		loadRegister(XA::RAX, REG_rt);
+		jumpIndirect();
+	}
+
+	void X64Recompiler::visit_JC_EQ() { jumpIf(XA::E, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_NE() { jumpIf(XA::NE, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_GE() { jumpIf(XA::GE, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_GEU() { jumpIf(XA::AE, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_GT() { jumpIf(XA::G, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_GTU() { jumpIf(XA::A, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_LE() { jumpIf(XA::LE, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_LEU() { jumpIf(XA::BE, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_LT() { jumpIf(XA::L, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+	void X64Recompiler::visit_JC_LTU() { jumpIf(XA::B, mInstructions[0].rd, mInstructions[0].rs, mInstructions[0].imm); }
+
+	void X64Recompiler::visit_JPI() {
+		jumpTo(mInstructions[0].imm);
+	}
+
+	void X64Recompiler::visit_JPR() {
+		loadRegister(XA::RAX, mInstructions[0].rd);
+		jumpIndirect();
+	}
+
+	void X64Recompiler::visit_XB() {
+		loadRegister(XA::RAX, mInstructions[0].rs);
+		assm.MOVSXB(XA::RAX, XA::RAX);
+		saveRegister(mInstructions[0].rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_XH() {
+		loadRegister(XA::RAX, mInstructions[0].rs);
+		assm.MOVSXW(XA::RAX, XA::RAX);
+		saveRegister(mInstructions[0].rd, XA::RAX);
+	}
+
+	void X64Recompiler::visit_SYSCALL() {
+		int returnAddr = mInstructions[0].ip + mInstructions[0].length;
+
+		assm.MOV64_imm64(ARG0, (long long)(size_t)mEnvironment.core);
+		assm.MOV_imm32(ARG1, mInstructions[0].imm);
+		generateCall((void*)&X64Recompiler::invokeSyscall);
+
+		// if(VM_Yield) return returnAddr;
+		assm.MOV64_imm64(XA::RAX, (long long)(size_t)mEnvironment.VM_Yield);
+		assm.MOV(XA::RCX, XA::Mem(XA::RAX));
+		assm.TEST_rr(XA::RCX, XA::RCX);
+		// skip the 5-byte MOV_imm32 and the 5-byte JMP_rel32 below.
+		assm.JCC_rel8(XA::E, 5 + XA::JMP_REL32_SIZE);
+		assm.MOV_imm32(XA::RAX, returnAddr);
+		assm.JMP_rel32(mExitOffset - (assm.getSize() + XA::JMP_REL32_SIZE));
+	}
+
+	void X64Recompiler::visit_CASE() {
+		byte rd = mInstructions[0].rd;
+		uint imm32 = mInstructions[0].imm;
+
+		imm32 <<= 2;
+		uint CaseStart = RECOMP_MEM(int, imm32, READ);
+		uint CaseLength = RECOMP_MEM(int, imm32 + 1*sizeof(int), READ);
+		int DefaultCaseAddress = RECOMP_MEM(int, imm32 + 2*sizeof(int), READ);
+		int tableAddress = imm32 + 3*sizeof(int);
+
+		loadRegister(XA::RAX, rd);
+		assm.ALU_imm32(XA::OP_SUB, XA::RAX, CaseStart);
+		assm.ALU_imm32(XA::OP_CMP, XA::RAX, CaseLength);
+		assm.JCC_rel32(XA::A, NATIVE_OFFSET(DefaultCaseAddress) -
+			(assm.getSize() + XA::JCC_REL32_SIZE));
+		assm.MOV(XA::RAX, XA::Mem(XA::R12, XA::RAX, 2, tableAddress));
+		jumpIndirect();
+	}
+
+	void X64Recompiler::visit_FAR() {
+		int op = mInstructions[0].op2;
+		byte rd = mInstructions[0].rd;
+		byte rs = mInstructions[0].rs;
+		int imm32 = mInstructions[0].imm;
+
+		switch(op) {
+			case _CALLI:	callTo(imm32); break;
+
+			case _JC_EQ:	jumpIf(XA::E, rd, rs, imm32); break;
+			case _JC_NE:	jumpIf(XA::NE, rd, rs, imm32); break;
+			case _JC_GE:	jumpIf(XA::GE, rd, rs, imm32); break;
+			case _JC_GT:	jumpIf(XA::G, rd, rs, imm32); break;
+			case _JC_LE:	jumpIf(XA::LE, rd, rs, imm32); break;
+			case _JC_LT:	jumpIf(XA::L, rd, rs, imm32); break;
+			case _JC_LTU:	jumpIf(XA::B, rd, rs, imm32); break;
+			case _JC_GEU:	jumpIf(XA::AE, rd, rs, imm32); break;
+			case _JC_GTU:	jumpIf(XA::A, rd, rs, imm32); break;
+			case _JC_LEU:	jumpIf(XA::BE, rd, rs, imm32); break;
+
+			case _JPI:	jumpTo(imm32); break;
+
+			default:
+				assm.JMP_rel32(mIllegalJumpOffset - (assm.getSize() + XA::JMP_REL32_SIZE));
+		}
+	}
+
+	//****************************************
+	// Passes
+	//****************************************
+
+#define SETUP_DEFAULT_VISITOR_ELEM(inst) defaultVisitors[_##inst] = &X64Recompiler::visit_##inst;
+
+	X64Recompiler::X64Recompiler() :
+		Recompiler<X64Recompiler>(2),
+		mCode(NULL),
+		mCodeSize(0),
+		mUnwindInfo(NULL),
+		mNativeMap(NULL) {
+		mInstructions = NULL;
+		INSTRUCTIONS(SETUP_DEFAULT_VISITOR_ELEM);
+	}
+
+	// The first pass only measures the code and records the offset of every
+	// instruction. The second pass emits into writable memory, using those
+	// offsets for all jump displacements, then makes it executable.
+	void X64Recompiler::beginPass() {
+		if(mPass == 1) {
+			assm.setBuffer(NULL);
+			generateStubs();
+			for(uint i = 0; i <= (uint)mEnvironment.codeMask; i++)
+				mNativeMap[i] = mIllegalJumpOffset;
+		} else {
+			mCode = (unsigned char*)allocateCodeMemory(CODE_MEMORY_SIZE(mCodeSize));
+			if(!mCode) BIG_PHAT_ERROR(ERR_OOM);
+			assm.setBuffer(mCode);
+			generateStubs();
+		}
+	}
+
+	void X64Recompiler::endPass() {
+		if(mPass == 1) {
+			mCodeSize = assm.getSize();
+		} else if(mPass == mNumPasses) {
+			DEBUG_ASSERT(assm.getSize() == mCodeSize);
+			for(uint i = 0; i <= (uint)mEnvironment.codeMask; i++)
+				mNativeMap[i] += (size_t)mCode;
+			registerUnwindInfo();
+			protectCodeMemory(mCode, CODE_MEMORY_SIZE(mCodeSize));
+		}
+	}
+
+	void X64Recompiler::beginInstruction(int ip) {
+		if(mPass == 1)
+			mNativeMap[ip] = assm.getSize();
+	}
+
+	void X64Recompiler::beginFunction(Function *f) {
+		while((assm.getSize() & (FUNCTION_ALIGNMENT-1)) != 0)
+			assm.NOP();
+	}
+
+	void X64Recompiler::endFunction(Function *f) {
+	}
+
+	int X64Recompiler::run(int ip) {
+		if(mStopped) {
+			LOG("Stopped, Recompiling...\n");
+			Recompiler<X64Recompiler>::recompile();
+			LOG("Finished recompiling, %i bytes of native code.\n", mCodeSize);
+			mStopped = false;
+		}
+		*mEnvironment.VM_Yield = 0;
+		void *target = (void*)mNativeMap[ip & mEnvironment.codeMask];
+		return ((int (*)(void*))mCode)(target);
+	}
+
+	void X64Recompiler::init(Core::VMCore *core, int *VM_Yield) {
+		Recompiler<X64Recompiler>::init(core, VM_Yield);
+		mNativeMap = new size_t[mEnvironment.codeMask + 1];
+		mInstructions = new Instruction[mInstructionsToFetch];
+		mStopped = true;
+	}
+
+	void X64Recompiler::close() {
+		Recompiler<X64Recompiler>::close();
+		assm.setBuffer(NULL);
+		if(mUnwindInfo) {
+			unregisterUnwindInfo();
+			mUnwindInfo = NULL;
+		}
+		if(mCode) {
+			freeCodeMemory(mCode, CODE_MEMORY_SIZE(mCodeSize));
+			mCode = NULL;
+		}
+		if(mNativeMap) {
+			delete[] mNativeMap;
+			mNativeMap = NULL;
+		}
+	}
+
+} // namespace MoSync
+
+#endif	//USE_X64_RECOMPILER
@@ -0,0 +1,130 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#ifndef _X64_RECOMPILER_H_
+#define _X64_RECOMPILER_H_
+
+#include "Recompiler.h"
+
+#ifdef USE_X64_RECOMPILER
+
+#include "X64Assembler.h"
+typedef MoSync::X64Assembler XA;
+
+namespace MoSync {
+
+	/**
+	 * Recompiles MoSync bytecode to x86-64 machine code.
+	 *
+	 * All MoSync registers stay in Core::VMCore::regs, which is addressed
+	 * through rbx. The data segment base is kept in r12 and the table that
+	 * maps MoSync code addresses to native code in r14. Memory references
+	 * are masked like RECOMP_MEMREF, so the generated code can never touch
+	 * memory outside the data segment.
+	 *
+	 * run() takes and returns MoSync code addresses. The generated code
+	 * returns to run() after any syscall that sets VM_Yield, with the
+	 * address of the instruction following the syscall.
+	 *
+	 * Syscalls may throw, for instance the ReloadException of MoRE, so the
+	 * code is registered with the platform's unwinder, as a single function
+	 * whose frame is set up by the entry stub. The code memory is writable
+	 * only while the code is emitted.
+	 */
+	class X64Recompiler : public Recompiler <X64Recompiler> {
+	public:
+		friend class Recompiler<X64Recompiler>;
+
+		X64Recompiler();
+
+		void* allocateCodeMemory(int size);
+		void freeCodeMemory(void *addr, int size);
+		void protectCodeMemory(void *addr, int size);
+
+		int run(int ip);
+		void init(Core::VMCore *core, int *VM_Yield);
+		void close();
+
+	protected:
+		void beginInstruction(int ip);
+
+		void beginPass();
+		void endPass();
+		void beginFunction(Function *f);
+		void endFunction(Function *f);
+
+		// declare instruction visitors, so that you get
+		// a compilation errors if you have unimplemented visitors.
+		INSTRUCTIONS(DECLARE_DEFAULT_VISITOR_ELEM)
+
+		void generateStubs();
+		void registerUnwindInfo();
+		void unregisterUnwindInfo();
+		void generateCall(void *func);
+
+		XA::Mem reg(int msReg) const { return XA::Mem(XA::RBX, msReg * 4); }
+		void loadRegister(XA::Register xr, int msReg) { assm.MOV(xr, reg(msReg)); }
+		void saveRegister(int msReg, XA::Register xr) { assm.MOV(reg(msReg), xr); }
+
+		void arithmetic(XA::AluOp op, int rd, int rs);
+		void arithmeticImm(XA::AluOp op, int rd, int imm32);
+		void shift(XA::ShiftOp op, int rd, int rs);
+		void shiftImm(XA::ShiftOp op, int rd, int imm8);
+		void divide(int rd, int rs, bool isSigned);
+		void divideImm(int rd, int imm32, bool isSigned);
+		void memoryAddress(int msReg, int imm32, int size);
+		void jumpTo(int address);
+		void jumpIf(XA::ConditionCode cc, int rd, int rs, int address);
+		void jumpIndirect();
+		void callTo(int address);
+
+		static void invokeSyscall(Core::VMCore *core, int id);
+		static void illegalJump();
+		static void divisionByZero();
+
+		XA assm;
+
+		unsigned char *mCode;
+		int mCodeSize;
+
+		// Unwind tables, stored in the code memory after the code.
+		// NULL until they are registered.
+		unsigned char *mUnwindInfo;
+
+		// Callee-saved registers, pushed by the entry stub.
+		enum { NUM_SAVED_REGISTERS = 8 };
+		static const XA::Register sSavedRegisters[NUM_SAVED_REGISTERS];
+
+		// Code offsets of the end of each register push, and of the whole
+		// prologue, in the entry stub.
+		int mPushEnd[NUM_SAVED_REGISTERS];
+		int mPrologueEnd;
+
+		// Indexed by MoSync code address. Holds offsets into the generated
+		// code during recompilation, then absolute addresses.
+		size_t *mNativeMap;
+
+		int mExitOffset;
+		int mIllegalJumpOffset;
+		int mDivisionByZeroOffset;
+	};
+
+} // namespace MoSync
+
+#endif	//USE_X64_RECOMPILER
+
+#endif	//_X64_RECOMPILER_H_
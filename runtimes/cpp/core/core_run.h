@@ -24,9 +24,20 @@ struct InstructionBucket {
 
 std::vector<InstructionBucket> gInstructionUseCount;
 
+// Sequence counts, indexed by opcode, for choosing superinstructions.
+// Superinstructions are counted as their parts, so that a profile taken with
+// a fused program is equivalent to one taken without.
+std::vector<int> gInstructionPairCount;
+std::vector<int> gInstructionTripleCount;
+int gPrevOp, gPrevPrevOp;
+
 void countInstructionUse(const char* opName, byte x) {
 	gInstructionUseCount[x].count++;
 	gInstructionUseCount[x].opName = opName;
+	gInstructionPairCount[gPrevOp * _ENDOP + x]++;
+	gInstructionTripleCount[(gPrevPrevOp * _ENDOP + gPrevOp) * _ENDOP + x]++;
+	gPrevPrevOp = gPrevOp;
+	gPrevOp = x;
 }
 
 void initInstructionUseCount() {
@@ -36,6 +47,9 @@ void initInstructionUseCount() {
 		gInstructionUseCount[i].count = 0;
 		gInstructionUseCount[i].opName = "UNUSED";
 	}
+	gInstructionPairCount.assign(_ENDOP * _ENDOP, 0);
+	gInstructionTripleCount.assign(_ENDOP * _ENDOP * _ENDOP, 0);
+	gPrevOp = gPrevPrevOp = _NUL;
 }
 
 static bool UDgreater ( InstructionBucket& elem1, InstructionBucket& elem2 )
@@ -45,6 +59,10 @@ static bool UDgreater ( InstructionBucket& elem1, InstructionBucket& elem2 )
 
 
 void logInstructionUse() {
+#define INSTRUCTION_NAME_ELEM(inst) #inst,
+	static const char* const names[_ENDOP] = { "NUL", INSTRUCTIONS(INSTRUCTION_NAME_ELEM) };
+#undef INSTRUCTION_NAME_ELEM
+
 	std::sort(gInstructionUseCount.begin(),
 		gInstructionUseCount.end(), &Core::VMCoreInt::UDgreater);
 
@@ -54,14 +72,113 @@ void logInstructionUse() {
 		int len = sprintf(temp, "inst %s: %d\n", gInstructionUseCount[i].opName, gInstructionUseCount[i].count);
 		use.write(temp, len);
 	}
+	for(int i = 0; i < _ENDOP * _ENDOP; i++) {
+		if(gInstructionPairCount[i] == 0)
+			continue;
+		int len = sprintf(temp, "pair %s %s: %d\n", names[i / _ENDOP], names[i % _ENDOP],
+			gInstructionPairCount[i]);
+		use.write(temp, len);
+	}
+	for(int i = 0; i < _ENDOP * _ENDOP * _ENDOP; i++) {
+		if(gInstructionTripleCount[i] == 0)
+			continue;
+		int len = sprintf(temp, "triple %s %s %s: %d\n", names[i / (_ENDOP * _ENDOP)],
+			names[(i / _ENDOP) % _ENDOP], names[i % _ENDOP], gInstructionTripleCount[i]);
+		use.write(temp, len);
+	}
 }
 #else
 #define countInstruction(x)
 #endif
 
+// Instruction bodies that are shared by superinstructions.
+#ifndef I_ADD
+#define I_ADD	FETCH_RD_RS	ARITH(rd, RD, +, RS);
+#define I_ADDI	FETCH_RD_CONST	ARITH(rd, RD, +, IMM);
+#define I_SUB	FETCH_RD_RS	ARITH(rd, RD, -, RS);
+#define I_SUBI	FETCH_RD_CONST	ARITH(rd, RD, -, IMM);
+#define I_LDI	FETCH_RD_CONST	WRITE_REG(rd, IMM);
+#define I_LDR	FETCH_RD_RS	WRITE_REG(rd, RS);
+#define I_RET	JMP_GENERIC(REG(REG_rt)); fakePop();
+#define I_JC_NE	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RD != RS)
+#define I_JC_LT	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RD < RS)
+
+#define I_LDW\
+		{\
+			FETCH_RD_RS_CONST\
+			WRITE_REG(rd, MEM(int32_t, RS + IMM, READ));\
+			LOGC("\t%i", RD);\
+		}
+
+#define I_STW\
+		{\
+			FETCH_RD_RS_CONST\
+			MEM(unsigned int, RD + IMM, WRITE) = RS;\
+		}
+
+#define I_PUSH	FETCH_RD_IMM8\
+		{\
+			byte r = rd;\
+			unsigned n = imm32;\
+			if(rd < 2 || int(rd) + n > 32) {\
+				DUMPINT(rd);\
+				DUMPINT(n);\
+				BIG_PHAT_ERROR(ERR_ILLEGAL_INSTRUCTION_FORM); /*raise hell*/\
+			}\
+\
+			do {\
+				ARITH(REG_sp, regs[REG_sp], -, 4);\
+				MEM(int32_t, REG(REG_sp), WRITE) = REG(r);\
+				LOGC("\t0x%x", REG(r));\
+				r++;\
+			} while(--n);\
+		}
+
+#define I_POP	FETCH_RD_IMM8\
+		{\
+			byte r = rd;\
+			unsigned n = imm32;\
+			if(rd > 31 || int(rd) - n < 1)\
+				BIG_PHAT_ERROR(ERR_ILLEGAL_INSTRUCTION_FORM); /*raise hell*/\
+\
+			do {\
+				REG(r) = MEM(int32_t, REG(REG_sp), READ);\
+				ARITH(REG_sp, regs[REG_sp], +, 4);\
+				LOGC("\t0x%x", REG(r));\
+				r--;\
+			} while(--n);\
+		}
+#endif	//I_ADD
+
 byte* RUN_NAME(byte* ip) {
+#ifdef USE_THREADED_CODE
+	byte rd,rs;
+	uint32_t imm32;
+	const ThreadedInstruction* ti;
+	const ThreadedInstruction* tp;
+
+#define THREADED_HANDLER_ELEM(inst) &&L_##inst,
+#define THREADED_SUPER_HANDLER_ELEM(name, first, second) &&L_##name,
+#define THREADED_SUPER3_HANDLER_ELEM(name, first, second, third) &&L_##name,
+	static const void* const handlers[] = {
+		&&L_NUL,
+		INSTRUCTIONS(THREADED_HANDLER_ELEM)
+		&&L_ILLEGAL_JUMP,
+		SUPERINSTRUCTIONS(THREADED_SUPER_HANDLER_ELEM)
+		SUPERINSTRUCTIONS3(THREADED_SUPER3_HANDLER_ELEM)
+	};
+#undef THREADED_HANDLER_ELEM
+#undef THREADED_SUPER_HANDLER_ELEM
+#undef THREADED_SUPER3_HANDLER_ELEM
+	if(ip == NULL) {
+		//called by predecodeThreadedCode()
+		mThreadedHandlers = handlers;
+		return NULL;
+	}
+#else
 	byte op,rd,rs;
 	uint32_t imm32;
+#endif	//USE_THREADED_CODE
 
 	VM_Yield = 0;
 
@@ -78,6 +195,11 @@ byte* RUN_NAME(byte* ip) {
 
 	//	printf("VM IP at %d\n",(int32_t) ip - (int32_t) mem_cs);
 
+#ifdef USE_THREADED_CODE
+	JMP_ADDRESS(uint(ip - mem_cs));
+	THREADED_DISPATCH;
+	{
+#else
 #ifndef CORE_DEBUGGING_MODE
 VMLOOP_LABEL
 #endif
@@ -86,6 +208,7 @@ VMLOOP_LABEL
 	IP = uint(ip - mem_cs);
 	//LOG("IP 0x%04X\n", IP);
 #endif
+	COUNT_INSTRUCTION
 
 #ifdef MEMORY_DEBUG
 	InstCount++;
@@ -128,10 +251,11 @@ VMLOOP_LABEL
 
 	switch (op)
 	{
-		OPC(ADD)	FETCH_RD_RS	ARITH(rd, RD, +, RS);	EOP;
-		OPC(ADDI)	FETCH_RD_CONST	ARITH(rd, RD, +, IMM);	EOP;
-		OPC(SUB)	FETCH_RD_RS	ARITH(rd, RD, -, RS);	EOP;
-		OPC(SUBI)	FETCH_RD_CONST	ARITH(rd, RD, -, IMM);	EOP;
+#endif	//USE_THREADED_CODE
+		OPC(ADD)	I_ADD	EOP;
+		OPC(ADDI)	I_ADDI	EOP;
+		OPC(SUB)	I_SUB	EOP;
+		OPC(SUBI)	I_SUBI	EOP;
 		OPC(MUL)	FETCH_RD_RS	ARITH(rd, RD, *, RS);	EOP;
 		OPC(MULI)	FETCH_RD_CONST	ARITH(rd, RD, *, IMM);	EOP;
 		OPC(AND)	FETCH_RD_RS	ARITH(rd, RD, &, RS);	EOP;
@@ -154,42 +278,8 @@ VMLOOP_LABEL
 		OPC(NOT)	FETCH_RD_RS	WRITE_REG(rd, ~RS);	EOP;
 		OPC(NEG)	FETCH_RD_RS	WRITE_REG(rd, -RS);	EOP;
 
-		OPC(PUSH)	FETCH_RD_IMM8
-		{
-			byte r = rd;
-			unsigned n = imm32;
-			if(rd < 2 || int(rd) + n > 32) {
-				DUMPINT(rd);
-				DUMPINT(n);
-				BIG_PHAT_ERROR(ERR_ILLEGAL_INSTRUCTION_FORM); //raise hell
-			}
-
-			do {
-				//REG(REG_sp) -= 4;
-				ARITH(REG_sp, regs[REG_sp], -, 4);
-				MEM(int32_t, REG(REG_sp), WRITE) = REG(r);
-				LOGC("\t0x%x", REG(r));
-				r++;
-			} while(--n);
-		}
-		EOP;
-
-		OPC(POP) FETCH_RD_IMM8
-		{
-			byte r = rd;
-			unsigned n = imm32;
-			if(rd > 31 || int(rd) - n < 1)
-				BIG_PHAT_ERROR(ERR_ILLEGAL_INSTRUCTION_FORM); //raise hell
-
-			do {
-				REG(r) = MEM(int32_t, REG(REG_sp), READ);
-				//REG(REG_sp) += 4;
-				ARITH(REG_sp, regs[REG_sp], +, 4);
-				LOGC("\t0x%x", REG(r));
-				r--;
-			} while(--n);
-		}
-		EOP;
+		OPC(PUSH)	I_PUSH	EOP;
+		OPC(POP)	I_POP	EOP;
 
 		OPC(LDB)
 		{
@@ -207,13 +297,7 @@ VMLOOP_LABEL
 		}
 		EOP;
 
-		OPC(LDW)
-		{
-			FETCH_RD_RS_CONST
-			WRITE_REG(rd, MEM(int32_t, RS + IMM, READ));
-			LOGC("\t%i", RD);
-		}
-		EOP;
+		OPC(LDW)	I_LDW	EOP;
 
 		OPC(STB)
 		{
@@ -229,20 +313,12 @@ VMLOOP_LABEL
 		}
 		EOP;
 
-		OPC(STW)
-		{
-			FETCH_RD_RS_CONST
-			MEM(unsigned int, RD + IMM, WRITE) = RS;
-		}
-		EOP;
+		OPC(STW)	I_STW	EOP;
 
-		OPC(LDI)	FETCH_RD_CONST	WRITE_REG(rd, IMM);	EOP;
-		OPC(LDR)	FETCH_RD_RS	WRITE_REG(rd, RS);	EOP;
+		OPC(LDI)	I_LDI	EOP;
+		OPC(LDR)	I_LDR	EOP;
 
-		OPC(RET)
-			fakePop();
-		JMP_GENERIC(REG(REG_rt));
-		EOP;
+		OPC(RET)	I_RET	EOP;
 
 		OPC(CALL)
 			FETCH_RD
@@ -252,24 +328,25 @@ VMLOOP_LABEL
 		OPC(CALLI)
 			FETCH_IMM16
 			CALL_IMM
-			fakePush(REG(REG_rt), IMM);
+			fakePush(REG(REG_rt), IMM_ADDRESS);
 		EOP;
 
-		OPC(JC_EQ) 	FETCH_RD_RS_ADDR16	if (RD == RS)	{ JMP_IMM; } 	EOP;
-		OPC(JC_NE)	FETCH_RD_RS_ADDR16	if (RD != RS)	{ JMP_IMM; }	EOP;
-		OPC(JC_GE)	FETCH_RD_RS_ADDR16	if (RD >= RS)	{ JMP_IMM; }	EOP;
-		OPC(JC_GT)	FETCH_RD_RS_ADDR16	if (RD >  RS)	{ JMP_IMM; }	EOP;
-		OPC(JC_LE)	FETCH_RD_RS_ADDR16	if (RD <= RS)	{ JMP_IMM; }	EOP;
-		OPC(JC_LT)	FETCH_RD_RS_ADDR16	if (RD <  RS)	{ JMP_IMM; }	EOP;
+		OPC(JC_EQ) 	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RD == RS) 	EOP;
+		OPC(JC_NE)	I_JC_NE	EOP;
+		OPC(JC_GE)	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RD >= RS)	EOP;
+		OPC(JC_GT)	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RD > RS)	EOP;
+		OPC(JC_LE)	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RD <= RS)	EOP;
+		OPC(JC_LT)	I_JC_LT	EOP;
 
-		OPC(JC_LTU)	FETCH_RD_RS_ADDR16	if (RDU <  RSU)	{ JMP_IMM; }	EOP;
-		OPC(JC_GEU)	FETCH_RD_RS_ADDR16	if (RDU >= RSU)	{ JMP_IMM; }	EOP;
-		OPC(JC_GTU)	FETCH_RD_RS_ADDR16	if (RDU >  RSU)	{ JMP_IMM; }	EOP;
-		OPC(JC_LEU)	FETCH_RD_RS_ADDR16	if (RDU <= RSU)	{ JMP_IMM; }	EOP;
+		OPC(JC_LTU)	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RDU < RSU)	EOP;
+		OPC(JC_GEU)	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RDU >= RSU)	EOP;
+		OPC(JC_GTU)	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RDU > RSU)	EOP;
+		OPC(JC_LEU)	FETCH_RD_RS_ADDR16	JMP_IMM_IF(RDU <= RSU)	EOP;
 
 		OPC(JPI)		FETCH_IMM16		JMP_IMM		EOP;
 		OPC(JPR)		FETCH_RD		JMP_RD		EOP;
 
+#ifndef USE_THREADED_CODE
 		OPC(FAR) op = *ip++; switch(op) {
 			OPC(CALLI)
 				FETCH_IMM24
@@ -277,17 +354,17 @@ VMLOOP_LABEL
 				fakePush(REG(REG_rt), IMM);
 			EOP;
 
-			OPC(JC_EQ) 	FETCH_RD_RS_ADDR24	if (RD == RS)	{ JMP_IMM; } 	EOP;
-			OPC(JC_NE)		FETCH_RD_RS_ADDR24	if (RD != RS)	{ JMP_IMM; }	EOP;
-			OPC(JC_GE)		FETCH_RD_RS_ADDR24	if (RD >= RS)	{ JMP_IMM; }	EOP;
-			OPC(JC_GT)		FETCH_RD_RS_ADDR24	if (RD >  RS)	{ JMP_IMM; }	EOP;
-			OPC(JC_LE)		FETCH_RD_RS_ADDR24	if (RD <= RS)	{ JMP_IMM; }	EOP;
-			OPC(JC_LT)		FETCH_RD_RS_ADDR24	if (RD <  RS)	{ JMP_IMM; }	EOP;
+			OPC(JC_EQ) 	FETCH_RD_RS_ADDR24	JMP_IMM_IF(RD == RS) 	EOP;
+			OPC(JC_NE)		FETCH_RD_RS_ADDR24	JMP_IMM_IF(RD != RS)	EOP;
+			OPC(JC_GE)		FETCH_RD_RS_ADDR24	JMP_IMM_IF(RD >= RS)	EOP;
+			OPC(JC_GT)		FETCH_RD_RS_ADDR24	JMP_IMM_IF(RD > RS)	EOP;
+			OPC(JC_LE)		FETCH_RD_RS_ADDR24	JMP_IMM_IF(RD <= RS)	EOP;
+			OPC(JC_LT)		FETCH_RD_RS_ADDR24	JMP_IMM_IF(RD < RS)	EOP;
 
-			OPC(JC_LTU)	FETCH_RD_RS_ADDR24	if (RDU <  RSU)	{ JMP_IMM; }	EOP;
-			OPC(JC_GEU)	FETCH_RD_RS_ADDR24	if (RDU >= RSU)	{ JMP_IMM; }	EOP;
-			OPC(JC_GTU)	FETCH_RD_RS_ADDR24	if (RDU >  RSU)	{ JMP_IMM; }	EOP;
-			OPC(JC_LEU)	FETCH_RD_RS_ADDR24	if (RDU <= RSU)	{ JMP_IMM; }	EOP;
+			OPC(JC_LTU)	FETCH_RD_RS_ADDR24	JMP_IMM_IF(RDU < RSU)	EOP;
+			OPC(JC_GEU)	FETCH_RD_RS_ADDR24	JMP_IMM_IF(RDU >= RSU)	EOP;
+			OPC(JC_GTU)	FETCH_RD_RS_ADDR24	JMP_IMM_IF(RDU > RSU)	EOP;
+			OPC(JC_LEU)	FETCH_RD_RS_ADDR24	JMP_IMM_IF(RDU <= RSU)	EOP;
 
 			OPC(JPI)		FETCH_IMM24		JMP_IMM		EOP;
 		default:
@@ -295,6 +372,7 @@ VMLOOP_LABEL
 			BIG_PHAT_ERROR(ERR_ILLEGAL_INSTRUCTION);
 			//return ip;
 		} EOP;
+#endif	//USE_THREADED_CODE
 
 		//OPC(XB)		FETCH_RD_RS		RD = (int)((char) RS); EOP;
 		OPC(XB)	FETCH_RD_RS	RD = ((RS & 0x80) == 0) ? (RS & 0xFF) : (RS | ~0xFF); EOP;
@@ -303,12 +381,13 @@ VMLOOP_LABEL
 
 		OPC(SYSCALL)
 		{
-			int syscallNumber = IB;
-			fakePush((int32_t) (ip - mem_cs), -syscallNumber);
+			FETCH_IMM8
+			int syscallNumber = imm32;
+			fakePush(NEXT_ADDRESS, -syscallNumber);
 			InvokeSysCall(syscallNumber);
 			fakePop();
 			if (VM_Yield)
-				return ip;
+				return NEXT_IP;
 		}
 		EOP;
 
@@ -326,6 +405,18 @@ VMLOOP_LABEL
 			}
 		} EOP;
 
+		// each part but the last must be one of the I_ bodies above that
+		// doesn't transfer control.
+#define SUPER_HANDLER(name, first, second)\
+		SOPC(name, first)	I_##first	SUPER_NEXT(second)	I_##second	EOP;
+#define SUPER3_HANDLER(name, first, second, third)\
+		SOPC(name, first)	I_##first	SUPER_NEXT(second)	I_##second\
+			SUPER_NEXT(third)	I_##third	EOP;
+		SUPERINSTRUCTIONS(SUPER_HANDLER)
+		SUPERINSTRUCTIONS3(SUPER3_HANDLER)
+#undef SUPER_HANDLER
+#undef SUPER3_HANDLER
+
 #if 0
 #ifdef ENABLE_DEBUGGER
 		OPC(DBG_OP) {
@@ -356,11 +447,24 @@ VMLOOP_LABEL
 #endif
 #endif
 
+#ifdef USE_THREADED_CODE
+	// FAR prefixes are folded into the following instruction when predecoding,
+	// so L_FAR is never dispatched to.
+	L_NUL:
+	L_FAR:
+		LOG("Illegal instruction 0x%02X @ 0x%04X\n", mem_cs[THREADED_ADDRESS(ti)], THREADED_ADDRESS(ti));
+		BIG_PHAT_ERROR(ERR_ILLEGAL_INSTRUCTION);
+
+	L_ILLEGAL_JUMP:
+		LOG("\nIllegal jump to a non-instruction address\n");
+		BIG_PHAT_ERROR(ERR_IMEM_OOB);
+#else
 	default:
 		//VM_State = -3;				// Bad instruction
 		LOG("Illegal instruction 0x%02X @ 0x%04X\n", op, (int)(size_t)(ip - mem_cs) - 1);
 		BIG_PHAT_ERROR(ERR_ILLEGAL_INSTRUCTION);
 		//return ip;
+#endif	//USE_THREADED_CODE
 	}
 #ifdef CORE_DEBUGGING_MODE
 	RUN_LOOP;
@@ -129,9 +129,7 @@ const FuncMapping* mapFunctionEx(int ip) {
 	FuncMapping temp;
 	temp.start = ip;
 	FuncMapAddr::const_iterator itr = sFuncMapAddr.lower_bound(&temp);
-	if(itr == sFuncMapAddr.end())
-		return NULL;
-	if((*itr)->start > ip) {
+	if(itr == sFuncMapAddr.end() || (*itr)->start > ip) {
 		if(itr == sFuncMapAddr.begin())
 			return NULL;
 		itr--;
@@ -25,6 +25,7 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 using namespace MoSyncError;
 
 #include <errno.h>
+#include <mach/mach_time.h>
 
 
 //*****************************************************************************
@@ -55,6 +56,13 @@ void MoSyncThread::sleep ( unsigned int ms ) {
     sleepMillis(ms);
 }
 
+int MoSyncThread::getTicks() {
+	static mach_timebase_info_data_t timebase;
+	if(timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return (int)(mach_absolute_time() * timebase.numer / timebase.denom / 1000000);
+}
+
 //*****************************************************************************
 //MoSyncSemaphore
 //*****************************************************************************
@@ -74,6 +82,13 @@ void MoSyncSemaphore::wait() {
    semaphore_wait(mSem);
 }
 
+bool MoSyncSemaphore::tryWait(unsigned int ms) {
+	mach_timespec_t timeout;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_nsec = (ms % 1000) * 1000000;
+	return semaphore_timedwait(mSem, timeout) == KERN_SUCCESS;
+}
+
 void MoSyncSemaphore::post() {
 //	sem_post(&mSem);
     semaphore_signal(mSem);
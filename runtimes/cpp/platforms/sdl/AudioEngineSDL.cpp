@@ -19,6 +19,7 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include "config_platform.h"
 #include "AudioEngine.h"
 #include "AudioChannel.h"
+#include "AudioMixer.h"
 #include "AudioSource.h"
 #include "Stream.h"
 #include "WaveAudioSource.h"
@@ -28,9 +29,15 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include "SDLSoundAudioSource.h"
 #endif
 #include "sdl_stream.h"
+#include "ThreadPoolImpl.h"
+#include <helpers/helpers.h>
 
 #define DEFAULT_AUDIOBUF_SAMPLES 1024*4
 #define MY_SAMPLE_RATE 44100
+// how long a decoder thread sleeps when its channel has nothing to decode
+#define DECODE_IDLE_MS 10
+// how many audio callbacks' worth of sound is decoded ahead of playback
+#define DECODE_AHEAD_PERIODS 3
 
 #ifdef LINUX
 #define stricmp(x, y) strcasecmp(x, y)
@@ -43,6 +50,21 @@ namespace AudioEngine {
 
 	static Sint32 gTempBuffer[DEFAULT_AUDIOBUF_SAMPLES*2];
 
+	// Sources are decoded ahead of playback, so that soundCallback only mixes.
+	// Each channel gets its own decoder thread the first time it is used;
+	// a BufferAudioSource waiting for the application must not stall the others.
+	static MoSyncThread* gDecoders[MAX_CHANNELS];
+	static volatile bool gDecodersQuit = false;
+
+	static int SDLCALL decoderThread(void* arg) {
+		AudioChannel* chnl = (AudioChannel*)arg;
+		while(!gDecodersQuit) {
+			if(!chnl->decode())
+				MoSyncThread::sleep(DECODE_IDLE_MS);
+		}
+		return 0;
+	}
+
 	static void soundCallback(void *userdata, Uint8 *buf,int len) {
 		//MutexHandler m(&gMutex);
 
@@ -55,15 +77,7 @@ namespace AudioEngine {
 			}
 		}
 
-		Sint16* dst = (Sint16*)buf;
-		for(int i = 0; i < numSamples<<1; i++) {
-			int sample = gTempBuffer[i];
-			if(sample<-32768) 
-				sample = 32768;
-			else if(sample>=32767) 
-				sample = 32767;
-			*dst++ = (Sint16) (gTempBuffer[i]);
-		}
+		AudioMixer::saturate((short*)buf, (const int*)gTempBuffer, numSamples<<1);
 	}
 
 	int getSampleRate() {
@@ -75,6 +89,8 @@ namespace AudioEngine {
 		if(Sound_Init() == 0) return -1;
 #endif		
 	
+		gDecodersQuit = false;
+
 		SDL_AudioSpec desired;
 		desired.freq=MY_SAMPLE_RATE;
 		desired.format=AUDIO_S16SYS;
@@ -97,7 +113,8 @@ namespace AudioEngine {
 	}
 
 	int close() {
-			
+		// closing the sources wakes decoders waiting in BufferAudioSource::fillBuffer().
+		gDecodersQuit = true;
 		for(int i = 0; i < MAX_CHANNELS; i++) {
 			if(gChannels[i]) {
 				AudioSource *src = gChannels[i]->getAudioSource();
@@ -106,6 +123,18 @@ namespace AudioEngine {
 			}
 		}
 
+		for(int i = 0; i < MAX_CHANNELS; i++) {
+			if(gDecoders[i]) {
+				gDecoders[i]->join();
+				delete gDecoders[i];
+				gDecoders[i] = NULL;
+
+				AudioChannel::Stats stats = gChannels[i]->getStats();
+				LOG("Audio channel %i: %i underruns, low watermark %i of %i frames\n",
+					i, stats.underruns, stats.minBufferedFrames, stats.capacity);
+			}
+		}
+
 
 		SDL_LockAudio();
 	   	 SDL_UnlockAudio();
@@ -123,7 +152,13 @@ namespace AudioEngine {
 	}
 
 	AudioChannel* getChannel(int i) {
-		return gChannels[i];
+		AudioChannel* chnl = gChannels[i];
+		if(!gDecoders[i] && chnl) {
+			chnl->enableDecodeAhead(DECODE_AHEAD_PERIODS*gAudioSpec.samples*1000/gAudioSpec.freq);
+			gDecoders[i] = new MoSyncThread();
+			gDecoders[i]->start(decoderThread, chnl);
+		}
+		return chnl;
 	}
 
 
@@ -0,0 +1,163 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#include "DrawRGB.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DRAWRGB_SSE2
+#include <emmintrin.h>
+#endif
+
+// returns the shift of an 8-bit channel mask, or -1 if it isn't one.
+static int channelShift(unsigned int mask) {
+	for(int shift = 0; shift < 32; shift += 8) {
+		if(mask == (0xffu << shift))
+			return shift;
+	}
+	return -1;
+}
+
+bool drawRGBSupported(unsigned int rMask, unsigned int gMask, unsigned int bMask) {
+	return channelShift(rMask) >= 0 && channelShift(gMask) >= 0 && channelShift(bMask) >= 0;
+}
+
+static inline unsigned int blendChannel(unsigned int s, unsigned int d, int alpha) {
+	return d + ((((int)s - (int)d) * alpha) >> 8);
+}
+
+// s is ARGB, d has its channels at the given shifts.
+static inline unsigned int blendPixel(unsigned int s, unsigned int d,
+	int rShift, int gShift, int bShift)
+{
+	unsigned int alpha = s >> 24;
+	unsigned int r = (s >> 16) & 0xff, g = (s >> 8) & 0xff, b = s & 0xff;
+	if(alpha != 255) {
+		r = blendChannel(r, (d >> rShift) & 0xff, alpha);
+		g = blendChannel(g, (d >> gShift) & 0xff, alpha);
+		b = blendChannel(b, (d >> bShift) & 0xff, alpha);
+	}
+	unsigned int keep = ~((0xffu << rShift) | (0xffu << gShift) | (0xffu << bShift));
+	return (d & keep) | (r << rShift) | (g << gShift) | (b << bShift);
+}
+
+// The same for the native channel order, with red and blue blended in
+// parallel, as SDL does. The per-channel results are the same.
+static inline unsigned int blendNativePixel(unsigned int s, unsigned int d) {
+	unsigned int alpha = s >> 24;
+	if(alpha == 255)
+		return (s & 0xffffff) | (d & 0xff000000);
+	unsigned int rb = d & 0xff00ff;
+	unsigned int g = d & 0xff00;
+	rb = (rb + (((s & 0xff00ff) - rb) * alpha >> 8)) & 0xff00ff;
+	g = (g + (((s & 0xff00) - g) * alpha >> 8)) & 0xff00;
+	return (d & 0xff000000) | rb | g;
+}
+
+#ifdef DRAWRGB_SSE2
+// Blends four ARGB pixels onto four xRGB pixels. The channels are widened to
+// 16 bits; only the low 16 bits of (s - d) * alpha are needed, because the
+// result is d plus bits 8-15 of the product, modulo 256. Alpha 255 is done
+// as 256, which gives s exactly.
+static inline __m128i blend4(__m128i s, __m128i d) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lowByte = _mm_set1_epi16(0xff);
+
+	__m128i a = _mm_srli_epi32(s, 24);
+	a = _mm_add_epi32(a, _mm_srli_epi32(_mm_cmpeq_epi32(a, _mm_set1_epi32(255)), 31));
+	a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+	__m128i aLo = _mm_unpacklo_epi32(a, a);
+	__m128i aHi = _mm_unpackhi_epi32(a, a);
+
+	__m128i sLo = _mm_unpacklo_epi8(s, zero), sHi = _mm_unpackhi_epi8(s, zero);
+	__m128i dLo = _mm_unpacklo_epi8(d, zero), dHi = _mm_unpackhi_epi8(d, zero);
+	__m128i rLo = _mm_add_epi16(dLo, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(sLo, dLo), aLo), 8));
+	__m128i rHi = _mm_add_epi16(dHi, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(sHi, dHi), aHi), 8));
+	return _mm_packus_epi16(_mm_and_si128(rLo, lowByte), _mm_and_si128(rHi, lowByte));
+}
+#endif
+
+// The common case: the destination has the same channel order as the source.
+static void drawRGBNative(unsigned char* dst, int dstPitch, const unsigned char* src,
+	int srcPitch, int width, int height)
+{
+#ifdef DRAWRGB_SSE2
+	const __m128i alphaMask = _mm_set1_epi32((int)0xff000000);
+#endif
+	while(height--) {
+		const unsigned int* s = (const unsigned int*)src;
+		unsigned int* d = (unsigned int*)dst;
+		int x = 0;
+#ifdef DRAWRGB_SSE2
+		for(; x + 4 <= width; x += 4) {
+			__m128i sv = _mm_loadu_si128((const __m128i*)&s[x]);
+			__m128i sa = _mm_and_si128(sv, alphaMask);
+			int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(sa, alphaMask));
+			int clear = _mm_movemask_epi8(_mm_cmpeq_epi32(sa, _mm_setzero_si128()));
+			if(clear == 0xffff)
+				continue;
+			__m128i dv = _mm_loadu_si128((const __m128i*)&d[x]);
+			__m128i rv;
+			if(opaque == 0xffff) {
+				rv = sv;
+			} else if((opaque | clear) == 0xffff) {	//sprite edges, no blending needed
+				__m128i m = _mm_cmpeq_epi32(sa, alphaMask);
+				rv = _mm_or_si128(_mm_and_si128(m, sv), _mm_andnot_si128(m, dv));
+			} else {
+				rv = blend4(sv, dv);
+			}
+			//the destination keeps its own alpha
+			rv = _mm_or_si128(_mm_andnot_si128(alphaMask, rv), _mm_and_si128(alphaMask, dv));
+			_mm_storeu_si128((__m128i*)&d[x], rv);
+		}
+#endif
+		for(; x < width; x++) {
+			unsigned int p = s[x];
+			if((p >> 24) != 0)
+				d[x] = blendNativePixel(p, d[x]);
+		}
+		src += srcPitch;
+		dst += dstPitch;
+	}
+}
+
+static void drawRGBAny(unsigned char* dst, int dstPitch, int rShift, int gShift, int bShift,
+	const unsigned char* src, int srcPitch, int width, int height)
+{
+	while(height--) {
+		const unsigned int* s = (const unsigned int*)src;
+		unsigned int* d = (unsigned int*)dst;
+		for(int x = 0; x < width; x++) {
+			unsigned int p = s[x];
+			if((p >> 24) != 0)
+				d[x] = blendPixel(p, d[x], rShift, gShift, bShift);
+		}
+		src += srcPitch;
+		dst += dstPitch;
+	}
+}
+
+void drawRGB(void* dst, int dstPitch, unsigned int rMask, unsigned int gMask,
+	unsigned int bMask, const void* src, int srcPitch, int width, int height)
+{
+	if(rMask == 0xff0000 && gMask == 0xff00 && bMask == 0xff) {
+		drawRGBNative((unsigned char*)dst, dstPitch, (const unsigned char*)src, srcPitch,
+			width, height);
+	} else {
+		drawRGBAny((unsigned char*)dst, dstPitch, channelShift(rMask), channelShift(gMask),
+			channelShift(bMask), (const unsigned char*)src, srcPitch, width, height);
+	}
+}
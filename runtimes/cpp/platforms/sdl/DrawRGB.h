@@ -0,0 +1,41 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+#ifndef DRAWRGB_H
+#define DRAWRGB_H
+
+// Blends the ARGB pixels passed to maDrawRGB() straight onto a 32-bit surface,
+// without wrapping them in an SDL_Surface first.
+//
+// The blend is the one SDL uses for per-pixel alpha blits between 32-bit surfaces:
+// d + (((s - d) * alpha) >> 8) for each color channel, where alpha 0 leaves
+// the destination and alpha 255 copies the source. Destination bits outside
+// the color channels, usually its alpha, are left unchanged.
+//
+// This file doesn't depend on SDL, so that it can be built into tools such as
+// the maDrawRGB benchmark.
+
+// Returns true if drawRGB() can draw on a 32-bit surface with these masks:
+// 8 bits per channel, on byte boundaries.
+bool drawRGBSupported(unsigned int rMask, unsigned int gMask, unsigned int bMask);
+
+// dst and src point to the first pixel to be touched. Pitches are in bytes.
+// The caller does the clipping.
+void drawRGB(void* dst, int dstPitch, unsigned int rMask, unsigned int gMask,
+	unsigned int bMask, const void* src, int srcPitch, int width, int height);
+
+#endif	//DRAWRGB_H
@@ -29,6 +29,14 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include <sys/stat.h>
 #include <errno.h>
 
+#if defined(HAVE_MAPPED_FILES) && !defined(_android)
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
 enum MyOpenMode {
 	eRead, eOverwrite, eAppend, eWriteExisting
 };
@@ -192,4 +200,116 @@ namespace Base {
 		return true;
 	}
 
+#if defined(HAVE_MAPPED_FILES) && !defined(_android)
+	//******************************************************************************
+	//MappedFileStream
+	//******************************************************************************
+
+	class FileMapping {
+	public:
+		void* base;
+		int size;
+		int refs;
+#ifdef WIN32
+		HANDLE handle;
+#endif
+	};
+
+	//returns NULL if the file doesn't exist, is empty or can't be mapped.
+	static FileMapping* mapFile(const char* filename) {
+		int fd = myOpen(filename, eRead);
+		if(fd < 0)
+			return NULL;
+		FileMapping* m = NULL;
+		struct stat s;
+		if(fstat(fd, &s) == 0 && s.st_size > 0) {
+#ifdef WIN32
+			HANDLE h = CreateFileMapping((HANDLE)_get_osfhandle(fd), NULL, PAGE_WRITECOPY, 0, 0, NULL);
+			void* base = h ? MapViewOfFile(h, FILE_MAP_COPY, 0, 0, 0) : NULL;
+			if(base) {
+				m = new FileMapping;
+				m->handle = h;
+			} else if(h) {
+				CloseHandle(h);
+			}
+#else
+			void* base = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if(base != MAP_FAILED) {
+				m = new FileMapping;
+			} else {
+				LOG("mmap(%s) failed: %i(%s)\n", filename, errno, strerror(errno));
+			}
+#endif
+			if(m) {
+				m->base = base;
+				m->size = s.st_size;
+				m->refs = 1;
+			}
+		}
+		//the mapping keeps the file open.
+		::close(fd);
+		return m;
+	}
+
+	static void unmapFile(FileMapping* m) {
+		if(m == NULL || --m->refs > 0)
+			return;
+#ifdef WIN32
+		UnmapViewOfFile(m->base);
+		CloseHandle(m->handle);
+#else
+		munmap(m->base, m->size);
+#endif
+		delete m;
+	}
+
+	MappedFileStream::MappedFileStream(const char* filename)
+		: MemStreamC(NULL, 0), mMapping(mapFile(filename))
+	{
+		if(mMapping) {
+			mSrc = mMapping->base;
+			mSize = mMapping->size;
+		}
+	}
+
+	MappedFileStream::MappedFileStream(FileMapping* mapping, const void* src, int size)
+		: MemStreamC(src, size), mMapping(mapping)
+	{
+		mMapping->refs++;
+	}
+
+	MappedFileStream::~MappedFileStream() {
+		unmapFile(mMapping);
+	}
+
+	bool MappedFileStream::write(const void* src, int size) {
+		TEST(isOpen());
+		if(mPos + size > mSize) {
+			FAIL;
+		}
+		memcpy((char*)mSrc + mPos, src, size);
+		mPos += size;
+		return true;
+	}
+
+	Stream* MappedFileStream::createLimitedCopy(int size) const {
+		if(size < 0)
+			size = mSize - mPos;
+		else if(mPos + size > mSize) {
+			FAIL;
+		}
+		TEST(isOpen());
+		return new MappedFileStream(mMapping, CBP mSrc + mPos, size);
+	}
+
+	Stream* MappedFileStream::createCopy() const {
+		TEST(isOpen());
+		return new MappedFileStream(mMapping, mSrc, mSize);
+	}
+
+	Stream* MappedFileStream::createView(int size) {
+		return createLimitedCopy(size);
+	}
+#endif	//HAVE_MAPPED_FILES
+
 };
@@ -141,6 +141,11 @@ int main2(int argc, char **argv) {
 				"  -resmem <bytes:integer>                set resource memory limit.\n"
 				"  -gdb                                   start gdb stub.\n"
 				"  -x <filename:string>                   load extension config file.\n"
+				"  -headless                              no window or sound, and a virtual clock that only advances\n"
+				"                                         when the program waits or updates the screen. implies -noscreen.\n"
+				"  -events <filename:string>              inject timed input events from a script. used with -headless.\n"
+				"                                         each line is \"<ms> <event> [args]\", see SyscallImpl.cpp.\n"
+				"  -frames <count:integer>                exit after this many screen updates and print frame statistics.\n"
 #ifdef EMULATOR
 				"  -allowdivzero                          allow floating-point division by zero. this produces ieee standard results.\n"
 				"  -timeout <seconds:integer>             close the program if it runs longer than the timeout.\n"
@@ -206,6 +211,24 @@ int main2(int argc, char **argv) {
 			}
 		} else if(strcmp(argv[i], "-noscreen")==0) {
 			settings.showScreen = false;
+		} else if(strcmp(argv[i], "-headless")==0) {
+			settings.headless = true;
+			settings.showScreen = false;
+			settings.haveSkin = false;
+		} else if(strcmp(argv[i], "-events")==0) {
+			i++;
+			if(i>=argc) {
+				LOG("not enough parameters for -events");
+				return 1;
+			}
+			settings.eventScript = argv[i];
+		} else if(strcmp(argv[i], "-frames")==0) {
+			i++;
+			if(i>=argc) {
+				LOG("not enough parameters for -frames");
+				return 1;
+			}
+			settings.maxFrames = atoi(argv[i]);
 		} else if(strcmp(argv[i], "-nomophone")==0) {
 				settings.haveSkin = false;
 		} else if(strcmp(argv[i], "-model")==0) {
@@ -447,6 +470,12 @@ int Base::getRuntimeIp() {
 	return -1;
 }
 
+bool Base::getRuntimeInstructionCount(uint& count) {
+	if(gCore)
+		return Core::GetInstructionCount(gCore, count);
+	return false;
+}
+
 #if 0
 extern "C" const char* FileNameFromPath(const char* path) {
 	const char* ptr = strrchr(path, '\\');
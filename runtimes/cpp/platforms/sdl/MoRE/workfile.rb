@@ -17,6 +17,9 @@ work.instance_eval do
 		"#{BD}/runtimes/cpp/core/sld.cpp",
 		"#{BD}/runtimes/cpp/core/GdbStub.cpp",
 		"#{BD}/runtimes/cpp/core/extensions.cpp",
+		"#{BD}/runtimes/cpp/core/disassembler.cpp",
+		"#{BD}/runtimes/cpp/core/Recompiler/X64Recompiler.cpp",
+		"#{BD}/runtimes/cpp/core/Recompiler/X64Assembler.cpp",
 		"#{BD}/intlibs/helpers/intutil.cpp",
 		]
 	@EXTRA_INCLUDES += ["../../.."]
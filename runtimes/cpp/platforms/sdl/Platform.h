@@ -35,6 +35,14 @@ namespace Core {
 	class VMCore;
 }
 
+//MappedFileStream is available
+#define HAVE_MAPPED_FILES
+
+#ifdef LINUX
+//plain TCP connections are run by NetReactor rather than the ThreadPool
+#define HAVE_EPOLL
+#endif
+
 #define VSV_ARGPTR_DECL , va_list argptr
 #define VSV_ARGPTR_USE , argptr
 
@@ -50,6 +50,10 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 #include <map>
 #include <time.h>
 #include <limits.h>
+#include <vector>
+#ifndef WIN32
+#include <sys/time.h>
+#endif
 
 
 #include <helpers/fifo.h>
@@ -88,6 +92,7 @@ extern "C" {
 #include "TcpConnection.h"
 #include "ConfigParser.h"
 #include "sdl_stream.h"
+#include "DrawRGB.h"
 
 #include "Skinning/Screen.h"
 #include "Skinning/SkinManager.h"
@@ -139,6 +144,9 @@ namespace Base {
 
 	static SDL_TimerID gExitTimer = NULL;
 
+	static bool gHeadless = false;
+	static int gVirtualTime = 0;
+
 #ifdef SUPPORT_OPENGL_ES
 	static SubView sSubView;
 	static bool sOpenGLMode = false;
@@ -156,6 +164,9 @@ namespace Base {
 	static void MAHandleKeyEvent(int sdlk, bool pressed);
 	static void MASendPointerEvent(int x, int y, int touchId, int type);
 
+	static void loadEventScript(const char* filename);
+	static void startFrameStats();
+
 	static int maSendToBackground();
 	static int maBringToForeground();
 
@@ -199,7 +210,10 @@ namespace Base {
 #ifndef DARWIN
 		int argc = 0;
 		char** argv = NULL;
-		gtk_init(&argc, &argv);
+		if(settings.headless)
+			gtk_init_check(&argc, &argv);	//there may be no display to connect to
+		else
+			gtk_init(&argc, &argv);
 #endif
 #endif
 
@@ -224,7 +238,10 @@ namespace Base {
 #ifndef DARWIN
 		int argc = 0;
 		char** argv = NULL;
-		gtk_init(&argc, &argv);
+		if(settings.headless)
+			gtk_init_check(&argc, &argv);	//there may be no display to connect to
+		else
+			gtk_init(&argc, &argv);
 #endif
 #endif
 		screenWidth = width;
@@ -384,6 +401,15 @@ namespace Base {
 			BIG_PHAT_ERROR(SDLERR_MOSYNCDIR_NOT_FOUND);
 		}
 
+		gHeadless = settings.headless;
+		if(gHeadless) {
+			//the dummy video driver gives us a video mode in memory, so images are
+			//converted to the screen format as usual. the dummy audio driver
+			//consumes the mix without a sound device.
+			SDL_putenv((char*)"SDL_VIDEODRIVER=dummy");
+			SDL_putenv((char*)"SDL_AUDIODRIVER=dummy");
+		}
+
 		TEST_LTZ(SDL_Init(0));
 		atexit(SDL_Quit);
 
@@ -416,7 +442,9 @@ namespace Base {
 
 		SDL_EnableUNICODE(true);
 
-		if(settings.showScreen) {
+		if(settings.headless) {
+			TEST_Z(setupScreen(settings));
+		} else if(settings.showScreen) {
 			TEST_Z(setupScreen(settings));
 
 			char caption[1024];
@@ -486,6 +514,14 @@ namespace Base {
 		}
 #endif
 
+		if(settings.eventScript) {
+			if(gHeadless)
+				loadEventScript(settings.eventScript);
+			else
+				LOG("Event script ignored, it requires -headless.\n");
+		}
+		startFrameStats();
+
 		return true;
 	}
 
@@ -725,6 +761,8 @@ namespace Base {
 
 	static void MAUpdateScreen() {
 #ifndef MOBILEAUTHOR
+		if(gHeadless)
+			return;
 		if(sSkin) {
 			sSkin->drawScreen();
 			sSkin->drawMultiTouchSimulation();
@@ -885,6 +923,226 @@ namespace Base {
 		DEBUG_ASSERT(NULL != gExitTimer);
 	}
 
+	//***************************************************************************
+	// Headless mode
+	//***************************************************************************
+	// With -headless, MoRE runs without a window or sound device, so that programs
+	// can be benchmarked and tested on machines without a display. Drawing goes to
+	// the back buffer as usual, but it is never shown. maGetMilliSecondCount()
+	// returns a virtual clock that only advances in maWait() and screen updates,
+	// so runs don't depend on the speed of the host and never sleep.
+	//
+	// Input comes from the -events script. Each line is a virtual time in
+	// milliseconds, followed by an event:
+	//   <ms> key_press <key>           key is a MAK_ name without the prefix
+	//   <ms> key_release <key>         (FIRE, LEFT, 5, SOFTLEFT...) or a key code
+	//   <ms> pointer_press <x> <y>
+	//   <ms> pointer_drag <x> <y>
+	//   <ms> pointer_release <x> <y>
+	//   <ms> close
+	// Times must not decrease. Anything after a # is a comment.
+
+	//virtual time per screen update, about 60 frames per second.
+	#define HEADLESS_FRAME_TIME 16
+
+	struct ScriptedEvent {
+		int time;
+		int type;	//EVENT_TYPE_*
+		int a, b;	//key, or x and y
+	};
+
+	static std::vector<ScriptedEvent> gEventScript;
+	static size_t gEventScriptPos = 0;
+
+	static const struct { const char* name; int type; } sScriptEventTypes[] = {
+		{ "key_press", EVENT_TYPE_KEY_PRESSED },
+		{ "key_release", EVENT_TYPE_KEY_RELEASED },
+		{ "pointer_press", EVENT_TYPE_POINTER_PRESSED },
+		{ "pointer_drag", EVENT_TYPE_POINTER_DRAGGED },
+		{ "pointer_release", EVENT_TYPE_POINTER_RELEASED },
+		{ "close", EVENT_TYPE_CLOSE },
+	};
+
+	static const struct { const char* name; int mak; } sScriptKeys[] = {
+#define SCRIPT_KEY(k) { #k, MAK_##k },
+		DIRECT_KEYS(SCRIPT_KEY)
+		SCRIPT_KEY(FIRE) SCRIPT_KEY(STAR) SCRIPT_KEY(POUND) SCRIPT_KEY(HASH)
+		SCRIPT_KEY(CLEAR) SCRIPT_KEY(SOFTLEFT) SCRIPT_KEY(SOFTRIGHT)
+	};
+
+	static bool parseScriptKey(const char* str, int& mak) {
+		for(size_t i=0; i<sizeof(sScriptKeys)/sizeof(sScriptKeys[0]); i++) {
+			if(strcmp(str, sScriptKeys[i].name) == 0) {
+				mak = sScriptKeys[i].mak;
+				return true;
+			}
+		}
+		char* end;
+		mak = strtol(str, &end, 10);
+		return *end == 0;
+	}
+
+	static bool parseScriptEvent(char* line, ScriptedEvent& e) {
+		char name[32], key[32];
+		int argPos = 0;
+		if(sscanf(line, "%d %31s %n", &e.time, name, &argPos) != 2)
+			return false;
+		const char* args = line + argPos;
+		e.a = e.b = 0;
+		for(size_t i=0; i<sizeof(sScriptEventTypes)/sizeof(sScriptEventTypes[0]); i++) {
+			if(strcmp(name, sScriptEventTypes[i].name) != 0)
+				continue;
+			e.type = sScriptEventTypes[i].type;
+			switch(e.type) {
+			case EVENT_TYPE_KEY_PRESSED:
+			case EVENT_TYPE_KEY_RELEASED:
+				return sscanf(args, "%31s", key) == 1 && parseScriptKey(key, e.a);
+			case EVENT_TYPE_CLOSE:
+				return true;
+			default:
+				return sscanf(args, "%d %d", &e.a, &e.b) == 2;
+			}
+		}
+		return false;
+	}
+
+	static void loadEventScript(const char* filename) {
+		FILE* file = fopen(filename, "r");
+		if(!file) {
+			LOG("Could not open event script %s\n", filename);
+			BIG_PHAT_ERROR(SDLERR_EVENT_SCRIPT_INVALID);
+		}
+		char line[256];
+		int lineNumber = 0;
+		while(fgets(line, sizeof(line), file)) {
+			lineNumber++;
+			line[strcspn(line, "#\r\n")] = 0;	//comments and line ends
+			char c;
+			if(sscanf(line, " %c", &c) != 1)
+				continue;
+			ScriptedEvent e;
+			if(!parseScriptEvent(line, e) ||
+				(!gEventScript.empty() && e.time < gEventScript.back().time))
+			{
+				LOG("%s:%i: invalid event: %s\n", filename, lineNumber, line);
+				fclose(file);
+				BIG_PHAT_ERROR(SDLERR_EVENT_SCRIPT_INVALID);
+			}
+			gEventScript.push_back(e);
+		}
+		fclose(file);
+		LOG("Loaded %i scripted events from %s\n", (int)gEventScript.size(), filename);
+	}
+
+	//sends the scripted events that are due.
+	static void injectScriptedEvents() {
+		while(gEventScriptPos < gEventScript.size() &&
+			gEventScript[gEventScriptPos].time <= gVirtualTime)
+		{
+			const ScriptedEvent& e(gEventScript[gEventScriptPos++]);
+			switch(e.type) {
+			case EVENT_TYPE_KEY_PRESSED:
+			case EVENT_TYPE_KEY_RELEASED:
+				MAHandleKeyEventMAK(e.a, e.type == EVENT_TYPE_KEY_PRESSED);
+				break;
+			case EVENT_TYPE_CLOSE:
+				if(!gClosing)
+					MASetClose();
+				break;
+			default:
+				MASendPointerEvent(e.a, e.b, 0, e.type);
+			}
+		}
+	}
+
+	//moves the virtual clock to the end of the wait, or to the next scripted
+	//event if it comes first. returns false if only a real event could end the
+	//wait, that is, there is no timeout and no more script; then maWait()
+	//blocks as usual.
+	static bool headlessWait(int timeout) {
+		if(MAProcessEvents() || gEventFifo.count() != 0)
+			return true;
+		int target = INT_MAX;
+		if(timeout > 0)
+			target = gVirtualTime + timeout;
+		if(gEventScriptPos < gEventScript.size())
+			target = MIN(target, gEventScript[gEventScriptPos].time);
+		if(target == INT_MAX)
+			return false;
+		gVirtualTime = MAX(gVirtualTime, target);
+		MAProcessEvents();
+		return true;
+	}
+
+	//***************************************************************************
+	// Frame statistics, for -headless and -frames
+	//***************************************************************************
+
+	static int gFrameCount = 0;
+	static double gLastFrameTime, gFrameTimeMin, gFrameTimeMax, gFrameTimeTotal;
+	static uint gLastInstructionCount = 0;
+	static double gInstructionCount = 0;
+	static bool gHaveInstructionCount = false;
+
+	//seconds, from a high resolution clock.
+	static double realTime() {
+#ifdef WIN32
+		LARGE_INTEGER freq, count;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&count);
+		return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+	}
+
+	static void startFrameStats() {
+		gLastFrameTime = realTime();
+	}
+
+	static void countFrame() {
+		double now = realTime();
+		double t = now - gLastFrameTime;
+		gLastFrameTime = now;
+		if(gFrameCount == 0 || t < gFrameTimeMin)
+			gFrameTimeMin = t;
+		if(gFrameCount == 0 || t > gFrameTimeMax)
+			gFrameTimeMax = t;
+		gFrameTimeTotal += t;
+		gFrameCount++;
+
+		//the counter wraps, so it is summed up a frame at a time.
+		uint count;
+		gHaveInstructionCount = getRuntimeInstructionCount(count);
+		if(gHaveInstructionCount) {
+			gInstructionCount += (uint)(count - gLastInstructionCount);
+			gLastInstructionCount = count;
+		}
+
+		if(gStartupSettings.maxFrames > 0 && gFrameCount >= gStartupSettings.maxFrames) {
+			LOG("Frame limit reached.\n");
+			MoSyncExit(0);
+		}
+	}
+
+	static void reportFrameStats() {
+		if(gFrameCount == 0)
+			return;
+		printf("frames: %i\n", gFrameCount);
+		printf("frame time: avg %.3f ms, min %.3f ms, max %.3f ms\n",
+			gFrameTimeTotal * 1000 / gFrameCount, gFrameTimeMin * 1000, gFrameTimeMax * 1000);
+		printf("run time: %.3f s, virtual %i ms\n", gFrameTimeTotal, gVirtualTime);
+		if(gHaveInstructionCount) {
+			printf("VM instructions: %.0f, %.2f million/s\n", gInstructionCount,
+				gInstructionCount / gFrameTimeTotal / 1000000);
+		} else {
+			printf("VM instructions: not counted by this build\n");
+		}
+		fflush(stdout);
+	}
+
 	static void MARotateScreen() {
 		// swap w/h
 		int h = screenWidth;
@@ -913,6 +1171,9 @@ namespace Base {
 			return 0;
 		running = true;
 
+		if(gHeadless)
+			injectScriptedEvents();
+
 		int PollEventResult = 0;
 		SDL_Event event;
 		bool ret = false;
@@ -1206,17 +1467,26 @@ namespace Base {
 		drawText<wchar, TTF_RenderUNICODE_Solid>(left, top, str);
 	}
 
+	//ends a frame, once per screen update, full or partial.
+	static void finishFrame() {
+		if(gHeadless)
+			gVirtualTime += HEADLESS_FRAME_TIME;
+		MAProcessEvents();
+		if(gHeadless || gStartupSettings.maxFrames > 0)
+			countFrame();
+	}
+
 	SYSCALL(void, maUpdateScreen()) {
 		LOGG("maUpdateScreen()\n");
 		if(gClosing)
 			return;
 		MAUpdateScreen();
-		MAProcessEvents();
 
 #ifdef SUPPORT_OPENGL_ES
 		if(sOpenGLMode)
 				Base::openGLSwap(sSubView);
 #endif
+		finishFrame();
 	}
 	SYSCALL(void, maResetBacklight()) {
 	}
@@ -1236,21 +1506,44 @@ namespace Base {
 		SYSCALL_THIS->ValidateMemRange(dstPoint, sizeof(MAPoint2d));
 		SYSCALL_THIS->ValidateMemRange(srcRect, sizeof(MARect));
 
-		//Niklas: duno about this validation, sdl does clipping?
-		//Fredrik: all memory access must be validated. clipping is irrelevant.
-		SYSCALL_THIS->ValidateMemRange(src, sizeof(int)*srcRect->height*scanlength);
+		int width = srcRect->width;
+		int height = srcRect->height;
+		if(width <= 0 || height <= 0)
+			return;
 
-		SDL_Rect srcSurfaceRect = { (Sint16)srcRect->left, (Sint16)srcRect->top,
-			(Uint16)srcRect->width, (Uint16)srcRect->height};
-		SDL_Rect dstSurfaceRect = { (Sint16)dstPoint->x, (Sint16)dstPoint->y,
-			(Uint16)srcRect->width, (Uint16)srcRect->height};
-		SDL_Surface* srcSurface = SDL_CreateRGBSurfaceFrom((void*)src,
-			srcSurfaceRect.w, srcSurfaceRect.h, 32, scanlength<<2,
-			0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+		//all memory access must be validated, clipped or not.
+		//pixel (x, y) of the rectangle is at src[y*scanlength + x].
+		long long first = (long long)srcRect->top * scanlength + srcRect->left;
+		long long count = (long long)(height - 1) * scanlength + width;
+		if(first < 0 || count <= 0 || first + count > INT_MAX / (int)sizeof(int))
+			BIG_PHAT_ERROR(ERR_MEMORY_OOB);
+		const int* srcPixels = (const int*)src + first;
+		SYSCALL_THIS->ValidateMemRange(srcPixels, sizeof(int) * (int)count);
+
+		const SDL_Rect& clip = gDrawSurface->clip_rect;
+		int left = MAX(dstPoint->x, clip.x);
+		int top = MAX(dstPoint->y, clip.y);
+		int right = MIN(dstPoint->x + width, clip.x + clip.w);
+		int bottom = MIN(dstPoint->y + height, clip.y + clip.h);
+		if(right <= left || bottom <= top)
+			return;
+		srcPixels += (top - dstPoint->y) * scanlength + (left - dstPoint->x);
 
-		SDL_SetAlpha(srcSurface, SDL_SRCALPHA, 0x0);
-		SDL_BlitSurface(srcSurface, &srcSurfaceRect, gDrawSurface, &dstSurfaceRect);
+		const SDL_PixelFormat* fmt = gDrawSurface->format;
+		if(fmt->BytesPerPixel == 4 && drawRGBSupported(fmt->Rmask, fmt->Gmask, fmt->Bmask)) {
+			drawRGB((char*)gDrawSurface->pixels + top * gDrawSurface->pitch + (left << 2),
+				gDrawSurface->pitch, fmt->Rmask, fmt->Gmask, fmt->Bmask,
+				srcPixels, scanlength << 2, right - left, bottom - top);
+			return;
+		}
 
+		//other pixel formats are left to SDL.
+		SDL_Rect dstSurfaceRect = { (Sint16)left, (Sint16)top, 0, 0 };
+		SDL_Surface* srcSurface = SDL_CreateRGBSurfaceFrom((void*)srcPixels,
+			right - left, bottom - top, 32, scanlength << 2,
+			0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+		SDL_SetAlpha(srcSurface, SDL_SRCALPHA, 0x0);
+		SDL_BlitSurface(srcSurface, NULL, gDrawSurface, &dstSurfaceRect);
 		SDL_FreeSurface(srcSurface);
 	}
 
@@ -1622,6 +1915,9 @@ namespace Base {
 		if(gEventFifo.count() != 0)
 			return;
 
+		if(gHeadless && headlessWait(timeout))
+			return;
+
 		DEBUG_ASSERT(gTimerId == NULL);
 		if(timeout > 0) {
 			//LOGD("Setting timer sequence %i\n", gTimerSequence);
@@ -1674,6 +1970,8 @@ namespace Base {
 	}
 
 	SYSCALL(int, maGetMilliSecondCount()) {
+		if(gHeadless)
+			return gVirtualTime;
 		return SDL_GetTicks();
 	}
 
@@ -1730,6 +2028,8 @@ namespace Base {
 		AudioSource *audioSource = chnl->getAudioSource();
 		if(audioSource!=NULL) {
 			audioSource->close();
+			// the channel's decoder thread may still be using it.
+			chnl->setAudioSource(NULL);
 			delete audioSource;
 		}
 
@@ -1806,6 +2106,56 @@ namespace Base {
 		return 1;
 	}
 
+	// Only the given areas are copied to the window. With a skin or in OpenGL mode
+	// the whole screen is composited anyway, so this does one maUpdateScreen().
+	// Either way it is one frame, for the virtual clock and -frames.
+	static int maUpdateScreenRects(const MARect* rects, int count) {
+		if(gClosing)
+			return 0;
+#ifndef MOBILEAUTHOR
+		bool full = sSkin != NULL;
+#ifdef SUPPORT_OPENGL_ES
+		full |= sOpenGLMode;
+#endif
+		if(full) {
+			maUpdateScreen();
+			return 1;
+		}
+
+		// There is no window in headless mode.
+		if(gHeadless) {
+			finishFrame();
+			return 1;
+		}
+
+		// The window is updated in batches of rects.
+#define UPDATE_BATCH 16
+		SDL_Rect dirty[UPDATE_BATCH];
+		int numDirty = 0;
+		for(int i = 0; i < count; i++) {
+			const MARect& rect(rects[i]);
+			int left = MAX(rect.left, 0);
+			int top = MAX(rect.top, 0);
+			int right = MIN(rect.left + rect.width, gBackBuffer->w);
+			int bottom = MIN(rect.top + rect.height, gBackBuffer->h);
+			if(right <= left || bottom <= top)
+				continue;
+			SDL_Rect src = { (Sint16)left, (Sint16)top, (Uint16)(right - left), (Uint16)(bottom - top) };
+			SDL_Rect dst = src;
+			SDL_BlitSurface(gBackBuffer, &src, gScreen, &dst);
+			dirty[numDirty++] = src;
+			if(numDirty == UPDATE_BATCH) {
+				SDL_UpdateRects(gScreen, numDirty, dirty);
+				numDirty = 0;
+			}
+		}
+		if(numDirty > 0)
+			SDL_UpdateRects(gScreen, numDirty, dirty);
+#endif
+		finishFrame();
+		return 1;
+	}
+
 	static void fillBufferCallback() {
 		MAEvent* ep = new MAEvent;
 		ep->type = EVENT_TYPE_AUDIOBUFFER_FILL;
@@ -2146,6 +2496,10 @@ namespace Base {
 			return maFrameBufferInit(SYSCALL_THIS->GetValidatedMemRange(a,
 				gBackBuffer->pitch*gBackBuffer->h));
 			maIOCtl_case(maFrameBufferClose);
+		case maIOCtl_maUpdateScreenRects:
+			if(b <= 0)
+				return 0;
+			return maUpdateScreenRects((MARect*)SYSCALL_THIS->GetValidatedMemRange(a, b * sizeof(MARect)), b);
 
 			maIOCtl_case(maAudioBufferInit);
 			maIOCtl_case(maAudioBufferReady);
@@ -2727,6 +3081,7 @@ void MoSyncExit(int r) {
 			SDL_bool res = SDL_RemoveTimer(gExitTimer);
 			DEBUG_ASSERT(res);
 		}
+		reportFrameStats();
 #ifdef USE_MALIBQUIT
 		MALibQuit();	//disabled, hack to allow static destructors
 #endif
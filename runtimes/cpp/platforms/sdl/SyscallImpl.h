@@ -32,6 +32,9 @@ public:
 				id         = NULL;
 				iconPath   = NULL;
 				resmem     = ((uint)-1);
+				headless   = false;
+				eventScript = NULL;
+				maxFrames  = 0;
 			}
 
 			bool showScreen;
@@ -40,6 +43,13 @@ public:
 			uint resmem;
 			MoRE::DeviceProfile profile;
 			bool haveSkin;
+
+			// no window, no sound device and a virtual clock; see SyscallImpl.cpp.
+			bool headless;
+			// file of timed input events, injected in headless mode.
+			const char* eventScript;
+			// exit after this many maUpdateScreen() calls and print frame statistics. 0 means no limit.
+			int maxFrames;
 #ifdef EMULATOR
 			uint timeout;
 #endif
@@ -49,6 +49,10 @@ void MoSyncThread::sleep ( unsigned int ms ) {
     SDL_Delay( (Uint32) ms );
 }
 
+int MoSyncThread::getTicks() {
+	return (int)SDL_GetTicks();
+}
+
 bool MoSyncThread::isCurrent() {
 	if(mThread) {
 		if(SDL_ThreadID() == SDL_GetThreadID(mThread))
@@ -76,6 +80,12 @@ void MoSyncSemaphore::wait() {
 	DEBUG_ASRTZERO(SDL_SemWait(mSem));
 }
 
+bool MoSyncSemaphore::tryWait(unsigned int ms) {
+	int res = SDL_SemWaitTimeout(mSem, ms);
+	DEBUG_ASSERT(res == 0 || res == SDL_MUTEX_TIMEDOUT);
+	return res == 0;
+}
+
 void MoSyncSemaphore::post() {
 	DEBUG_ASRTZERO(SDL_SemPost(mSem));
 }
@@ -25,6 +25,8 @@ public:
 	void start(int (SDLCALL * func)(void*), void* arg);
 	int join();
 	static void sleep(unsigned int ms);
+	//milliseconds from a monotonic host clock, even in -headless mode.
+	static int getTicks();
 	bool isCurrent();	//returns true if this thread is the current thread.
 private:
 	SDL_Thread* mThread;
@@ -35,6 +37,8 @@ public:
 	MoSyncSemaphore();
 	~MoSyncSemaphore();
 	void wait();
+	//returns false if \a ms milliseconds passed without a post().
+	bool tryWait(unsigned int ms);
 	void post();
 private:
 	SDL_sem* mSem;
@@ -140,6 +140,10 @@ int Base::getRuntimeIp() {
 	return -1;
 }
 
+bool Base::getRuntimeInstructionCount(uint&) {
+	return false;
+}
+
 void Base::reportCallStack() {
 }
 
@@ -27,5 +27,6 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 	m(80010, SDLERR_TEXT_RENDER_FAILED, "Failed to render text")\
 	m(80011, SDLERR_SOUND_DECODE_FAILED, "Failed to decode sound")\
 	m(80012, SDLERR_NOSKIN, "Selected skin unavailable")\
+	m(80013, SDLERR_EVENT_SCRIPT_INVALID, "Invalid event script")\
 
 DECLARE_ERROR_ENUM(SDL);
@@ -38,6 +38,8 @@ void __attribute((noreturn)) reloadProgram();
 	void reportCallStack();
 	int maDumpCallStackEx(const char*, int);
 	int getRuntimeIp();
+	//returns false if the core doesn't count instructions.
+	bool getRuntimeInstructionCount(uint& count);
 	bool MAProcessEvents();
 }
 using namespace Base;
@@ -5,7 +5,7 @@ require File.expand_path('../../../../rules/native_mosync.rb')
 work = NativeMoSyncLib.new
 work.instance_eval do 
 	@SOURCES = [".", "./thread", "./Skinning", "../../base", "../../base/thread", "../../../../intlibs/hashmap"]
-	@IGNORED_FILES = ["Image.cpp", "audio.cpp"]
+	@IGNORED_FILES = ["Image.cpp", "Blitter.cpp", "audio.cpp"]
 	common_includes = [".", "../../base"]
 	common_libraries = ["SDL", "SDLmain", "SDL_ttf"]
 	@SPECIFIC_CFLAGS = {"SDL_prim.c" => " -Wno-float-equal -Wno-unreachable-code",
@@ -46,7 +46,7 @@ work.instance_eval do
 	
 	if(!@GCC_IS_V4)
 		@SPECIFIC_CFLAGS["hashmap.cpp"] = " -Wno-unreachable-code"
-		@SPECIFIC_CFLAGS["AudioChannel.cpp"] = " -Wno-unreachable-code"
+		@SPECIFIC_CFLAGS["AudioMixer.cpp"] = " -Wno-unreachable-code"
 		if(CONFIG == "")	#buggy compiler
 			@SPECIFIC_CFLAGS["ConfigParser.cpp"] = " -Wno-uninitialized"
 			@SPECIFIC_CFLAGS["Syscall.cpp"] = " -Wno-uninitialized -Wno-float-equal"
@@ -58,6 +58,10 @@ void MoSyncThread::sleep ( unsigned int ms ) {
     Sleep( (DWORD) ms );
 }
 
+int MoSyncThread::getTicks() {
+	return (int)GetTickCount();
+}
+
 //*****************************************************************************
 //MoSyncSemaphore
 //*****************************************************************************
@@ -85,6 +89,14 @@ void MoSyncSemaphore::wait() {
 	}
 }
 
+bool MoSyncSemaphore::tryWait(unsigned int ms) {
+	DWORD res = WaitForSingleObject(mSem, ms);
+	if(res == WAIT_FAILED) {
+		GLE(0);
+	}
+	return res == WAIT_OBJECT_0;
+}
+
 void MoSyncSemaphore::post() {
 	GLE(ReleaseSemaphore(mSem, 1, NULL));
 }
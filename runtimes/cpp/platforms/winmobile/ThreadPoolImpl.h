@@ -25,6 +25,8 @@ public:
 	void start(int (*func)(void*), void* arg);
 	int join();
         static void sleep ( unsigned int ms );
+	//milliseconds from a monotonic host clock.
+	static int getTicks();
 private:
 	HANDLE mThread;
 };
@@ -34,6 +36,8 @@ public:
 	MoSyncSemaphore();
 	~MoSyncSemaphore();
 	void wait();
+	//returns false if \a ms milliseconds passed without a post().
+	bool tryWait(unsigned int ms);
 	void post();
 private:
 	HANDLE mSem;
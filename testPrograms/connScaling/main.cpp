@@ -0,0 +1,137 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+// Connection scaling benchmark.
+// Opens 1 to CONN_MAX connections to an echo server and bounces a message
+// over each of them ROUNDS times, with all connections active at once.
+// Prints the time taken for each connection count.
+//
+// Run an echo server on the host first, for example:
+//   socat TCP-LISTEN:7777,fork,reuseaddr EXEC:cat
+
+#include <conprint.h>
+#include <ma.h>
+#include <maassert.h>
+#include <mastring.h>
+
+#define URL "socket://127.0.0.1:7777"
+#define ROUNDS 100
+#define MSG_SIZE 64
+
+struct Conn {
+	MAHandle h;
+	char out[MSG_SIZE];
+	char in[MSG_SIZE];
+	int got;
+	int rounds;
+};
+
+static Conn sConns[CONN_MAX];
+
+static Conn& findConn(MAHandle h, int n) {
+	for(int i=0; i<n; i++) {
+		if(sConns[i].h == h)
+			return sConns[i];
+	}
+	maPanic(0, "Unknown connection handle");
+}
+
+static void startRound(Conn& c) {
+	c.got = 0;
+	maConnWrite(c.h, c.out, MSG_SIZE);
+	maConnRead(c.h, c.in, MSG_SIZE);
+}
+
+// Returns the time taken in milliseconds, or <0 on error.
+static int bench(int n) {
+	int start = maGetMilliSecondCount();
+	for(int i=0; i<n; i++) {
+		Conn& c(sConns[i]);
+		memset(c.out, 'a' + i, MSG_SIZE);
+		c.rounds = 0;
+		c.h = maConnect(URL);
+		if(c.h < 0) {
+			printf("maConnect error %i\n", c.h);
+			return c.h;
+		}
+	}
+
+	int done = 0;
+	int result = 0;
+	while(done < n && result >= 0) {
+		MAEvent event;
+		while(maGetEvent(&event)) {
+			if(event.type == EVENT_TYPE_CLOSE ||
+				(event.type == EVENT_TYPE_KEY_PRESSED && event.key == MAK_0))
+			{
+				maExit(0);
+			}
+			if(event.type != EVENT_TYPE_CONN)
+				continue;
+			Conn& c(findConn(event.conn.handle, n));
+			if(event.conn.result <= 0) {
+				printf("Op %i conn %i error %i\n", event.conn.opType, c.h, event.conn.result);
+				result = event.conn.result;
+				break;
+			}
+			switch(event.conn.opType) {
+			case CONNOP_CONNECT:
+				startRound(c);
+				break;
+			case CONNOP_WRITE:
+				break;
+			case CONNOP_READ:
+				c.got += event.conn.result;
+				if(c.got < MSG_SIZE) {
+					maConnRead(c.h, c.in + c.got, MSG_SIZE - c.got);
+					break;
+				}
+				MAASSERT(memcmp(c.in, c.out, MSG_SIZE) == 0);
+				if(++c.rounds == ROUNDS)
+					done++;
+				else
+					startRound(c);
+				break;
+			}
+		}
+		if(done < n && result >= 0)
+			maWait(0);
+	}
+	int time = maGetMilliSecondCount() - start;
+
+	for(int i=0; i<n; i++) {
+		maConnClose(sConns[i].h);
+	}
+	return result < 0 ? result : time;
+}
+
+extern "C" int MAMain() {
+	InitConsole();
+	gConsoleLogging = 1;
+
+	printf("%i round trips of %i bytes per connection\n", ROUNDS, MSG_SIZE);
+	for(int n=1; n<=CONN_MAX; n*=2) {
+		int time = bench(n);
+		if(time < 0)
+			break;
+		printf("%2i connections: %5i ms, %i round trips/s\n", n, time,
+			time > 0 ? (n * ROUNDS * 1000) / time : 0);
+	}
+
+	printf("Done.\n");
+	FREEZE;
+}
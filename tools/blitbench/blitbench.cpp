@@ -0,0 +1,306 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+// Measures the blitters behind Image::drawImageRegion() in the software
+// rendering runtimes: the loops it used to run for every format, against
+// the ones in Blitter.cpp. Also counts the pixels where the two differ.
+// Usage: blitbench [seconds per case]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Blitter.h"
+
+using namespace Blitter;
+
+static const Format sRGB565 = { 2, 0xf800, 0x07e0, 0x001f, 11, 5, 0 };
+static const Format sRGB888 = { 4, 0xff0000, 0xff00, 0xff, 16, 8, 0 };
+
+enum Kind { COPY, ALPHA_PLANE, ALPHA_CHANNEL };
+enum Transform { NONE, ROT90, ROT180, MIRROR };
+enum Fill { OPAQUE, SPRITE, TRANSLUCENT };
+
+static const char* sTransformNames[] = { "none", "rot90", "rot180", "mirror" };
+static const char* sFillNames[] = { "opaque", "sprite", "translucent" };
+
+struct Case {
+	const char* name;
+	const Format* fmt;
+	Kind kind;
+	Transform trans;
+	Fill fill;
+};
+
+static const Case sCases[] = {
+	{ "565 copy", &sRGB565, COPY, NONE, OPAQUE },
+	{ "565 copy", &sRGB565, COPY, ROT90, OPAQUE },
+	{ "565 copy", &sRGB565, COPY, MIRROR, OPAQUE },
+	{ "888 copy", &sRGB888, COPY, NONE, OPAQUE },
+	{ "888 copy", &sRGB888, COPY, ROT90, OPAQUE },
+	{ "888 copy", &sRGB888, COPY, ROT180, OPAQUE },
+	{ "565 alpha", &sRGB565, ALPHA_PLANE, NONE, SPRITE },
+	{ "565 alpha", &sRGB565, ALPHA_PLANE, NONE, TRANSLUCENT },
+	{ "565 alpha", &sRGB565, ALPHA_PLANE, ROT90, TRANSLUCENT },
+	{ "888 alpha", &sRGB888, ALPHA_PLANE, NONE, SPRITE },
+	{ "888 alpha", &sRGB888, ALPHA_PLANE, NONE, TRANSLUCENT },
+	{ "8888", &sRGB888, ALPHA_CHANNEL, NONE, SPRITE },
+	{ "8888", &sRGB888, ALPHA_CHANNEL, NONE, TRANSLUCENT },
+	{ "8888", &sRGB888, ALPHA_CHANNEL, MIRROR, TRANSLUCENT },
+};
+
+static const int sSizes[] = { 64, 480 };
+
+// A square source image and its position for a transform, as set up by
+// Image::drawImageRegion().
+struct Source {
+	unsigned char* data;
+	unsigned char* alpha;
+	int size, bpp, pitch;
+	const unsigned char* start;
+	const unsigned char* alphaStart;
+	int pitchX, pitchY;
+};
+
+static void setup(Source& s, Transform t) {
+	int n = s.size - 1;
+	int x = 0, y = 0;
+	switch(t) {
+	case NONE: s.pitchX = s.bpp; s.pitchY = s.pitch; break;
+	case ROT90: s.pitchX = -s.pitch; s.pitchY = s.bpp; y = n; break;
+	case ROT180: s.pitchX = -s.bpp; s.pitchY = -s.pitch; x = n; y = n; break;
+	case MIRROR: s.pitchX = -s.bpp; s.pitchY = s.pitch; x = n; break;
+	}
+	s.start = s.data + x*s.bpp + y*s.pitch;
+	s.alphaStart = s.alpha + x + y*(s.pitch/s.bpp);
+}
+
+static unsigned int randomAlpha(Fill f) {
+	switch(f) {
+	case OPAQUE: return 0xff;
+	case SPRITE: return (rand() & 1) ? 0xff : 0;
+	default: return rand() & 0xff;
+	}
+}
+
+static void fill(Source& s, Kind kind, Fill f) {
+	for(int i = 0; i < s.size*s.size; i++) {
+		unsigned int p = ((rand() & 0xfff) << 12) | (rand() & 0xfff);
+		unsigned int a = randomAlpha(f);
+		if(s.bpp == 2)
+			((unsigned short*)s.data)[i] = (unsigned short)p;
+		else
+			((unsigned int*)s.data)[i] = kind == ALPHA_CHANNEL ? (a << 24) | p : p;
+		s.alpha[i] = (unsigned char)a;
+	}
+}
+
+// what Image::drawImageRegion() did before, for a destination with the same format
+static void oldBlit(unsigned char* dst, int dstPitch, const Source& s, const Format& f,
+	Kind kind, int transWidth, int transHeight)
+{
+	const unsigned char* src = s.start;
+	int srcPitchX = s.pitchX, srcPitchY = s.pitchY;
+	if(kind == ALPHA_PLANE && s.bpp == 2) {
+		srcPitchX>>=1;
+		const unsigned char *salpha = s.alphaStart;
+		while(transHeight--) {
+			const unsigned short *src_scan = (const unsigned short*)src;
+			unsigned short *dst_scan = (unsigned short*)dst;
+			const unsigned char *ascan = salpha;
+			int x = transWidth;
+			while(x--) {
+				int sr = (((*src_scan)&f.redMask)>>f.redShift);
+				int sg = (((*src_scan)&f.greenMask)>>f.greenShift);
+				int sb = (((*src_scan)&f.blueMask)>>f.blueShift);
+				int dr = (((*dst_scan)&f.redMask)>>f.redShift);
+				int dg = (((*dst_scan)&f.greenMask)>>f.greenShift);
+				int db = (((*dst_scan)&f.blueMask)>>f.blueShift);
+				if(*ascan == 255) {
+					*dst_scan = (((sr)<< f.redShift)&f.redMask) |
+						(((sg)<< f.greenShift)&f.greenMask) |
+						(((sb)<< f.blueShift)&f.blueMask);
+				} else if(*ascan == 0) {
+					*dst_scan = (((dr)<< f.redShift)&f.redMask) |
+						(((dg)<< f.greenShift)&f.greenMask) |
+						(((db)<< f.blueShift)&f.blueMask);
+				} else {
+					*dst_scan =
+						(((dr + (((sr-dr)*(*ascan))>>8)) << f.redShift)&f.redMask) |
+						(((dg + (((sg-dg)*(*ascan))>>8)) << f.greenShift)&f.greenMask) |
+						(((db + (((sb-db)*(*ascan))>>8)) << f.blueShift)&f.blueMask);
+				}
+				src_scan+=srcPitchX;
+				dst_scan++;
+				ascan+=srcPitchX;
+			}
+			src += srcPitchY;
+			dst += dstPitch;
+			salpha += srcPitchY>>1;
+		}
+	} else if(kind != COPY) {
+		srcPitchX>>=2;
+		const unsigned char *salpha = s.alphaStart;
+		while(transHeight--) {
+			const unsigned int *src_scan = (const unsigned int*)src;
+			unsigned int *dst_scan = (unsigned int*)dst;
+			const unsigned char *ascan = salpha;
+			int x = transWidth;
+			while(x--) {
+				int sr = (((*src_scan)&f.redMask)>>f.redShift);
+				int sg = (((*src_scan)&f.greenMask)>>f.greenShift);
+				int sb = (((*src_scan)&f.blueMask)>>f.blueShift);
+				int sa = kind == ALPHA_PLANE ? *ascan : (int)((*src_scan)>>24);
+				int dr = (((*dst_scan)&f.redMask)>>f.redShift);
+				int dg = (((*dst_scan)&f.greenMask)>>f.greenShift);
+				int db = (((*dst_scan)&f.blueMask)>>f.blueShift);
+				if(sa == 255) {
+					*dst_scan = (((sr)<< f.redShift)&f.redMask) |
+						(((sg)<< f.greenShift)&f.greenMask) |
+						(((sb)<< f.blueShift)&f.blueMask);
+				} else if(sa == 0) {
+					*dst_scan = (((dr)<< f.redShift)&f.redMask) |
+						(((dg)<< f.greenShift)&f.greenMask) |
+						(((db)<< f.blueShift)&f.blueMask);
+				} else {
+					*dst_scan =
+						(((dr + (((sr-dr)*(sa))>>8)) << f.redShift)&f.redMask) |
+						(((dg + (((sg-dg)*(sa))>>8)) << f.greenShift)&f.greenMask) |
+						(((db + (((sb-db)*(sa))>>8)) << f.blueShift)&f.blueMask);
+				}
+				src_scan+=srcPitchX;
+				dst_scan++;
+				ascan+=srcPitchX;
+			}
+			src += srcPitchY;
+			dst += dstPitch;
+			salpha += srcPitchY>>2;
+		}
+	} else {
+		int bytesPerPixel = f.bytesPerPixel;
+		int dstOffsetY = -transWidth*bytesPerPixel + dstPitch;
+		int srcOffsetY = -srcPitchX*transWidth + srcPitchY;
+		while(transHeight--) {
+			int width = transWidth;
+			while(width--) {
+				memcpy(dst, src, bytesPerPixel);
+				src+=srcPitchX;
+				dst+=bytesPerPixel;
+			}
+			dst+=dstOffsetY;
+			src+=srcOffsetY;
+		}
+	}
+}
+
+static void newBlit(unsigned char* dst, int dstPitch, const Source& s, const Format& f,
+	Kind kind, int transWidth, int transHeight)
+{
+	switch(kind) {
+	case COPY:
+		copy(dst, dstPitch, s.start, s.pitchX, s.pitchY, f.bytesPerPixel, transWidth, transHeight);
+		break;
+	case ALPHA_PLANE:
+		blend(dst, dstPitch, s.start, s.alphaStart, s.pitchX, s.pitchY, f, transWidth, transHeight);
+		break;
+	case ALPHA_CHANNEL:
+		blend(dst, dstPitch, s.start, NULL, s.pitchX, s.pitchY, f, transWidth, transHeight);
+		break;
+	}
+}
+
+typedef void (*BlitFunc)(unsigned char*, int, const Source&, const Format&, Kind, int, int);
+
+static void clear(unsigned char* buf, int pitch, int size, int bpp) {
+	for(int y = 0; y < size; y++) {
+		for(int x = 0; x < size; x++) {
+			unsigned int p = (x*7) ^ (y*13) ^ 0x00804020;
+			if(bpp == 2)
+				((unsigned short*)(buf + y*pitch))[x] = (unsigned short)(p * 0x1234);
+			else
+				((unsigned int*)(buf + y*pitch))[x] = p;
+		}
+	}
+}
+
+// megapixels per second
+static double measure(BlitFunc blit, unsigned char* dst, int dstPitch, const Source& s,
+	const Format& f, Kind kind, double seconds)
+{
+	double pixels = 0;
+	int repeat = (1 << 20) / (s.size*s.size) + 1;
+	clock_t start = clock();
+	clock_t end = start + (clock_t)(seconds * CLOCKS_PER_SEC);
+	clock_t now;
+	do {
+		for(int i = 0; i < repeat; i++)
+			blit(dst, dstPitch, s, f, kind, s.size, s.size);
+		pixels += (double)repeat * s.size * s.size;
+		now = clock();
+	} while(now < end);
+	return pixels / 1e6 / ((double)(now - start) / CLOCKS_PER_SEC);
+}
+
+int main(int argc, char** argv) {
+	double seconds = argc > 1 ? atof(argv[1]) : 1;
+	srand(1);
+
+	printf("%-10s %-7s %-12s %5s %10s %10s %8s %7s\n", "format", "trans", "pixels",
+		"size", "old Mp/s", "new Mp/s", "speedup", "differ");
+	for(size_t i = 0; i < sizeof(sCases)/sizeof(Case); i++) {
+		const Case& c = sCases[i];
+		for(size_t j = 0; j < sizeof(sSizes)/sizeof(int); j++) {
+			int size = sSizes[j];
+			int bpp = c.fmt->bytesPerPixel;
+			// odd pitches, so that rows aren't all aligned the same
+			int pitch = (size + 3) * bpp;
+			Source s;
+			s.size = size;
+			s.bpp = bpp;
+			s.pitch = pitch;
+			s.data = new unsigned char[pitch*size];
+			s.alpha = new unsigned char[(pitch/bpp)*size];
+			memset(s.alpha, 0, (pitch/bpp)*size);
+			fill(s, c.kind, c.fill);
+			setup(s, c.trans);
+
+			unsigned char* a = new unsigned char[pitch*size];
+			unsigned char* b = new unsigned char[pitch*size];
+			clear(a, pitch, size, bpp);
+			clear(b, pitch, size, bpp);
+			oldBlit(a, pitch, s, *c.fmt, c.kind, size, size);
+			newBlit(b, pitch, s, *c.fmt, c.kind, size, size);
+			int differ = 0;
+			for(int y = 0; y < size; y++)
+				for(int x = 0; x < size; x++)
+					differ += memcmp(a + y*pitch + x*bpp, b + y*pitch + x*bpp, bpp) != 0;
+
+			double oldRate = measure(oldBlit, a, pitch, s, *c.fmt, c.kind, seconds);
+			double newRate = measure(newBlit, b, pitch, s, *c.fmt, c.kind, seconds);
+			printf("%-10s %-7s %-12s %5i %10.0f %10.0f %7.1fx %7i\n", c.name,
+				sTransformNames[c.trans], sFillNames[c.fill], size, oldRate, newRate,
+				newRate / oldRate, differ);
+
+			delete[] a;
+			delete[] b;
+			delete[] s.data;
+			delete[] s.alpha;
+		}
+	}
+	return 0;
+}
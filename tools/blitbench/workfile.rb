@@ -0,0 +1,14 @@
+#!/usr/bin/ruby
+
+require File.expand_path('../../rules/exe.rb')
+
+work = ExeWork.new
+work.instance_eval do
+	@SOURCES = ["."]
+	@EXTRA_SOURCEFILES = ["../../runtimes/cpp/base/Blitter.cpp"]
+	@EXTRA_INCLUDES = ["../../runtimes/cpp/base"]
+	@NAME = "blitbench"
+	setup
+end
+
+work.invoke
@@ -0,0 +1,357 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+// Measures the runtime's plain TCP connection operations: the ThreadPool
+// ConnOps against NetReactor. Like testPrograms/connScaling, it bounces a
+// message over every connection at once, a number of rounds, but it runs
+// the runtime's networking code natively, against an echo server in a
+// child process. Then it closes the connections with a read pending on each,
+// which must cancel them.
+// Prints the time taken and the peak number of threads in the process.
+// The runtime's own log goes to log.txt.
+// Linux only, as that is where the runtime has NetReactor.
+// Usage: connbench <pool|reactor> <connections> [rounds]
+// Many connections may need a higher open file limit (ulimit -n).
+
+#include "config_platform.h"
+#include "Platform.h"
+#include <helpers/helpers.h>
+
+#define NETWORKING_H
+#include "networking.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <deque>
+#include <vector>
+
+#ifndef HAVE_EPOLL
+#error connbench needs a runtime with NetReactor.
+#endif
+
+enum { MSG_SIZE = 64 };
+
+//*****************************************************************************
+// What the runtime's event loop would otherwise provide
+//*****************************************************************************
+
+MoSyncMutex* gpConnMutex = NULL;
+ConnMap* gpConnections = NULL;
+int gConnNextHandle = 1;
+
+static pthread_mutex_t sQueueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sQueueCond = PTHREAD_COND_INITIALIZER;
+static std::deque<MAEvent*> sQueue;
+
+void ConnPushEvent(MAEvent* ep) {
+	pthread_mutex_lock(&sQueueMutex);
+	sQueue.push_back(ep);
+	pthread_cond_signal(&sQueueCond);
+	pthread_mutex_unlock(&sQueueMutex);
+}
+
+// Returns NULL if wait is false and there is no event.
+static MAEvent* popEvent(bool wait) {
+	MAEvent* ep = NULL;
+	pthread_mutex_lock(&sQueueMutex);
+	while(wait && sQueue.empty())
+		pthread_cond_wait(&sQueueCond, &sQueueMutex);
+	if(!sQueue.empty()) {
+		ep = sQueue.front();
+		sQueue.pop_front();
+	}
+	pthread_mutex_unlock(&sQueueMutex);
+	return ep;
+}
+
+void ConnWaitEvent() {
+	usleep(1000);
+}
+
+void DefluxBinPushEvent(MAHandle, Stream&) {
+}
+
+namespace Base {
+	bool MAProcessEvents() {
+		return true;
+	}
+}
+
+void MoSyncErrorExit(int errorCode) {
+	printf("MoSyncErrorExit(%i)\n", errorCode);
+	exit(1);
+}
+
+//*****************************************************************************
+// Echo server
+//*****************************************************************************
+
+static void echoServer(int listener) {
+	int ep = epoll_create(1);
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = listener;
+	epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+
+	epoll_event events[64];
+	char buf[4096];
+	while(true) {
+		int n = epoll_wait(ep, events, 64, -1);
+		for(int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if(fd == listener) {
+				int s = accept(listener, NULL, NULL);
+				if(s < 0)
+					continue;
+				ev.events = EPOLLIN;
+				ev.data.fd = s;
+				epoll_ctl(ep, EPOLL_CTL_ADD, s, &ev);
+				continue;
+			}
+			int len = read(fd, buf, sizeof(buf));
+			if(len <= 0) {
+				close(fd);
+				continue;
+			}
+			// The messages are small, so a blocking write is fine.
+			for(int pos = 0; pos < len; ) {
+				int res = write(fd, buf + pos, len - pos);
+				if(res <= 0)
+					break;
+				pos += res;
+			}
+		}
+	}
+}
+
+// Returns the port, or <0 on error.
+static int startEchoServer(pid_t& pid) {
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(listener < 0)
+		return -1;
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = 0;
+	socklen_t len = sizeof(addr);
+	if(bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+		listen(listener, 1024) < 0 ||
+		getsockname(listener, (sockaddr*)&addr, &len) < 0)
+	{
+		return -1;
+	}
+
+	pid = fork();
+	if(pid < 0)
+		return -1;
+	if(pid == 0) {
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		echoServer(listener);
+		_exit(0);
+	}
+	close(listener);
+	return ntohs(addr.sin_port);
+}
+
+//*****************************************************************************
+// Benchmark
+//*****************************************************************************
+
+static int threadCount() {
+	FILE* file = fopen("/proc/self/status", "r");
+	if(!file)
+		return 0;
+	char line[256];
+	int n = 0;
+	while(fgets(line, sizeof(line), file)) {
+		if(strncmp(line, "Threads:", 8) == 0)
+			n = atoi(line + 8);
+	}
+	fclose(file);
+	return n;
+}
+
+static double now() {
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct Conn {
+	MAStreamConn* mac;
+	char out[MSG_SIZE];
+	char in[MSG_SIZE];
+	int got;
+	bool writing;
+	int rounds;
+};
+
+static bool sReactor;
+static ThreadPool* sPool;
+
+static void startOp(Conn& c, int op) {
+	gConnMutex.lock();
+	c.mac->state |= op;
+	gConnMutex.unlock();
+}
+
+static void startRead(Conn& c) {
+	startOp(c, CONNOP_READ);
+	if(sReactor)
+		NetReactorRead(*c.mac, c.in + c.got, MSG_SIZE - c.got);
+	else
+		sPool->execute(new ConnRead(*c.mac, c.in + c.got, MSG_SIZE - c.got));
+}
+
+// A connection may only have one write pending, so a round only ends once
+// both the echo and the write result are in.
+static void startRound(Conn& c) {
+	c.got = 0;
+	c.writing = true;
+	startOp(c, CONNOP_WRITE);
+	if(sReactor)
+		NetReactorWrite(*c.mac, c.out, MSG_SIZE);
+	else
+		sPool->execute(new ConnWrite(*c.mac, c.out, MSG_SIZE));
+	startRead(c);
+}
+
+int main(int argc, char** argv) {
+	if(argc < 3 || (strcmp(argv[1], "pool") != 0 && strcmp(argv[1], "reactor") != 0)) {
+		printf("Usage: connbench <pool|reactor> <connections> [rounds]\n");
+		return 1;
+	}
+	sReactor = strcmp(argv[1], "reactor") == 0;
+	int n = atoi(argv[2]);
+	int rounds = argc > 3 ? atoi(argv[3]) : 100;
+	if(n < 1 || rounds < 1) {
+		printf("connections and rounds must be positive\n");
+		return 1;
+	}
+
+	// Fork before there are any threads.
+	pid_t server;
+	int port = startEchoServer(server);
+	if(port < 0) {
+		printf("Could not start the echo server\n");
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	gpConnMutex = new MoSyncMutex;
+	gpConnMutex->init();
+	gpConnections = new ConnMap;
+	sPool = new ThreadPool;
+	NetReactorInit();
+
+	std::vector<Conn> conns(n);
+	int peak = threadCount();
+	double start = now();
+	for(int i = 0; i < n; i++) {
+		Conn& c(conns[i]);
+		TcpConnection* tcp = new TcpConnection("127.0.0.1", port);
+		c.mac = new MAStreamConn(gConnNextHandle++, tcp, sReactor ? tcp : NULL);
+		memset(c.out, 'a' + i % 26, MSG_SIZE);
+		c.rounds = 0;
+		startOp(c, CONNOP_CONNECT);
+		if(!sReactor || !NetReactorConnect(*c.mac))
+			sPool->execute(new Connect(*c.mac));
+	}
+
+	int done = 0;
+	while(done < n) {
+		MAEvent* ep = popEvent(true);
+		Conn& c(conns[ep->conn.handle - 1]);
+		int op = ep->conn.opType;
+		int result = ep->conn.result;
+		delete ep;
+		if(result <= 0) {
+			printf("Connection %i, operation %i: error %i\n", c.mac->handle, op, result);
+			kill(server, SIGTERM);
+			return 1;
+		}
+		int threads = threadCount();
+		if(threads > peak)
+			peak = threads;
+
+		if(op == CONNOP_CONNECT) {
+			startRound(c);
+			continue;
+		}
+		if(op == CONNOP_WRITE) {
+			c.writing = false;
+		} else {
+			c.got += result;
+			if(c.got < MSG_SIZE)
+				startRead(c);
+		}
+
+		if(!c.writing && c.got == MSG_SIZE) {
+			if(memcmp(c.in, c.out, MSG_SIZE) != 0) {
+				printf("Connection %i: echo mismatch\n", c.mac->handle);
+				kill(server, SIGTERM);
+				return 1;
+			}
+			if(++c.rounds == rounds)
+				done++;
+			else
+				startRound(c);
+		}
+	}
+	double time = now() - start;
+
+	// Close with a read pending on every connection.
+	for(int i = 0; i < n; i++) {
+		conns[i].got = 0;
+		startRead(conns[i]);
+	}
+	for(int i = 0; i < n; i++) {
+		if(sReactor)
+			NetReactorCancel(*conns[i].mac);
+		conns[i].mac->close();
+		delete conns[i].mac->conn;
+		delete conns[i].mac;
+	}
+	int canceled = 0;
+	while(MAEvent* ep = popEvent(false)) {
+		if(ep->conn.result == CONNERR_CANCELED)
+			canceled++;
+		delete ep;
+	}
+
+	printf("%s, %i connections, %i rounds of %i bytes: %.3f s, peak %i threads, %i of %i reads canceled\n",
+		argv[1], n, rounds, MSG_SIZE, time, peak, canceled, n);
+
+	NetReactorClose();
+	sPool->close();
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	return canceled == n ? 0 : 1;
+}
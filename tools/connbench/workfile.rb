@@ -0,0 +1,20 @@
+#!/usr/bin/ruby
+
+require File.expand_path('../../rules/native_mosync.rb')
+
+# Linux only; NetReactor uses epoll.
+work = MoSyncExe.new
+work.instance_eval do
+	@SOURCES = ["."]
+	@EXTRA_SOURCEFILES = ["../../runtimes/cpp/base/NetReactor.cpp",
+		"../../runtimes/cpp/base/ThreadPool.cpp", "../../runtimes/cpp/base/MemStream.cpp",
+		"../../runtimes/cpp/base/Stream.cpp", "../../runtimes/cpp/platforms/sdl/ThreadPoolImpl.cpp",
+		"../../runtimes/cpp/platforms/sdl/mutexImpl.cpp"]
+	@EXTRA_INCLUDES = ["../../intlibs", "../../runtimes/cpp", "../../runtimes/cpp/core",
+		"../../runtimes/cpp/base", "../../runtimes/cpp/platforms/sdl"]
+	@LOCAL_LIBS = ["mosync_log_file", "net"]
+	@LIBRARIES = ["SDL", "pthread"]
+	@NAME = "connbench"
+end
+
+work.invoke
@@ -0,0 +1,141 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+// Measures full-screen maDrawRGB() in the SDL runtime: the SDL_Surface
+// wrapping blit it used to do, against the direct blitter in DrawRGB.cpp.
+// Also counts the pixels where the two differ.
+// Usage: drawrgbbench [seconds per case]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <SDL/SDL.h>
+
+#include "DrawRGB.h"
+
+struct Size {
+	int w, h;
+};
+
+static const Size sSizes[] = {
+	{ 240, 320 },
+	{ 480, 800 },
+};
+
+enum Fill { OPAQUE, SPRITE, TRANSLUCENT };
+
+static const char* sFillNames[] = { "opaque", "sprite", "translucent" };
+
+static void fill(unsigned int* buf, int n, Fill f) {
+	for(int i = 0; i < n; i++) {
+		unsigned int rgb = ((rand() & 0xfff) << 12) | (rand() & 0xfff);
+		unsigned int a;
+		switch(f) {
+		case OPAQUE: a = 0xff; break;
+		case SPRITE: a = (rand() & 1) ? 0xff : 0; break;
+		default: a = rand() & 0xff;
+		}
+		buf[i] = (a << 24) | rgb;
+	}
+}
+
+// what the syscall did before
+static void oldDrawRGB(SDL_Surface* dst, const unsigned int* src, int w, int h) {
+	SDL_Rect srcRect = { 0, 0, (Uint16)w, (Uint16)h };
+	SDL_Rect dstRect = { 0, 0, (Uint16)w, (Uint16)h };
+	SDL_Surface* srcSurface = SDL_CreateRGBSurfaceFrom((void*)src, w, h, 32, w<<2,
+		0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+	SDL_SetAlpha(srcSurface, SDL_SRCALPHA, 0x0);
+	SDL_BlitSurface(srcSurface, &srcRect, dst, &dstRect);
+	SDL_FreeSurface(srcSurface);
+}
+
+static void newDrawRGB(SDL_Surface* dst, const unsigned int* src, int w, int h) {
+	const SDL_PixelFormat* fmt = dst->format;
+	drawRGB(dst->pixels, dst->pitch, fmt->Rmask, fmt->Gmask, fmt->Bmask, src, w<<2, w, h);
+}
+
+static SDL_Surface* createScreen(const Size& s) {
+	return SDL_CreateRGBSurface(SDL_SWSURFACE, s.w, s.h, 32,
+		0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+}
+
+static void clear(SDL_Surface* surf) {
+	for(int y = 0; y < surf->h; y++)
+		for(int x = 0; x < surf->w; x++)
+			((unsigned int*)((char*)surf->pixels + y*surf->pitch))[x] = (x*7) ^ (y*13) ^ 0x00804020;
+}
+
+// frames per second for a drawing function
+static double measure(void (*draw)(SDL_Surface*, const unsigned int*, int, int),
+	SDL_Surface* dst, const unsigned int* src, double seconds)
+{
+	int frames = 0;
+	clock_t start = clock();
+	clock_t end = start + (clock_t)(seconds * CLOCKS_PER_SEC);
+	clock_t now;
+	do {
+		for(int i = 0; i < 16; i++)
+			draw(dst, src, dst->w, dst->h);
+		frames += 16;
+		now = clock();
+	} while(now < end);
+	return frames / ((double)(now - start) / CLOCKS_PER_SEC);
+}
+
+int main(int argc, char** argv) {
+	double seconds = argc > 1 ? atof(argv[1]) : 2;
+	srand(1);
+
+	printf("%-10s %-12s %12s %12s %8s %10s\n", "size", "pixels", "old fps", "new fps",
+		"speedup", "differ");
+	for(size_t i = 0; i < sizeof(sSizes)/sizeof(Size); i++) {
+		const Size& s = sSizes[i];
+		unsigned int* src = new unsigned int[s.w * s.h];
+		SDL_Surface* a = createScreen(s);
+		SDL_Surface* b = createScreen(s);
+		for(int f = OPAQUE; f <= TRANSLUCENT; f++) {
+			fill(src, s.w * s.h, (Fill)f);
+
+			// one draw on identical backgrounds, for the comparison
+			clear(a);
+			clear(b);
+			oldDrawRGB(a, src, s.w, s.h);
+			newDrawRGB(b, src, s.w, s.h);
+			int differ = 0;
+			for(int y = 0; y < s.h; y++) {
+				const unsigned int* pa = (const unsigned int*)((char*)a->pixels + y*a->pitch);
+				const unsigned int* pb = (const unsigned int*)((char*)b->pixels + y*b->pitch);
+				for(int x = 0; x < s.w; x++)
+					differ += pa[x] != pb[x];
+			}
+
+			double oldFps = measure(oldDrawRGB, a, src, seconds);
+			double newFps = measure(newDrawRGB, b, src, seconds);
+			char size[16];
+			sprintf(size, "%ix%i", s.w, s.h);
+			printf("%-10s %-12s %12.0f %12.0f %7.1fx %10i\n", size, sFillNames[f],
+				oldFps, newFps, newFps / oldFps, differ);
+		}
+		SDL_FreeSurface(a);
+		SDL_FreeSurface(b);
+		delete[] src;
+	}
+	return 0;
+}
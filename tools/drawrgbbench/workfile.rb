@@ -0,0 +1,19 @@
+#!/usr/bin/ruby
+
+require File.expand_path('../../rules/exe.rb')
+
+work = ExeWork.new
+work.instance_eval do
+	@SOURCES = ["."]
+	@EXTRA_SOURCEFILES = ["../../runtimes/cpp/platforms/sdl/DrawRGB.cpp"]
+	@EXTRA_INCLUDES = ["../../runtimes/cpp/platforms/sdl"]
+	if(HOST == :win32)
+		@CUSTOM_LIBS = ["SDL.lib"]
+	else
+		@LIBRARIES = ["SDL"]
+	end
+	@NAME = "drawrgbbench"
+	setup
+end
+
+work.invoke
@@ -0,0 +1,161 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+// Measures pipe-tool link time on a generated program of MAUI-style mangled
+// C++ functions. The names are built from a few class names and a four-digit
+// number, so most of them are anagrams of each other, as in a large app.
+// Each pipe-tool given is timed on the same input, and its module is compared
+// with the first one's.
+// Usage: linkbench <functions> <runs> <pipe-tool> [pipe-tool...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+static const char* sWords[] = {
+	"Widget", "Label", "Font", "Image", "Screen",
+	"Layout", "Listbox", "Engine", "Draw", "Button",
+};
+static const int NWORDS = sizeof(sWords) / sizeof(char*);
+
+static unsigned int sSeed = 1;
+
+// A fixed generator, so that every platform gets the same input.
+static unsigned int next() {
+	sSeed = sSeed * 1103515245 + 12345;
+	return (sSeed >> 8) & 0xffffff;
+}
+
+static void name(char* buf, int i) {
+	const char* a = sWords[i % NWORDS];
+	const char* b = sWords[(i / NWORDS) % NWORDS];
+	const char* c = sWords[(i / (NWORDS*NWORDS)) % NWORDS];
+	sprintf(buf, "_ZN4MAUI%d%s%d%s%d%sE%04dv", (int)strlen(a), a, (int)strlen(b), b,
+		(int)strlen(c), c, (i / (NWORDS*NWORDS*NWORDS)) % 10000);
+}
+
+static bool generate(const char* file, int functions) {
+	FILE* f = fopen(file, "w");
+	if(!f)
+		return false;
+	char buf[128];
+
+	fprintf(f, "\t.data\n\t.align 4\ncounter:\n\t.word\t0\n\n");
+	fprintf(f, "\t.code\n\t.align 4\n\t.global crt0_startup\n");
+	fprintf(f, ".func crt0_startup, 0, void\n\tld r0,#0\n\tld r1,#1\n");
+	for(int i = 0; i < functions; i += 16) {
+		name(buf, i);
+		fprintf(f, "\tcall &%s\n", buf);
+	}
+	fprintf(f, "\tret\n");
+
+	for(int i = 0; i < functions; i++) {
+		name(buf, i);
+		fprintf(f, "\n.func %s, 0, int\n\tld r3,[&counter]\n", buf);
+		for(int j = 0; j < 2; j++) {
+			name(buf, next() % functions);
+			fprintf(f, "\tcall &%s\n", buf);
+		}
+		fprintf(f, "L%d:\n\tadd r0,r3\n\tjc lt,r0,r3,&L%d\n\tret\n", i, i);
+	}
+	return fclose(f) == 0;
+}
+
+static double now() {
+#ifdef WIN32
+	return GetTickCount() / 1000.0;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static bool sameFile(const char* a, const char* b) {
+	FILE* fa = fopen(a, "rb");
+	FILE* fb = fopen(b, "rb");
+	bool same = fa && fb;
+	while(same) {
+		int ca = fgetc(fa);
+		int cb = fgetc(fb);
+		if(ca != cb)
+			same = false;
+		else if(ca == EOF)
+			break;
+	}
+	if(fa) fclose(fa);
+	if(fb) fclose(fb);
+	return same;
+}
+
+int main(int argc, char** argv) {
+	if(argc < 4) {
+		printf("Usage: linkbench <functions> <runs> <pipe-tool> [pipe-tool...]\n");
+		return 1;
+	}
+	int functions = atoi(argv[1]);
+	int runs = atoi(argv[2]);
+	if(functions < 1 || runs < 1) {
+		printf("functions and runs must be positive\n");
+		return 1;
+	}
+
+	if(!generate("linkbench.s", functions)) {
+		printf("Could not write linkbench.s\n");
+		return 1;
+	}
+	printf("%d functions, best of %d runs\n", functions, runs);
+
+	// The tools take turns, so that a slow spell of the machine
+	// doesn't land on one of them only.
+	int tools = argc - 3;
+	double* best = new double[tools];
+	for(int t = 0; t < tools; t++)
+		best[t] = -1;
+	char cmd[1024];
+	for(int r = 0; r < runs; r++) {
+		for(int t = 0; t < tools; t++) {
+			sprintf(cmd, "\"%s\" -B -custom-config linkbench%d.mod linkbench.s > linkbench%d.log",
+				argv[3 + t], t, t);
+			double start = now();
+			int res = system(cmd);
+			double time = now() - start;
+			if(res != 0) {
+				printf("%s failed, see linkbench%d.log\n", argv[3 + t], t);
+				return 1;
+			}
+			if(best[t] < 0 || time < best[t])
+				best[t] = time;
+		}
+	}
+
+	for(int t = 0; t < tools; t++) {
+		char mod[32], first[32];
+		sprintf(mod, "linkbench%d.mod", t);
+		sprintf(first, "linkbench%d.mod", 0);
+		printf("%8.2f s  %s%s\n", best[t], argv[3 + t],
+			t == 0 ? "" : sameFile(mod, first) ? "  (same module)" : "  (module differs)");
+	}
+	delete[] best;
+	return 0;
+}
@@ -0,0 +1,12 @@
+#!/usr/bin/ruby
+
+require File.expand_path('../../rules/exe.rb')
+
+work = ExeWork.new
+work.instance_eval do
+	@SOURCES = ["."]
+	@NAME = "linkbench"
+	setup
+end
+
+work.invoke
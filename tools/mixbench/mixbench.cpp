@@ -0,0 +1,176 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+// Measures the per-channel cost of the runtime's audio mixer, compared
+// to the per-sample conversion loop it replaced.
+// Usage: mixbench [seconds of audio per case]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "AudioMixer.h"
+
+#define OUT_RATE 44100
+#define OUT_FRAMES 4096
+#define BLOCK_FRAMES 512
+// a channel at half volume, so the volume scaling is measured too
+#define VOLUME 0x8000
+
+using namespace AudioMixer;
+
+// The conversion loop used by AudioChannel before the block mixer.
+template< typename SrcT, int srcBitDepth, int srcNumChannels, bool sign >
+static void legacy_convert ( int *dst, int numSamples, const SrcT *src,
+                             int pos, int delta, int vol )
+{
+	int sample;
+	for(int i = 0; i < numSamples; i++) {
+		sample = (int)src[((pos>>8)<<(srcNumChannels>>1))];
+		if(sign == false)
+			sample -= ((1<<srcBitDepth)>>1);
+		sample <<= 16-srcBitDepth;
+		sample = (sample*vol)>>16;
+		dst[i*2+0] += sample;
+		if(srcNumChannels == 2) {
+			sample = (int)src[((pos>>8)<<1)+1];
+			if(sign == false)
+				sample -= ((1<<srcBitDepth)>>1);
+			sample <<= 16-srcBitDepth;
+			sample = (sample*vol)>>16;
+			dst[i*2+1] += sample;
+		} else
+			dst[i*2+1] += sample;
+		pos += delta;
+	}
+}
+
+static void legacy_mix(int* dst, const void* src, SampleFormat fmt, int nc, int rate,
+	int vol)
+{
+	int delta = (rate<<8)/OUT_RATE;
+	if(fmt == FMT_S16 && nc == 2)
+		legacy_convert<short, 16, 2, true>(dst, OUT_FRAMES, (const short*)src, 0, delta, vol);
+	else if(fmt == FMT_S16)
+		legacy_convert<short, 16, 1, true>(dst, OUT_FRAMES, (const short*)src, 0, delta, vol);
+	else
+		legacy_convert<unsigned char, 8, 1, false>(dst, OUT_FRAMES, (const unsigned char*)src, 0, delta, vol);
+}
+
+// Same block structure as AudioChannel::mix.
+static void block_mix(int* dst, const void* src, SampleFormat fmt, int nc, int rate,
+	Quality quality, int vol)
+{
+	static short block[(BLOCK_FRAMES+1)*2];
+	int delta = (int)(((long long)rate<<16)/OUT_RATE);
+	int frameSize = nc * ((fmt == FMT_S16) ? 2 : 1);
+	int pos = 0, frac = 0, written = 0;
+	block[0] = block[1] = 0;
+	while(written < OUT_FRAMES) {
+		int available = BLOCK_FRAMES;
+		int n = ((available<<16) - frac + delta - 1) / delta;
+		if(n > OUT_FRAMES - written)
+			n = OUT_FRAMES - written;
+		int numFrames = ((frac + (n-1)*delta)>>16) + 1;
+		if(nc == 1) {
+			if(pos > 0)
+				convertMono(block, (const char*)src + (pos-1)*frameSize, fmt, 1);
+			convertMono(&block[1], (const char*)src + pos*frameSize, fmt, numFrames);
+			scaleMono(block, numFrames+1, vol);
+			if(delta == 0x10000 && frac == 0)
+				mixMono(&dst[written*2], &block[quality == LINEAR ? 0 : 1], n);
+			else
+				resampleMono(&dst[written*2], n, block, frac, delta, quality);
+		} else {
+			if(pos > 0)
+				convert(block, (const char*)src + (pos-1)*frameSize, fmt, nc, 1);
+			convert(&block[2], (const char*)src + pos*frameSize, fmt, nc, numFrames);
+			scale(block, numFrames+1, vol);
+			if(delta == 0x10000 && frac == 0)
+				mix(&dst[written*2], &block[quality == LINEAR ? 0 : 2], n);
+			else
+				resample(&dst[written*2], n, block, frac, delta, quality);
+		}
+		int advance = frac + n*delta;
+		written += n;
+		pos += advance>>16;
+		frac = advance & 0xffff;
+	}
+}
+
+struct Case {
+	const char* name;
+	SampleFormat fmt;
+	int nc;
+	int rate;
+};
+
+static const Case sCases[] = {
+	{ "44100 Hz S16 stereo", FMT_S16, 2, 44100 },
+	{ "22050 Hz S16 mono  ", FMT_S16, 1, 22050 },
+	{ " 8000 Hz U8 mono   ", FMT_U8, 1, 8000 },
+};
+
+static double seconds(clock_t start) {
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+	double audioSeconds = argc > 1 ? atof(argv[1]) : 600;
+	int iterations = (int)(audioSeconds * OUT_RATE / OUT_FRAMES);
+	if(iterations < 1)
+		iterations = 1;
+
+	static int acc[OUT_FRAMES*2];
+	static short out[OUT_FRAMES*2];
+	static short src[OUT_FRAMES*2 + 16];
+	srand(1);
+	for(size_t i = 0; i < sizeof(src)/sizeof(short); i++)
+		src[i] = (short)(rand() - RAND_MAX/2);
+
+	printf("%d output frames x %d iterations (%.0f s of audio)\n",
+		OUT_FRAMES, iterations, audioSeconds);
+	printf("%-20s %12s %12s %12s\n", "ns/frame", "legacy", "nearest", "linear");
+	for(size_t c = 0; c < sizeof(sCases)/sizeof(Case); c++) {
+		const Case& k = sCases[c];
+		double t[3];
+		for(int m = 0; m < 3; m++) {
+			clock_t start = clock();
+			for(int i = 0; i < iterations; i++) {
+				if(m == 0)
+					legacy_mix(acc, src, k.fmt, k.nc, k.rate, VOLUME);
+				else
+					block_mix(acc, src, k.fmt, k.nc, k.rate, m == 1 ? NEAREST : LINEAR, VOLUME);
+			}
+			t[m] = seconds(start) * 1e9 / ((double)iterations * OUT_FRAMES);
+		}
+		printf("%-20s %12.2f %12.2f %12.2f\n", k.name, t[0], t[1], t[2]);
+	}
+
+	clock_t start = clock();
+	for(int i = 0; i < iterations; i++)
+		saturate(out, acc, OUT_FRAMES*2);
+	printf("%-20s %12s %12s %12.2f\n", "saturate", "", "",
+		seconds(start) * 1e9 / ((double)iterations * OUT_FRAMES));
+
+	// keep the results alive
+	int sum = 0;
+	for(int i = 0; i < OUT_FRAMES*2; i++)
+		sum += out[i];
+	return sum == 0x7fffffff;
+}
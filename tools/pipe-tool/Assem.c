@@ -35,6 +35,43 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 
 int CodeCopyInit = 0;
 
+//****************************************
+//		  Code layout relaxation
+//
+// The only instructions whose size depends on
+// a code address are far jumps/calls, and those
+// that load a code address from the constant
+// pool. They are recorded, along with the code
+// labels, in each pass after the first, and
+// RelaxCode() iterates on their sizes until the
+// labels settle. The next pass then assembles
+// the settled layout, instead of needing a pass
+// for every change to ripple through.
+//****************************************
+
+enum
+{
+	relax_label,
+	relax_addr,
+	relax_const
+};
+
+typedef struct
+{
+	int		Kind;
+	int		IP;				// CodeIP in the recording pass
+	SYMBOL	*Sym;			// Label, jump target, or code label of the constant
+	int		Size;			// Size of the variable part, as assembled
+	int		Offset;			// relax_const: constant - Sym->Value
+} RelaxItem;
+
+#define RELAX_MAX_SWEEPS 32
+
+ArrayStore RelaxArray;
+int RelaxCount = 0;
+int RelaxRecord = 0;
+int RelaxConstOffset;
+
 void AsmMain()
 {
 	int p;
@@ -53,6 +90,15 @@ void AsmMain()
 	GenRegConst();					// Generate the constant table
 	AsmAllocMem();
 
+	// Superinstructions are not understood by the code rebuilders,
+	// so they are only emitted into the final module
+
+	if (ArgSuper && !Do_Elimination)
+		LoadSuperProfile(SuperName);
+
+	if (ArgLayout)
+		LoadLayoutProfile(LayoutName);
+
 	Section = SECT_data;
 
 	pass_count = 0;
@@ -75,18 +121,33 @@ void AsmMain()
 	RedefENum("__final__",0);
 
 
+	ArrayInit(&RelaxArray, sizeof(RelaxItem), 0);
+
 	for (p=1;p<32;p++)
 	{
 		printf("pass %i. %i known symbols.\n", p, CountUsedSymbols());
 		if (AsmPass(p))
 			break;
+
+		// All symbols are known after pass 1
+
+		if (p > 1)
+			RelaxCode();
 	}
 
+	RelaxRecord = 0;
+	ArrayDispose(&RelaxArray);
+
 	if (p == 32)
 		Error(Error_Fatal, "Code did'nt settle correctly (Please report this)");
 
 //	printf("final pass. %i known symbols.\n", CountUsedSymbols());
 
+	// Block profiles are decoded from the settled code
+
+	if (ArgSuper && !Do_Elimination)
+		ProfileSuperBlocks();
+
 	Final_Pass = 1;
 	RedefENum("__final__",1);
 
@@ -169,6 +230,8 @@ void AsmMain()
 
 //	PerfEnd();
 
+	DisposeLayout();
+
 	t = GetTickCount() - t;
 
 	printf("Symbols used %d\n",CountUsedSymbols());
@@ -183,6 +246,8 @@ extern int Last_Instruction;
 
 int AsmPass(int thisPass)
 {
+	int layoutChanged;
+
 	// Set the pass number
 	
 	Pass = 1;
@@ -226,10 +291,21 @@ int AsmPass(int thisPass)
 
 		ArrayClear(&SLD_Line_Array);
 		ArrayClear(&SLD_File_Array);
-	
+
+		ArrayClear(&RelaxArray);
+		RelaxCount = 0;
+
+		// Relaxation shifts labels in source order,
+		// which is not the code order with a layout
+
+		RelaxRecord = !Final_Pass && !ArgLayout;
+
 		// Sort constant pool
+		// Frequencies are only counted in pass 1, sorting again
+		// would just move constants and change instruction sizes
 
-		SortVarPool();
+		if (thisPass == 2)
+			SortVarPool();
 
 		//printf("Pass %d VarPool Hash %x\n",thisPass,HashVarPool());
 	}
@@ -238,6 +314,10 @@ int AsmPass(int thisPass)
 	
 	SetAsmPtrs();
 
+	// Place the functions from the sizes of the last pass
+
+	LayoutBeginPass();
+
 	// Reset constructor/destructor ptrs
 
 	SetAsmCDtors();
@@ -253,6 +333,8 @@ int AsmPass(int thisPass)
 	
 	Assemble();
 
+	layoutChanged = LayoutEndPass();
+
 	// Write the constructor/destructor
 
 	EmitCDtors();
@@ -285,6 +367,9 @@ int AsmPass(int thisPass)
 	if (BssIP  != pBssIP)
 		return 0;			// Build not ready yet
 
+	if (layoutChanged)
+		return 0;			// Functions have moved
+
 	return 1;				// Build ready
 }
 
@@ -364,6 +449,157 @@ void AsmAllocMem()
 {	
 }
 
+//****************************************
+//	 Record a code label for relaxation
+//****************************************
+
+void RelaxLabel(SYMBOL *Sym)
+{
+	RelaxItem *item;
+
+	if (!RelaxRecord)
+		return;
+
+	item = (RelaxItem *) ArrayPtr(&RelaxArray, RelaxCount++);
+
+	item->Kind = relax_label;
+	item->IP = CodeIP;
+	item->Sym = Sym;
+	item->Size = 0;
+}
+
+//****************************************
+// Remember if a constant refers to code
+//	  Called before it is looked up
+//****************************************
+
+void SetRelaxConst(int value)
+{
+	SYMBOL *ref = GetLastSymbolRef();
+
+	RelaxConstSym = 0;
+
+	if (!GetExpCodeRef() || !ref)
+		return;
+
+	RelaxConstSym = ref;
+	RelaxConstOffset = value - ref->Value;
+}
+
+//****************************************
+//	  Record an instruction with a size
+//	  that depends on a code address
+//****************************************
+
+void RelaxOpcode(int ip, int field)
+{
+	RelaxItem *item;
+	SYMBOL *ref = 0;
+	int kind = relax_addr;
+	int size = 0;
+
+	if (!RelaxRecord)
+		return;
+
+	if (field & use_addr)
+	{
+		ref = GetLastSymbolRef();
+		size = farop ? 4 : 2;
+	}
+	else if ((field & use_int) && !SizeConstOpt)
+	{
+		ref = RelaxConstSym;
+		kind = relax_const;
+		size = (imm < 128) ? 1 : 2;
+	}
+
+	RelaxConstSym = 0;
+
+	if (!ref)
+		return;
+
+	item = (RelaxItem *) ArrayPtr(&RelaxArray, RelaxCount++);
+
+	item->Kind = kind;
+	item->IP = ip;
+	item->Sym = ref;
+	item->Size = size;
+	item->Offset = (kind == relax_const) ? RelaxConstOffset : 0;
+}
+
+//****************************************
+//	  Settle the recorded code layout
+//****************************************
+
+void RelaxCode()
+{
+	RelaxItem *item;
+	int n, sweep, shift, size, changed, idx, added;
+
+	shift = 0;
+
+	for (sweep=0;sweep<RELAX_MAX_SWEEPS;sweep++)
+	{
+		changed = 0;
+		shift = 0;
+		added = 0;
+
+		for (n=0;n<RelaxCount;n++)
+		{
+			item = (RelaxItem *) ArrayPtr(&RelaxArray, n);
+			size = item->Size;
+
+			switch(item->Kind)
+			{
+				case relax_label:
+				{
+					if (item->Sym->Value != item->IP + shift)
+					{
+						item->Sym->Value = item->IP + shift;
+						changed = 1;
+					}
+				}
+				continue;
+
+				case relax_addr:
+				{
+					size = (item->Sym->Value & 0xffff0000) ? 4 : 2;
+				}
+				break;
+
+				case relax_const:
+				{
+					// Only look the constant up. Storing it would
+					// leave the values of unsettled sweeps in the
+					// pool. A constant the next pass will store goes
+					// after those already there; counting repeats
+					// can only overestimate its index.
+
+					idx = SearchVarPool(item->Sym->Value + item->Offset);
+
+					if (idx == -1)
+						idx = VarCount + added++;
+
+					size = (idx < 128) ? 1 : 2;
+				}
+				break;
+			}
+
+			shift += size - item->Size;
+		}
+
+		if (!changed)
+			break;
+	}
+
+	if (INFO)
+		printf("Relaxed code by %d bytes in %d sweeps\n", shift, sweep + 1);
+
+	// The next pass is checked against the relaxed size
+
+	CodeIP += shift;
+}
+
 //****************************************
 //
 //****************************************
@@ -390,6 +626,8 @@ void SetAsmPtrs()
 
 	CurrentFile[0] = 0;
 //	CurrentFileLine = 0;
+
+	ResetSuperInstruction();
 }
 
 //****************************************
@@ -597,6 +835,16 @@ void DefineLabel(int isFunction)
 	if (isFunction)
 		SetCurrentFunction(0);
 
+	// Each function starts a chunk of the code layout
+
+	if (isFunction && Section == SECT_code)
+		LayoutFunction(Name);
+
+	// A label may be a jump target, don't fuse across it
+
+	if (Section == SECT_code)
+		ResetSuperInstruction();
+
 	Sym = FindSymbols(Name,section_Enum,section_Enum, LocalScope);
 	
 	if (Sym)
@@ -620,7 +868,10 @@ void DefineLabel(int isFunction)
 		// Write ref to data label array
 
 		if (Section == SECT_code)
+		{
 			WriteCodeArray(Sym);
+			RelaxLabel(Sym);
+		}
 		
 		if (Section == SECT_data)
 			ArraySet(&LabelArray, DataIP, (int) Sym);
@@ -165,7 +165,7 @@ void Peeper(uchar *ip, uchar *ip_end)
 
 void RebuildEmit(char *Template, ...)
 {
-		char 	Str[1024];
+		char 	Str[2048];
 		va_list args;
 		int n,len;
 
@@ -224,7 +224,8 @@ void RebuildFunc(SYMBOL *sym)
 	uchar *ip, *ip_end, *ip_last;
 
 	int real_ip;
-	char str[256];
+	int touched;
+	char str[1024];
 
 	if (!sym)
 		return;
@@ -261,6 +262,9 @@ void RebuildFunc(SYMBOL *sym)
 	ip = (uchar *) ArrayPtr(&CodeMemArray, sym->Value);
 	real_ip	= sym->Value;
 
+	if (ArgRebuildOpt)
+		RebuildOptReset();
+
 	while(1)
 	{
 		ip_last = ip;
@@ -276,20 +280,40 @@ void RebuildFunc(SYMBOL *sym)
 		{
 			if (ref->LabelType == label_Local)
 				RebuildEmit("%s_%d:\n", ref->Name, ref->LocalScope);
+
+			// Other code can jump here, so no values are known
+
+			if (ArgRebuildOpt)
+				RebuildOptReset();
 		}
 
 		RebuildEmitStabs(real_ip);
 
 //		Peeper(ip, ip_end);
 
+		touched = 1;
+
 		if (ArgSkipElim == 0)
 			if (ArrayGet(&CodeTouchArray, real_ip) == 0)
-				RebuildEmit("// ");
+				touched = 0;
+
+		if (!touched)
+			RebuildEmit("// ");
 
 		CaseRef = 0;
 
 		ip = DecodeOpcode(&thisOp, ip);
-		DecodeAsmString(&thisOp, str, 1);
+
+		if (ArgRebuildOpt && touched)
+			RebuildOptInst(&thisOp, str, sizeof(str));
+		else
+		{
+			if (ArgRebuildOpt)
+				RebuildOptReset();
+
+			DecodeAsmString(&thisOp, str, 1);
+		}
+
 		RebuildEmit("\t%s", str);
 
 //		DecodeAsmString(&thisOp, str, 0);			// Sanity testing
@@ -618,9 +642,15 @@ void Rebuild_Main()
 
 	RebuildEmit(".lfile 'rebuild.s'\n");
 
+	if (ArgRebuildOpt)
+		RebuildOptInit();
+
 	RebuildEmit(".code\n");
 	Rebuild_Code();
 
+	if (ArgRebuildOpt)
+		RebuildOptDispose();
+
 	RebuildEmit(".data\n");
 	Rebuild_Memory();
 
@@ -44,6 +44,9 @@ static int ReturnCount;
 
 static int CppUsedCallReg;
 
+static int CppLocalSp;					// sp is cached in a local (-cpp-opt)
+static int CppHasCalls;					// Function calls out, so sp is flushed
+
 static char *Cpp_reg[] = {"zr","sp","rt","fr","d0","d1","d2","d3",
 					"d4","d5","d6","d7","i0","i1","i2","i3",
 					"r0","r1","r2","r3","r4","r5","r6","r7",
@@ -516,6 +519,11 @@ void CppDecodeSysCall(OpcodeInfo *theOp)
 
 	param_count = syscall->Params;
 
+	// Parameters after the fourth are read off the stack
+
+	if (CppLocalSp && param_count > 4)
+		RebuildEmit("	::sp = sp;\n");
+
 	CppEmitReturnType(syscall->RetType);
 
 
@@ -661,6 +669,9 @@ int CppDecodeCall(OpcodeInfo *theOp)
 
 	ref = labref;
 
+	if (CppLocalSp)
+		RebuildEmit("	::sp = sp;\n");
+
 	return CppCallFunction(ref, 1);
 }
 
@@ -676,6 +687,9 @@ void CppDecodeCallReg(OpcodeInfo *theOp)
 	int i2 = funcprop.reg_used & REGBIT(REG_i2);
 	int i3 = funcprop.reg_used & REGBIT(REG_i3);
 
+	if (CppLocalSp)
+		RebuildEmit("	::sp = sp;\n");
+
 	RebuildEmit("	r14 = CallReg(%s", Cpp_reg[theOp->rd]);
 
 	if (i0)
@@ -969,6 +983,481 @@ void CppEmitReturnDecl(int rettype)
 	}
 }
 
+//****************************************
+//	  Register liveness, for -cpp-opt
+//
+// Each instruction of a function gets the
+// registers it reads and the ones it must
+// write, and a backwards pass finds the
+// registers live after it. A store to a
+// register that is not live afterwards is
+// left out, and its sources don't count
+// as reads, so chains of dead stores all
+// go in the same pass.
+//
+// sp is cached in a local, so only calls
+// and syscalls with stack parameters read
+// it. It is only written back to the global
+// before those and on exit.
+//****************************************
+
+typedef struct
+{
+	int		ip;				// Code address
+	int		use;			// Registers read
+	int		def;			// Registers written
+	int		live;			// Registers live after it
+	int		target;			// Jump target, switch table or -1
+	char	flow;			// How control leaves it
+	char	pure;			// Only writes its registers
+} CppInst;
+
+enum
+{
+	flow_Next = 0,
+	flow_Cond,
+	flow_Jump,
+	flow_Case,
+	flow_Exit,
+	flow_Unknown
+};
+
+#define REG_ALL		(~REGBIT(REG_zero))
+
+static CppInst *CppInsts;
+static int CppInstCount;
+static int CppExitLive;
+
+//****************************************
+//	 Find the instruction at an address
+//****************************************
+
+int CppFindInst(int ip)
+{
+	int lo = 0;
+	int hi = CppInstCount - 1;
+	int mid;
+
+	while (lo <= hi)
+	{
+		mid = (lo + hi) >> 1;
+
+		if (CppInsts[mid].ip == ip)
+			return mid;
+
+		if (CppInsts[mid].ip < ip)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return -1;
+}
+
+//****************************************
+//	 Registers read by a call's params
+//****************************************
+
+int CppParamRegs(int params)
+{
+	if (params > 4)
+		params = 4;
+
+	return ((1 << params) - 1) << REG_i0;
+}
+
+//****************************************
+//	 Registers written by a call's return
+//****************************************
+
+int CppReturnRegs(int rettype)
+{
+	if (rettype == RET_int || rettype == RET_float)
+		return REGBIT(REG_r14);
+
+	if (rettype == RET_double && (funcprop.reg_used & REGBIT(REG_r15)))
+		return REGBIT(REG_r14) | REGBIT(REG_r15);
+
+	if (rettype == RET_double)
+		return REGBIT(REG_r14);
+
+	return 0;
+}
+
+//****************************************
+//	Fill in the registers and the flow
+//	   of one decoded instruction
+//****************************************
+
+void CppInstRegs(OpcodeInfo *theOp, int n)
+{
+	CppInst *inst = &CppInsts[n];
+	SYMBOL *ref;
+	int rd = REGBIT(theOp->rd);
+	int rs = REGBIT(theOp->rs);
+
+	inst->use = 0;
+	inst->def = 0;
+	inst->target = -1;
+	inst->flow = flow_Next;
+	inst->pure = 0;
+
+	switch (theOp->op)
+	{
+		case _PUSH:
+		case _POP:
+			inst->use = REGBIT(REG_sp);
+			inst->def = REGBIT(REG_sp);
+			inst->pure = 1;
+		break;
+
+		case _CASE:
+			inst->use = rd;
+			inst->target = theOp->imm;
+			inst->flow = flow_Case;
+		break;
+
+		case _CALLI:
+			ref = (SYMBOL *) ArrayGet(&CallArray, theOp->rip);
+
+			if (!ref)
+				break;
+
+			inst->use = CppParamRegs(ref->Params) | REGBIT(REG_sp);
+			inst->def = CppReturnRegs(ref->RetType);
+		break;
+
+		case _CALL:
+			inst->use = rd | (funcprop.reg_used & CppParamRegs(4)) | REGBIT(REG_sp);
+			inst->def = REGBIT(REG_r14) | (funcprop.reg_used & REGBIT(REG_r15));
+		break;
+
+		case _SYSCALL:
+			ref = FindSysCall(theOp->imm);
+
+			if (!ref)
+				break;
+
+			inst->use = CppParamRegs(ref->Params);
+			inst->def = CppReturnRegs(ref->RetType);
+
+			if (ref->Params > 4)
+				inst->use |= REGBIT(REG_sp);
+
+			if (ref->RetType == RET_double)
+				inst->def |= REGBIT(REG_r15);
+		break;
+
+		case _LDI:
+			inst->def = rd;
+			inst->pure = 1;
+		break;
+
+		case _LDR:
+		case _NOT:
+		case _NEG:
+		case _XB:
+		case _XH:
+			inst->use = rs;
+			inst->def = rd;
+			inst->pure = 1;
+		break;
+
+		case _ADD:
+		case _MUL:
+		case _SUB:
+		case _AND:
+		case _OR:
+		case _XOR:
+		case _SLL:
+		case _SRA:
+		case _SRL:
+			inst->use = rd | rs;
+			inst->def = rd;
+			inst->pure = 1;
+		break;
+
+		// Divides are never removed, as the VM
+		// faults on a divide by zero
+
+		case _DIVU:
+		case _DIV:
+			inst->use = rd | rs;
+			inst->def = rd;
+		break;
+
+		case _DIVUI:
+		case _DIVI:
+			inst->use = rd;
+			inst->def = rd;
+		break;
+
+		case _ADDI:
+		case _MULI:
+		case _SUBI:
+		case _ANDI:
+		case _ORI:
+		case _XORI:
+		case _SLLI:
+		case _SRAI:
+		case _SRLI:
+			inst->use = rd;
+			inst->def = rd;
+			inst->pure = 1;
+		break;
+
+		case _RET:
+			inst->flow = flow_Exit;
+		break;
+
+		case _JC_EQ:
+		case _JC_NE:
+		case _JC_GE:
+		case _JC_GEU:
+		case _JC_GT:
+		case _JC_GTU:
+		case _JC_LE:
+		case _JC_LEU:
+		case _JC_LT:
+		case _JC_LTU:
+			inst->use = rd | rs;
+			inst->flow = flow_Cond;
+		break;
+
+		case _JPI:
+			inst->flow = flow_Jump;
+		break;
+
+		case _LDW:
+		case _LDH:
+		case _LDB:
+			inst->use = rs;
+			inst->def = rd;
+			inst->pure = 1;
+		break;
+
+		case _STW:
+		case _STH:
+		case _STB:
+			inst->use = rd | rs;
+		break;
+
+		default:
+			inst->use = REG_ALL;
+			inst->flow = flow_Unknown;
+		break;
+	}
+
+	// Jumps go to the label the call array points at
+
+	if (inst->flow == flow_Cond || inst->flow == flow_Jump)
+	{
+		ref = (SYMBOL *) ArrayGet(&CallArray, theOp->rip);
+
+		if (ref)
+			inst->target = ref->Value;
+		else
+			inst->flow = flow_Unknown;
+	}
+
+	inst->use &= REG_ALL;
+	inst->def &= REG_ALL;
+}
+
+//****************************************
+//	  Registers live on entry to an
+//	  instruction, given its live-out
+//****************************************
+
+int CppLiveIn(int n)
+{
+	CppInst *inst = &CppInsts[n];
+
+	if (inst->pure && !(inst->def & inst->live))
+		return inst->live;
+
+	return inst->use | (inst->live & ~inst->def);
+}
+
+//****************************************
+//	 Registers live at an address, all
+//	   if it is not in the function
+//****************************************
+
+int CppLiveAt(int ip)
+{
+	int n = CppFindInst(ip);
+
+	if (n < 0)
+		return REG_ALL;
+
+	return CppLiveIn(n);
+}
+
+//****************************************
+//	  Registers live after a switch
+//****************************************
+
+int CppLiveCase(int data_ip)
+{
+	int len, def_ip, i;
+	int live;
+
+	data_ip++;							// Skip the start value
+	len		= GetDataMemLong(data_ip++);
+	def_ip	= GetDataMemLong(data_ip++);
+
+	live = CppLiveAt(def_ip);
+
+	for (i=0;i<len+1;i++)
+		live |= CppLiveAt(GetDataMemLong(data_ip++));
+
+	return live;
+}
+
+//****************************************
+//	  Work out the liveness of all the
+//		instructions in a function
+//****************************************
+
+void CppLivenessAnalyse(SYMBOL *sym)
+{
+	OpcodeInfo thisOp;
+	CppInst *inst;
+	uchar *ip, *ip_start, *ip_end;
+	int live, changed;
+	int n;
+
+	ip_start = (uchar *) ArrayPtr(&CodeMemArray, sym->Value);
+	ip_end = (uchar *) ArrayPtr(&CodeMemArray, sym->EndIP);
+
+	// Count the instructions
+
+	CppInstCount = 0;
+
+	for (ip=ip_start;ip<=ip_end;CppInstCount++)
+		ip = DecodeOpcode(&thisOp, ip);
+
+	CppInsts = (CppInst *) NewPtr(sizeof(CppInst) * (CppInstCount + 1));
+
+	if (!CppInsts)
+		Error(Error_Fatal, "Out of memory in Cpp rebuilder");
+
+	CppHasCalls = 0;
+
+	for (ip=ip_start,n=0;n<CppInstCount;n++)
+	{
+		inst = &CppInsts[n];
+		inst->ip = sym->Value + (ip - ip_start);
+
+		ip = DecodeOpcode(&thisOp, ip);
+
+		CppInstRegs(&thisOp, n);
+		inst->live = 0;
+
+		if (thisOp.op == _CALLI || thisOp.op == _CALL)
+			CppHasCalls = 1;
+
+		// Stack parameters make a syscall write the global sp too
+
+		if (thisOp.op == _SYSCALL && (inst->use & REGBIT(REG_sp)))
+			CppHasCalls = 1;
+	}
+
+	// What the caller sees on return
+
+	CppExitLive = CppReturnRegs(ThisFunctionRetType);
+
+	if (ThisFunctionRetType == RET_double)
+		CppExitLive |= REGBIT(REG_r15);
+
+	if (CppHasCalls)
+		CppExitLive |= REGBIT(REG_sp);
+
+	// Iterate backwards until nothing changes
+
+	do
+	{
+		changed = 0;
+
+		for (n=CppInstCount-1;n>=0;n--)
+		{
+			inst = &CppInsts[n];
+
+			switch (inst->flow)
+			{
+				case flow_Next:
+					live = (n + 1 < CppInstCount) ? CppLiveIn(n + 1) : CppExitLive;
+				break;
+
+				case flow_Cond:
+					live = (n + 1 < CppInstCount) ? CppLiveIn(n + 1) : CppExitLive;
+					live |= CppLiveAt(inst->target);
+				break;
+
+				case flow_Jump:
+					live = CppLiveAt(inst->target);
+				break;
+
+				case flow_Case:
+					live = CppLiveCase(inst->target);
+				break;
+
+				case flow_Exit:
+					live = CppExitLive;
+				break;
+
+				default:
+					live = REG_ALL;
+				break;
+			}
+
+			if (live != inst->live)
+			{
+				inst->live = live;
+				changed = 1;
+			}
+		}
+	}
+	while (changed);
+}
+
+//****************************************
+//	 Check if the instruction at an ip
+//	  only writes registers nobody reads
+//****************************************
+
+int CppIsDeadStore(int ip)
+{
+	CppInst *inst;
+	int n;
+
+	if (!CppInsts)
+		return 0;
+
+	n = CppFindInst(ip);
+
+	if (n < 0)
+		return 0;
+
+	inst = &CppInsts[n];
+
+	return inst->pure && !(inst->def & inst->live);
+}
+
+//****************************************
+//
+//****************************************
+
+void CppLivenessDispose()
+{
+	if (CppInsts)
+		DisposePtr((char *) CppInsts);
+
+	CppInsts = 0;
+	CppInstCount = 0;
+}
+
 //****************************************
 //		Disassemble Function
 //****************************************
@@ -986,6 +1475,11 @@ void RebuildCppProlog(SYMBOL *sym, int isproto)
 
 	reg_used = FunctionRegAnalyse(sym, &funcprop);
 
+	// With -cpp-opt sp is cached in a local, so
+	// stores to it don't go through the global
+
+	CppLocalSp = ArgCppOpt && REGUSED(funcprop.reg_used, REG_sp);
+
 	reg_alloc = 0;
 
 	// Output helpful header
@@ -1104,6 +1598,8 @@ void RebuildCppProlog(SYMBOL *sym, int isproto)
 		RebuildEmit(";\n\n");
 	}
 
+	if (CppLocalSp)
+		RebuildEmit("\tint sp = ::sp;\n\n");
 }
 
 //****************************************
@@ -1117,6 +1613,11 @@ void RebuildCppEpilog(SYMBOL *sym)
 	if (ReturnCount > 0)
 		RebuildEmit("label_0:;\n");
 
+	// Give the caller back its sp
+
+	if (CppLocalSp && CppHasCalls)
+		RebuildEmit("	::sp = sp;\n");
+
 	CppDecodeReturn(1);
 	RebuildEmit("\n");
 
@@ -1162,6 +1663,9 @@ void RebuildCppFunc(SYMBOL *sym, int isproto)
 	if (isproto)
 		return;
 
+	if (ArgCppOpt)
+		CppLivenessAnalyse(sym);
+
 	ip_end = (uchar *) ArrayPtr(&CodeMemArray, sym->EndIP);
 	ip = (uchar *) ArrayPtr(&CodeMemArray, sym->Value);
 	real_ip	= sym->Value;
@@ -1188,13 +1692,21 @@ void RebuildCppFunc(SYMBOL *sym, int isproto)
 			}
 		}
 
-		if (ArrayGet(&CodeTouchArray, real_ip) == 0)
-			RebuildEmit("// ");
-
 		CaseRef = 0;
 
 		ip = DecodeOpcode(&thisOp, ip);
 
+		// Leave out stores nothing reads
+
+		if (CppIsDeadStore(real_ip))
+		{
+			real_ip += (ip - ip_last);
+			continue;
+		}
+
+		if (ArrayGet(&CodeTouchArray, real_ip) == 0)
+			RebuildEmit("// ");
+
 		ThisFunctionExit = 0;
 
 		if (ip > ip_end)
@@ -1236,6 +1748,8 @@ void RebuildCppFunc(SYMBOL *sym, int isproto)
 	}
 
 	RebuildCppEpilog(sym);
+
+	CppLivenessDispose();
 }
 
 //****************************************
@@ -0,0 +1,755 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+//*********************************************************************************************
+//				       PIP-e II Profile Guided Function Layout
+//*********************************************************************************************
+
+#include "compile.h"
+
+//****************************************
+//		  Profile guided layout
+//
+// The code is cut into chunks, each running
+// from a .func to the next one. Code before
+// the first .func stays where it is. The
+// chunks are assembled in source order, as
+// always, but from pass 2 on each one is
+// placed at the address the layout gives it,
+// using the chunk sizes of the pass before.
+// A pass is only settled when no chunk size
+// changed, so the final pass places every
+// function where the others expect it.
+//
+// The layout comes from a function profile,
+// either the folded stacks of a sampling
+// profile (samples.folded) or the call tree
+// of a function profile (fp.xml). Hot call
+// chains are merged so callers fall through
+// to their hottest callee, the chains are
+// ordered by weight, and functions that the
+// profile never saw go last, in source order.
+//****************************************
+
+typedef struct
+{
+	char	*Name;			// Function name
+	int		Size;			// Size in this pass
+	int		PrevSize;		// Size in the previous pass
+	int		Place;			// Address in this pass
+} LayoutChunk;
+
+typedef struct
+{
+	char	*Name;
+	uint	Hash;
+	int		Next;			// Next function in the hash chain, or -1
+	int		Chunk;			// Chunk of the function, or -1
+	double	Weight;			// Self samples or self time
+} LayoutFunc;
+
+typedef struct
+{
+	int		From;			// LayoutFunc indices
+	int		To;
+	double	Weight;			// Samples or calls
+} LayoutEdge;
+
+#define LAYOUT_HASH_SIZE	4096
+
+ArrayStore LayoutChunks;
+ArrayStore LayoutFuncs;
+ArrayStore LayoutEdges;
+ArrayStore LayoutOrder;
+ArrayStore LayoutHash;
+
+int LayoutChunkCount = 0;		// Chunks found in this pass
+int LayoutPrevCount = 0;		// Chunks found in the previous pass
+int LayoutFuncCount = 0;
+int LayoutEdgeCount = 0;
+int LayoutReady = 0;			// The order has been worked out
+int LayoutPlacing = 0;			// Chunks are placed in this pass
+int LayoutChanged = 0;			// A chunk size differs from the previous pass
+int LayoutCurrent = -1;			// Current chunk, -1 for the code before the first
+int LayoutHeadSize = 0;			// Size of the code before the first chunk
+int LayoutPrevHeadSize = 0;
+int LayoutStart = 0;			// Start of the current chunk
+int LayoutEnd = 0;				// End of the highest placed chunk
+int LayoutPlanEnd = 0;			// End of the chunks placed from the last pass
+
+//****************************************
+//	   Find a profile function, or -1.
+//	  With add, it is added if not found
+//****************************************
+
+int LayoutFuncIndex(char *name, int add)
+{
+	LayoutFunc *func;
+	uint hash;
+	int len;
+	int n;
+
+	hash = HashName(name, &len);
+
+	n = ArrayGet(&LayoutHash, hash & (LAYOUT_HASH_SIZE-1)) - 1;
+
+	while (n >= 0)
+	{
+		func = (LayoutFunc *) ArrayPtr(&LayoutFuncs, n);
+
+		if (func->Hash == hash && strcmp(func->Name, name) == 0)
+			return n;
+
+		n = func->Next;
+	}
+
+	if (!add)
+		return -1;
+
+	n = LayoutFuncCount++;
+
+	func = (LayoutFunc *) ArrayPtr(&LayoutFuncs, n);
+
+	func->Name = NewPtr(len + 1);
+	strcpy(func->Name, name);
+	func->Hash = hash;
+	func->Chunk = -1;
+	func->Weight = 0;
+	func->Next = ArrayGet(&LayoutHash, hash & (LAYOUT_HASH_SIZE-1)) - 1;
+
+	ArraySet(&LayoutHash, hash & (LAYOUT_HASH_SIZE-1), n + 1);
+	return n;
+}
+
+//****************************************
+//
+//****************************************
+
+void AddLayoutEdge(int from, int to, double weight)
+{
+	LayoutEdge *edge;
+
+	if (from == to)
+		return;
+
+	edge = (LayoutEdge *) ArrayPtr(&LayoutEdges, LayoutEdgeCount++);
+
+	edge->From = from;
+	edge->To = to;
+	edge->Weight = weight;
+}
+
+//****************************************
+//	  Read one line of a folded profile
+//		"outer;...;inner count"
+//****************************************
+
+void ReadLayoutStack(char *line)
+{
+	LayoutFunc *func;
+	char *count;
+	char *name;
+	char *end;
+	int prev = -1;
+	int n;
+	double weight;
+
+	count = strrchr(line, ' ');
+
+	if (!count)
+		return;
+
+	*count++ = 0;
+	weight = atof(count);
+
+	if (weight <= 0)
+		return;
+
+	name = line;
+
+	while (name)
+	{
+		end = strchr(name, ';');
+
+		if (end)
+			*end++ = 0;
+
+		n = LayoutFuncIndex(name, 1);
+
+		if (prev >= 0)
+			AddLayoutEdge(prev, n, weight);
+
+		// The innermost frame is where the sample was taken
+
+		if (!end)
+		{
+			func = (LayoutFunc *) ArrayPtr(&LayoutFuncs, n);
+			func->Weight += weight;
+		}
+
+		prev = n;
+		name = end;
+	}
+}
+
+//****************************************
+//	   Get an attribute of an <f> tag
+//****************************************
+
+int GetLayoutAttr(char *line, char *attr, char *value, int maxlen)
+{
+	char key[16];
+	char *ptr;
+	int n = 0;
+
+	sprintf(key, " %s=\"", attr);
+
+	ptr = strstr(line, key);
+
+	if (!ptr)
+		return 0;
+
+	ptr += strlen(key);
+
+	while (*ptr && *ptr != '"' && n < maxlen-1)
+	{
+		if (strncmp(ptr, "&amp;", 5) == 0)
+		{
+			value[n++] = '&';
+			ptr += 5;
+			continue;
+		}
+
+		if (strncmp(ptr, "&lt;", 4) == 0)
+		{
+			value[n++] = '<';
+			ptr += 4;
+			continue;
+		}
+
+		if (strncmp(ptr, "&gt;", 4) == 0)
+		{
+			value[n++] = '>';
+			ptr += 4;
+			continue;
+		}
+
+		value[n++] = *ptr++;
+	}
+
+	value[n] = 0;
+	return 1;
+}
+
+//****************************************
+//	 Read one line of a function profile
+//	  <f n="name" c="calls" lt="self">
+//****************************************
+
+#define LAYOUT_MAX_DEPTH	4096
+
+int LayoutStack[LAYOUT_MAX_DEPTH];
+int LayoutDepth = 0;
+
+void ReadLayoutCall(char *line)
+{
+	LayoutFunc *func;
+	char name[1024];
+	char value[64];
+	double calls = 0;
+	double self = 0;
+	int n;
+
+	while (iswhite(*line))
+		line++;
+
+	if (strncmp(line, "</f>", 4) == 0)
+	{
+		if (LayoutDepth > 0)
+			LayoutDepth--;
+
+		return;
+	}
+
+	if (strncmp(line, "<f ", 3) != 0)
+		return;
+
+	// Unnamed functions are kept as their address
+
+	if (!GetLayoutAttr(line, "n", name, sizeof(name)))
+	if (!GetLayoutAttr(line, "a", name, sizeof(name)))
+		strcpy(name, "?");
+
+	if (GetLayoutAttr(line, "c", value, sizeof(value)))
+		calls = atof(value);
+
+	if (GetLayoutAttr(line, "lt", value, sizeof(value)))
+		self = atof(value);
+
+	n = LayoutFuncIndex(name, 1);
+
+	func = (LayoutFunc *) ArrayPtr(&LayoutFuncs, n);
+	func->Weight += self;
+
+	if (LayoutDepth > 0)
+		AddLayoutEdge(LayoutStack[LayoutDepth-1], n, calls);
+
+	if (LayoutDepth < LAYOUT_MAX_DEPTH)
+		LayoutStack[LayoutDepth++] = n;
+}
+
+//****************************************
+//		  Read a function profile
+//****************************************
+
+void LoadLayoutProfile(char *name)
+{
+	FILE *f;
+	char line[16384];
+	int len;
+
+	ArrayInit(&LayoutChunks, sizeof(LayoutChunk), 0);
+	ArrayInit(&LayoutFuncs, sizeof(LayoutFunc), 0);
+	ArrayInit(&LayoutEdges, sizeof(LayoutEdge), 0);
+	ArrayInit(&LayoutOrder, sizeof(int), 0);
+	ArrayInit(&LayoutHash, sizeof(int), LAYOUT_HASH_SIZE);
+
+	LayoutFuncCount = 0;
+	LayoutEdgeCount = 0;
+	LayoutPrevCount = 0;
+	LayoutReady = 0;
+	LayoutDepth = 0;
+
+	f = fopen(name, "r");
+
+	if (!f)
+		Error(Error_Fatal, "Could not read layout profile '%s'", name);
+
+	while (fgets(line, sizeof(line), f))
+	{
+		len = strlen(line);
+
+		while (len > 0 && iswhite(line[len-1]))
+			line[--len] = 0;
+
+		if (len == 0)
+			continue;
+
+		if (strchr(line, '<'))
+			ReadLayoutCall(line);
+		else
+			ReadLayoutStack(line);
+	}
+
+	fclose(f);
+}
+
+//****************************************
+//
+//****************************************
+
+int CompareLayoutEdgePair(const void *a, const void *b)
+{
+	const LayoutEdge *ea = (const LayoutEdge *) a;
+	const LayoutEdge *eb = (const LayoutEdge *) b;
+
+	if (ea->From != eb->From)
+		return ea->From - eb->From;
+
+	return ea->To - eb->To;
+}
+
+int CompareLayoutEdgeWeight(const void *a, const void *b)
+{
+	const LayoutEdge *ea = (const LayoutEdge *) a;
+	const LayoutEdge *eb = (const LayoutEdge *) b;
+
+	// Heaviest first, and keep the order stable between runs
+
+	return (ea->Weight < eb->Weight) ? 1 : (ea->Weight > eb->Weight) ? -1 : CompareLayoutEdgePair(a, b);
+}
+
+//****************************************
+//	 Work out the order of the chunks
+//****************************************
+
+void MakeLayoutOrder()
+{
+	LayoutChunk *chunk;
+	LayoutFunc *func;
+	LayoutEdge *edge;
+	LayoutEdge *edges;
+	int *chainHead;			// First chunk of the chain a chunk is in
+	int *chainNext;			// Next chunk in the chain, or -1
+	int *chainTail;			// Last chunk, valid for chain heads
+	double *chainWeight;	// Weight, valid for chain heads
+	int *heads;
+	int headCount;
+	int count = LayoutChunkCount;
+	int hot = 0;
+	int n, k, a, b, t;
+	int from, to;
+	double w;
+
+	// Match the profile to the chunks, the first
+	// chunk of a name takes its profile entry
+
+	for (n=0;n<LayoutFuncCount;n++)
+		((LayoutFunc *) ArrayPtr(&LayoutFuncs, n))->Chunk = -1;
+
+	for (n=0;n<count;n++)
+	{
+		chunk = (LayoutChunk *) ArrayPtr(&LayoutChunks, n);
+		k = LayoutFuncIndex(chunk->Name, 0);
+
+		if (k < 0)
+			continue;
+
+		func = (LayoutFunc *) ArrayPtr(&LayoutFuncs, k);
+
+		if (func->Chunk < 0)
+			func->Chunk = n;
+	}
+
+	chainHead = (int *) NewPtrClear(count * sizeof(int) + 4);
+	chainNext = (int *) NewPtrClear(count * sizeof(int) + 4);
+	chainTail = (int *) NewPtrClear(count * sizeof(int) + 4);
+	heads = (int *) NewPtrClear(count * sizeof(int) + 4);
+	chainWeight = (double *) NewPtrClear(count * sizeof(double) + 8);
+
+	for (n=0;n<count;n++)
+	{
+		chainHead[n] = n;
+		chainNext[n] = -1;
+		chainTail[n] = n;
+		chainWeight[n] = -1;		// Not in the profile
+	}
+
+	for (n=0;n<LayoutFuncCount;n++)
+	{
+		func = (LayoutFunc *) ArrayPtr(&LayoutFuncs, n);
+
+		if (func->Chunk >= 0)
+		{
+			if (chainWeight[func->Chunk] < 0)
+				chainWeight[func->Chunk] = 0;
+
+			chainWeight[func->Chunk] += func->Weight;
+		}
+	}
+
+	// Merge the duplicate edges, then take them heaviest first
+
+	edges = 0;
+
+	if (LayoutEdgeCount)
+	{
+		edges = (LayoutEdge *) NewPtr(LayoutEdgeCount * sizeof(LayoutEdge));
+
+		for (n=0;n<LayoutEdgeCount;n++)
+			edges[n] = *(LayoutEdge *) ArrayPtr(&LayoutEdges, n);
+
+		qsort(edges, LayoutEdgeCount, sizeof(LayoutEdge), CompareLayoutEdgePair);
+
+		k = 0;
+
+		for (n=0;n<LayoutEdgeCount;n++)
+		{
+			if (k > 0 && edges[k-1].From == edges[n].From && edges[k-1].To == edges[n].To)
+				edges[k-1].Weight += edges[n].Weight;
+			else
+				edges[k++] = edges[n];
+		}
+
+		qsort(edges, k, sizeof(LayoutEdge), CompareLayoutEdgeWeight);
+
+		// Append the callee's chain to the caller's, when the
+		// caller ends its chain and the callee starts one
+
+		for (n=0;n<k;n++)
+		{
+			edge = &edges[n];
+
+			from = ((LayoutFunc *) ArrayPtr(&LayoutFuncs, edge->From))->Chunk;
+			to = ((LayoutFunc *) ArrayPtr(&LayoutFuncs, edge->To))->Chunk;
+
+			if (from < 0 || to < 0 || edge->Weight <= 0)
+				continue;
+
+			// Called functions are in the profile, even without self time
+
+			if (chainWeight[chainHead[from]] < 0)
+				chainWeight[chainHead[from]] = 0;
+
+			if (chainWeight[chainHead[to]] < 0)
+				chainWeight[chainHead[to]] = 0;
+
+			a = chainHead[from];
+			b = chainHead[to];
+
+			if (a == b || chainTail[a] != from || b != to)
+				continue;
+
+			chainNext[chainTail[a]] = b;
+			chainTail[a] = chainTail[b];
+			chainWeight[a] += chainWeight[b];
+
+			for (t=b;t>=0;t=chainNext[t])
+				chainHead[t] = a;
+		}
+
+		DisposePtr((char *) edges);
+	}
+
+	// Sort the profiled chains by weight, heaviest first.
+	// The chains are few, so an insertion sort will do
+
+	headCount = 0;
+
+	for (n=0;n<count;n++)
+	{
+		if (chainHead[n] != n || chainWeight[n] < 0)
+			continue;
+
+		w = chainWeight[n];
+
+		for (k=headCount;k>0 && chainWeight[heads[k-1]] < w;k--)
+			heads[k] = heads[k-1];
+
+		heads[k] = n;
+		headCount++;
+	}
+
+	k = 0;
+
+	for (n=0;n<headCount;n++)
+	{
+		for (t=heads[n];t>=0;t=chainNext[t])
+		{
+			ArraySet(&LayoutOrder, k++, t);
+			hot++;
+		}
+	}
+
+	// Then the rest, as they came
+
+	for (n=0;n<count;n++)
+	{
+		if (chainWeight[chainHead[n]] < 0)
+			ArraySet(&LayoutOrder, k++, n);
+	}
+
+	DisposePtr((char *) chainHead);
+	DisposePtr((char *) chainNext);
+	DisposePtr((char *) chainTail);
+	DisposePtr((char *) heads);
+	DisposePtr((char *) chainWeight);
+
+	if (!ArgQuiet)
+		printf("layout: %i of %i functions profiled\n", hot, count);
+
+	LayoutReady = 1;
+}
+
+//****************************************
+//		Start placing for a new pass
+//****************************************
+
+void LayoutBeginPass()
+{
+	LayoutChunk *chunk;
+	int place;
+	int n;
+
+	if (!ArgLayout)
+		return;
+
+	// Remember the sizes of the last pass
+
+	LayoutPrevCount = LayoutChunkCount;
+	LayoutPrevHeadSize = LayoutHeadSize;
+
+	for (n=0;n<LayoutChunkCount;n++)
+	{
+		chunk = (LayoutChunk *) ArrayPtr(&LayoutChunks, n);
+		chunk->PrevSize = chunk->Size;
+		chunk->Size = 0;
+	}
+
+	if (!LayoutReady && LayoutPrevCount)
+		MakeLayoutOrder();
+
+	LayoutPlacing = LayoutReady;
+
+	// Pack the chunks in layout order, after the code before them
+
+	place = 1 + LayoutPrevHeadSize;
+
+	for (n=0;n<LayoutPrevCount && LayoutPlacing;n++)
+	{
+		chunk = (LayoutChunk *) ArrayPtr(&LayoutChunks, ArrayGet(&LayoutOrder, n));
+		chunk->Place = place;
+		place += chunk->PrevSize;
+	}
+
+	LayoutPlanEnd = place;
+
+	LayoutChunkCount = 0;
+	LayoutCurrent = -1;
+	LayoutHeadSize = 0;
+	LayoutStart = CodeIP;
+	LayoutEnd = 0;
+	LayoutChanged = 0;
+}
+
+//****************************************
+//	  Close the current chunk
+//****************************************
+
+void LayoutCloseChunk()
+{
+	LayoutChunk *chunk;
+
+	if (CodeIP > LayoutEnd)
+		LayoutEnd = CodeIP;
+
+	if (LayoutCurrent < 0)
+	{
+		LayoutHeadSize = CodeIP - LayoutStart;
+
+		if (LayoutHeadSize != LayoutPrevHeadSize)
+			LayoutChanged = 1;
+
+		return;
+	}
+
+	chunk = (LayoutChunk *) ArrayPtr(&LayoutChunks, LayoutCurrent);
+	chunk->Size = CodeIP - LayoutStart;
+
+	if (chunk->Size != chunk->PrevSize)
+		LayoutChanged = 1;
+}
+
+//****************************************
+//	  Start the chunk of a new function
+//****************************************
+
+void LayoutFunction(char *name)
+{
+	LayoutChunk *chunk;
+
+	if (!ArgLayout)
+		return;
+
+	LayoutCloseChunk();
+
+	LayoutCurrent = LayoutChunkCount++;
+
+	chunk = (LayoutChunk *) ArrayPtr(&LayoutChunks, LayoutCurrent);
+
+	// Conditional code can change the functions between
+	// passes, the order is then worked out again
+
+	if (!chunk->Name || strcmp(chunk->Name, name) != 0)
+	{
+		if (chunk->Name)
+			DisposePtr(chunk->Name);
+
+		chunk->Name = NewPtr(strlen(name) + 1);
+		strcpy(chunk->Name, name);
+
+		LayoutReady = 0;
+	}
+
+	if (LayoutPlacing)
+	{
+		// New chunks go after all the planned ones
+
+		if (LayoutChunkCount > LayoutPrevCount)
+		{
+			if (LayoutPlanEnd < LayoutEnd)
+				LayoutPlanEnd = LayoutEnd;
+
+			chunk->Place = LayoutPlanEnd;
+		}
+
+		CodeIP = chunk->Place;
+	}
+
+	LayoutStart = CodeIP;
+}
+
+//****************************************
+//	 End of the code, returns 1 if the
+//	  layout has changed since last pass
+//****************************************
+
+int LayoutEndPass()
+{
+	if (!ArgLayout)
+		return 0;
+
+	LayoutCloseChunk();
+
+	if (LayoutChunkCount != LayoutPrevCount)
+		LayoutChanged = 1;
+
+	// The last chunk in the source need not be the last in the code
+
+	CodeIP = LayoutEnd;
+
+	return LayoutChanged;
+}
+
+//****************************************
+//
+//****************************************
+
+void DisposeLayout()
+{
+	LayoutChunk *chunk;
+	LayoutFunc *func;
+	int n;
+
+	if (!ArgLayout)
+		return;
+
+	for (n=0;n<LayoutChunkCount;n++)
+	{
+		chunk = (LayoutChunk *) ArrayPtr(&LayoutChunks, n);
+
+		if (chunk->Name)
+			DisposePtr(chunk->Name);
+	}
+
+	for (n=0;n<LayoutFuncCount;n++)
+	{
+		func = (LayoutFunc *) ArrayPtr(&LayoutFuncs, n);
+		DisposePtr(func->Name);
+	}
+
+	ArrayDispose(&LayoutChunks);
+	ArrayDispose(&LayoutFuncs);
+	ArrayDispose(&LayoutEdges);
+	ArrayDispose(&LayoutOrder);
+	ArrayDispose(&LayoutHash);
+
+	LayoutChunkCount = 0;
+	LayoutFuncCount = 0;
+	LayoutEdgeCount = 0;
+	LayoutReady = 0;
+}
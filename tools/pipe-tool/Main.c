@@ -164,9 +164,11 @@ int main(int argc,char *argv[])
 	ArgJavaNative = 0;
 	ArgBrewGen = 0;
 	ArgCppGen = 0;
+	ArgCppOpt = 0;
 	ArgCsGen = 0;
 	ArgSLD = 0;
 	ArgDebugRebuild = 0;
+	ArgRebuildOpt = 0;
 	ArgUseStabs = 0;
 
 	DisasFunc[0] = 0;
@@ -257,6 +259,22 @@ int main(int argc,char *argv[])
 			continue;
 		}
 
+		if (Token("super="))
+		{
+			ArgSuper = 1;
+			GetCmdString();
+			strcpy(SuperName, Name);
+			continue;
+		}
+
+		if (Token("layout="))
+		{
+			ArgLayout = 1;
+			GetCmdString();
+			strcpy(LayoutName, Name);
+			continue;
+		}
+
 		if (Token("stabs="))
 		{
 			ArgUseStabs = 1;
@@ -291,6 +309,12 @@ int main(int argc,char *argv[])
 			continue;
 		}
 
+		if (Token("opt"))
+		{
+			ArgRebuildOpt = 1;
+			continue;
+		}
+
 		if (Token("elim"))
 		{
 			Do_Elimination = 1;
@@ -458,6 +482,17 @@ int main(int argc,char *argv[])
 		}
 */
 
+		if (Token("cpp-opt"))
+		{
+			ArgCppGen = 1;
+			ArgCppOpt = 1;
+			ArgConstOpt = 0;
+			Do_Elimination = 1;
+
+			dbprintf("Native cpp build on, with register liveness\n");
+			continue;
+		}
+
 		if (Token("cpp"))
 		{
 			ArgCppGen = 1;
@@ -742,9 +777,15 @@ Build application (-B) options:\n\
   -sld=file            output source/line translation\n\
   -stabs=file          output debug information\n\
   -elim                eliminate unreferenced code/data\n\
+  -opt                 with -elim, inline small leaf functions and fold\n\
+                       constants in the rebuilt code\n\
+  -super=file          emit superinstructions chosen from an instruction_use.txt\n\
+                       or block_profile.txt\n\
+  -layout=file         order functions from a samples.folded or fp.xml profile\n\
   -no-verify           prevent code verification\n\
   -java                build a Java class file\n\
   -gcj=flags           for -java option: set flags for GCJ\n\
+  -cpp-opt             rebuild as C++, leaving out dead register stores\n\
 \n\
 Resource compiler (-R) options:\n\
   -depend=file         output dependencies in makefile syntax\n\
@@ -57,6 +57,7 @@ void Instructions()
 	// Clear all the special variables
 
 	farop = imm = rd = rs = rt = op = 0;
+	RelaxConstSym = 0;
 
 	SkipWhiteSpace();
 
@@ -132,6 +133,7 @@ void Instructions()
 	// Clear all the special variables
 
 	farop = imm = rd = rs = rt = op = 0;
+	RelaxConstSym = 0;
 
 	AsmCharPtr = FilePtr;
 
@@ -1125,6 +1127,7 @@ void HandleExprImm()
 		return;
 	}
 
+	SetRelaxConst(imm);
 	imm = FindVar(imm);
 	return;
 }
@@ -1170,6 +1173,7 @@ int HandleExprConst()				// Const or Imm
 		return 0;
 	}
 
+	SetRelaxConst(imm);
 	imm = FindVar(imm);
 	return 0;
 }
@@ -1410,6 +1414,13 @@ void WriteOpcode(char *AsmName, int field)
 		CodeIP++;
 	}
 
+	RelaxOpcode(StartCodeIP, field);
+
+	if (farop)
+		ResetSuperInstruction();
+	else
+		FuseSuperInstruction(StartCodeIP, op, CodeIP);
+
 	// Debug list
 
 	if (LIST)
@@ -1573,3 +1584,331 @@ void CheckIndexAlign(int opc, int immVal, char *AsmName)
 	}
 }
 
+//****************************************
+//		   Superinstructions
+//****************************************
+
+// Sequences are named as in instruction_use.txt,
+// which is written by runtimes built with COUNT_INSTRUCTION_USE.
+// A block_profile.txt from a runtime built with BLOCK_PROFILING
+// can be used instead, see ProfileSuperBlocks()
+
+SuperInst SuperTable[] =
+{
+	{"LDW ADD",			_LDW_ADD,		{_LDW, _ADD, _NOP}, 0, 0},
+	{"LDW LDW",			_LDW_LDW,		{_LDW, _LDW, _NOP}, 0, 0},
+	{"LDW STW",			_LDW_STW,		{_LDW, _STW, _NOP}, 0, 0},
+	{"LDR LDR",			_LDR_LDR,		{_LDR, _LDR, _NOP}, 0, 0},
+	{"LDI LDI",			_LDI_LDI,		{_LDI, _LDI, _NOP}, 0, 0},
+	{"ADD LDW",			_ADD_LDW,		{_ADD, _LDW, _NOP}, 0, 0},
+	{"ADDI LDW",		_ADDI_LDW,		{_ADDI, _LDW, _NOP}, 0, 0},
+	{"ADD JC_LT",		_ADD_JC_LT,		{_ADD, _JC_LT, _NOP}, 0, 0},
+	{"ADD JC_NE",		_ADD_JC_NE,		{_ADD, _JC_NE, _NOP}, 0, 0},
+	{"PUSH SUB",		_PUSH_SUB,		{_PUSH, _SUB, _NOP}, 0, 0},
+	{"PUSH SUBI",		_PUSH_SUBI,		{_PUSH, _SUBI, _NOP}, 0, 0},
+	{"ADD POP",			_ADD_POP,		{_ADD, _POP, _NOP}, 0, 0},
+	{"ADDI POP",		_ADDI_POP,		{_ADDI, _POP, _NOP}, 0, 0},
+	{"POP RET",			_POP_RET,		{_POP, _RET, _NOP}, 0, 0},
+	{"ADD POP RET",		_ADD_POP_RET,	{_ADD, _POP, _RET}, 0, 0},
+	{"ADDI POP RET",	_ADDI_POP_RET,	{_ADDI, _POP, _RET}, 0, 0},
+	{0}
+};
+
+// A sequence is fused if it makes up at least this share
+// of all instructions executed in the profile
+
+#define SUPER_THRESHOLD 0.005
+
+int SuperActive = 0;
+
+int SuperCount;			// Number of instructions in the current sequence
+int SuperIP[2];			// Their code addresses
+int SuperOp[2];			// Their opcodes, as assembled
+int SuperEnd;			// End of the last instruction
+int SuperFused;			// SuperIP[0] has been replaced by a pair
+
+ArrayStore SuperBlocks;	// start, end, count for each profiled block
+int SuperBlockCount = 0;
+int SuperBlockCodeLen;	// Code size of the profiled module
+
+//****************************************
+//	 Choose superinstructions from profile
+//****************************************
+
+void LoadSuperProfile(char *name)
+{
+	FILE *f;
+	char line[256];
+	char seq[128];
+	double total = 0;
+	int count;
+	int n;
+
+	f = fopen(name, "r");
+
+	if (!f)
+		Error(Error_Fatal, "Could not read superinstruction profile '%s'", name);
+
+	// Block profiles need the assembled code, so they are
+	// only read here and evaluated before the final pass
+
+	if (fgets(line, sizeof(line), f) && sscanf(line, "BLOCK COUNTS: %d", &SuperBlockCodeLen) == 1)
+	{
+		LoadSuperBlocks(f);
+		fclose(f);
+		return;
+	}
+
+	rewind(f);
+
+	// Total number of instructions executed
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "inst %127[^:]: %d", seq, &count) == 2)
+			total += count;
+	}
+
+	rewind(f);
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "pair %127[^:]: %d", seq, &count) != 2 &&
+			sscanf(line, "triple %127[^:]: %d", seq, &count) != 2)
+			continue;
+
+		if (count == 0 || count < total * SUPER_THRESHOLD)
+			continue;
+
+		for (n=0;SuperTable[n].Name;n++)
+		{
+			if (strcmp(SuperTable[n].Name, seq) == 0)
+			{
+				SuperTable[n].Enabled = 1;
+				SuperActive = 1;
+
+				if (!ArgQuiet)
+					printf("superinstruction '%s' (%.1f%%)\n", seq, count * 100.0 / total);
+			}
+		}
+	}
+
+	fclose(f);
+}
+
+//****************************************
+//	   Read the blocks of a block profile
+//****************************************
+
+void LoadSuperBlocks(FILE *f)
+{
+	char line[256];
+	int start, end, count, taken;
+
+	ArrayInit(&SuperBlocks, sizeof(int), 0);
+	SuperBlockCount = 0;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "%x-%x: %d %d", &start, &end, &count, &taken) != 4)
+			continue;
+
+		if (start < 0 || end <= start || count <= 0)
+			continue;
+
+		ArrayAppend(&SuperBlocks, start);
+		ArrayAppend(&SuperBlocks, end);
+		ArrayAppend(&SuperBlocks, count);
+		SuperBlockCount++;
+	}
+}
+
+//****************************************
+//	 Choose superinstructions from blocks
+//****************************************
+
+// Each block is a straight run of code, so the executed sequences
+// are found by decoding it. This must be done on settled code, which
+// has the same layout as the final module.
+
+void ProfileSuperBlocks()
+{
+	OpcodeInfo thisOp;
+	double total = 0;
+	int ops[3] = {0, 0, 0};
+	int start, end, count;
+	int ip, len;
+	int n, b;
+
+	if (!SuperBlockCount)
+		return;
+
+	if (SuperBlockCodeLen != CodeIP)
+	{
+		Error(Error_Warning, "Block profile is for a different program (code size %d, not %d), ignored",
+			SuperBlockCodeLen, CodeIP);
+		return;
+	}
+
+	for (n=0;SuperTable[n].Name;n++)
+		SuperTable[n].Count = 0;
+
+	for (b=0;b<SuperBlockCount;b++)
+	{
+		start = ArrayGet(&SuperBlocks, b * 3);
+		end = ArrayGet(&SuperBlocks, b * 3 + 1);
+		count = ArrayGet(&SuperBlocks, b * 3 + 2);
+
+		if (end > CodeIP)
+			continue;
+
+		len = 0;
+
+		for (ip=start; ip<end; )
+		{
+			ip = DecodeOpcodeIP(&thisOp, ip);
+			total += count;
+
+			// Far instructions are never fused
+
+			if (thisOp.farflag)
+			{
+				len = 0;
+				continue;
+			}
+
+			ops[0] = ops[1];
+			ops[1] = ops[2];
+			ops[2] = thisOp.op;
+
+			if (len < 3)
+				len++;
+
+			for (n=0;SuperTable[n].Name;n++)
+			{
+				SuperInst *s = &SuperTable[n];
+
+				if (s->Part[2] == _NOP)
+				{
+					if (len >= 2 && s->Part[0] == ops[1] && s->Part[1] == ops[2])
+						s->Count += count;
+				}
+				else if (len >= 3 && s->Part[0] == ops[0] && s->Part[1] == ops[1] && s->Part[2] == ops[2])
+					s->Count += count;
+			}
+		}
+	}
+
+	for (n=0;SuperTable[n].Name;n++)
+	{
+		SuperInst *s = &SuperTable[n];
+
+		if (s->Count <= 0 || s->Count < total * SUPER_THRESHOLD)
+			continue;
+
+		s->Enabled = 1;
+		SuperActive = 1;
+
+		if (!ArgQuiet)
+			printf("superinstruction '%s' (%.1f%%)\n", s->Name, s->Count * 100.0 / total);
+	}
+}
+
+//****************************************
+//	 Find an enabled superinstruction
+//****************************************
+
+int FindSuperInstruction(int a, int b, int c)
+{
+	int n;
+
+	for (n=0;SuperTable[n].Name;n++)
+	{
+		SuperInst *s = &SuperTable[n];
+
+		if (s->Enabled && s->Part[0] == a && s->Part[1] == b && s->Part[2] == c)
+			return s->Op;
+	}
+
+	return 0;
+}
+
+//****************************************
+//		Restart sequence matching
+//****************************************
+
+void ResetSuperInstruction()
+{
+	SuperCount = 0;
+	SuperFused = 0;
+}
+
+//****************************************
+//  Fuse the instruction just written
+//	with the ones before it
+//****************************************
+
+void FuseSuperInstruction(int ip, int opc, int end)
+{
+	char *CodePtr;
+	int super;
+
+	// Only the final module gets superinstructions, the
+	// fused opcodes are never seen by the other passes
+
+	if (!SuperActive || !Final_Pass)
+		return;
+
+	if (SuperCount && SuperEnd != ip)
+		SuperCount = 0;
+
+	if (SuperCount == 2)
+	{
+		super = FindSuperInstruction(SuperOp[0], SuperOp[1], opc);
+
+		if (super)
+		{
+			CodePtr = (char *) ArrayPtr(&CodeMemArray, SuperIP[0]);
+			*CodePtr = (char) super;
+
+			ResetSuperInstruction();
+			return;
+		}
+
+		// If the last two were fused, the second one can't start another
+
+		if (SuperFused)
+			SuperCount = 0;
+		else
+		{
+			SuperIP[0] = SuperIP[1];
+			SuperOp[0] = SuperOp[1];
+			SuperCount = 1;
+		}
+	}
+
+	if (SuperCount == 1)
+	{
+		super = FindSuperInstruction(SuperOp[0], opc, _NOP);
+		SuperFused = 0;
+
+		if (super)
+		{
+			CodePtr = (char *) ArrayPtr(&CodeMemArray, SuperIP[0]);
+			*CodePtr = (char) super;
+			SuperFused = 1;
+		}
+
+		SuperIP[1] = ip;
+		SuperOp[1] = opc;
+		SuperCount = 2;
+		SuperEnd = end;
+		return;
+	}
+
+	SuperIP[0] = ip;
+	SuperOp[0] = opc;
+	SuperCount = 1;
+	SuperFused = 0;
+	SuperEnd = end;
+}
@@ -0,0 +1,653 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+//*********************************************************************************************
+//				       PIP-e II Rebuild Optimiser
+//*********************************************************************************************
+
+#include "compile.h"
+
+#ifdef INCLUDE_CODE_REBUILD
+
+//****************************************
+//		   Rebuild optimiser
+//
+// Runs on the instructions as they are
+// written to rebuild.s, so every back end
+// that assembles the rebuilt code gains.
+//
+// Calls to small straight line leaf
+// functions are replaced by the body of
+// the function, without its ret.
+//
+// Register values loaded from plain
+// constants are tracked until the next
+// label, call or unknown instruction.
+// Instructions with known sources become
+// loads of their result or take their
+// source as an immediate, and conditional
+// jumps with known operands become a jump
+// or go away.
+//
+// The output goes into the caller's line
+// buffer. A call is left as it is if the
+// inlined body wouldn't fit in it.
+//****************************************
+
+#define OPT_INLINE_MAX	6			// Most instructions in an inlined function
+#define OPT_LINE_MAX	1024		// Longest line of output
+#define OPT_NAME_MAX	(OPT_LINE_MAX - 32)	// Longest symbol name written by the optimiser
+
+#define OPT_INLINE_UNKNOWN	0
+#define OPT_INLINE_YES		1
+#define OPT_INLINE_NO		2
+
+static ArrayStore OptInlineArray;	// Inline state, by function address
+
+static int OptKnown;				// Registers with a known value
+static int OptValue[32];
+
+static int OptInlined;
+static int OptFolded;
+
+static int OptOverflow;				// Set when a line didn't fit in the output
+
+//****************************************
+//
+//****************************************
+
+void RebuildOptInit()
+{
+	ArrayInit(&OptInlineArray, sizeof(char), 0);
+
+	OptKnown = 0;
+	OptInlined = 0;
+	OptFolded = 0;
+}
+
+//****************************************
+//
+//****************************************
+
+void RebuildOptDispose()
+{
+	ArrayDispose(&OptInlineArray);
+
+	if (!ArgQuiet)
+		printf("rebuild: %i calls inlined, %i instructions folded\n", OptInlined, OptFolded);
+}
+
+//****************************************
+//   Forget the register values, at the
+//	  start of a function or a label
+//****************************************
+
+void RebuildOptReset()
+{
+	OptKnown = 0;
+}
+
+//****************************************
+//	  Get a known register value
+//****************************************
+
+int OptIsKnown(int reg)
+{
+	if (reg == REG_zero)
+		return 1;
+
+	if (reg >= 32)
+		return 0;
+
+	return (OptKnown >> reg) & 1;
+}
+
+int OptGetValue(int reg)
+{
+	if (reg == REG_zero)
+		return 0;
+
+	return OptValue[reg];
+}
+
+void OptSetValue(int reg, int value)
+{
+	if (reg == REG_zero || reg >= 32)
+		return;
+
+	OptKnown |= 1 << reg;
+	OptValue[reg] = value;
+}
+
+void OptForget(int reg)
+{
+	if (reg >= 32)
+		return;
+
+	OptKnown &= ~(1 << reg);
+}
+
+//****************************************
+// Check that the immediate of an opcode
+//	  is a number, not an address
+//****************************************
+
+int OptPlainImm(OpcodeInfo *theOp)
+{
+	if (ArrayGet(&CallArray, theOp->rip))
+		return 0;
+
+	if (ArrayGet(&DataAccessArray, theOp->rip))
+		return 0;
+
+	return 1;
+}
+
+//****************************************
+//	 Add a line of code to the output,
+//	 which holds 'size' chars with the 0
+//****************************************
+
+void OptAppend(char *out, int size, char *line)
+{
+	int len = strlen(out);
+
+	if (len)
+		len += 2;
+
+	if (len + (int) strlen(line) >= size)
+	{
+		OptOverflow = 1;
+		return;
+	}
+
+	if (out[0])
+		strcat(out, "\n\t");
+
+	strcat(out, line);
+}
+
+//****************************************
+//	  Work out an arithmetic opcode on
+//	   two values, returns 0 if the
+//	   result is not safe to fold
+//****************************************
+
+int OptFoldArith(int op, int a, int b, int *result)
+{
+	uint ua = (uint) a;
+	uint ub = (uint) b;
+
+	switch (op)
+	{
+		case _ADD:	case _ADDI:		*result = (int) (ua + ub);		return 1;
+		case _SUB:	case _SUBI:		*result = (int) (ua - ub);		return 1;
+		case _MUL:	case _MULI:		*result = (int) (ua * ub);		return 1;
+		case _AND:	case _ANDI:		*result = a & b;				return 1;
+		case _OR:	case _ORI:		*result = a | b;				return 1;
+		case _XOR:	case _XORI:		*result = a ^ b;				return 1;
+
+		case _DIV:
+		case _DIVI:
+			if (b == 0 || (a == (int) 0x80000000 && b == -1))
+				return 0;
+
+			*result = a / b;
+			return 1;
+
+		case _DIVU:
+		case _DIVUI:
+			if (b == 0)
+				return 0;
+
+			*result = (int) (ua / ub);
+			return 1;
+
+		case _SLL:
+		case _SLLI:
+			if (ub > 31)
+				return 0;
+
+			*result = (int) (ua << ub);
+			return 1;
+
+		case _SRA:
+		case _SRAI:
+			if (ub > 31)
+				return 0;
+
+			*result = a >> ub;
+			return 1;
+
+		case _SRL:
+		case _SRLI:
+			if (ub > 31)
+				return 0;
+
+			*result = (int) (ua >> ub);
+			return 1;
+	}
+
+	return 0;
+}
+
+//****************************************
+//	  Get the assembler name of an
+//		   arithmetic opcode
+//****************************************
+
+char * OptArithName(int op)
+{
+	switch (op)
+	{
+		case _ADD:	return "add";
+		case _SUB:	return "sub";
+		case _MUL:	return "mul";
+		case _AND:	return "and";
+		case _OR:	return "or";
+		case _XOR:	return "xor";
+		case _DIV:	return "div";
+		case _DIVU:	return "divu";
+		case _SLL:	return "sll";
+		case _SRA:	return "sra";
+		case _SRL:	return "srl";
+	}
+
+	return 0;
+}
+
+//****************************************
+//	  Find the label a jump goes to
+//****************************************
+
+SYMBOL * OptJumpLabel(OpcodeInfo *theOp)
+{
+	SYMBOL *ref;
+
+	ref = (SYMBOL *) ArrayGet(&CallArray, theOp->rip);
+
+	if (!ref)
+		return 0;
+
+	return (SYMBOL *) ArrayGet(&CodeLabelArray, ref->Value);
+}
+
+//****************************************
+//	 Check if a conditional jump with
+//	  known operands is taken, or -1
+//****************************************
+
+int OptJumpTaken(OpcodeInfo *theOp)
+{
+	int a, b;
+
+	if (!OptIsKnown(theOp->rd) || !OptIsKnown(theOp->rs))
+		return -1;
+
+	a = OptGetValue(theOp->rd);
+	b = OptGetValue(theOp->rs);
+
+	switch (theOp->op)
+	{
+		case _JC_EQ:	return a == b;
+		case _JC_NE:	return a != b;
+		case _JC_GE:	return a >= b;
+		case _JC_GT:	return a > b;
+		case _JC_LE:	return a <= b;
+		case _JC_LT:	return a < b;
+		case _JC_GEU:	return (uint) a >= (uint) b;
+		case _JC_GTU:	return (uint) a > (uint) b;
+		case _JC_LEU:	return (uint) a <= (uint) b;
+		case _JC_LTU:	return (uint) a < (uint) b;
+	}
+
+	return -1;
+}
+
+//****************************************
+//	 Check if an opcode can be part of
+//		   an inlined function
+//****************************************
+
+int OptInlineOpcode(OpcodeInfo *theOp)
+{
+	int rd = theOp->rd;
+	int rs = theOp->rs;
+
+	// The stack and frame belong to the caller
+
+	if (rd == REG_sp || rd == REG_rt || rd == REG_fr)
+		return 0;
+
+	if (rs == REG_sp || rs == REG_rt || rs == REG_fr)
+		return 0;
+
+	switch (theOp->op)
+	{
+		case _LDI:	case _LDR:
+		case _ADD:	case _ADDI:
+		case _SUB:	case _SUBI:
+		case _MUL:	case _MULI:
+		case _AND:	case _ANDI:
+		case _OR:	case _ORI:
+		case _XOR:	case _XORI:
+		case _DIV:	case _DIVI:
+		case _DIVU:	case _DIVUI:
+		case _SLL:	case _SLLI:
+		case _SRA:	case _SRAI:
+		case _SRL:	case _SRLI:
+		case _NOT:	case _NEG:
+		case _XB:	case _XH:
+		case _LDW:	case _LDH:	case _LDB:
+		case _STW:	case _STH:	case _STB:
+			return 1;
+	}
+
+	return 0;
+}
+
+//****************************************
+//	Check if a function is a small leaf
+//	 that can be copied into its callers
+//****************************************
+
+int OptCanInline(SYMBOL *sym)
+{
+	OpcodeInfo thisOp;
+	uchar *ip, *ip_end;
+	int state, count;
+
+	if (!sym || sym->Type != SECT_code || sym->LabelType < label_Function)
+		return 0;
+
+	state = ArrayGet(&OptInlineArray, sym->Value);
+
+	if (state != OPT_INLINE_UNKNOWN)
+		return state == OPT_INLINE_YES;
+
+	state = OPT_INLINE_NO;
+
+	ip = (uchar *) ArrayPtr(&CodeMemArray, sym->Value);
+	ip_end = (uchar *) ArrayPtr(&CodeMemArray, sym->EndIP);
+
+	// Straight line code, only ending in a ret
+
+	for (count=0;ip<=ip_end;count++)
+	{
+		ip = DecodeOpcode(&thisOp, ip);
+
+		if (thisOp.op == _RET)
+		{
+			if (ip > ip_end)
+				state = OPT_INLINE_YES;
+
+			break;
+		}
+
+		if (count == OPT_INLINE_MAX || !OptInlineOpcode(&thisOp))
+			break;
+	}
+
+	ArraySet(&OptInlineArray, sym->Value, state);
+
+	return state == OPT_INLINE_YES;
+}
+
+//****************************************
+//	Optimise one opcode, and add its code
+//			to the output
+//****************************************
+
+void RebuildOptOpcode(OpcodeInfo *theOp, char *out, int size)
+{
+	char line[OPT_LINE_MAX];
+	SYMBOL *ref;
+	int a, b, v;
+	int taken;
+
+	switch (theOp->op)
+	{
+		case _LDI:
+			if (OptPlainImm(theOp))
+				OptSetValue(theOp->rd, theOp->imm);
+			else
+				OptForget(theOp->rd);
+		break;
+
+		case _LDR:
+			if (theOp->rs != REG_zero && OptIsKnown(theOp->rs))
+			{
+				v = OptGetValue(theOp->rs);
+				sprintf(line, "ld %s,#0x%x", DecodeRegName(theOp->rd, 0), v);
+				OptAppend(out, size, line);
+				OptSetValue(theOp->rd, v);
+				OptFolded++;
+				return;
+			}
+
+			if (theOp->rs == REG_zero)
+				OptSetValue(theOp->rd, 0);
+			else
+				OptForget(theOp->rd);
+		break;
+
+		case _ADD:	case _SUB:	case _MUL:
+		case _AND:	case _OR:	case _XOR:
+		case _DIV:	case _DIVU:
+		case _SLL:	case _SRA:	case _SRL:
+			if (!OptIsKnown(theOp->rs))
+			{
+				OptForget(theOp->rd);
+				break;
+			}
+
+			b = OptGetValue(theOp->rs);
+
+			// Both known, load the result
+
+			if (OptIsKnown(theOp->rd) && OptFoldArith(theOp->op, OptGetValue(theOp->rd), b, &v))
+			{
+				sprintf(line, "ld %s,#0x%x", DecodeRegName(theOp->rd, 0), v);
+				OptAppend(out, size, line);
+				OptSetValue(theOp->rd, v);
+				OptFolded++;
+				return;
+			}
+
+			OptForget(theOp->rd);
+
+			// Only the source known, make it an immediate
+
+			if (OptFoldArith(theOp->op, 0, b, &v))
+			{
+				sprintf(line, "%s %s,#0x%x", OptArithName(theOp->op), DecodeRegName(theOp->rd, 0), b);
+				OptAppend(out, size, line);
+				OptFolded++;
+				return;
+			}
+		break;
+
+		case _ADDI:	case _SUBI:	case _MULI:
+		case _ANDI:	case _ORI:	case _XORI:
+		case _DIVI:	case _DIVUI:
+		case _SLLI:	case _SRAI:	case _SRLI:
+			if (OptPlainImm(theOp) && OptIsKnown(theOp->rd) &&
+				OptFoldArith(theOp->op, OptGetValue(theOp->rd), theOp->imm, &v))
+			{
+				sprintf(line, "ld %s,#0x%x", DecodeRegName(theOp->rd, 0), v);
+				OptAppend(out, size, line);
+				OptSetValue(theOp->rd, v);
+				OptFolded++;
+				return;
+			}
+
+			OptForget(theOp->rd);
+		break;
+
+		case _NOT:	case _NEG:
+		case _XB:	case _XH:
+			if (!OptIsKnown(theOp->rs))
+			{
+				OptForget(theOp->rd);
+				break;
+			}
+
+			a = OptGetValue(theOp->rs);
+
+			if (theOp->op == _NOT)
+				v = ~a;
+			else if (theOp->op == _NEG)
+				v = (int) (0 - (uint) a);
+			else if (theOp->op == _XB)
+				v = (int) (signed char) a;
+			else
+				v = (int) (short) a;
+
+			sprintf(line, "ld %s,#0x%x", DecodeRegName(theOp->rd, 0), v);
+			OptAppend(out, size, line);
+			OptSetValue(theOp->rd, v);
+			OptFolded++;
+		return;
+
+		case _LDW:	case _LDH:	case _LDB:
+			OptForget(theOp->rd);
+		break;
+
+		case _STW:	case _STH:	case _STB:
+		break;
+
+		case _JC_EQ:	case _JC_NE:
+		case _JC_GE:	case _JC_GEU:
+		case _JC_GT:	case _JC_GTU:
+		case _JC_LE:	case _JC_LEU:
+		case _JC_LT:	case _JC_LTU:
+			taken = OptJumpTaken(theOp);
+			ref = OptJumpLabel(theOp);
+
+			if (taken == 1 && ref && strlen(ref->Name) <= OPT_NAME_MAX)
+			{
+				sprintf(line, "jp &%s_%d", ref->Name, ref->LocalScope);
+				OptAppend(out, size, line);
+				OptFolded++;
+				return;
+			}
+
+			if (taken == 0)
+			{
+				OptAppend(out, size, "// jump never taken");
+				OptFolded++;
+				return;
+			}
+		break;
+
+		case _CALLI:
+			ref = OptJumpLabel(theOp);
+
+			if (OptCanInline(ref) && RebuildOptInline(ref, out, size))
+				return;
+
+			RebuildOptReset();
+		break;
+
+		case _PUSH:
+			OptForget(REG_sp);
+		break;
+
+		default:
+			RebuildOptReset();
+		break;
+	}
+
+	// Not changed, write it as it is
+
+	DecodeAsmString(theOp, line, 1);
+	OptAppend(out, size, line);
+}
+
+//****************************************
+//	  Copy the body of a function into
+//	 the code of its caller, returns 0
+//	  and leaves out as it was if the
+//		   body doesn't fit
+//****************************************
+
+int RebuildOptInline(SYMBOL *sym, char *out, int size)
+{
+	OpcodeInfo thisOp;
+	uchar *ip, *ip_end;
+	char line[OPT_LINE_MAX];
+	int len, folded;
+
+	if (strlen(sym->Name) > OPT_NAME_MAX)
+		return 0;
+
+	len = strlen(out);
+	folded = OptFolded;
+	OptOverflow = 0;
+
+	ip = (uchar *) ArrayPtr(&CodeMemArray, sym->Value);
+	ip_end = (uchar *) ArrayPtr(&CodeMemArray, sym->EndIP);
+
+	sprintf(line, "// inlined %s", sym->Name);
+	OptAppend(out, size, line);
+
+	while (ip <= ip_end)
+	{
+		ip = DecodeOpcode(&thisOp, ip);
+
+		if (thisOp.op == _RET)
+			break;
+
+		RebuildOptOpcode(&thisOp, out, size);
+	}
+
+	if (OptOverflow)
+	{
+		out[len] = 0;
+		OptFolded = folded;
+		OptOverflow = 0;
+		return 0;
+	}
+
+	OptInlined++;
+	return 1;
+}
+
+//****************************************
+//	 Optimise an opcode of the function
+//	 being rebuilt, out gets its code
+//****************************************
+
+void RebuildOptInst(OpcodeInfo *theOp, char *out, int size)
+{
+	out[0] = 0;
+	OptOverflow = 0;
+
+	RebuildOptOpcode(theOp, out, size);
+
+	// Too long even on its own, write it as it is
+
+	if (OptOverflow)
+	{
+		RebuildOptReset();
+		DecodeAsmString(theOp, out, 1);
+	}
+}
+
+//****************************************
+
+#endif // INCLUDE_CODE_REBUILD
@@ -50,12 +50,33 @@ char *Sect_Strings[] =
 //	Initialises Symbol table to null.
 //****************************************
 
-#define SYMBOL_HASH_SIZE 32749			// Prime
+#define SYMBOL_HASH_MIN 4096			// Power of two
+#define NAME_HASH_MIN 4096				// Power of two
+#define NAME_BLOCK_SIZE (256*1024)
 
 #ifdef USE_HASHING
-BucketArray SymbolHash;
+SYMBOL **SymbolHash;					// Chained on SYMBOL.HashNext
+uint SymbolHashSize;
+uint SymbolHashCount;
 #endif
 
+// Interned symbol names.
+// Each distinct name is stored once in a NameBlock,
+// and shared by all the symbols with that name.
+
+typedef struct NameBlock
+{
+	struct NameBlock *Next;
+	int		Size;
+	int		Used;
+	char	Data[1];
+} NameBlock;
+
+NameBlock *NameBlocks;
+char **NameHash;						// Open addressed
+uint NameHashSize;
+uint NameHashCount;
+
 SYMBOL *NextFreeSym;
 int NextSymbolCount;
 
@@ -91,9 +112,16 @@ int InitSymbolTable(void)
 	while(--n);
 
 #ifdef USE_HASHING
-	BucketArrayInit(&SymbolHash, SYMBOL_HASH_SIZE);
+	SymbolHashSize = SYMBOL_HASH_MIN;
+	SymbolHashCount = 0;
+	SymbolHash = (SYMBOL **) NewPtrClear(sizeof(SYMBOL *) * SymbolHashSize);
 #endif
 
+	NameBlocks = NULL;
+	NameHashSize = NAME_HASH_MIN;
+	NameHashCount = 0;
+	NameHash = (char **) NewPtrClear(sizeof(char *) * NameHashSize);
+
 	NextFreeSym = SymTab;
 	NextSymbolCount = 0;
 
@@ -109,10 +137,14 @@ void CloseSymbolTable(void)
 {
 
 #ifdef USE_HASHING
-	BucketArrayDispose(&SymbolHash);
+	if (SymbolHash)
+		DisposePtr((char *) SymbolHash);
+
+	SymbolHash = 0;
 #endif
 
 	DisposeSymbols();
+	DisposeNames();
 
 	if (SymTab)
 		DisposePtr((char *) SymTab);
@@ -221,29 +253,205 @@ SYMBOL * GetSymbol(int num)
 	return Sym;
 }
 */
+//****************************************
+//			  Hash Name
+// FNV-1a, so that names made up of the same
+// characters in a different order (which is
+// common for mangled C++ names) don't collide.
+// Also returns the length of the name.
+//****************************************
+
+uint HashName(char *string, int *len)
+{
+	uchar *p = (uchar *) string;
+	uint v = 2166136261u;
+
+	while (*p)
+	{
+		v ^= *p++;
+		v *= 16777619;
+	}
+
+	*len = (char *) p - string;
+	return v;
+}
+
 //****************************************
 //			  Hash Symbol
-// Returns the entry point into hash table
+// Combines a name hash with the scope and
+// section the symbol is stored under
+//****************************************
+
+uint HashSymbol(uint nameHash, int scope, int section)
+{
+	uint v = nameHash;
+
+	v ^= (uint) scope * 0x9E3779B1;
+	v ^= (uint) section * 0x85EBCA6B;
+
+	// Mix the high bits down, as only the low
+	// bits are used to pick a bucket
+
+	v ^= v >> 16;
+	v *= 0x7FEB352D;
+	v ^= v >> 15;
+
+	return v;
+}
+
+#ifdef USE_HASHING
+
 //****************************************
+//	Add a symbol to the end of its chain
+// so that the first symbol stored under a
+// name is the one that is found
+//****************************************
+
+void SymbolHashLink(SYMBOL *Sym)
+{
+	SYMBOL **link = &SymbolHash[Sym->Hash & (SymbolHashSize - 1)];
 
-//#define HASHFUNC(vv) ((vv * 1103515245) + 12345)
+	while (*link)
+		link = &(*link)->HashNext;
+
+	Sym->HashNext = NULL;
+	*link = Sym;
+}
 
-int HashSymbol(char *string, int scope, int section)
+//****************************************
+//	Double the number of hash buckets
+//****************************************
+
+void SymbolHashGrow(void)
 {
-	uint v, n;
-	uint len;
+	SYMBOL *Sym;
 
-	len = strlen(string);
+	DisposePtr((char *) SymbolHash);
 
-	v = 41;
-	v += HASHFUNC(scope);
-	v += HASHFUNC(section);
-	v += HASHFUNC(len);
+	SymbolHashSize *= 2;
+	SymbolHash = (SYMBOL **) NewPtrClear(sizeof(SYMBOL *) * SymbolHashSize);
 
-	for (n=0;n<len;n++)
-		v += HASHFUNC(string[n]);
+	if (!SymbolHash)
+		Error(Error_Fatal, "Out of symbol hash memory!!");
+
+	// Relink in the order the symbols were stored
+
+	for (Sym = SymTab; Sym < NextFreeSym; Sym++)
+		SymbolHashLink(Sym);
+}
+
+#endif
+
+//****************************************
+//	Intern a name, returns the shared copy
+//****************************************
+
+char * InternName(char *string, int len, uint hash)
+{
+	NameBlock *block;
+	char *name;
+	uint mask, n;
+
+	// Keep the table at most half full
+
+	if (NameHashCount * 2 >= NameHashSize)
+	{
+		char **oldHash = NameHash;
+		uint oldSize = NameHashSize;
+		int oldLen;
+
+		NameHashSize *= 2;
+		NameHash = (char **) NewPtrClear(sizeof(char *) * NameHashSize);
+
+		if (!NameHash)
+			Error(Error_Fatal, "Out of symbol name memory!!");
+
+		mask = NameHashSize - 1;
+
+		for (n=0;n<oldSize;n++)
+		{
+			uint i;
+
+			if (!oldHash[n])
+				continue;
+
+			i = HashName(oldHash[n], &oldLen) & mask;
+
+			while (NameHash[i])
+				i = (i + 1) & mask;
+
+			NameHash[i] = oldHash[n];
+		}
+
+		DisposePtr((char *) oldHash);
+	}
+
+	mask = NameHashSize - 1;
+	n = hash & mask;
+
+	while ((name = NameHash[n]) != NULL)
+	{
+		if (name[0] == string[0] && strcmp(name, string) == 0)
+			return name;
+
+		n = (n + 1) & mask;
+	}
+
+	// Not found, copy it into the current block
+
+	block = NameBlocks;
+
+	if (!block || block->Used + len + 1 > block->Size)
+	{
+		int size = NAME_BLOCK_SIZE;
+
+		if (len + 1 > size)
+			size = len + 1;
+
+		block = (NameBlock *) NewPtr(sizeof(NameBlock) + size);
+
+		if (!block)
+			Error(Error_Fatal, "Out of symbol name memory!!");
+
+		block->Next = NameBlocks;
+		block->Size = size;
+		block->Used = 0;
+		NameBlocks = block;
+	}
+
+	name = &block->Data[block->Used];
+	block->Used += len + 1;
+
+	memcpy(name, string, len + 1);
+
+	NameHash[n] = name;
+	NameHashCount++;
+
+	return name;
+}
+
+//****************************************
+//		Free all interned names
+//****************************************
+
+void DisposeNames(void)
+{
+	NameBlock *block = NameBlocks;
 
-	return v % SYMBOL_HASH_SIZE;
+	while (block)
+	{
+		NameBlock *next = block->Next;
+		DisposePtr((char *) block);
+		block = next;
+	}
+
+	NameBlocks = NULL;
+
+	if (NameHash)
+		DisposePtr((char *) NameHash);
+
+	NameHash = NULL;
+	NameHashCount = 0;
 }
 
 //****************************************
@@ -261,25 +469,16 @@ int HashSymbol(char *string, int scope, int section)
 SYMBOL * FindSymbolsOld(char *string,int sectionStart,int sectionEnd)
 {
 	SYMBOL *Sym;
-	int elem, entry;
+	uint hash;
 	int	len;
 
-	len = strlen(string);
-
-	entry = HashSymbol(string, 0, sectionStart);
-	elem = -1;
+	hash = HashSymbol(HashName(string, &len), 0, sectionStart);
+	Sym = SymbolHash[hash & (SymbolHashSize - 1)];
 
-	while(1)
+	for (; Sym; Sym = Sym->HashNext)
 	{
-		elem = BucketArraySearch(&SymbolHash, entry, elem, (uint*) &Sym);
-
-		if (Sym == 0)
-			return NULL;
-
-		if (elem == -1)
-			return NULL;
-
-		if ( (Sym->Len == len) &&
+		if ( (Sym->Hash == hash) &&
+			 (Sym->Len == len) &&
 			 (Sym->Section != 0)  &&
 			 (Sym->Section >= sectionStart) &&
 			 (Sym->Section <= sectionEnd) &&
@@ -289,9 +488,6 @@ SYMBOL * FindSymbolsOld(char *string,int sectionStart,int sectionEnd)
 //			LastSymCount = n;
 			return Sym;
 		}
-
-		if (elem == 0)
-			return NULL;
 	}
 
 	return NULL;
@@ -349,25 +545,16 @@ SYMBOL * FindSymbolsOld(char *string,int sectionStart,int sectionEnd)
 SYMBOL * FindSymbols(char *string,int sectionStart,int sectionEnd, int scope)
 {
 	SYMBOL *Sym;
-	int elem, entry;
+	uint hash;
 	int	len;
 
-	len = strlen(string);
-
-	entry = HashSymbol(string, scope, sectionStart);
-	elem = -1;
+	hash = HashSymbol(HashName(string, &len), scope, sectionStart);
+	Sym = SymbolHash[hash & (SymbolHashSize - 1)];
 
-	while(1)
+	for (; Sym; Sym = Sym->HashNext)
 	{
-		elem = BucketArraySearch(&SymbolHash, entry, elem, (uint*) &Sym);
-
-		if (Sym == 0)
-			return NULL;
-
-		if (elem == -1)
-			return NULL;
-
-		if ( (Sym->LocalScope == scope) &&
+		if ( (Sym->Hash == hash) &&
+			 (Sym->LocalScope == scope) &&
 			 (Sym->Len == len) &&
 			 (Sym->Section != 0)  &&
 			 (Sym->Section >= sectionStart) &&
@@ -378,9 +565,6 @@ SYMBOL * FindSymbols(char *string,int sectionStart,int sectionEnd, int scope)
 //				LastSymCount = n;
 				return Sym;
 			}
-
-		if (elem == 0)
-			return NULL;
 	}
 
 	return NULL;
@@ -504,39 +688,35 @@ SYMBOL * FindNextSymbol(SYMBOL *Sym,char *string,int sectionStart,int sectionEnd
 SYMBOL * StoreSymbol(SYMBOL *NewSym,char *string)
 {
 	SYMBOL *Sym = FreeSymbol();
-	char *ThisName;					// Location of PTR to name
+	uint nameHash;
 	int StringLen;
-	int entry;
-
-	StringLen = strlen(string) + 1;	// Get length of string
 
 	// if there was not Symbol space quit
 
 	if (Sym == NULL)
 			return NULL;
 
-	// if there was no name space quit
-
-	ThisName = (char *) NewPtr((int) StringLen);
-
-	// Copy the name to the NamesList
+	nameHash = HashName(string, &StringLen);
 
-	memcpy(ThisName,string,StringLen);
 	memcpy(Sym,NewSym,sizeof(SYMBOL));
 
-	// Set the Symbol data ptr
+	// Set the Symbol data ptr to the shared name
 
-	Sym->Name = ThisName;
-	Sym->Len = StringLen-1;
+	Sym->Name = InternName(string, StringLen, nameHash);
+	Sym->Len = StringLen;
 
 	Sym->Flags = 0;
 
 	// Add symbol to hash table
 
+	Sym->Hash = HashSymbol(nameHash, Sym->LocalScope, Sym->Section);
+
 #ifdef USE_HASHING
 
-	entry = HashSymbol(Sym->Name, Sym->LocalScope, Sym->Section);
-	BucketArrayAdd(&SymbolHash, entry, (int) Sym);
+	if (++SymbolHashCount > SymbolHashSize)
+		SymbolHashGrow();
+	else
+		SymbolHashLink(Sym);
 
 #endif
 	// Carry forward the names pointer
@@ -555,8 +735,7 @@ int DelSymbol(SYMBOL *ThisSym)
 
 	//OutEval("------ Undeclare '%s'\n",(char *) ThisSym->name);
 
-	if (ThisSym->Name)
-		DisposePtr((char *) ThisSym->Name);			// Give back memory
+	ThisSym->Name = NULL;							// Names are freed by DisposeNames()
 
 	return 1;										// Say o.k
 }
@@ -1535,46 +1714,108 @@ void DumpIPTrans()
 }
 
 
+//****************************************
+//	  Functions in address order
+//
+// The symbol table holds the functions in
+// source order, which is also their address
+// order unless -layout moved them. The
+// dumps below take the functions from this
+// list instead, so the
+// function entries come out in address
+// order either way, and the other entries
+// stay where they were. The list ends with
+// a null pointer.
+//****************************************
+
+int CompareFuncSymAddr(const void *a, const void *b)
+{
+	const SYMBOL *sa = *(const SYMBOL **) a;
+	const SYMBOL *sb = *(const SYMBOL **) b;
+
+	if (sa->Value != sb->Value)
+		return (sa->Value < sb->Value) ? -1 : 1;
+
+	// Keep table order for equal addresses
+
+	return (sa < sb) ? -1 : (sa > sb);
+}
+
+int IsDumpedFunction(SYMBOL *Sym, int codeOnly)
+{
+	if ((Sym->LabelType != label_Function) && (Sym->LabelType != label_Virtual))
+		return 0;
+
+	if (Sym->Section != section_Enum)
+		return 0;
+
+	if (codeOnly)
+		return (Sym->Type == SECT_code);
+
+	return (Sym->Type != SECT_null);
+}
+
+SYMBOL ** SortFunctionsByAddr(int codeOnly)
+{
+	SYMBOL	**list;
+	SYMBOL	*Sym;
+	int		count = 0;
+
+	for (Sym = SymTab; Sym < SymTab + SYMMAX; Sym++)
+		if (IsDumpedFunction(Sym, codeOnly))
+			count++;
+
+	list = (SYMBOL **) NewPtr(sizeof(SYMBOL *) * (count + 1));
+
+	if (!list)
+		Error(Error_Fatal, "Could not allocate function list");
+
+	count = 0;
+
+	for (Sym = SymTab; Sym < SymTab + SYMMAX; Sym++)
+		if (IsDumpedFunction(Sym, codeOnly))
+			list[count++] = Sym;
+
+	qsort(list, count, sizeof(SYMBOL *), CompareFuncSymAddr);
+	list[count] = 0;
+	return list;
+}
+
 //****************************************
 //		Dump Function Table
 //****************************************
 
 void DumpFunctions(FILE *out)
 {
+	SYMBOL	**list;
 	SYMBOL	*Sym;
 	int lastVal = -1;
 	int		n;
 
 	fprintf(out, "FUNCTIONS\n");
 
-	Sym = SymTab;
-	n = SYMMAX;
+	list = SortFunctionsByAddr(0);
 
-	do
+	for (n=0;list[n];n++)
 	{
-		if (((Sym->LabelType == label_Function) || (Sym->LabelType == label_Virtual))
-			//&& ((Sym->Section == section_Label) || (Sym->Section == section_Global)))
-			//&& Sym->EndIP != 0)
-			&& (Sym->Section == section_Enum) && (Sym->Type != SECT_null))
-		{
-			fprintf(out, "%s ",Sym->Name);
-			fprintf(out, "%s,",Hex32(Sym->Value));
-			fprintf(out, "%s",Hex32(Sym->EndIP));
+		Sym = list[n];
+
+		fprintf(out, "%s ",Sym->Name);
+		fprintf(out, "%s,",Hex32(Sym->Value));
+		fprintf(out, "%s",Hex32(Sym->EndIP));
 #if 0	// for debugging
-			fprintf(out, "(t%i, lt%i, s%i, vi%i, ls%i, le%i)",
-				Sym->Type, Sym->LabelType, Sym->Section, Sym->VirtualIndex,
-				Sym->LocalScope, Sym->LabelEnum);
+		fprintf(out, "(t%i, lt%i, s%i, vi%i, ls%i, le%i)",
+			Sym->Type, Sym->LabelType, Sym->Section, Sym->VirtualIndex,
+			Sym->LocalScope, Sym->LabelEnum);
 #endif
-			fprintf(out, "\n");
-			if(Sym->Value > Sym->EndIP || Sym->Value <= lastVal) {
-				printf("Warning: problematic symbol value: %s\n", Sym->Name);
-			}
-			lastVal = Sym->Value;
+		fprintf(out, "\n");
+		if(Sym->Value > Sym->EndIP || Sym->Value <= lastVal) {
+			printf("Warning: problematic symbol value: %s\n", Sym->Name);
 		}
-
-		Sym++;
+		lastVal = Sym->Value;
 	}
-	while(--n);
+
+	DisposePtr((char *) list);
 
 	fprintf(out, "CDTOR ");
 	fprintf(out, "%s,",   Hex32(CDtorStart));
@@ -1629,7 +1870,10 @@ int IsDebugLabel ( const char *l )
 
 void DumpMetaData ( FILE *out )
 {
+	SYMBOL	**list;
 	SYMBOL	*Sym;
+	SYMBOL	*Func;
+	int		next = 0;
 	int lastVal = -1;
 	//int lastEnd = -1;
 	int		n;
@@ -1643,27 +1887,33 @@ void DumpMetaData ( FILE *out )
 
 	fprintf(out, "Meta\n");
 
+	// Each function entry prints the next function in
+	// address order, so the syscalls keep their places
+
+	list = SortFunctionsByAddr(1);
+
 	Sym = SymTab;
 	n = SYMMAX;
 
 	do
 	{
-		if (((Sym->LabelType == label_Function) || (Sym->LabelType == label_Virtual))
-			&& (Sym->Section == section_Enum) && (Sym->Type == SECT_code))
+		if (IsDumpedFunction(Sym, 1))
 		{
-			fprintf(out, "F<%s,",Sym->Name);
-			fprintf(out, "%s,",Hex32(Sym->Value));
-			fprintf(out, "%s,",Hex32(Sym->EndIP));
-			fprintf(out, "%d,", Sym->Params > 4 ? 4 : Sym->Params );
-			fprintf(out, "%s", returnType[(int)(Sym->RetType)]);
+			Func = list[next++];
+
+			fprintf(out, "F<%s,",Func->Name);
+			fprintf(out, "%s,",Hex32(Func->Value));
+			fprintf(out, "%s,",Hex32(Func->EndIP));
+			fprintf(out, "%d,", Func->Params > 4 ? 4 : Func->Params );
+			fprintf(out, "%s", returnType[(int)(Func->RetType)]);
 			fprintf(out, ">\n");
 
-			if(Sym->Value > Sym->EndIP || Sym->Value <= lastVal) {
-				printf("Warning: problematic symbol value: %s\n", Sym->Name);
+			if(Func->Value > Func->EndIP || Func->Value <= lastVal) {
+				printf("Warning: problematic symbol value: %s\n", Func->Name);
 			}
 
-			lastVal = Sym->Value;
-			//lastEnd = Sym->EndIP;
+			lastVal = Func->Value;
+			//lastEnd = Func->EndIP;
 		}
 		/*
 		else if (((Sym->LabelType == label_Local))
@@ -1694,6 +1944,7 @@ void DumpMetaData ( FILE *out )
 	}
 	while(--n);
 
+	DisposePtr((char *) list);
 	return;
 }
 //****************************************
@@ -25,6 +25,14 @@ Software Foundation, 59 Temple Place - Suite 330, Boston, MA
 
 #define VARMAX 32768			//16384
 
+// Index from constant value to pool entry, so that FindVar
+// doesn't have to search the whole pool for every constant.
+// Open addressed, each slot holds a pool index + 1, or 0 if empty.
+
+#define VARINDEX_SIZE (VARMAX * 2)	// Power of two, at most half full
+
+int *VarIndex;
+
 //****************************************
 //		Initialise the constant pool
 //****************************************
@@ -44,6 +52,15 @@ int InitVarPool()
 		return 0;
 	}
 
+	VarIndex = (int *) NewPtrClear( (int) (sizeof(int) * VARINDEX_SIZE));
+
+	if (!VarIndex)
+	{
+		DisposePtr((char *) VarPool);
+		DisposePtr((char *) VarFreq);
+		return 0;
+	}
+
 	ThisVar = VarPool;
 	VarCount = 0;
 
@@ -63,6 +80,10 @@ void CloseVarPool()
 	if (VarFreq)
 		DisposePtr((char *) VarFreq);
 
+	if (VarIndex)
+		DisposePtr((char *) VarIndex);
+
+	VarIndex = 0;
 	VarCount = 0;
 	ThisVar = 0;
 }
@@ -76,30 +97,55 @@ void ClearVarPool()
 	ThisVar = VarPool;
 	VarCount = 0;
 
+	memset(VarIndex, 0, sizeof(int) * VARINDEX_SIZE);
+
 	StoreVarPool(0);			// Store defualt 0
 }
 
 //****************************************
-//		  Search var pool entry (Slow)
+//	   Find the index slot for a value
 //****************************************
 
-int SearchVarPool(int v)
+int *VarIndexSlot(int v)
 {
-	int *vptr;
-	int n;
-
-	// Failed so look again
+	uint n = HASHFUNC((uint) v);
+	int *slot;
 
-	vptr = VarPool;
+	n ^= n >> 16;
 
-	for (n=0;n<VarCount;n++)
+	while(1)
 	{
-		if (v == *vptr++)
-			return n;
+		n &= VARINDEX_SIZE - 1;
+		slot = &VarIndex[n];
+
+		if (*slot == 0 || VarPool[*slot - 1] == v)
+			return slot;
 
+		n++;
 	}
+}
+
+//****************************************
+//	Rebuild the index after the pool moved
+//****************************************
+
+void IndexVarPool()
+{
+	int n;
+
+	memset(VarIndex, 0, sizeof(int) * VARINDEX_SIZE);
+
+	for (n=0;n<VarCount;n++)
+		*VarIndexSlot(VarPool[n]) = n + 1;
+}
 
-	return -1;
+//****************************************
+//		  Search var pool entry
+//****************************************
+
+int SearchVarPool(int v)
+{
+	return *VarIndexSlot(v) - 1;
 }
 
 //****************************************
@@ -117,6 +163,8 @@ int StoreVarPool(int v)
 
 	idx = VarCount;
 	VarCount++;
+
+	*VarIndexSlot(v) = idx + 1;
 	return idx;
 }
 
@@ -156,6 +204,7 @@ int FindVar(int v)
 void SortVarPool()
 {
   varpool_q_sort(0, VarCount - 1);
+  IndexVarPool();
 }
 
 void varpool_q_sort(int left, int right)
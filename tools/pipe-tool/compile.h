@@ -287,6 +287,43 @@ enum
 	_ENDOP
 };
 
+//****************************************
+//		 Superinstructions
+//****************************************
+// Must match SUPERINSTRUCTIONS in runtimes/cpp/core/CoreCommon.h
+// A superinstruction replaces the opcode of the first instruction
+// in a sequence, all other bytes are left intact.
+
+enum
+{
+	_LDW_ADD = _ENDOP + 1,
+	_LDW_LDW,
+	_LDW_STW,
+	_LDR_LDR,
+	_LDI_LDI,
+	_ADD_LDW,
+	_ADDI_LDW,
+	_ADD_JC_LT,
+	_ADD_JC_NE,
+	_PUSH_SUB,
+	_PUSH_SUBI,
+	_ADD_POP,
+	_ADDI_POP,
+	_POP_RET,
+	_ADD_POP_RET,
+	_ADDI_POP_RET,
+	_ENDSUPER
+};
+
+typedef struct
+{
+	char	*Name;
+	int		Op;
+	int		Part[3];		// _NOP terminated for pairs
+	int		Enabled;
+	double	Count;			// Executions, when derived from a block profile
+} SuperInst;
+
 //****************************************
 //		  Module Header Structure
 //****************************************
@@ -476,6 +513,9 @@ typedef struct SYMBOL
 	char	Params;			// Parameter count
 	char	RetType;		// Return type
 
+	uint	Hash;			// HashSymbol() of name, scope and section
+	struct SYMBOL *HashNext;	// Next symbol in the same hash bucket
+
 //	int		Size;			// size of anything
 //	char	*SymLink;		// Ptr to anything
 //	int		Extern;
@@ -738,22 +778,28 @@ decset(int ArgRes, 0)
 decset(int ArgJavaNative, 0)
 decset(int ArgBrewGen, 0)
 decset(int ArgCppGen, 0)
+decset(int ArgCppOpt, 0)
 decset(int ArgCsGen, 0)
 
 decset(int ArgFilePaths, 0)
 decset(int ArgOptimize, 1)
 decset(int Do_Elimination, 0)
 decset(int ArgDebugRebuild, 0)
+decset(int ArgRebuildOpt, 0)
 decset(int ArgSkipElim, 0)
 decset(int ArgSLD, 0)
 decset(int ArgUseStabs, 0)
 decset(int ArgWriteMeta, 0)
+decset(int ArgSuper, 0)
+decset(int ArgLayout, 0)
 
 decset(int ArgQuiet, 0)
 
 dec(char SldName[256])
 dec(char StabsName[256])
 dec(char MetaFileName[256])
+dec(char SuperName[256])
+dec(char LayoutName[256])
 
 decset(int ArgUseMasterDump, 0)
 
@@ -825,6 +871,7 @@ dec(int rd)
 dec(int imm)
 dec(int op)
 dec(int farop)
+dec(SYMBOL *RelaxConstSym)			// Code label of the last constant expression
 
 decset(int GlobalsInCode, 0)
 
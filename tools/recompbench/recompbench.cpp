@@ -0,0 +1,341 @@
+/* Copyright (C) 2011 MoSync AB
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2, as published by
+the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.
+*/
+
+// Measures the X64Recompiler on a few compute-heavy MoSync programs,
+// against a byte-dispatch loop with the semantics of core_run.h in a
+// release build (masked memory references, no MEMORY_DEBUG). Also checks
+// that both produce the same result.
+// Usage: recompbench [runs per case]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "X64Recompiler.h"
+
+using namespace Core;
+
+#define CODE_SIZE (64*1024)
+#define DATA_SIZE (64*1024)
+#define STACK_TOP DATA_SIZE
+// where the programs keep their arrays
+#define ARRAY 1024
+
+#define SIEVE_SIZE 8192
+#define HASH_BYTES 16384
+#define FIB_N 24
+
+//****************************************
+// Stubs for the parts of the runtime the recompiler calls
+//****************************************
+
+static int sYield;
+
+VMCore::VMCore() {}
+VMCore::~VMCore() {}
+
+// every program ends with a syscall.
+void VMCore::invokeSysCall(int id) {
+	sYield = 1;
+}
+
+void MoSyncErrorExit(int errorCode) {
+	printf("MoSync Panic %i\n", errorCode);
+	exit(1);
+}
+
+void LogV(const char* fmt, va_list args) {}
+void LogBin(const void* data, int size) {}
+void logWithoutNewline(const char* fmt, ...) {}
+
+//****************************************
+// Program builder
+//****************************************
+
+struct Program {
+	byte code[CODE_SIZE];
+	int codeLen;
+	int consts[128];
+	int numConsts;
+
+	Program() : codeLen(1), numConsts(0) {}
+
+	int here() const { return codeLen; }
+	void b(int x) { code[codeLen++] = (byte)x; }
+
+	// a constant pool index, one byte as long as there are fewer than 128
+	void c(int value) {
+		int i = 0;
+		while(i < numConsts && consts[i] != value)
+			i++;
+		if(i == numConsts)
+			consts[numConsts++] = value;
+		b(i);
+	}
+
+	void addr16(int address) { b(address >> 8); b(address); }
+	void patch16(int pos, int address) {
+		code[pos] = (byte)(address >> 8);
+		code[pos + 1] = (byte)address;
+	}
+
+	void rr(int op, int rd, int rs) { b(op); b(rd); b(rs); }
+	void ri(int op, int rd, int imm) { b(op); b(rd); c(imm); }
+	void rri(int op, int rd, int rs, int imm) { b(op); b(rd); b(rs); c(imm); }
+	void rn(int op, int rd, int n) { b(op); b(rd); b(n); }
+	void jc(int op, int rd, int rs, int address) { b(op); b(rd); b(rs); addr16(address); }
+	// returns the position of the address, for patching
+	int jcFwd(int op, int rd, int rs) { b(op); b(rd); b(rs); addr16(0); return codeLen - 2; }
+	void jpi(int address) { b(_JPI); addr16(address); }
+	void calli(int address) { b(_CALLI); addr16(address); }
+	int calliFwd() { b(_CALLI); addr16(0); return codeLen - 2; }
+	void ret() { b(_RET); }
+	// ends a run. The recompiler needs every function to end with a
+	// return or a backward jump, so loop like an event loop would.
+	void yield() { b(_SYSCALL); b(0); jpi(1); }
+};
+
+// r0 = the number of primes below SIEVE_SIZE, with a byte array.
+static void buildSieve(Program& p) {
+	p.ri(_LDI, REG_r0, 0);
+	p.ri(_LDI, REG_r1, 0);
+	p.ri(_LDI, REG_r5, SIEVE_SIZE);
+	int clear = p.here();
+	p.rri(_STB, REG_r1, REG_zero, ARRAY);
+	p.ri(_ADDI, REG_r1, 1);
+	p.jc(_JC_LT, REG_r1, REG_r5, clear);
+	p.ri(_LDI, REG_r1, 2);
+	p.ri(_LDI, REG_r6, 1);
+	int outer = p.here();
+	p.rri(_LDB, REG_r3, REG_r1, ARRAY);
+	int composite = p.jcFwd(_JC_NE, REG_r3, REG_zero);
+	p.ri(_ADDI, REG_r0, 1);
+	p.rr(_LDR, REG_r4, REG_r1);
+	p.rr(_ADD, REG_r4, REG_r1);
+	int inner = p.here();
+	int innerDone = p.jcFwd(_JC_GE, REG_r4, REG_r5);
+	p.rri(_STB, REG_r4, REG_r6, ARRAY);
+	p.rr(_ADD, REG_r4, REG_r1);
+	p.jpi(inner);
+	p.patch16(composite, p.here());
+	p.patch16(innerDone, p.here());
+	p.ri(_ADDI, REG_r1, 1);
+	p.jc(_JC_LT, REG_r1, REG_r5, outer);
+	p.yield();
+}
+
+// r0 = an FNV-1a style hash of HASH_BYTES of words.
+static void buildHash(Program& p) {
+	p.ri(_LDI, REG_r0, (int)2166136261u);
+	p.ri(_LDI, REG_r1, 0);
+	p.ri(_LDI, REG_r5, HASH_BYTES);
+	int loop = p.here();
+	p.rri(_LDW, REG_r3, REG_r1, ARRAY);
+	p.rr(_XOR, REG_r0, REG_r3);
+	p.ri(_MULI, REG_r0, 16777619);
+	p.rr(_LDR, REG_r4, REG_r0);
+	p.rn(_SRLI, REG_r4, 15);
+	p.rr(_XOR, REG_r0, REG_r4);
+	p.ri(_ADDI, REG_r1, 4);
+	p.jc(_JC_LT, REG_r1, REG_r5, loop);
+	p.yield();
+}
+
+// r0 = fib(FIB_N), recursively, with the calling convention pipe-tool uses.
+static void buildFib(Program& p) {
+	p.ri(_LDI, REG_i0, FIB_N);
+	p.ri(_LDI, REG_d7, 2);
+	int call = p.calliFwd();
+	p.yield();
+
+	int fib = p.here();
+	p.patch16(call, fib);
+	int small = p.jcFwd(_JC_LT, REG_i0, REG_d7);
+	p.rn(_PUSH, REG_rt, 4);	// rt, fr, d0, d1
+	p.rr(_LDR, REG_d0, REG_i0);
+	p.ri(_SUBI, REG_i0, 1);
+	p.calli(fib);
+	p.rr(_LDR, REG_d1, REG_r0);
+	p.rr(_LDR, REG_i0, REG_d0);
+	p.ri(_SUBI, REG_i0, 2);
+	p.calli(fib);
+	p.rr(_ADD, REG_r0, REG_d1);
+	p.rn(_POP, REG_d1, 4);
+	p.ret();
+	p.patch16(small, p.here());
+	p.rr(_LDR, REG_r0, REG_i0);
+	p.ret();
+}
+
+//****************************************
+// Byte-dispatch interpreter
+//****************************************
+
+#define IB ((int)(*ip++))
+#define FETCH_RD rd = IB;
+#define FETCH_RS rs = IB;
+#define FETCH_CONST imm32 = IB; if(imm32>127) {imm32=((imm32&127)<<8)+IB;}\
+	imm32 = mem_cp[imm32];
+#define FETCH_IMM8 imm32 = IB;
+#define FETCH_IMM16 imm32 = IB << 8; imm32 += IB;
+#define RD regs[rd]
+#define RS regs[rs]
+#define MEMREF(type, addr) (*(type*)(((char*)mem_ds) + \
+	((addr) & (DATA_SIZE - 1) & ~(sizeof(type) - 1))))
+#define JMP(address) ip = mem_cs + ((address) & (CODE_SIZE - 1));
+#define NEXT_ADDRESS (int)(ip - mem_cs)
+
+// Runs from ip until a syscall.
+static void interpret(VMCore& core, int address) {
+	byte* mem_cs = core.mem_cs;
+	int* mem_ds = core.mem_ds;
+	int* mem_cp = core.mem_cp;
+	int* regs = core.regs;
+	byte* ip = mem_cs + address;
+	int rd, rs, imm32;
+
+	for(;;) {
+		byte op = *ip++;
+		switch(op) {
+		case _PUSH:
+			FETCH_RD FETCH_IMM8
+			do {
+				regs[REG_sp] -= 4;
+				MEMREF(int, regs[REG_sp]) = regs[rd++];
+			} while(--imm32);
+			break;
+		case _POP:
+			FETCH_RD FETCH_IMM8
+			do {
+				regs[rd--] = MEMREF(int, regs[REG_sp]);
+				regs[REG_sp] += 4;
+			} while(--imm32);
+			break;
+		case _CALLI: FETCH_IMM16 regs[REG_rt] = NEXT_ADDRESS; JMP(imm32) break;
+		case _RET: JMP(regs[REG_rt]) break;
+		case _LDB: FETCH_RD FETCH_RS FETCH_CONST RD = MEMREF(char, RS + imm32); break;
+		case _STB: FETCH_RD FETCH_RS FETCH_CONST MEMREF(char, RD + imm32) = (char)RS; break;
+		case _LDW: FETCH_RD FETCH_RS FETCH_CONST RD = MEMREF(int, RS + imm32); break;
+		case _STW: FETCH_RD FETCH_RS FETCH_CONST MEMREF(int, RD + imm32) = RS; break;
+		case _LDI: FETCH_RD FETCH_CONST RD = imm32; break;
+		case _LDR: FETCH_RD FETCH_RS RD = RS; break;
+		case _ADD: FETCH_RD FETCH_RS RD += RS; break;
+		case _ADDI: FETCH_RD FETCH_CONST RD += imm32; break;
+		case _SUBI: FETCH_RD FETCH_CONST RD -= imm32; break;
+		case _MULI: FETCH_RD FETCH_CONST RD *= imm32; break;
+		case _XOR: FETCH_RD FETCH_RS RD ^= RS; break;
+		case _SRLI: FETCH_RD FETCH_IMM8 RD = (uint)RD >> imm32; break;
+		case _JC_NE: FETCH_RD FETCH_RS FETCH_IMM16 if(RD != RS) { JMP(imm32) } break;
+		case _JC_LT: FETCH_RD FETCH_RS FETCH_IMM16 if(RD < RS) { JMP(imm32) } break;
+		case _JC_GE: FETCH_RD FETCH_RS FETCH_IMM16 if(RD >= RS) { JMP(imm32) } break;
+		case _JPI: FETCH_IMM16 JMP(imm32) break;
+		case _SYSCALL: IB; return;
+		default:
+			MoSyncErrorExit(op);
+		}
+	}
+}
+
+//****************************************
+// Benchmark
+//****************************************
+
+struct Case {
+	const char* name;
+	void (*build)(Program&);
+};
+
+static const Case sCases[] = {
+	{ "sieve", buildSieve },
+	{ "hash", buildHash },
+	{ "fib", buildFib },
+};
+
+static double seconds(clock_t start) {
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void reset(VMCore& core) {
+	memset(core.regs, 0, sizeof(core.regs));
+	core.regs[REG_sp] = STACK_TOP;
+	for(int i = 0; i < HASH_BYTES / 4; i++)
+		core.mem_ds[ARRAY / 4 + i] = i * 0x9e3779b9;
+}
+
+int main(int argc, char** argv) {
+	int runs = argc > 1 ? atoi(argv[1]) : 200;
+	if(runs < 1)
+		runs = 1;
+
+	static Program program;
+	static int data[DATA_SIZE / 4];
+
+	printf("%d runs per case\n", runs);
+	printf("%-10s %12s %12s %8s\n", "us/run", "interpreter", "x64", "speedup");
+	int mismatches = 0;
+	for(size_t c = 0; c < sizeof(sCases)/sizeof(Case); c++) {
+		const Case& k = sCases[c];
+		program = Program();
+		k.build(program);
+
+		VMCore core;
+		core.Head.EntryPoint = 1;
+		core.Head.CodeLen = program.codeLen;
+		core.Head.DataLen = DATA_SIZE;
+		core.Head.IntLen = program.numConsts;
+		core.CODE_SEGMENT_SIZE = CODE_SIZE;
+		core.DATA_SEGMENT_SIZE = DATA_SIZE;
+		core.mem_cs = program.code;
+		core.mem_ds = data;
+		core.mem_cp = program.consts;
+
+		int result[2];
+		double t[2];
+
+		reset(core);
+		clock_t start = clock();
+		for(int i = 0; i < runs; i++) {
+			core.regs[REG_sp] = STACK_TOP;
+			interpret(core, 1);
+		}
+		t[0] = seconds(start);
+		result[0] = core.regs[REG_r0];
+
+		reset(core);
+		MoSync::X64Recompiler recompiler;
+		recompiler.init(&core, &sYield);
+		// the first run includes the recompilation
+		start = clock();
+		for(int i = 0; i < runs; i++) {
+			core.regs[REG_sp] = STACK_TOP;
+			recompiler.run(1);
+		}
+		t[1] = seconds(start);
+		result[1] = core.regs[REG_r0];
+		recompiler.close();
+
+		printf("%-10s %12.2f %12.2f %7.1fx\n", k.name,
+			t[0] * 1e6 / runs, t[1] * 1e6 / runs, t[0] / t[1]);
+		if(result[0] != result[1]) {
+			printf("%s: results differ, %d and %d\n", k.name, result[0], result[1]);
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
@@ -0,0 +1,19 @@
+#!/usr/bin/ruby
+
+require File.expand_path('../../rules/native_mosync.rb')
+
+# x86-64 hosts only.
+work = MoSyncExe.new
+work.instance_eval do
+	@SOURCES = ["."]
+	@EXTRA_SOURCEFILES = ["../../runtimes/cpp/core/Recompiler/X64Recompiler.cpp",
+		"../../runtimes/cpp/core/Recompiler/X64Assembler.cpp",
+		"../../runtimes/cpp/core/disassembler.cpp"]
+	@EXTRA_INCLUDES = ["../../intlibs", "../../runtimes/cpp", "../../runtimes/cpp/core",
+		"../../runtimes/cpp/core/Recompiler", "../../runtimes/cpp/base",
+		"../../runtimes/cpp/platforms/sdl"]
+	@EXTRA_CPPFLAGS = " -DUSE_X64_RECOMPILER"
+	@NAME = "recompbench"
+end
+
+work.invoke